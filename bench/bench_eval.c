@@ -0,0 +1,956 @@
+// Engine micro-benchmarks (no GTK). Build and run with `make bench`.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "calc_data.h"
+#include "calc_eval.h"
+#include "calc_incremental.h"
+#include "calc_internal.h"
+#include "calc_parallel.h"
+#include "calc_trace.h"
+#include "calc_workspace.h"
+#include "history_log.h"
+#include "plot_sampler.h"
+
+#include <glib/gstdio.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FORMULA "2*3.141592653589793*x + sin(x)^2 - x/3"
+#define ITERATIONS 1000000
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double sink = 0.0;
+
+// The pre-existing path: the caller splices each value into the text and calls calc_eval().
+static double bench_eval_text(void) {
+    char expr[128];
+    char err[128];
+    double start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        double x = i * 1e-3;
+        g_snprintf(expr, sizeof(expr), "2*3.141592653589793*%.17g + sin(%.17g)^2 - %.17g/3", x, x, x);
+        double r = 0.0;
+        if (calc_eval(expr, FALSE, &r, err, sizeof(err))) sink += r;
+    }
+    return (now_ns() - start) / ITERATIONS;
+}
+
+static double bench_program(const CalcProgram *prog) {
+    char err[128];
+    double start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        double x = i * 1e-3;
+        double r = 0.0;
+        if (calc_program_eval(prog, &x, &r, err, sizeof(err))) sink += r;
+    }
+    return (now_ns() - start) / ITERATIONS;
+}
+
+static double bench_columns(const CalcProgram *prog) {
+    double *x = g_new(double, ITERATIONS);
+    double *out = g_new(double, ITERATIONS);
+    guint8 *status = g_new(guint8, (ITERATIONS + 7) / 8);
+    for (int i = 0; i < ITERATIONS; i++) x[i] = i * 1e-3;
+
+    const double *cols[] = { x };
+    double start = now_ns();
+    calc_program_eval_columns(prog, cols, ITERATIONS, out, status);
+    double ns = (now_ns() - start) / ITERATIONS;
+
+    sink += out[ITERATIONS - 1];
+    g_free(x);
+    g_free(out);
+    g_free(status);
+    return ns;
+}
+
+// Throughput of calc_eval_parallel() over the same input set for 1..N worker threads.
+static void bench_scaling(void) {
+    const size_t n = ITERATIONS;
+    char *text = g_malloc(n * 48);
+    const char **exprs = g_new(const char *, n);
+    double *results = g_new(double, n);
+    guint8 *status = g_new(guint8, (n + 7) / 8);
+    for (size_t i = 0; i < n; i++) {
+        char *e = text + i * 48;
+        g_snprintf(e, 48, "%zu*sin(%zu)/(1+%zu%%7)", i, i % 360, i);
+        exprs[i] = e;
+    }
+
+    guint max_threads = calc_parallel_workers(0);
+    double base = 0.0;
+    printf("calc_eval_parallel scaling (%zu expressions, %u CPUs)\n", n, max_threads);
+    for (guint t = 1; t <= max_threads; t = (t * 2 <= max_threads || t == max_threads) ? t * 2 : max_threads) {
+        double start = now_ns();
+        calc_eval_parallel(exprs, n, FALSE, t, results, status);
+        double rate = n / ((now_ns() - start) * 1e-9);
+        if (t == 1) base = rate;
+        printf("  %3u threads  %8.2f Mexpr/s  %5.2fx\n", t, rate / 1e6, rate / base);
+    }
+    sink += results[n - 1];
+
+    g_free(text);
+    g_free(exprs);
+    g_free(results);
+    g_free(status);
+}
+
+// Latency of calc_eval() on a small set of recurring expressions, with and without the cache.
+static void bench_repeats(void) {
+    static const char *corpus[] = {
+        "1+2*3", "sin(30)+cos(60)", "sqrt(2)/2", "(1+2)*(3+4)/5", "2^10-1",
+        "log(1000)+ln(10)", "abs(-3.5)*exp(1)", "5!/3!", "12%5+7", "tan(45)*csc(30)",
+    };
+    enum { REPEATS = 200000 };
+    const size_t n_corpus = G_N_ELEMENTS(corpus);
+    double *lat = g_new(double, REPEATS);
+    char err[128];
+
+    printf("calc_eval on %zu recurring expressions (%d calls)\n", n_corpus, REPEATS);
+    for (int cached = 0; cached <= 1; cached++) {
+        calc_cache_clear();
+        calc_cache_set_capacity(cached ? 256 : 0);
+        for (int i = 0; i < REPEATS; i++) {
+            double r = 0.0;
+            double start = now_ns();
+            calc_eval(corpus[i % n_corpus], TRUE, &r, err, sizeof(err));
+            lat[i] = now_ns() - start;
+            sink += r;
+        }
+        qsort(lat, REPEATS, sizeof(double), cmp_double);
+        printf("  %-8s p50 %7.1f ns  p99 %7.1f ns  p99.9 %7.1f ns\n", cached ? "cache" : "no cache",
+               lat[REPEATS / 2], lat[REPEATS * 99 / 100], lat[REPEATS * 999 / 1000]);
+    }
+
+    CalcCacheStats stats;
+    calc_cache_get_stats(&stats);
+    printf("  cache: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses, %" G_GUINT64_FORMAT " evictions\n",
+           stats.hits, stats.misses, stats.evictions);
+    g_free(lat);
+}
+
+// Interpreter vs. native code on the same programs.
+static void bench_jit(void) {
+    static const char *corpus[] = {
+        "2*3.141592653589793*x + sin(x)^2 - x/3",
+        "((x+1)*(x-1)+x*x*0.5)/(x+7)",
+        "sqrt(abs(x))*exp(-x/8)+log(x+2)",
+        "x^2+3*x-5+(x-1)^3",
+        "csc(x+0.5)+sec(x)+cot(x+1)",
+        "pow(x+1.5,0.3)+ln(x+3)%7",
+    };
+    const char *vars[] = { "x" };
+    char err[128];
+    enum { N = ITERATIONS / 2 };
+
+    printf("interpreter vs JIT (%d evaluations per formula)\n", N);
+    for (size_t f = 0; f < G_N_ELEMENTS(corpus); f++) {
+        CalcProgram *prog = calc_compile(corpus[f], vars, 1, FALSE, err, sizeof(err));
+        if (!prog) continue;
+        double ns[2];
+        for (int native = 0; native <= 1; native++) {
+            if (native && !calc_program_jit(prog)) {
+                printf("  %-42s (JIT unavailable)\n", corpus[f]);
+                break;
+            }
+            double start = now_ns();
+            for (int i = 0; i < N; i++) {
+                double x = i * 1e-4;
+                double r = 0.0;
+                if (calc_program_eval(prog, &x, &r, err, sizeof(err))) sink += r;
+            }
+            ns[native] = (now_ns() - start) / N;
+            if (native) printf("  %-42s %7.1f ns  %7.1f ns  %5.2fx\n", corpus[f], ns[0], ns[1], ns[0] / ns[1]);
+        }
+        calc_program_free(prog);
+    }
+}
+
+// Builds "x*1.5+x*1.5+..." (flat) or "x-(x-(x-...))" (nested, value stack as deep as the
+// expression is long) with roughly n_tokens tokens.
+static char *long_expression(size_t n_tokens, gboolean nested) {
+    GString *s = g_string_sized_new(n_tokens * 3);
+    if (nested) {
+        size_t terms = MAX(n_tokens / 4, (size_t)1);
+        for (size_t i = 1; i < terms; i++) g_string_append(s, "x-(");
+        g_string_append_c(s, 'x');
+        for (size_t i = 1; i < terms; i++) g_string_append_c(s, ')');
+    } else {
+        size_t terms = MAX(n_tokens / 4, (size_t)1);
+        for (size_t i = 0; i < terms; i++) g_string_append(s, i ? "+x*1.5" : "x*1.5");
+    }
+    return g_string_free(s, FALSE);
+}
+
+// Compile (lex, parse, optimize) and evaluate cost per token from 10 to 10M tokens.
+static void bench_long(void) {
+    const char *vars[] = { "x" };
+    char err[128];
+
+    printf("long expressions (per token):\n");
+    for (int nested = 0; nested <= 1; nested++) {
+        for (size_t n = 10; n <= 10000000; n *= 100) {
+            char *expr = long_expression(n, nested);
+            size_t reps = MAX((size_t)10000000 / n, (size_t)1);
+            double parse = 0.0;
+            double eval = 0.0;
+            for (size_t r = 0; r < reps; r++) {
+                double t0 = now_ns();
+                CalcProgram *prog = calc_compile(expr, vars, 1, FALSE, err, sizeof(err));
+                double t1 = now_ns();
+                if (!prog) {
+                    fprintf(stderr, "compile failed: %s\n", err);
+                    break;
+                }
+                double x = 0.5;
+                double v = 0.0;
+                if (calc_program_eval(prog, &x, &v, err, sizeof(err))) sink += v;
+                eval += now_ns() - t1;
+                parse += t1 - t0;
+                calc_program_free(prog);
+            }
+            printf("  %-6s %9zu tokens   compile %6.1f ns   eval %6.1f ns\n", nested ? "nested" : "flat", n,
+                   parse / reps / n, eval / reps / n);
+            g_free(expr);
+        }
+    }
+}
+
+// Arbitrary-precision evaluation: big factorials and powers in full, transcendental functions.
+static void bench_precise(void) {
+    static const struct { const char *expr; guint digits; } cases[] = {
+        { "100000!", 50 },
+        { "100000!", 456574 },
+        { "2^100000", 30103 },
+        { "3^100000", 47713 },
+        { "sin(1)+exp(0.5)", 1000 },
+        { "sqrt(2)", 100000 },
+    };
+    char err[128];
+
+    printf("arbitrary precision:\n");
+    for (size_t i = 0; i < G_N_ELEMENTS(cases); i++) {
+        double start = now_ns();
+        char *text = calc_eval_precise(cases[i].expr, FALSE, cases[i].digits, err, sizeof(err));
+        double ms = (now_ns() - start) / 1e6;
+        if (!text) {
+            fprintf(stderr, "%s: %s\n", cases[i].expr, err);
+            continue;
+        }
+        printf("  %-18s %7u digits  %8.2f ms\n", cases[i].expr, cases[i].digits, ms);
+        g_free(text);
+    }
+}
+
+// Exact trig forms on the "=" path in degree mode: bare table lookups and compound expressions.
+static void bench_exact_trig(void) {
+    static const char *const exprs[] = { "cos(45)", "cot(330)", "sin(198)", "2*sin(30)+cos(45)" };
+    char out[128];
+    char err[128];
+
+    printf("exact trig:\n");
+    for (size_t i = 0; i < G_N_ELEMENTS(exprs); i++) {
+        double start = now_ns();
+        for (int k = 0; k < ITERATIONS; k++) {
+            double v = 0.0;
+            int deg;
+            if (calc_try_special_trig(exprs[i], &deg, out, sizeof(out), &v, err, sizeof(err))) sink += v;
+        }
+        printf("  %-20s %-14s %6.1f ns\n", exprs[i], out, (now_ns() - start) / ITERATIONS);
+    }
+}
+
+// A literal-heavy expression of about n bytes: integers, decimals and exponents, some spaced.
+static char *literal_expression(size_t n) {
+    static const char *const literals[] = { "12", "0.5", "3.14159265358979", "6.02214076e23", "1e-9",
+                                            "42.125", "299792458", "1.602176634e-19", "0.001", "7" };
+    GString *s = g_string_sized_new(n + 32);
+    for (size_t i = 0; s->len < n; i++) {
+        if (i) g_string_append(s, (i % 4 == 0) ? " + " : "*");
+        g_string_append(s, literals[i % G_N_ELEMENTS(literals)]);
+    }
+    return g_string_free(s, FALSE);
+}
+
+// Converts every literal in expr with calc_read_number() or strtod(); returns how many of them
+// the two disagree on when check is set.
+static size_t scan_literals(const char *expr, const char *end, gboolean use_strtod, gboolean check) {
+    size_t mismatches = 0;
+    for (const char *p = expr; p < end;) {
+        if (!calc_char_is(*p, CALC_CC_DIGIT)) {
+            p++;
+            continue;
+        }
+        char *endptr;
+        const char *stop;
+        double v = use_strtod ? strtod(p, &endptr) : calc_read_number(p, end, &stop);
+        if (use_strtod) stop = endptr;
+        if (check) {
+            const char *fast_stop;
+            double fast = calc_read_number(p, end, &fast_stop);
+            mismatches += (memcmp(&fast, &v, sizeof(v)) != 0 || fast_stop != stop);
+        }
+        sink += v;
+        p = stop;
+    }
+    return mismatches;
+}
+
+// Lexing throughput: the full parser, and the literal conversion alone against strtod().
+static void bench_lexer(void) {
+    enum { BYTES = 16 << 20, REPS = 5 };
+    char *expr = literal_expression(BYTES);
+    const char *end = expr + strlen(expr);
+    double gb = (double)(end - expr) * REPS / 1e9;
+    CalcScratch scratch;
+    char err[128];
+    size_t count = 0;
+    double seconds[3];
+
+    calc_scratch_init(&scratch);
+    double start = now_ns();
+    for (int r = 0; r < REPS; r++) calc_parse(&scratch, expr, NULL, 0, &count, err, sizeof(err));
+    seconds[0] = (now_ns() - start) / 1e9;
+    calc_scratch_clear(&scratch);
+
+    for (int use_strtod = 0; use_strtod <= 1; use_strtod++) {
+        start = now_ns();
+        for (int r = 0; r < REPS; r++) scan_literals(expr, end, use_strtod, FALSE);
+        seconds[1 + use_strtod] = (now_ns() - start) / 1e9;
+    }
+    size_t mismatches = scan_literals(expr, end, TRUE, TRUE);
+
+    printf("lexing (%zu MB of literals, %zu tokens):\n", (size_t)(end - expr) >> 20, count);
+    printf("  calc_parse         %6.2f GB/s\n", gb / seconds[0]);
+    printf("  calc_read_number   %6.2f GB/s\n", gb / seconds[1]);
+    printf("  strtod             %6.2f GB/s  (%zu results differ)\n", gb / seconds[2], mismatches);
+    g_free(expr);
+}
+
+// Live preview: one keystroke appended to an expression of n bytes, then the result, against
+// evaluating the whole text again with calc_eval_scratch().
+static void bench_incremental(void) {
+    static const char typed[] = "+1.5*2";
+    enum { KEYSTROKES = 20000 };
+    char err[128];
+
+    printf("live preview (per keystroke):\n");
+    for (int nested = 0; nested <= 1; nested++) {
+        for (size_t n = 100; n <= 1000000; n *= 100) {
+            // x is not a variable here; sin(1) stands in for it.
+            char *base = long_expression(n / 3, nested);
+            GString *text = g_string_new(NULL);
+            for (const char *c = base; *c; c++) {
+                if (*c == 'x') g_string_append(text, "sin(1)");
+                else g_string_append_c(text, *c);
+            }
+            g_free(base);
+
+            CalcIncremental *inc = calc_incremental_new();
+            calc_incremental_insert(inc, 0, text->str, text->len);
+            double v = 0.0;
+            double start = now_ns();
+            calc_incremental_result(inc, &v, err, sizeof(err));
+            double initial = now_ns() - start;
+
+            start = now_ns();
+            for (int k = 0; k < KEYSTROKES; k++) {
+                calc_incremental_insert(inc, calc_incremental_length(inc), &typed[k % (sizeof(typed) - 1)], 1);
+                if (calc_incremental_result(inc, &v, err, sizeof(err))) sink += v;
+            }
+            double keystroke = (now_ns() - start) / KEYSTROKES;
+
+            CalcScratch scratch;
+            calc_scratch_init(&scratch);
+            size_t reps = MAX((size_t)1000000 / text->len, (size_t)1);
+            start = now_ns();
+            for (size_t r = 0; r < reps; r++) {
+                if (calc_eval_scratch(&scratch, text->str, FALSE, &v, err, sizeof(err))) sink += v;
+            }
+            double full = (now_ns() - start) / reps;
+            calc_scratch_clear(&scratch);
+
+            printf("  %-6s %8zu bytes   keystroke %8.1f ns   first parse %10.1f ns   calc_eval %10.1f ns\n",
+                   nested ? "nested" : "flat", text->len, keystroke, initial, full);
+            calc_incremental_free(inc);
+            g_string_free(text, TRUE);
+        }
+    }
+}
+
+static gboolean bench_user_fn(const double *args, double *out, gpointer user_data) {
+    (void)user_data;
+    *out = args[0];
+    return TRUE;
+}
+
+// Parse time of a long expression made of function calls: almost all of it is identifier
+// lookup. Built-in names go through the perfect hash; registered names miss it first.
+static void bench_functions(void) {
+    static const char *const builtin_calls[] = { "sin(x)", "atan2(x,1)", "log2(x)", "hypot(x,x)", "round(x)",
+                                                 "sqrt(x)", "max(x,1)", "cosh(x)" };
+    enum { CALLS = 100000, USER_FUNCS = 256 };
+    const char *vars[] = { "x" };
+    char err[128];
+    char name[32];
+
+    for (int i = 0; i < USER_FUNCS; i++) {
+        g_snprintf(name, sizeof(name), "user_fn%d", i);
+        calc_register_function(name, 1, CALC_FUNC_PURE, bench_user_fn, NULL, err, sizeof(err));
+    }
+
+    printf("function lookup (%d calls per expression):\n", CALLS);
+    for (int user = 0; user < 2; user++) {
+        GString *s = g_string_new("0");
+        for (int i = 0; i < CALLS; i++) {
+            if (user) g_string_append_printf(s, "+user_fn%d(x)", i % USER_FUNCS);
+            else g_string_append_printf(s, "+%s", builtin_calls[i % G_N_ELEMENTS(builtin_calls)]);
+        }
+        double start = now_ns();
+        CalcProgram *prog = calc_compile(s->str, vars, 1, FALSE, err, sizeof(err));
+        double ns = now_ns() - start;
+        if (!prog) {
+            printf("  compile failed: %s\n", err);
+        } else {
+            printf("  %-10s %6.1f ns/call\n", user ? "registered" : "built-in", ns / CALLS);
+        }
+        calc_program_free(prog);
+        g_string_free(s, TRUE);
+    }
+}
+
+// History log: append cost on the caller's thread, reopening a large log, building the search
+// index and searching it.
+static void bench_history(void) {
+    static const char *const queries[] = { "sin", "12", "sqrt(4", "no such entry" };
+    enum { RECORDS = 1000000 };
+    char err[128];
+    char expr[64];
+    char result[32];
+
+    char *dir = g_dir_make_tmp("calc-bench-XXXXXX", NULL);
+    if (!dir) return;
+    HistoryLog *log = history_log_open(dir, err, sizeof(err));
+    if (!log) {
+        printf("history: %s\n", err);
+        g_rmdir(dir);
+        g_free(dir);
+        return;
+    }
+
+    printf("history (%d entries):\n", RECORDS);
+    double start = now_ns();
+    for (int i = 0; i < RECORDS; i++) {
+        g_snprintf(expr, sizeof(expr), "sin(%d)+sqrt(%d)*%d", i % 360, i % 97, i);
+        g_snprintf(result, sizeof(result), "%d", i);
+        history_log_append(log, expr, result);
+    }
+    double append = (now_ns() - start) / RECORDS;
+    start = now_ns();
+    history_log_close(log);
+    printf("  append %8.1f ns/entry   flush on close %8.1f ms\n", append, (now_ns() - start) / 1e6);
+
+    start = now_ns();
+    log = history_log_open(dir, err, sizeof(err));
+    printf("  reopen %8.3f ms\n", (now_ns() - start) / 1e6);
+    if (log) {
+        GArray *matches = g_array_new(FALSE, FALSE, sizeof(guint));
+        for (int indexed = 0; indexed <= 1; indexed++) {
+            if (indexed) {
+                start = now_ns();
+                while (history_log_index_step(log, G_MAXUINT)) {}
+                printf("  build index %8.1f ms\n", (now_ns() - start) / 1e6);
+            }
+            for (size_t q = 0; q < G_N_ELEMENTS(queries); q++) {
+                start = now_ns();
+                history_log_search(log, queries[q], NULL, matches);
+                printf("  search %-8s %-15s %8.2f ms  (%u matches)\n", indexed ? "indexed" : "scan",
+                       queries[q], (now_ns() - start) / 1e6, matches->len);
+            }
+        }
+        g_array_unref(matches);
+        history_log_close(log);
+    }
+
+    static const char *const files[] = { "history.log", "history.idx" };
+    for (size_t f = 0; f < G_N_ELEMENTS(files); f++) {
+        char *path = g_build_filename(dir, files[f], NULL);
+        g_remove(path);
+        g_free(path);
+    }
+    g_rmdir(dir);
+    g_free(dir);
+}
+
+// A model of interdependent definitions: ten inputs, each feeding a chain of formulas. Editing
+// one input and running the whole text again recalculates only that input's chain.
+static char *workspace_model(int formulas, double input3) {
+    GString *s = g_string_new(NULL);
+    for (int i = 0; i < 10; i++) g_string_append_printf(s, "p%d = %d.5;\n", i, i == 3 ? (int)input3 : i);
+    g_string_append(s, "grow(x, r) = x*(1 + r/100);\n");
+    for (int i = 0; i < formulas; i++) {
+        if (i < 10) g_string_append_printf(s, "v%d = grow(p%d, 2) + sqrt(p%d);\n", i, i, i);
+        else g_string_append_printf(s, "v%d = grow(v%d, 1.5) - v%d/%d + sin(p%d);\n", i, i - 10, i - 10, i, i % 10);
+    }
+    return g_string_free(s, FALSE);
+}
+
+static void bench_workspace(void) {
+    enum { FORMULAS = 1000, EDITS = 200 };
+    char err[128];
+    double v = 0.0;
+    gboolean has_value;
+
+    printf("workspace (%d formulas, 10 inputs):\n", FORMULAS);
+    char *model = workspace_model(FORMULAS, 3.0);
+    double start = now_ns();
+    CalcWorkspace *ws = calc_workspace_new(FALSE);
+    if (!calc_workspace_run(ws, model, &v, &has_value, err, sizeof(err))) printf("  run failed: %s\n", err);
+    double first = now_ns() - start;
+
+    start = now_ns();
+    for (int k = 0; k < EDITS; k++) calc_workspace_run(ws, model, &v, &has_value, err, sizeof(err));
+    double unchanged = (now_ns() - start) / EDITS;
+
+    char *edits[2] = { workspace_model(FORMULAS, 4.0), model };
+    start = now_ns();
+    for (int k = 0; k < EDITS; k++) {
+        if (calc_workspace_run(ws, edits[k & 1], &v, &has_value, err, sizeof(err))) sink += v;
+    }
+    double edit = (now_ns() - start) / EDITS;
+
+    const char *statements[2] = { "p3 = 4.5", "p3 = 3.5" };
+    start = now_ns();
+    for (int k = 0; k < EDITS; k++) {
+        if (calc_workspace_run(ws, statements[k & 1], &v, &has_value, err, sizeof(err))) sink += v;
+    }
+    double single = (now_ns() - start) / EDITS;
+    calc_workspace_free(ws);
+
+    printf("  first run (compile + evaluate all) %10.1f us\n", first / 1e3);
+    printf("  same text again                    %10.1f us\n", unchanged / 1e3);
+    printf("  text with one input edited         %10.1f us  (%.1fx faster than from scratch)\n", edit / 1e3,
+           first / edit);
+    printf("  just the edited statement          %10.1f us  (%d of %d formulas recalculated)\n", single / 1e3,
+           FORMULAS / 10, FORMULAS);
+    g_free(edits[0]);
+    g_free(model);
+}
+
+static void bench_plot(void) {
+    enum { WIDTH = 1200, FRAMES = 600, PAN = 8 };
+    static const char *const exprs[] = { "sin(x)*x", "tan(x)", "1/sin(x)", "floor(x)", "sqrt(4-x^2)" };
+    enum { CURVES = G_N_ELEMENTS(exprs) };
+    const double unit = 20.0 / WIDTH;
+    const char *vars[] = { "x" };
+    char err[128];
+    PlotCurve *curves[CURVES];
+    CalcProgram *progs[CURVES];
+    GArray *points = g_array_new(FALSE, FALSE, sizeof(PlotPoint));
+
+    printf("plot (%d curves, %d px wide, pan %d px per frame):\n", CURVES, WIDTH, PAN);
+    for (int i = 0; i < CURVES; i++) {
+        curves[i] = plot_curve_new(exprs[i], FALSE, err, sizeof(err));
+        progs[i] = calc_compile(exprs[i], vars, 1, FALSE, err, sizeof(err));
+    }
+
+    size_t evaluations = 0;
+    double start = now_ns();
+    for (int i = 0; i < CURVES; i++) evaluations += plot_curve_sample(curves[i], -10.0, 10.0, unit, points);
+    double first = now_ns() - start;
+    size_t first_evaluations = evaluations;
+    guint first_points = points->len;
+
+    evaluations = 0;
+    start = now_ns();
+    for (int f = 1; f <= FRAMES; f++) {
+        double x0 = -10.0 + f * PAN * unit;
+        for (int i = 0; i < CURVES; i++) {
+            g_array_set_size(points, 0);
+            evaluations += plot_curve_sample(curves[i], x0, x0 + WIDTH * unit, unit, points);
+        }
+    }
+    double pan = (now_ns() - start) / FRAMES;
+
+    // Baseline: one evaluation per pixel column and curve, every frame, nothing kept.
+    start = now_ns();
+    for (int f = 1; f <= FRAMES / 10; f++) {
+        double x0 = -10.0 + f * PAN * unit;
+        for (int i = 0; i < CURVES; i++) {
+            for (int px = 0; px < WIDTH; px++) {
+                double x = x0 + px * unit, y;
+                if (calc_program_eval(progs[i], &x, &y, err, sizeof(err))) sink += y;
+            }
+        }
+    }
+    double naive = (now_ns() - start) / (FRAMES / 10);
+
+    for (int i = 0; i < CURVES; i++) {
+        plot_curve_free(curves[i]);
+        calc_program_free(progs[i]);
+    }
+    printf("  first frame                        %10.1f us  (%zu evaluations, %u points)\n", first / 1e3,
+           first_evaluations, first_points);
+    printf("  panning, per frame                 %10.1f us  (%.0f evaluations; 60 fps allows 16667 us)\n",
+           pan / 1e3, (double)evaluations / FRAMES);
+    printf("  one evaluation per pixel, per frame%10.1f us  (%.1fx slower, no refinement)\n", naive / 1e3,
+           naive / pan);
+    g_array_unref(points);
+}
+
+// Newton's method x -= f(x)/f'(x) on a few roots, with f' from a central difference (two more
+// evaluations and a step size to pick) and from calc_program_eval_diff().
+static void bench_newton(void) {
+    enum { SOLVES = 20000, MAX_STEPS = 50 };
+    static const char *const exprs[] = { "x^3 - 2*x - 5", "cos(x) - x", "exp(x) - 3*x^2", "log2(x) + x^2 - 3" };
+    static const double starts[] = { 2.0, 1.0, 3.5, 1.5 };
+    enum { ROOTS = G_N_ELEMENTS(exprs) };
+    const char *vars[] = { "x" };
+    char err[128];
+    CalcProgram *progs[ROOTS];
+    for (int i = 0; i < ROOTS; i++) progs[i] = calc_compile(exprs[i], vars, 1, FALSE, err, sizeof(err));
+
+    long steps_fd = 0, steps_ad = 0;
+    double start = now_ns();
+    for (int k = 0; k < SOLVES; k++) {
+        for (int i = 0; i < ROOTS; i++) {
+            double x = starts[i] + k * 1e-6, f = 1.0, fl, fr;
+            for (int s = 0; s < MAX_STEPS && fabs(f) > 1e-12; s++, steps_fd++) {
+                double h = 1e-6 * MAX(1.0, fabs(x)), xl = x - h, xr = x + h;
+                calc_program_eval(progs[i], &x, &f, err, sizeof(err));
+                calc_program_eval(progs[i], &xl, &fl, err, sizeof(err));
+                calc_program_eval(progs[i], &xr, &fr, err, sizeof(err));
+                x -= f / ((fr - fl) / (2.0 * h));
+            }
+            sink += x;
+        }
+    }
+    double fd = (now_ns() - start) / (SOLVES * ROOTS);
+
+    // The same through calc_eval(), with x spliced into the text (a tenth of the solves).
+    char text[160];
+    start = now_ns();
+    for (int k = 0; k < SOLVES / 10; k++) {
+        for (int i = 0; i < ROOTS; i++) {
+            double x = starts[i] + k * 1e-6, f = 1.0, fx[3];
+            for (int s = 0; s < MAX_STEPS && fabs(f) > 1e-12; s++) {
+                double h = 1e-6 * MAX(1.0, fabs(x));
+                for (int j = 0; j < 3; j++) {
+                    const char *e = exprs[i];
+                    g_snprintf(text, sizeof(text), "%.17g", x + (j - 1) * h);
+                    GString *spliced = g_string_new(NULL);
+                    for (const char *c = e; *c; c++) {
+                        if (*c == 'x' && !(c > e && g_ascii_isalpha(c[-1])) && !g_ascii_isalpha(c[1])) {
+                            g_string_append_printf(spliced, "(%s)", text);
+                        } else {
+                            g_string_append_c(spliced, *c);
+                        }
+                    }
+                    calc_eval(spliced->str, FALSE, &fx[j], err, sizeof(err));
+                    g_string_free(spliced, TRUE);
+                }
+                f = fx[1];
+                x -= f / ((fx[2] - fx[0]) / (2.0 * h));
+            }
+            sink += x;
+        }
+    }
+    double text_fd = (now_ns() - start) / (SOLVES / 10 * ROOTS);
+
+    start = now_ns();
+    for (int k = 0; k < SOLVES; k++) {
+        for (int i = 0; i < ROOTS; i++) {
+            double x = starts[i] + k * 1e-6, f = 1.0, d;
+            for (int s = 0; s < MAX_STEPS && fabs(f) > 1e-12; s++, steps_ad++) {
+                calc_program_eval_diff(progs[i], &x, 0, &f, &d, err, sizeof(err));
+                x -= f / d;
+            }
+            sink += x;
+        }
+    }
+    double ad = (now_ns() - start) / (SOLVES * ROOTS);
+    for (int i = 0; i < ROOTS; i++) calc_program_free(progs[i]);
+
+    printf("newton (%d roots, |f| < 1e-12):\n", ROOTS);
+    printf("  central difference via calc_eval() %10.1f ns\n", text_fd);
+    printf("  central difference, per root       %10.1f ns  (%.1f steps)\n", fd,
+           (double)steps_fd / (SOLVES * ROOTS));
+    printf("  automatic derivative, per root     %10.1f ns  (%.1f steps, %.1fx / %.1fx faster)\n", ad,
+           (double)steps_ad / (SOLVES * ROOTS), fd / ad, text_fd / ad);
+}
+
+// Complex mode: a real formula keeps the real kernels, and complex values run through the SoA
+// batch kernels.
+static void bench_complex(void) {
+    enum { ROWS = 1000000 };
+    const char *vars[] = { "x" };
+    char err[128];
+    double *re = g_new(double, ROWS), *im = g_new(double, ROWS);
+    double *out_re = g_new(double, ROWS), *out_im = g_new(double, ROWS);
+    for (int j = 0; j < ROWS; j++) {
+        re[j] = j * 1e-3 - 500.0;
+        im[j] = 0.5 - j * 1e-6;
+    }
+    const double *re_cols[] = { re }, *im_cols[] = { im };
+
+    CalcProgram *real_prog = calc_compile(FORMULA, vars, 1, FALSE, err, sizeof(err));
+    CalcProgram *same_prog = calc_compile_complex(FORMULA, vars, 1, FALSE, err, sizeof(err));
+    double start = now_ns();
+    calc_program_eval_columns(real_prog, re_cols, ROWS, out_re, NULL);
+    double real_ns = (now_ns() - start) / ROWS;
+    start = now_ns();
+    calc_program_eval_columns_complex(same_prog, re_cols, NULL, ROWS, out_re, out_im, NULL);
+    double same_ns = (now_ns() - start) / ROWS;
+
+    CalcProgram *prog = calc_compile_complex("(x*x + 3*i*x - 2) / (x + 1 - i)", vars, 1, FALSE, err, sizeof(err));
+    start = now_ns();
+    calc_program_eval_columns_complex(prog, re_cols, im_cols, ROWS, out_re, out_im, NULL);
+    double soa_ns = (now_ns() - start) / ROWS;
+    start = now_ns();
+    for (int j = 0; j < ROWS; j++) {
+        CalcComplex x = { re[j], im[j] }, r;
+        if (calc_program_eval_complex(prog, &x, &r, err, sizeof(err))) sink += r.re;
+    }
+    double scalar_ns = (now_ns() - start) / ROWS;
+    sink += out_re[ROWS - 1] + out_im[ROWS - 1];
+
+    printf("complex mode (%d rows):\n", ROWS);
+    printf("  real formula, calc_compile          %8.2f ns/row\n", real_ns);
+    printf("  real formula, calc_compile_complex  %8.2f ns/row  (real kernels kept)\n", same_ns);
+    printf("  complex formula, row by row         %8.2f ns/row\n", scalar_ns);
+    printf("  complex formula, SoA columns        %8.2f ns/row  (%.1fx)\n", soa_ns, scalar_ns / soa_ns);
+    calc_program_free(real_prog);
+    calc_program_free(same_prog);
+    calc_program_free(prog);
+    g_free(re);
+    g_free(im);
+    g_free(out_re);
+    g_free(out_im);
+}
+
+// Matrices: a 1000x1000 product against the textbook triple loop, then the LU-based builtins,
+// and a small expression repeated to show that the arena keeps evaluation allocation-free.
+static void bench_matrix(void) {
+    enum { N = 1000, SMALL = 100000 };
+    const char *vars[] = { "A", "B" };
+    char err[128];
+    CalcMatrix in[2] = { { N, N, g_new(double, (size_t)N * N) }, { N, N, g_new(double, (size_t)N * N) } };
+    guint32 seed = 12345;
+    for (size_t j = 0; j < (size_t)N * N; j++) {
+        for (int k = 0; k < 2; k++) {
+            seed = seed * 1664525u + 1013904223u;
+            in[k].data[j] = (double)(seed >> 8) / (double)(1u << 24) - 0.5;
+        }
+    }
+
+    double *naive = g_new(double, (size_t)N * N);
+    double start = now_ns();
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < N; j++) {
+            double acc = 0.0;
+            for (size_t k = 0; k < N; k++) acc += in[0].data[i * N + k] * in[1].data[k * N + j];
+            naive[i * N + j] = acc;
+        }
+    }
+    double naive_ms = (now_ns() - start) / 1e6;
+
+    const char *exprs[] = { "A*B", "det(A)", "inv(A)", "solve(A, B)" };
+    double ms[G_N_ELEMENTS(exprs)];
+    for (size_t e = 0; e < G_N_ELEMENTS(exprs); e++) {
+        CalcProgram *prog = calc_compile(exprs[e], vars, 2, FALSE, err, sizeof(err));
+        CalcMatrix r = { 0 };
+        start = now_ns();
+        if (calc_program_eval_matrix(prog, in, &r, err, sizeof(err))) sink += r.data[0];
+        ms[e] = (now_ns() - start) / 1e6;
+        if (e == 0) sink += r.data[N * N - 1] - naive[N * N - 1];
+        g_free(r.data);
+        calc_program_free(prog);
+    }
+
+    CalcProgram *small = calc_compile("det(A*B + transpose(A)) * 2", vars, 2, FALSE, err, sizeof(err));
+    CalcMatrix small_in[2] = { { 4, 4, in[0].data }, { 4, 4, in[1].data } };
+    start = now_ns();
+    for (int j = 0; j < SMALL; j++) {
+        CalcMatrix r;
+        if (calc_program_eval_matrix(small, small_in, &r, err, sizeof(err))) sink += r.data[0];
+        g_free(r.data);
+    }
+    double small_ns = (now_ns() - start) / SMALL;
+    calc_program_free(small);
+
+    double flops = 2.0 * N * N * N;
+    printf("matrices (%dx%d):\n", N, N);
+    printf("  A*B, triple loop            %8.1f ms  (%.2f GFLOP/s)\n", naive_ms, flops / naive_ms / 1e6);
+    printf("  A*B, blocked                %8.1f ms  (%.2f GFLOP/s, %.1fx)\n", ms[0], flops / ms[0] / 1e6,
+           naive_ms / ms[0]);
+    printf("  det(A)                      %8.1f ms\n", ms[1]);
+    printf("  inv(A)                      %8.1f ms\n", ms[2]);
+    printf("  solve(A, B)                 %8.1f ms\n", ms[3]);
+    printf("  4x4 det(A*B + transpose(A)) %8.1f ns/eval\n", small_ns);
+    g_free(naive);
+    g_free(in[0].data);
+    g_free(in[1].data);
+}
+
+// Datasets: statistics of a 10-million-value CSV file on one thread and on every CPU, against
+// reading it with fgets() and strtod(), then the median and a cached evaluation.
+static void bench_data(void) {
+    enum { VALUES = 10000000, EVALS = 100000 };
+    char *dir = g_dir_make_tmp("calc-bench-XXXXXX", NULL);
+    if (!dir) return;
+    char *paths[2] = { g_build_filename(dir, "a.csv", NULL), g_build_filename(dir, "b.csv", NULL) };
+    FILE *f = fopen(paths[0], "w");
+    if (!f) {
+        g_rmdir(dir);
+        g_free(dir);
+        return;
+    }
+    guint32 seed = 12345;
+    for (int i = 0; i < VALUES; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        fprintf(f, "%u.%03u%c", seed >> 12, seed % 1000, (i % 4 == 3) ? '\n' : ',');
+    }
+    fclose(f);
+    GStatBuf st;
+    double mb = g_stat(paths[0], &st) == 0 ? (double)st.st_size / 1e6 : 0.0;
+
+    double start = now_ns();
+    f = fopen(paths[0], "r");
+    char line[256];
+    double naive = 0.0;
+    while (fgets(line, sizeof(line), f)) {
+        for (char *p = line, *stop;; p = stop + 1) {
+            naive += strtod(p, &stop);
+            if (*stop != ',') break;
+        }
+    }
+    fclose(f);
+    double naive_ms = (now_ns() - start) / 1e6;
+    sink += naive;
+
+    // Results are kept per path, so each timing reads the file under a new name.
+    char err[256];
+    CalcDataStats stats;
+    guint workers = calc_parallel_workers(0);
+    start = now_ns();
+    calc_data_stats(paths[0], 1, &stats, err, sizeof(err));
+    double one_ms = (now_ns() - start) / 1e6;
+    g_rename(paths[0], paths[1]);
+    start = now_ns();
+    calc_data_stats(paths[1], 0, &stats, err, sizeof(err));
+    double all_ms = (now_ns() - start) / 1e6;
+    double median;
+    start = now_ns();
+    calc_data_median(paths[1], 0, &median, err, sizeof(err));
+    double median_ms = (now_ns() - start) / 1e6;
+    sink += stats.sum + median;
+
+    char *expr = g_strdup_printf("mean(load(\"%s\"))", paths[1]);
+    start = now_ns();
+    for (int i = 0; i < EVALS; i++) {
+        double r;
+        if (calc_eval(expr, FALSE, &r, err, sizeof(err))) sink += r;
+    }
+    double cached_ns = (now_ns() - start) / EVALS;
+
+    printf("dataset (%d values, %.0f MB):\n", VALUES, mb);
+    printf("  fgets + strtod, 1 thread   %8.1f ms  (%6.0f MB/s)\n", naive_ms, mb / naive_ms * 1e3);
+    printf("  statistics, 1 thread       %8.1f ms  (%6.0f MB/s)\n", one_ms, mb / one_ms * 1e3);
+    printf("  statistics, %2u threads     %8.1f ms  (%6.0f MB/s)\n", workers, all_ms, mb / all_ms * 1e3);
+    printf("  median                     %8.1f ms\n", median_ms);
+    printf("  mean(load(...)), unchanged %8.1f ns/eval\n", cached_ns);
+    g_free(expr);
+    g_remove(paths[1]);
+    g_free(paths[0]);
+    g_free(paths[1]);
+    g_rmdir(dir);
+    g_free(dir);
+}
+
+// calc_eval() with tracing off (the shipped default) and on, where every phase is timed and
+// recorded. Off should match `make bench-check` from before tracing existed.
+static void bench_trace(void) {
+    static const char *corpus[] = { "1+2*3", "sin(30)+cos(60)", "sqrt(2)/2", "(1+2)*(3+4)/5", "2^10-1" };
+    enum { REPEATS = 1000000 };
+    char err[128];
+    char out[64];
+
+    printf("tracing overhead (calc_eval + calc_format_result, %d calls)\n", REPEATS);
+    for (int on = 0; on <= 1; on++) {
+        calc_trace_enable(on);
+        double start = now_ns();
+        for (int i = 0; i < REPEATS; i++) {
+            double r = 0.0;
+            if (calc_eval(corpus[i % G_N_ELEMENTS(corpus)], FALSE, &r, err, sizeof(err))) {
+                calc_format_result(r, out, sizeof(out));
+                sink += r + out[0];
+            }
+        }
+        printf("  %-4s %7.1f ns/call\n", on ? "on" : "off", (now_ns() - start) / REPEATS);
+    }
+    calc_trace_enable(FALSE);
+
+    CalcTraceCounter counters[CALC_TRACE_PHASES];
+    calc_trace_get_counters(counters);
+    for (int p = 0; p < CALC_TRACE_PHASES; p++) {
+        if (!counters[p].count) continue;
+        printf("  %-12s %9" G_GUINT64_FORMAT " calls %7.1f ns/call\n", calc_trace_phase_name(p), counters[p].count,
+               (double)counters[p].ns / (double)counters[p].count);
+    }
+}
+
+int main(void) {
+    char err[128] = {0};
+    const char *vars[] = { "x" };
+    CalcProgram *prog = calc_compile(FORMULA, vars, 1, FALSE, err, sizeof(err));
+    if (!prog) {
+        fprintf(stderr, "compile failed: %s\n", err);
+        return 1;
+    }
+
+    printf("formula: %s (%d evaluations)\n", FORMULA, ITERATIONS);
+    double text_ns = bench_eval_text();
+    double prog_ns = bench_program(prog);
+    double cols_ns = bench_columns(prog);
+    printf("  calc_eval (text per value)   %8.1f ns/eval\n", text_ns);
+    printf("  calc_program_eval            %8.1f ns/eval  (%.1fx)\n", prog_ns, text_ns / prog_ns);
+    printf("  calc_program_eval_columns    %8.1f ns/row   (%.1fx, %.1f Mrows/s)\n",
+           cols_ns, text_ns / cols_ns, 1e3 / cols_ns);
+
+    calc_program_free(prog);
+
+    bench_jit();
+    bench_repeats();
+    bench_scaling();
+    bench_long();
+    bench_precise();
+    bench_exact_trig();
+    bench_functions();
+    bench_lexer();
+    bench_incremental();
+    bench_workspace();
+    bench_plot();
+    bench_newton();
+    bench_complex();
+    bench_matrix();
+    bench_data();
+    bench_trace();
+    bench_history();
+    return sink == 42.0; // keep the loops alive
+}
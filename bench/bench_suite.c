@@ -0,0 +1,425 @@
+// Engine regression suite (no GTK): a fixed corpus of short interactive inputs, deep nesting,
+// long machine-generated formulas, degree-mode trig and result formatting, timed stage by stage.
+// `make bench` compares each case against a stored baseline and fails on a regression:
+//
+//   calc_bench_suite [--save FILE] [--check FILE] [--threshold PERCENT]
+//
+// --save writes the baseline (`make bench-baseline`); --check exits with status 1 when a case's
+// median ns/eval is more than PERCENT (default 10) above the baseline, or when it allocates more.
+// Any run exits with status 1 if two built-in function names collide in the registry's hash.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "calc_eval.h"
+#include "calc_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Timed rounds per case, after the warm-up rounds; each round runs the whole corpus at least
+// often enough to take ROUND_NS, and its mean ns/eval is one sample for the percentiles.
+#define ROUNDS 101
+#define WARMUP_ROUNDS 5
+#define ROUND_NS 50000.0
+#define DEFAULT_THRESHOLD 10.0
+
+// Allocation counting: the executable's malloc() takes precedence over libc's for the whole
+// process, GLib included, so every g_malloc() passes through here on the way to glibc's allocator.
+#ifdef __GLIBC__
+#define HAVE_ALLOC_COUNT 1
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+static gint allocations = 0;
+
+void *malloc(size_t size) {
+    g_atomic_int_inc(&allocations);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    g_atomic_int_inc(&allocations);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+    g_atomic_int_inc(&allocations);
+    return __libc_realloc(p, size);
+}
+#else
+#define HAVE_ALLOC_COUNT 0
+static gint allocations = 0;
+#endif
+
+typedef struct {
+    const char *name;
+    char **exprs;        // expressions in x
+    size_t n;
+    gboolean degrees;
+    CalcProgram **progs; // exprs compiled, for the eval stage
+    double *values;      // numbers for the format stage
+} Corpus;
+
+typedef struct {
+    const char *name;
+    Corpus *corpus;
+    void (*pass)(const Corpus *corpus); // one call per corpus entry
+} Case;
+
+typedef struct {
+    double p50;
+    double p90;
+    double p99;
+    double allocs; // per call; negative if not counted
+} CaseResult;
+
+static double sink = 0.0;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// What a user types: numbers, a few operators, a function or two.
+static const char *interactive_exprs[] = {
+    "1+2*3", "12.5*4", "sqrt(2)/2", "(1+2)*(3+4)/5", "2^10-1", "1/3+1/6", "log(1000)+ln(10)",
+    "abs(-3.5)*exp(1)", "5!/3!", "12%5+7", "3.14159*2.5^2", "100*(1+0.05)^10", "-(4-7)*2", "1e6/7",
+};
+
+// Degree mode, mostly at the angles calc_try_special_trig() turns into exact results.
+static const char *trig_exprs[] = {
+    "sin(30)", "cos(45)", "tan(60)", "sin(30)+cos(60)", "2*sin(30)+cos(45)", "sin(30)^2+cos(30)^2",
+    "tan(45)*csc(30)", "sec(60)-1", "cot(45)", "-sin(150)", "sin(37)", "cos(1000)",
+};
+
+static const char *format_values_src[] = {
+    "0", "1", "-1", "0.1", "1/3", "2/3", "sqrt(2)", "pi", "1e300", "-2.5e-10", "123456789", "1e15+0.5",
+    "7!", "1/7", "e^10", "0.000001234",
+};
+
+// Deep nesting: value stack as deep as the expression is long, nested calls, nested parentheses.
+static char *nested_expression(int kind, int depth) {
+    GString *s = g_string_new(NULL);
+    static const char *const calls[] = { "sin(", "abs(", "cos(", "sqrt(" }; // sqrt() of sin(abs(...)) >= 0
+    for (int i = 0; i < depth; i++) {
+        switch (kind) {
+            case 0: g_string_append(s, "x-("); break;
+            case 1: g_string_append(s, calls[i % G_N_ELEMENTS(calls)]); break;
+            default: g_string_append_printf(s, "(%d+", i % 9 + 1); break;
+        }
+    }
+    g_string_append_c(s, 'x');
+    for (int i = 0; i < depth; i++) {
+        g_string_append(s, kind == 2 ? ")*x" : ")");
+    }
+    return g_string_free(s, FALSE);
+}
+
+// Machine-generated formulas of roughly n_terms terms, as a spreadsheet or code generator emits them.
+static char *long_expression(int n_terms) {
+    GString *s = g_string_new("x");
+    for (int i = 1; i < n_terms; i++) {
+        switch (i % 5) {
+            case 0: g_string_append_printf(s, "+%d.%d*x", i % 97, i % 10); break;
+            case 1: g_string_append_printf(s, "-sin(x/%d)", i % 13 + 1); break;
+            case 2: g_string_append_printf(s, "+(x^2-%d)/%d", i % 7, i % 11 + 1); break;
+            case 3: g_string_append_printf(s, "*%d.5", i % 3 + 1); break;
+            default: g_string_append_printf(s, "+sqrt(abs(x)+%d)", i % 17); break;
+        }
+    }
+    return g_string_free(s, FALSE);
+}
+
+static Corpus *corpus_new(const char *name, gboolean degrees) {
+    Corpus *c = g_new0(Corpus, 1);
+    c->name = name;
+    c->degrees = degrees;
+    return c;
+}
+
+static void corpus_add(Corpus *c, char *expr) {
+    c->exprs = g_renew(char *, c->exprs, c->n + 1);
+    c->exprs[c->n++] = expr;
+}
+
+static gboolean corpus_compile(Corpus *c) {
+    const char *vars[] = { "x" };
+    char err[128];
+    c->progs = g_new0(CalcProgram *, c->n);
+    for (size_t i = 0; i < c->n; i++) {
+        c->progs[i] = calc_compile(c->exprs[i], vars, 1, c->degrees, err, sizeof(err));
+        if (!c->progs[i]) {
+            fprintf(stderr, "%s: cannot compile %.40s: %s\n", c->name, c->exprs[i], err);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void corpus_free(Corpus *c) {
+    for (size_t i = 0; c->exprs && i < c->n; i++) {
+        if (c->progs) calc_program_free(c->progs[i]);
+        g_free(c->exprs[i]);
+    }
+    g_free(c->progs);
+    g_free(c->exprs);
+    g_free(c->values);
+    g_free(c);
+}
+
+// calc_eval() with the expression cache off: lexing, parsing, optimizing and evaluating.
+static void pass_calc_eval(const Corpus *c) {
+    char err[128];
+    for (size_t i = 0; i < c->n; i++) {
+        double r = 0.0;
+        if (calc_eval(c->exprs[i], c->degrees, &r, err, sizeof(err))) sink += r;
+    }
+}
+
+static void pass_compile(const Corpus *c) {
+    const char *vars[] = { "x" };
+    char err[128];
+    for (size_t i = 0; i < c->n; i++) {
+        CalcProgram *prog = calc_compile(c->exprs[i], vars, 1, c->degrees, err, sizeof(err));
+        calc_program_free(prog);
+    }
+}
+
+static void pass_eval(const Corpus *c) {
+    char err[128];
+    double x = 0.75;
+    for (size_t i = 0; i < c->n; i++) {
+        double r = 0.0;
+        if (calc_program_eval(c->progs[i], &x, &r, err, sizeof(err))) sink += r;
+    }
+}
+
+static void pass_special_trig(const Corpus *c) {
+    char out[128];
+    char err[128];
+    for (size_t i = 0; i < c->n; i++) {
+        int deg = 0;
+        double r = 0.0;
+        if (calc_try_special_trig(c->exprs[i], &deg, out, sizeof(out), &r, err, sizeof(err))) sink += r;
+    }
+}
+
+static void pass_format(const Corpus *c) {
+    char out[128];
+    for (size_t i = 0; i < c->n; i++) {
+        calc_format_result(c->values[i], out, sizeof(out));
+        sink += out[0];
+    }
+}
+
+static CaseResult run_case(const Case *k) {
+    CaseResult res = { 0 };
+    size_t n = k->corpus->n;
+
+    // Calibrate: repeat the corpus until a round takes at least ROUND_NS.
+    double start = now_ns();
+    k->pass(k->corpus);
+    double once = MAX(now_ns() - start, 1.0);
+    int reps = (int)MAX(1.0, ROUND_NS / once + 0.5);
+
+    for (int r = 0; r < WARMUP_ROUNDS; r++) {
+        for (int i = 0; i < reps; i++) k->pass(k->corpus);
+    }
+
+    // Allocations in one pass after the warm-up, when per-thread scratch space is in place.
+    gint before = g_atomic_int_get(&allocations);
+    k->pass(k->corpus);
+    res.allocs = HAVE_ALLOC_COUNT ? (double)(g_atomic_int_get(&allocations) - before) / (double)n : -1.0;
+
+    double samples[ROUNDS];
+    for (int r = 0; r < ROUNDS; r++) {
+        start = now_ns();
+        for (int i = 0; i < reps; i++) k->pass(k->corpus);
+        samples[r] = (now_ns() - start) / ((double)reps * (double)n);
+    }
+    qsort(samples, ROUNDS, sizeof(double), cmp_double);
+    res.p50 = samples[ROUNDS / 2];
+    res.p90 = samples[ROUNDS * 90 / 100];
+    res.p99 = samples[ROUNDS * 99 / 100];
+    return res;
+}
+
+// Baseline files hold one "case p50_ns allocs_per_eval" line per case; '#' starts a comment.
+static GHashTable *load_baseline(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return NULL;
+    GHashTable *table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        char name[128];
+        double p50 = 0.0;
+        double allocs = 0.0;
+        if (line[0] == '#' || sscanf(line, "%127s %lf %lf", name, &p50, &allocs) != 3) continue;
+        CaseResult *res = g_new0(CaseResult, 1);
+        res->p50 = p50;
+        res->allocs = allocs;
+        g_hash_table_replace(table, g_strdup(name), res);
+    }
+    fclose(f);
+    return table;
+}
+
+static gboolean save_baseline(const char *path, const Case *cases, const CaseResult *results, size_t n) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "cannot write %s\n", path);
+        return FALSE;
+    }
+    fprintf(f, "# calc_bench_suite baseline: case, median ns/eval, allocations/eval\n");
+    for (size_t i = 0; i < n; i++) fprintf(f, "%s %.2f %.2f\n", cases[i].name, results[i].p50, results[i].allocs);
+    return fclose(f) == 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: calc_bench_suite [--save FILE] [--check FILE] [--threshold PERCENT]\n");
+}
+
+int main(int argc, char **argv) {
+    const char *save = NULL;
+    const char *check = NULL;
+    double threshold = DEFAULT_THRESHOLD;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+            save = argv[++i];
+        } else if (strcmp(argv[i], "--check") == 0 && i + 1 < argc) {
+            check = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            char *end = NULL;
+            threshold = g_ascii_strtod(argv[++i], &end);
+            if (*end || threshold < 0) {
+                usage();
+                return 2;
+            }
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    // The built-in name table is fixed at compile time, so this is the build's check on it.
+    const char *collision = calc_func_builtin_collision();
+    if (collision) {
+        fprintf(stderr, "built-in function hash collision: %s\n", collision);
+        return 1;
+    }
+
+    // Every calc_eval() call should parse, as a first keystroke does.
+    calc_cache_set_capacity(0);
+
+    Corpus *interactive = corpus_new("interactive", FALSE);
+    for (size_t i = 0; i < G_N_ELEMENTS(interactive_exprs); i++) corpus_add(interactive, g_strdup(interactive_exprs[i]));
+
+    Corpus *trig = corpus_new("trig", TRUE);
+    for (size_t i = 0; i < G_N_ELEMENTS(trig_exprs); i++) corpus_add(trig, g_strdup(trig_exprs[i]));
+
+    Corpus *nested = corpus_new("nested", FALSE);
+    for (int kind = 0; kind < 3; kind++) {
+        corpus_add(nested, nested_expression(kind, 16));
+        corpus_add(nested, nested_expression(kind, 100));
+    }
+
+    Corpus *generated = corpus_new("long", FALSE);
+    corpus_add(generated, long_expression(100));
+    corpus_add(generated, long_expression(1000));
+    corpus_add(generated, long_expression(10000));
+
+    Corpus *format = corpus_new("format", FALSE);
+    format->values = g_new(double, G_N_ELEMENTS(format_values_src));
+    format->n = G_N_ELEMENTS(format_values_src);
+    for (size_t i = 0; i < format->n; i++) {
+        char err[128];
+        if (!calc_eval(format_values_src[i], FALSE, &format->values[i], err, sizeof(err))) format->values[i] = 0.0;
+    }
+
+    if (!corpus_compile(interactive) || !corpus_compile(trig) || !corpus_compile(nested) ||
+        !corpus_compile(generated)) {
+        return 2;
+    }
+
+    const Case cases[] = {
+        { "interactive/calc_eval", interactive, pass_calc_eval },
+        { "interactive/compile", interactive, pass_compile },
+        { "interactive/eval", interactive, pass_eval },
+        { "trig/special_trig", trig, pass_special_trig },
+        { "trig/calc_eval", trig, pass_calc_eval },
+        { "trig/eval", trig, pass_eval },
+        { "nested/compile", nested, pass_compile },
+        { "nested/eval", nested, pass_eval },
+        { "long/compile", generated, pass_compile },
+        { "long/eval", generated, pass_eval },
+        { "format/format_result", format, pass_format },
+    };
+    const size_t n_cases = G_N_ELEMENTS(cases);
+    CaseResult results[G_N_ELEMENTS(cases)];
+
+    GHashTable *baseline = check ? load_baseline(check) : NULL;
+    if (check && !baseline) printf("no baseline at %s (make bench-baseline writes one); not checking\n", check);
+
+    printf("%-24s %10s %10s %10s %12s %10s %8s\n", "case", "p50 ns", "p90 ns", "p99 ns", "allocs/eval", "baseline",
+           "change");
+    int regressions = 0;
+    for (size_t i = 0; i < n_cases; i++) {
+        results[i] = run_case(&cases[i]);
+        const CaseResult *r = &results[i];
+        char allocs[32];
+        if (r->allocs < 0) {
+            g_snprintf(allocs, sizeof(allocs), "-");
+        } else {
+            g_snprintf(allocs, sizeof(allocs), "%.2f", r->allocs);
+        }
+        printf("%-24s %10.1f %10.1f %10.1f %12s", cases[i].name, r->p50, r->p90, r->p99, allocs);
+
+        const CaseResult *base = baseline ? g_hash_table_lookup(baseline, cases[i].name) : NULL;
+        if (!base) {
+            printf("\n");
+            continue;
+        }
+        double change = (r->p50 / base->p50 - 1.0) * 100.0;
+        gboolean slower = change > threshold;
+        gboolean more_allocs = r->allocs >= 0 && r->allocs > base->allocs + 0.005;
+        printf(" %10.1f %+7.1f%%%s%s\n", base->p50, change, slower ? "  SLOWER" : "",
+               more_allocs ? "  MORE ALLOCATIONS" : "");
+        regressions += slower || more_allocs;
+    }
+
+    int status = 0;
+    if (baseline) {
+        if (regressions) {
+            printf("%d of %zu cases regressed (threshold %.1f%%)\n", regressions, n_cases, threshold);
+            status = 1;
+        } else {
+            printf("no regressions (threshold %.1f%%)\n", threshold);
+        }
+        g_hash_table_destroy(baseline);
+    }
+    if (save) {
+        if (save_baseline(save, cases, results, n_cases)) {
+            printf("baseline written to %s\n", save);
+        } else {
+            status = 2;
+        }
+    }
+
+    corpus_free(interactive);
+    corpus_free(trig);
+    corpus_free(nested);
+    corpus_free(generated);
+    corpus_free(format);
+    return sink == 42.0 ? 3 : status; // keep the loops alive
+}
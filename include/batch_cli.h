@@ -0,0 +1,16 @@
+#pragma once
+
+#include <glib.h>
+
+// Returns TRUE if argv asks for the headless batch mode ("--batch" or "--data").
+gboolean batch_cli_requested(int argc, char **argv);
+
+// Reads newline-delimited expressions from a file or stdin, evaluates each one and streams
+// one result line per input line to stdout, in input order. Never touches GTK. --threads N
+// evaluates on N workers (0 = one per CPU); --cache-size N bounds the compiled-expression cache.
+// --data FILE prints the statistics of a dataset (see calc_data.h) instead, on every CPU unless
+// --threads says otherwise. --trace FILE records the run (see calc_trace.h) and writes it at exit;
+// with --stats it also prints the time spent in each phase. Returns the process exit status.
+//   calculator --batch [--degrees] [--stats] [--threads N] [--cache-size N] [--trace FILE] [FILE|-]
+//   calculator --data FILE [--stats] [--threads N]
+int batch_cli_run(int argc, char **argv);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "calc_eval.h"
+
+// Statistics over numeric datasets (see calc_data.c). A dataset is a text file of numbers separated
+// by commas, semicolons or whitespace, such as a CSV file or one number per line; every number in
+// it counts, and a first line that does not start with a number is a header and is skipped. In
+// expressions, mean(load("prices.csv")) is the mean of prices.csv, and sum, var, stddev, min, max,
+// median and count work the same way. Files are memory-mapped and read in parallel, never loaded
+// whole; results are kept until the file changes. Thread-safe.
+typedef struct {
+    guint64 count;
+    double sum;    // compensated (Neumaier) sum
+    double mean;
+    double var;    // sample variance; NaN for fewer than 2 values
+    double stddev;
+    double min;
+    double max;
+} CalcDataStats;
+
+// Reads path in one pass on n_threads workers (0 = one per CPU). The result does not depend on
+// n_threads. Returns FALSE and writes err if the file cannot be read, has no numbers, or has a
+// field that is not a number.
+gboolean calc_data_stats(const char *path, guint n_threads, CalcDataStats *stats, char *err, size_t err_cap);
+
+// Median of path (the mean of the middle two for an even count), found by radix selection in a
+// few more passes over the file that narrow it down until at most a few million values are left
+// to hold in memory.
+gboolean calc_data_median(const char *path, guint n_threads, double *median, char *err, size_t err_cap);
@@ -5,11 +5,146 @@
 
 // Evaluates an expression. If degrees is TRUE, trig functions use degrees.
 // Returns TRUE on success; otherwise returns FALSE and writes a short error into err.
+// Parsed expressions are kept in a bounded LRU cache, so repeats skip parsing.
 gboolean calc_eval(const char *expr, gboolean degrees, double *result, char *err, size_t err_cap);
 
-// Tries to produce a symbolic (Casio-like) result for simple trig expressions in degrees.
-// Example: "cos(45)" -> "sqrt(2)/2". Returns TRUE if handled.
-// On success, writes both display_out and out_val.
+typedef struct {
+    guint64 hits;
+    guint64 misses;
+    guint64 evictions;
+    size_t size;
+    size_t capacity;
+} CalcCacheStats;
+
+// Sets how many compiled expressions calc_eval() keeps (0 disables caching). Thread-safe.
+void calc_cache_set_capacity(size_t capacity);
+void calc_cache_get_stats(CalcCacheStats *stats);
+void calc_cache_clear(void);
+
+// A parsed expression that can be evaluated many times without re-parsing.
+typedef struct CalcProgram CalcProgram;
+
+// Parses expr once. var_names lists identifiers (e.g. "x", "y") that become input slots;
+// slot i reads vars[i] in calc_program_eval(). Returns NULL and writes err on failure.
+CalcProgram *calc_compile(const char *expr, const char *const *var_names, size_t n_vars, gboolean degrees,
+                          char *err, size_t err_cap);
+
+// Translates a program to native x86-64 code so calc_program_eval() skips the interpreter.
+// Results and errors are identical. Returns FALSE (and the interpreter stays in use) when the
+// platform or the program is not supported. Call before sharing the program between threads.
+gboolean calc_program_jit(CalcProgram *prog);
+
+// Evaluates a compiled program with the given variable values (may be NULL if it has none).
+gboolean calc_program_eval(const CalcProgram *prog, const double *vars, double *result, char *err, size_t err_cap);
+
+// Evaluates a compiled program over n rows of structure-of-arrays input: cols[i][row] is the
+// value of variable slot i. Writes out[row] (NaN for failed rows) and, if status is non-NULL,
+// sets bit (row % 8) of status[row / 8] for every row that succeeded. Returns the success count.
+size_t calc_program_eval_columns(const CalcProgram *prog, const double *const *cols, size_t n,
+                                 double *out, guint8 *status);
+
+// Evaluates a compiled program and its derivative with respect to variable slot in one pass
+// (forward-mode automatic differentiation, see calc_diff.c), with no step size and no extra
+// evaluations. Fails where calc_program_eval() does, and on registered functions of the
+// variable, which have no derivative.
+gboolean calc_program_eval_diff(const CalcProgram *prog, const double *vars, size_t slot, double *result,
+                                double *derivative, char *err, size_t err_cap);
+
+// Value and derivative of expr with respect to var at var = at, e.g. "x^2" at 3 gives 9 and 6.
+// Within expressions the derivative is written diff(expr, var, at).
+gboolean calc_diff(const char *expr, const char *var, double at, gboolean degrees, double *result,
+                   double *derivative, char *err, size_t err_cap);
+
+void calc_program_free(CalcProgram *prog);
+
+// Largest number of digits calc_eval_precise() accepts.
+#define CALC_PRECISE_MAX_DIGITS 1000000
+
+// Evaluates an expression in arbitrary precision (see calc_mp.c) with digits significant decimal
+// digits. Factorials and powers are not limited to the range of a double. Returns the formatted
+// result (free with g_free()), or NULL and writes a short error into err. Thread-safe.
+char *calc_eval_precise(const char *expr, gboolean degrees, guint digits, char *err, size_t err_cap);
+
+// Complex mode (see calc_complex.c): i is the imaginary unit ("3+4i", "exp(i*pi)") and roots,
+// logarithms, powers and inverse functions take their principal complex value where real mode
+// reports a domain error, e.g. sqrt(-1) is i and ln(-2) is ln(2)+pi*i.
+typedef struct {
+    double re;
+    double im;
+} CalcComplex;
+
+// Evaluates an expression in complex mode. Returns FALSE and writes err on failure.
+gboolean calc_eval_complex(const char *expr, gboolean degrees, CalcComplex *result, char *err, size_t err_cap);
+
+// calc_compile() in complex mode. Programs that cannot leave the reals (no i, no roots or logs)
+// are recognised here and keep the real evaluators, so they run as fast as calc_compile()'s;
+// for those calc_program_eval() and calc_program_eval_columns() work as well.
+CalcProgram *calc_compile_complex(const char *expr, const char *const *var_names, size_t n_vars,
+                                  gboolean degrees, char *err, size_t err_cap);
+
+gboolean calc_program_eval_complex(const CalcProgram *prog, const CalcComplex *vars, CalcComplex *result,
+                                   char *err, size_t err_cap);
+
+// calc_program_eval_columns() for complex values, with real and imaginary parts in separate
+// arrays: re[i][row] + im[i][row]*i is variable slot i. im may be NULL for real inputs. Failed
+// rows get NaN in both parts.
+size_t calc_program_eval_columns_complex(const CalcProgram *prog, const double *const *re,
+                                         const double *const *im, size_t n, double *out_re, double *out_im,
+                                         guint8 *status);
+
+// Formats a complex result as "a+bi", or as a real number when the imaginary part is 0.
+void calc_format_complex(CalcComplex value, char *out, size_t out_cap);
+
+// Matrices (see calc_matrix.c): "[1, 2; 3, 4]" is a 2x2 matrix, with "," between the elements of a
+// row and ";" between rows, and [1, 2, 3] is a row vector. + and - work element by element, * is
+// the matrix product, ^ an integer power of a square matrix, and other functions apply to each
+// element. det(), inv(), transpose(), solve(A, b) (the x with A*x = b) and dot(u, v) are built in.
+// An expression whose result is a number also works with calc_eval() and calc_program_eval().
+typedef struct {
+    size_t rows;
+    size_t cols;
+    double *data; // rows * cols values, row by row
+} CalcMatrix;
+
+// Evaluates an expression whose result may be a matrix; a number comes back as a 1x1 matrix.
+// Free result->data with g_free().
+gboolean calc_eval_matrix(const char *expr, gboolean degrees, CalcMatrix *result, char *err, size_t err_cap);
+
+// calc_program_eval() with matrix inputs: variable slot i is vars[i], 1x1 for a number.
+// Intermediate values live in a per-thread arena, so repeated evaluations do not allocate.
+gboolean calc_program_eval_matrix(const CalcProgram *prog, const CalcMatrix *vars, CalcMatrix *result, char *err,
+                                  size_t err_cap);
+
+// Formats a matrix as "[1, 2; 3, 4]", a 1x1 matrix as a number, and one that does not fit out as
+// "RxC matrix".
+void calc_format_matrix(const CalcMatrix *m, char *out, size_t out_cap);
+
+// Most arguments a registered function can take.
+#define CALC_FUNC_MAX_ARGS 8
+
+typedef enum {
+    CALC_FUNC_PURE = 1 << 0,         // same arguments give the same result; calls may be constant-folded
+    CALC_FUNC_ANGLE_RESULT = 1 << 1, // result is an angle in radians, converted in degree mode
+} CalcFuncFlags;
+
+// A native function: reads arity values from args and writes the result to *out. Returning
+// FALSE reports "<name> domain error".
+typedef gboolean (*CalcNativeFn)(const double *args, double *out, gpointer user_data);
+
+// Makes name(a, b, ...) available to expressions parsed after the call. Names are a letter
+// followed by letters, digits or '_', and may not replace a built-in or an earlier registration.
+// arity is 1..CALC_FUNC_MAX_ARGS. Registered functions are not available in calc_eval_precise().
+// Thread-safe; registrations last for the lifetime of the process.
+gboolean calc_register_function(const char *name, guint arity, CalcFuncFlags flags, CalcNativeFn fn,
+                                gpointer user_data, char *err, size_t err_cap);
+
+// Formats a numeric result the way the calculator displays it.
+void calc_format_result(double value, char *out, size_t out_cap);
+
+// Tries to produce a symbolic (Casio-like) result for trig expressions in degrees at multiples
+// of 15 and 18 degrees (see calc_exact.c).
+// Example: "cos(45)" -> "sqrt(2)/2", "2*sin(30)+cos(45)" -> "1+sqrt(2)/2". Returns TRUE if handled.
+// On success, writes both display_out and out_val; out_deg is only set for a bare "func(angle)".
 gboolean calc_try_special_trig(const char *expr, int *out_deg, char *display_out, size_t out_cap,
                                double *out_val, char *err, size_t err_cap);
 
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "calc_eval.h"
+
+// Evaluates an expression while it is being edited (see calc_incremental.c). The object keeps its
+// own copy of the text: report every edit, then ask for the result. Only the part of the text from
+// the first edit onwards is parsed again, so appending to an expression costs about the same
+// however long it already is.
+typedef struct CalcIncremental CalcIncremental;
+
+// Constructs the incremental parser leaves to the full parser; the parse stops at the first one.
+typedef enum {
+    CALC_INCREMENTAL_SUPPORTED,
+    CALC_INCREMENTAL_DIFF,    // diff(), which evaluates its first argument at a point given after it
+    CALC_INCREMENTAL_MATRIX,  // '[', a matrix literal
+    CALC_INCREMENTAL_DATA,    // load("file") and the dataset statistics around it
+    CALC_INCREMENTAL_CALL,    // a call to a function the lookup hook reports
+    CALC_INCREMENTAL_COMPLEX, // i, the imaginary unit
+} CalcIncrementalConstruct;
+
+// What the lookup hook knows about a name that is not a built-in or registered function.
+typedef enum {
+    CALC_INCREMENTAL_NAME_UNKNOWN,  // parsed as if there were no hook
+    CALC_INCREMENTAL_NAME_VALUE,    // *value holds its value
+    CALC_INCREMENTAL_NAME_ERROR,    // it has no value; err says why
+    CALC_INCREMENTAL_NAME_FUNCTION, // a function the parser leaves to the caller
+} CalcIncrementalName;
+
+// Resolves the len bytes at name, which are not NUL-terminated.
+typedef CalcIncrementalName (*CalcIncrementalLookup)(const char *name, size_t len, double *value,
+                                                      char *err, size_t err_cap, gpointer user_data);
+
+CalcIncremental *calc_incremental_new(void);
+void calc_incremental_free(CalcIncremental *inc);
+
+// Switches trig between degrees and radians (the default) and re-evaluates from scratch.
+void calc_incremental_set_degrees(CalcIncremental *inc, gboolean degrees);
+
+// Resolves names such as variables through lookup, and re-evaluates from scratch. Call
+// calc_incremental_names_changed() whenever what lookup reports changes; only the text from the
+// first name it was asked about is parsed again.
+void calc_incremental_set_lookup(CalcIncremental *inc, CalcIncrementalLookup lookup, gpointer user_data);
+void calc_incremental_names_changed(CalcIncremental *inc);
+
+// Edits the text. Offsets and lengths are in bytes and must fall on UTF-8 character boundaries.
+void calc_incremental_insert(CalcIncremental *inc, size_t offset, const char *text, size_t len);
+void calc_incremental_delete(CalcIncremental *inc, size_t offset, size_t len);
+
+// The current text, owned by inc and valid until the next edit.
+const char *calc_incremental_text(const CalcIncremental *inc);
+size_t calc_incremental_length(const CalcIncremental *inc);
+
+// Whether the current text is a workspace program rather than one expression, as
+// calc_workspace_is_program() decides. Counts kept edit by edit answer most texts without reading them.
+gboolean calc_incremental_is_program(const CalcIncremental *inc);
+
+// Value of the current text as calc_eval() would compute it, except that parentheses still open at
+// the end are taken as closed, so a half-typed "sqrt(2" already has a value. Returns FALSE and
+// writes the error calc_eval() would report otherwise. Text with a construct the parser leaves to
+// the full parser is evaluated by calc_eval(), which knows nothing of the lookup hook.
+gboolean calc_incremental_result(CalcIncremental *inc, double *result, char *err, size_t err_cap);
+
+// The construct that stopped the parse of the current text, if any.
+CalcIncrementalConstruct calc_incremental_unsupported(CalcIncremental *inc);
+
+// TRUE if the last calc_incremental_result() left the real numbers: it failed with a domain error
+// such as sqrt(-1) or ln(-2), or a negative base to a fractional power came out NaN. A complex
+// evaluation may still have a value then; other errors stand as reported.
+gboolean calc_incremental_left_reals(const CalcIncremental *inc);
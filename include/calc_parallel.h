@@ -0,0 +1,23 @@
+#pragma once
+
+#include "calc_eval.h"
+
+// Runs [begin, end) of a parallel loop. worker is in [0, n_workers) and stays fixed for the
+// calling thread during one calc_parallel_for(), so it can index per-worker scratch state.
+typedef void (*CalcRangeFunc)(gpointer data, guint worker, size_t begin, size_t end);
+
+// Number of workers used for a request of n_threads (0 = one per CPU).
+guint calc_parallel_workers(guint n_threads);
+
+// Splits [0, n) into chunks of `grain` items (chunk starts are multiples of grain) and runs them
+// on a work-stealing pool; the calling thread takes part as worker 0. Blocks until all chunks ran.
+void calc_parallel_for(size_t n, size_t grain, guint n_threads, CalcRangeFunc fn, gpointer data);
+
+// Evaluates n independent expressions in parallel. results[i] and status bit i (bit i % 8 of
+// status[i / 8], may be NULL) correspond to exprs[i]. Returns the number that succeeded.
+size_t calc_eval_parallel(const char *const *exprs, size_t n, gboolean degrees, guint n_threads,
+                          double *results, guint8 *status);
+
+// calc_program_eval_columns() split across worker threads.
+size_t calc_program_eval_columns_parallel(const CalcProgram *prog, const double *const *cols, size_t n,
+                                          double *out, guint8 *status, guint n_threads);
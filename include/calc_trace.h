@@ -0,0 +1,71 @@
+#pragma once
+
+#include <glib.h>
+#include <stddef.h>
+
+// Engine tracing (see calc_trace.c). When enabled, each phase of an evaluation is timed: whole
+// phases become events in a per-thread ring buffer that calc_trace_write() saves as Chrome
+// trace-event JSON (chrome://tracing, ui.perfetto.dev), and every phase adds to per-thread counters.
+// Set CALC_TRACE=trace.json (or pass --trace FILE in batch mode) to record a run and write it at exit.
+// Disabled, a phase costs one predictable branch; building with -DCALC_NO_TRACE removes even that.
+typedef enum {
+    CALC_TRACE_EVAL,        // calc_eval(), end to end
+    CALC_TRACE_CACHE,       // compiled-expression cache lookup
+    CALC_TRACE_PARSE,       // text to RPN, lexing and lookups included
+    CALC_TRACE_LEX,         // number literals (counters only)
+    CALC_TRACE_LOOKUP,      // function names (counters only)
+    CALC_TRACE_OPTIMIZE,    // constant folding and rewrites
+    CALC_TRACE_RUN,         // running the RPN program
+    CALC_TRACE_EXACT,       // calc_try_special_trig()
+    CALC_TRACE_FORMAT,      // calc_format_result()
+    CALC_TRACE_UI_EVALUATE, // the "=" button, end to end
+    CALC_TRACE_FIRST_FRAME, // process start (tracing enabled in main()) to the first frame drawn
+    CALC_TRACE_THEME,       // light/dark switch to the next frame drawn
+    CALC_TRACE_PHASES
+} CalcTracePhase;
+
+typedef struct {
+    guint64 count;
+    guint64 ns;
+} CalcTraceCounter;
+
+#ifndef CALC_NO_TRACE
+extern gint calc_trace_on;
+guint64 calc_trace_now(void);
+void calc_trace_record(CalcTracePhase phase, guint64 start);
+void calc_trace_count(CalcTracePhase phase, guint64 start);
+guint64 calc_trace_enabled_at(void);
+
+// CALC_TRACE_BEGIN(t) ... CALC_TRACE_END(CALC_TRACE_PARSE, t) around a phase records an event;
+// CALC_TRACE_COUNT() only updates the counters, for phases too short and frequent for events.
+#define CALC_TRACE_BEGIN(start) guint64 start = G_UNLIKELY(calc_trace_on) ? calc_trace_now() : 0
+// Like CALC_TRACE_BEGIN, but the phase starts when tracing was first enabled.
+#define CALC_TRACE_BEGIN_AT_ENABLE(start) guint64 start = G_UNLIKELY(calc_trace_on) ? calc_trace_enabled_at() : 0
+#define CALC_TRACE_END(phase, start) \
+    do { if (G_UNLIKELY(start)) calc_trace_record((phase), (start)); } while (0)
+#define CALC_TRACE_COUNT(phase, start) \
+    do { if (G_UNLIKELY(start)) calc_trace_count((phase), (start)); } while (0)
+#else
+#define CALC_TRACE_BEGIN(start) guint64 start = 0
+#define CALC_TRACE_BEGIN_AT_ENABLE(start) guint64 start = 0
+#define CALC_TRACE_END(phase, start) ((void)(start))
+#define CALC_TRACE_COUNT(phase, start) ((void)(start))
+#endif
+
+// Turns tracing on or off for all threads. Events already recorded are kept.
+void calc_trace_enable(gboolean on);
+
+// Enables tracing and writes the trace to path when the process exits.
+void calc_trace_start(const char *path);
+
+// calc_trace_start() with the path in the CALC_TRACE environment variable, if it is set.
+void calc_trace_start_from_env(void);
+
+// Writes the events recorded so far as Chrome trace-event JSON, with the counters in "otherData".
+// Each thread keeps its most recent 65536 events. Exact when no evaluation is running.
+gboolean calc_trace_write(const char *path, char *err, size_t err_cap);
+
+// Sums the counters of all threads.
+void calc_trace_get_counters(CalcTraceCounter counters[CALC_TRACE_PHASES]);
+
+const char *calc_trace_phase_name(CalcTracePhase phase);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "calc_eval.h"
+#include "calc_incremental.h"
+
+// Named definitions that expressions can refer to (see calc_workspace.c). "name = expr" defines a
+// variable, "name(a, b) = expr" a function; a variable keeps its formula, so redefining one input
+// recalculates every variable that depends on it, and only those, like a spreadsheet. "ans" stands
+// for the last result given to calc_workspace_set_ans(). Not thread-safe.
+typedef struct CalcWorkspace CalcWorkspace;
+
+CalcWorkspace *calc_workspace_new(gboolean degrees);
+void calc_workspace_free(CalcWorkspace *ws);
+
+// Switches trig between degrees and radians and recalculates every variable.
+void calc_workspace_set_degrees(CalcWorkspace *ws, gboolean degrees);
+
+void calc_workspace_set_ans(CalcWorkspace *ws, double value);
+
+// TRUE if text holds definitions or several statements, i.e. needs calc_workspace_run() rather
+// than calc_workspace_expand().
+gboolean calc_workspace_is_program(const char *text);
+
+// Runs statements separated by ';' or newlines. Definitions whose text did not change cost
+// nothing; the others are recompiled, then everything downstream of them is recalculated once,
+// in dependency order. Sets *has_value and, if the last statement has a value (it is an
+// expression or a variable definition), stores it in *result. Returns FALSE and writes the first
+// error into err if a statement fails.
+gboolean calc_workspace_run(CalcWorkspace *ws, const char *text, double *result, gboolean *has_value,
+                            char *err, size_t err_cap);
+
+// Rewrites expr for calc_eval() and friends: variables and "ans" become their values and calls of
+// workspace functions are inlined. Names the workspace does not know are left for the evaluator
+// to report. Returns a new string (free with g_free()), or NULL and writes err.
+char *calc_workspace_expand(CalcWorkspace *ws, const char *expr, char *err, size_t err_cap);
+
+// What name (len bytes, not NUL-terminated) means in expressions, with the same answers
+// calc_workspace_expand() gives; fits a CalcIncrementalLookup through a thin adapter.
+CalcIncrementalName calc_workspace_resolve(CalcWorkspace *ws, const char *name, size_t len, double *value,
+                                           char *err, size_t err_cap);
+
+// Current value of a variable. Returns FALSE and writes err if it is undefined or failed.
+gboolean calc_workspace_lookup(CalcWorkspace *ws, const char *name, double *value, char *err, size_t err_cap);
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <gtk/gtk.h>
+
+// Text storage for the calculator's entry (see expr_buffer.c): a GtkEntryBuffer kept as a gap
+// buffer, so typing, pasting and deleting at the cursor move only the text between the previous
+// edit and this one, and character positions near the cursor map to bytes without a UTF-8 walk
+// from the start of the text.
+#define EXPR_TYPE_BUFFER (expr_buffer_get_type())
+G_DECLARE_FINAL_TYPE(ExprBuffer, expr_buffer, EXPR, BUFFER, GtkEntryBuffer)
+
+GtkEntryBuffer *expr_buffer_new(void);
+
+// Byte offset of character position in the text, for callers that keep their own copy of it.
+gsize expr_buffer_byte_offset(ExprBuffer *buffer, guint position);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <glib.h>
+
+// Calculation history in an append-only log on disk (see history_log.c). Opening maps the files
+// without reading the records, so it takes the same time for ten entries or ten million. All
+// functions except the background writer are for the thread that opened the log.
+typedef struct HistoryLog HistoryLog;
+
+typedef struct {
+    const char *expression; // expression_len bytes, not NUL-terminated
+    guint32 expression_len;
+    const char *result;     // result_len bytes, not NUL-terminated
+    guint32 result_len;
+    gint64 time;            // microseconds since the epoch, as g_get_real_time()
+} HistoryRecord;
+
+// Opens the log in dir, creating dir and the log if needed. Returns NULL and writes a short
+// error into err on failure.
+HistoryLog *history_log_open(const char *dir, char *err, size_t err_cap);
+
+// Waits for pending appends to reach the disk and closes the log.
+void history_log_close(HistoryLog *log);
+
+guint history_log_count(const HistoryLog *log);
+
+// Record index (0 = oldest). The pointers stay valid until the log is closed. Returns FALSE past
+// the end, and for a record a damaged index file has lost.
+gboolean history_log_get(const HistoryLog *log, guint index, HistoryRecord *rec);
+
+// Adds a record and returns at once; a background thread writes it to disk.
+void history_log_append(HistoryLog *log, const char *expression, const char *result);
+
+// Adds up to max_records records to the trigram index that narrows searches, so the index can be
+// built in idle time. Returns TRUE while records remain unindexed, including ones appended later.
+gboolean history_log_index_step(HistoryLog *log, guint max_records);
+
+// Stores in matches (guint record indices, ascending) the records whose expression or result
+// contains query, ignoring ASCII case. Queries of three bytes or more look up the index; records
+// not indexed yet are scanned. within, if not NULL, holds the current matches of a query that
+// query extends, so only those records are considered again.
+void history_log_search(const HistoryLog *log, const char *query, const GArray *within, GArray *matches);
+
+// TRUE if record index contains query (see history_log_search()).
+gboolean history_log_matches(const HistoryLog *log, guint index, const char *query);
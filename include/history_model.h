@@ -0,0 +1,31 @@
+#pragma once
+
+#include <gtk/gtk.h>
+
+#include "history_log.h"
+
+// List model over a HistoryLog for GtkListView, newest entry first (see history_model.c). Items
+// are GtkStringObjects holding the expression, created only for the rows the view asks for.
+#define HISTORY_TYPE_MODEL (history_model_get_type())
+G_DECLARE_FINAL_TYPE(HistoryModel, history_model, HISTORY, MODEL, GObject)
+
+// Takes ownership of log, which is closed when the model is finalized.
+HistoryModel *history_model_new(HistoryLog *log);
+
+// Logs an evaluation and shows it at the top.
+void history_model_append(HistoryModel *model, const char *expression, const char *result);
+
+// Starts building the search index in idle time. Does nothing after the first call.
+void history_model_prepare_search(HistoryModel *model);
+
+// A searchable view of a HistoryModel, one per history panel: each has its own query, so several
+// views can share one model. Items are the model's, newest first.
+#define HISTORY_TYPE_FILTER (history_filter_get_type())
+G_DECLARE_FINAL_TYPE(HistoryFilter, history_filter, HISTORY, FILTER, GObject)
+
+HistoryFilter *history_filter_new(HistoryModel *model);
+
+// Shows only entries containing query; NULL or "" shows everything.
+void history_filter_set_query(HistoryFilter *filter, const char *query);
+
+gboolean history_filter_get_record(HistoryFilter *filter, guint position, HistoryRecord *rec);
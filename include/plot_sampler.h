@@ -0,0 +1,25 @@
+#pragma once
+
+#include "calc_eval.h"
+
+// Samples y = f(x) for drawing (see plot_sampler.c). Samples are computed in tiles along x and
+// kept, so redrawing after a pan evaluates only the newly exposed tiles. Not thread-safe.
+typedef struct PlotCurve PlotCurve;
+
+// A point of a sampled curve. A point with a NaN y lifts the pen: the curve is undefined there
+// (a domain error) or jumps (a pole or a step), and nothing should be drawn across it.
+typedef struct {
+    double x;
+    double y;
+} PlotPoint;
+
+// Compiles expr with x as the only variable. Returns NULL and writes err on failure.
+PlotCurve *plot_curve_new(const char *expr, gboolean degrees, char *err, size_t err_cap);
+void plot_curve_free(PlotCurve *curve);
+
+// Appends points covering at least [x0, x1] to out (a GArray of PlotPoint), in increasing x,
+// resolved to about one pixel when a pixel is unit wide and tall (both axes share the scale).
+// Smooth stretches get one sample per pixel; sharp bends, poles and domain edges get more.
+// Returns how many new evaluations it took, which is 0 when every tile was cached. A range more
+// than about 2^53 units from 0, where pixels can no longer be told apart, gets no points.
+size_t plot_curve_sample(PlotCurve *curve, double x0, double x1, double unit, GArray *out);
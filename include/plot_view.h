@@ -0,0 +1,16 @@
+#pragma once
+
+#include <gtk/gtk.h>
+
+// Graph of y = f(x) for a few expressions at once (see plot_view.c). Drag to pan; scroll or pinch
+// to zoom about the pointer. Both axes share one scale.
+#define PLOT_TYPE_VIEW (plot_view_get_type())
+G_DECLARE_FINAL_TYPE(PlotView, plot_view, PLOT, VIEW, GtkWidget)
+
+GtkWidget *plot_view_new(void);
+
+// Plots exprs[0..n), each with x as its variable. Curves whose expression and mode did not
+// change keep their cached samples. Expressions that do not compile are left out; if none
+// compiles, the current curves stay, sampled again if degrees changed. Returns the number of new
+// curves shown.
+guint plot_view_set_expressions(PlotView *view, const char *const *exprs, guint n, gboolean degrees);
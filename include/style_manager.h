@@ -4,10 +4,10 @@
 
 typedef struct StyleManager StyleManager;
 
-// Create a manager that loads these CSS files and follows system light/dark preference.
-// Relative paths are resolved relative to the executable directory.
-StyleManager *style_manager_new(const char *dark_css_path, const char *light_css_path);
+// Create a manager that follows the system light/dark preference with the stylesheets at these
+// GResource paths (compiled into the binary from assets/). Both are parsed here, once; switching
+// themes afterwards only swaps which one is attached to the display.
+StyleManager *style_manager_new(const char *dark_resource, const char *light_resource);
 
 void style_manager_attach(StyleManager *m);
 void style_manager_free(StyleManager *m);
-
@@ -1,8 +1,16 @@
 #include <gtk/gtk.h>
 
+#include "batch_cli.h"
+#include "calc_trace.h"
 #include "ui.h"
 
 int main(int argc, char **argv) {
+    calc_trace_start_from_env(); // CALC_TRACE=trace.json
+    // Headless mode: evaluate expressions from a file/stdin without initializing GTK.
+    if (batch_cli_requested(argc, argv)) {
+        return batch_cli_run(argc, argv);
+    }
+
     GtkApplication *app =
         gtk_application_new("org.project.calculator", G_APPLICATION_DEFAULT_FLAGS);
 
@@ -12,4 +20,3 @@ int main(int argc, char **argv) {
     g_object_unref(app);
     return status;
 }
-
@@ -0,0 +1,328 @@
+#include "batch_cli.h"
+
+#include "calc_data.h"
+#include "calc_eval.h"
+#include "calc_parallel.h"
+#include "calc_trace.h"
+
+#include <glib/gstdio.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BATCH_IO_SIZE (1 << 20)
+#define BATCH_MAX_LINES 16384
+#define BATCH_LINE_GRAIN 256
+
+typedef struct {
+    gboolean degrees;
+    gboolean complex_mode;
+    gboolean stats;
+    guint threads;    // 0 = one per CPU
+    const char *path; // NULL or "-" means stdin
+    const char *data; // --data FILE: print the file's statistics instead
+    const char *trace; // --trace FILE: write a Chrome trace of the run at exit
+} BatchOptions;
+
+// Lines collected from the input buffer and their formatted results, in input order. Each worker
+// appends the results of the lines it evaluates to a buffer of its own, so a result is as long as
+// it needs to be; line i's result is lens[i] bytes at offsets[i] in results[workers[i]].
+typedef struct {
+    gboolean degrees;
+    gboolean complex_mode;
+    char *lines[BATCH_MAX_LINES];
+    size_t offsets[BATCH_MAX_LINES];
+    size_t lens[BATCH_MAX_LINES];
+    guint workers[BATCH_MAX_LINES];
+    GString **results; // one per worker
+    guint n_results;
+    size_t count;
+} PendingLines;
+
+typedef struct {
+    FILE *fp;
+    char *buf;
+    size_t len;
+} OutBuf;
+
+static void out_flush(OutBuf *o) {
+    if (o->len > 0) fwrite(o->buf, 1, o->len, o->fp);
+    o->len = 0;
+}
+
+static void out_write(OutBuf *o, const char *s, size_t n) {
+    if (o->len + n > BATCH_IO_SIZE) out_flush(o);
+    if (n > BATCH_IO_SIZE) {
+        fwrite(s, 1, n, o->fp);
+        return;
+    }
+    memcpy(o->buf + o->len, s, n);
+    o->len += n;
+}
+
+static void append_error(GString *out, const char *err) {
+    g_string_append(out, "Error: ");
+    g_string_append(out, err);
+}
+
+// Same decision order as the GUI "=" button: exact trig forms first (degrees only), then numeric.
+// Appends the result or the error to out.
+static void eval_line(const char *expr, gboolean degrees, gboolean complex_mode, GString *out) {
+    char err[256] = {0};
+    char buf[128];
+    double result = 0.0;
+
+    if (degrees) {
+        int deg = 0;
+        if (calc_try_special_trig(expr, &deg, buf, sizeof(buf), &result, err, sizeof(err))) {
+            g_string_append(out, buf);
+            return;
+        }
+        if (err[0]) {
+            append_error(out, err);
+            return;
+        }
+    }
+
+    if (complex_mode) {
+        CalcComplex value;
+        if (calc_eval_complex(expr, degrees, &value, err, sizeof(err))) {
+            calc_format_complex(value, buf, sizeof(buf));
+            g_string_append(out, buf);
+            return;
+        }
+    } else if (calc_eval(expr, degrees, &result, err, sizeof(err))) {
+        calc_format_result(result, buf, sizeof(buf));
+        g_string_append(out, buf);
+        return;
+    } else if (strchr(expr, '[')) {
+        CalcMatrix m;
+        if (calc_eval_matrix(expr, degrees, &m, err, sizeof(err))) {
+            // Room for every element in full: a number takes at most 63 bytes, its separator 2, and
+            // the closing bracket and NUL 2 more.
+            size_t at = out->len;
+            size_t cap = m.rows * m.cols * 65 + 2;
+            g_string_set_size(out, at + cap);
+            calc_format_matrix(&m, out->str + at, cap);
+            g_string_truncate(out, at + strlen(out->str + at));
+            g_free(m.data);
+            return;
+        }
+    }
+    append_error(out, err);
+}
+
+static void eval_pending_range(gpointer data, guint worker, size_t begin, size_t end) {
+    PendingLines *pending = data;
+    GString *out = pending->results[worker];
+    for (size_t i = begin; i < end; i++) {
+        size_t at = out->len;
+        eval_line(pending->lines[i], pending->degrees, pending->complex_mode, out);
+        g_string_append_c(out, '\n');
+        pending->workers[i] = worker;
+        pending->offsets[i] = at;
+        pending->lens[i] = out->len - at;
+    }
+}
+
+static void flush_pending(PendingLines *pending, guint threads, OutBuf *out) {
+    calc_parallel_for(pending->count, BATCH_LINE_GRAIN, threads, eval_pending_range, pending);
+    for (size_t i = 0; i < pending->count; i++) {
+        out_write(out, pending->results[pending->workers[i]]->str + pending->offsets[i], pending->lens[i]);
+    }
+    for (guint w = 0; w < pending->n_results; w++) g_string_truncate(pending->results[w], 0);
+    pending->count = 0;
+}
+
+static gboolean parse_args(int argc, char **argv, BatchOptions *opts) {
+    memset(opts, 0, sizeof(*opts));
+    gboolean threads_given = FALSE;
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        if (strcmp(a, "--batch") == 0) continue;
+        if (strcmp(a, "--degrees") == 0) { opts->degrees = TRUE; continue; }
+        if (strcmp(a, "--complex") == 0) { opts->complex_mode = TRUE; continue; }
+        if (strcmp(a, "--stats") == 0) { opts->stats = TRUE; continue; }
+        if (strcmp(a, "--threads") == 0 && i + 1 < argc) {
+            opts->threads = (guint)strtoul(argv[++i], NULL, 10);
+            threads_given = TRUE;
+            continue;
+        }
+        if (strcmp(a, "--cache-size") == 0 && i + 1 < argc) {
+            calc_cache_set_capacity((size_t)strtoul(argv[++i], NULL, 10));
+            continue;
+        }
+        if (strcmp(a, "--data") == 0 && i + 1 < argc) {
+            opts->data = argv[++i];
+            continue;
+        }
+        if (strcmp(a, "--trace") == 0 && i + 1 < argc) {
+            opts->trace = argv[++i];
+            continue;
+        }
+        if (a[0] == '-' && a[1] != '\0') {
+            fprintf(stderr, "unknown option: %s\n", a);
+            return FALSE;
+        }
+        if (opts->path) {
+            fprintf(stderr, "only one input file is supported\n");
+            return FALSE;
+        }
+        opts->path = a;
+    }
+    // Expressions are short, datasets large: only datasets use every CPU by default.
+    if (!threads_given) opts->threads = opts->data ? 0 : 1;
+    return TRUE;
+}
+
+// Time per phase from the trace counters; "parse" includes "lex" and "lookup".
+static void print_trace_counters(void) {
+    CalcTraceCounter counters[CALC_TRACE_PHASES];
+    calc_trace_get_counters(counters);
+    for (int p = 0; p < CALC_TRACE_PHASES; p++) {
+        if (!counters[p].count) continue;
+        fprintf(stderr, "  %-12s %10" G_GUINT64_FORMAT " calls %10.3f ms %8.0f ns/call\n", calc_trace_phase_name(p),
+                counters[p].count, (double)counters[p].ns / 1e6, (double)counters[p].ns / (double)counters[p].count);
+    }
+}
+
+gboolean batch_cli_requested(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--batch") == 0 || strcmp(argv[i], "--data") == 0) return TRUE;
+    }
+    return FALSE;
+}
+
+// Prints count, sum, mean, var, stddev, min, max and median of the dataset, one per line.
+static int print_data_stats(const BatchOptions *opts) {
+    char err[256];
+    CalcDataStats st;
+    double median;
+    gint64 start = g_get_monotonic_time();
+    if (!calc_data_stats(opts->data, opts->threads, &st, err, sizeof(err)) ||
+        !calc_data_median(opts->data, opts->threads, &median, err, sizeof(err))) {
+        fprintf(stderr, "Error: %s\n", err);
+        return 1;
+    }
+    double secs = (double)(g_get_monotonic_time() - start) / G_USEC_PER_SEC;
+
+    const struct { const char *name; double value; } rows[] = {
+        { "sum", st.sum }, { "mean", st.mean }, { "var", st.var }, { "stddev", st.stddev },
+        { "min", st.min }, { "max", st.max }, { "median", median },
+    };
+    printf("count   %" G_GUINT64_FORMAT "\n", st.count);
+    for (size_t i = 0; i < G_N_ELEMENTS(rows); i++) {
+        if (isnan(rows[i].value)) continue; // var and stddev of a single value
+        char out[64];
+        calc_format_result(rows[i].value, out, sizeof(out));
+        printf("%-7s %s\n", rows[i].name, out);
+    }
+    if (opts->stats) {
+        GStatBuf sb;
+        double bytes = g_stat(opts->data, &sb) == 0 ? (double)sb.st_size : 0.0;
+        fprintf(stderr, "%" G_GUINT64_FORMAT " values, %.0f bytes in %.3f s: %.1f MB/s on %u threads\n", st.count,
+                bytes, secs, bytes / MAX(secs, 1e-9) / 1e6, calc_parallel_workers(opts->threads));
+    }
+    return 0;
+}
+
+int batch_cli_run(int argc, char **argv) {
+    BatchOptions opts;
+    if (!parse_args(argc, argv, &opts)) {
+        fprintf(stderr, "usage: %s --batch [--degrees] [--complex] [--stats] [--threads N] [--cache-size N] "
+                "[--trace FILE] [FILE|-]\n"
+                "       %s --data FILE [--stats] [--threads N]\n", argv[0], argv[0]);
+        return 2;
+    }
+    if (opts.trace) calc_trace_start(opts.trace);
+    if (opts.data) return print_data_stats(&opts);
+
+    FILE *in = stdin;
+    if (opts.path && strcmp(opts.path, "-") != 0) {
+        in = fopen(opts.path, "rb");
+        if (!in) {
+            perror(opts.path);
+            return 1;
+        }
+    }
+
+    size_t cap = BATCH_IO_SIZE;
+    char *buf = g_malloc(cap + 1);
+    OutBuf out = { .fp = stdout, .buf = g_malloc(BATCH_IO_SIZE), .len = 0 };
+    PendingLines *pending = g_new0(PendingLines, 1);
+    pending->degrees = opts.degrees;
+    pending->complex_mode = opts.complex_mode;
+    pending->n_results = calc_parallel_workers(opts.threads);
+    pending->results = g_new(GString *, pending->n_results);
+    for (guint w = 0; w < pending->n_results; w++) pending->results[w] = g_string_new(NULL);
+    size_t have = 0;
+    guint64 lines = 0;
+    guint64 bytes = 0;
+    gboolean eof = FALSE;
+    gint64 start = g_get_monotonic_time();
+
+    while (!eof || have > 0) {
+        if (!eof) {
+            if (have == cap) {
+                // A single line longer than the buffer: grow instead of splitting it.
+                cap *= 2;
+                buf = g_realloc(buf, cap + 1);
+            }
+            size_t got = fread(buf + have, 1, cap - have, in);
+            if (got == 0) eof = TRUE;
+            have += got;
+            bytes += got;
+        }
+
+        char *p = buf;
+        char *end = buf + have;
+        for (;;) {
+            char *nl = memchr(p, '\n', (size_t)(end - p));
+            if (!nl) {
+                if (!eof || p == end) break;
+                nl = end; // last line without a trailing newline
+            }
+            char *line_end = nl;
+            if (line_end > p && line_end[-1] == '\r') line_end--;
+            *line_end = '\0';
+
+            pending->lines[pending->count++] = p;
+            if (pending->count == BATCH_MAX_LINES) flush_pending(pending, opts.threads, &out);
+            lines++;
+
+            p = (nl == end) ? end : nl + 1;
+        }
+        // Lines point into buf, so evaluate them before the tail is moved down.
+        flush_pending(pending, opts.threads, &out);
+
+        have = (size_t)(end - p);
+        memmove(buf, p, have);
+    }
+
+    out_flush(&out);
+    fflush(stdout);
+
+    if (opts.stats) {
+        double secs = (double)(g_get_monotonic_time() - start) / G_USEC_PER_SEC;
+        if (secs <= 0.0) secs = 1e-9;
+        fprintf(stderr, "%" G_GUINT64_FORMAT " lines, %" G_GUINT64_FORMAT " bytes in %.3f s: "
+                "%.0f lines/s, %.1f MB/s, %.0f ns/line\n",
+                lines, bytes, secs, (double)lines / secs, (double)bytes / secs / 1e6,
+                lines ? secs * 1e9 / (double)lines : 0.0);
+        CalcCacheStats cache;
+        calc_cache_get_stats(&cache);
+        fprintf(stderr, "cache: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses, "
+                "%" G_GUINT64_FORMAT " evictions, %zu/%zu entries\n",
+                cache.hits, cache.misses, cache.evictions, cache.size, cache.capacity);
+        if (opts.trace) print_trace_counters();
+    }
+
+    if (in != stdin) fclose(in);
+    g_free(buf);
+    g_free(out.buf);
+    for (guint w = 0; w < pending->n_results; w++) g_string_free(pending->results[w], TRUE);
+    g_free(pending->results);
+    g_free(pending);
+    return 0;
+}
@@ -0,0 +1,251 @@
+#include "calc_eval.h"
+#include "calc_internal.h"
+
+#include <math.h>
+#include <string.h>
+
+// Rows evaluated together. Each RPN op runs over a whole block before the next op,
+// so every case below is a short, branch-free loop the compiler can vectorize.
+#define BATCH_BLOCK 256
+
+// Deep programs would need max_depth * BATCH_BLOCK doubles of value stack; past this budget
+// the block is shortened instead (never below BATCH_MIN_BLOCK rows).
+#define BATCH_STACK_BUDGET ((size_t)1 << 20)
+#define BATCH_MIN_BLOCK 8
+
+// Values of the dataset statistics outside diff() blocks, in code order, or NULL if there are
+// none. Each read checks the file, so they are read once per call rather than once per block; a
+// statistic that fails is NaN.
+static double *read_data(const CalcProgram *prog) {
+    size_t n = 0;
+    for (size_t i = 0; i < prog->count; i++) {
+        if (prog->code[i].type != TOK_OP) continue;
+        if (prog->code[i].op == 'D') i += (size_t)prog->code[i].slot;
+        else if (prog->code[i].op == 'R') n++;
+    }
+    if (n == 0) return NULL;
+    double *data = g_new(double, n);
+    char err[64];
+    n = 0;
+    for (size_t i = 0; i < prog->count; i++) {
+        const Token *t = &prog->code[i];
+        if (t->type != TOK_OP) continue;
+        if (t->op == 'D') {
+            i += (size_t)t->slot;
+        } else if (t->op == 'R') {
+            if (!calc_data_value(t->slot, (int)t->value, 0, &data[n], err, sizeof(err))) data[n] = NAN;
+            n++;
+        }
+    }
+    return data;
+}
+
+static void eval_block(const CalcProgram *prog, const double *const *cols, const double *data, size_t base,
+                       size_t len, size_t stride, double *stack, guint8 *bad) {
+    const double scale = prog->degrees ? (G_PI / 180.0) : 1.0;
+    int top = -1;
+
+    memset(bad, 0, len);
+
+    for (size_t i = 0; i < prog->count; i++) {
+        const Token *t = &prog->code[i];
+
+        if (t->type == TOK_NUM) {
+            double *restrict r = stack + (size_t)(++top) * stride;
+            for (size_t j = 0; j < len; j++) r[j] = t->value;
+            continue;
+        }
+        if (t->type == TOK_VAR) {
+            memcpy(stack + (size_t)(++top) * stride, cols[t->slot] + base, len * sizeof(double));
+            continue;
+        }
+
+        if (t->op == 'R') {
+            // A dataset statistic is the same for every row.
+            double *restrict r = stack + (size_t)(++top) * stride;
+            double v = *data++;
+            if (isnan(v)) memset(bad, 1, len);
+            for (size_t j = 0; j < len; j++) r[j] = v;
+            continue;
+        }
+
+        if (t->op == 'F') {
+            // Registered functions take their arguments row by row.
+            const CalcFunc *fn = calc_func_get(t->slot);
+            top -= fn->arity - 1;
+            double *a = stack + (size_t)top * stride;
+            double args[CALC_FUNC_MAX_ARGS];
+            for (size_t j = 0; j < len; j++) {
+                for (int k = 0; k < fn->arity; k++) args[k] = a[(size_t)k * stride + j];
+                bad[j] |= !fn->fn(args, &a[j], fn->user_data);
+            }
+            if (prog->degrees && (fn->flags & CALC_FUNC_ANGLE_RESULT)) {
+                for (size_t j = 0; j < len; j++) a[j] *= 180.0 / G_PI;
+            }
+            continue;
+        }
+
+        if (t->op == 'D') {
+            // Derivatives carry a second value through the block, so they go row by row too.
+            double *a = stack + (size_t)top * stride;
+            double *vars = g_new(double, prog->n_vars + 1);
+            char err[64];
+            for (size_t j = 0; j < len; j++) {
+                for (size_t k = 0; k < prog->n_vars; k++) vars[k] = cols[k][base + j];
+                double value;
+                bad[j] |= !calc_diff_rpn(t + 1, (size_t)t->slot, vars, (int)t->value, a[j], prog->degrees, &value,
+                                         &a[j], err, sizeof(err));
+            }
+            g_free(vars);
+            i += (size_t)t->slot;
+            continue;
+        }
+
+        if (calc_op_arity(t->op) == 1) {
+            double *restrict a = stack + (size_t)top * stride;
+            switch (t->op) {
+                case 'u': for (size_t j = 0; j < len; j++) a[j] = -a[j]; break;
+                case 'w': {
+                    // Same multiply sequence as calc_powi(), one bit of the exponent at a time.
+                    double acc[BATCH_BLOCK];
+                    for (size_t j = 0; j < len; j++) acc[j] = 1.0;
+                    for (int e = (int)t->value;;) {
+                        if (e & 1) for (size_t j = 0; j < len; j++) acc[j] *= a[j];
+                        e >>= 1;
+                        if (!e) break;
+                        for (size_t j = 0; j < len; j++) a[j] *= a[j];
+                    }
+                    memcpy(a, acc, len * sizeof(double));
+                    break;
+                }
+                case 'A': for (size_t j = 0; j < len; j++) a[j] = fabs(a[j]); break;
+                case 'E': for (size_t j = 0; j < len; j++) a[j] = exp(a[j]); break;
+                case 'S': for (size_t j = 0; j < len; j++) a[j] = sin(a[j] * scale); break;
+                case 'C': for (size_t j = 0; j < len; j++) a[j] = cos(a[j] * scale); break;
+                case 'T': for (size_t j = 0; j < len; j++) a[j] = tan(a[j] * scale); break;
+                case 'Q':
+                    for (size_t j = 0; j < len; j++) bad[j] |= (a[j] < 0.0);
+                    for (size_t j = 0; j < len; j++) a[j] = sqrt(a[j]);
+                    break;
+                case 'L':
+                    for (size_t j = 0; j < len; j++) bad[j] |= (a[j] <= 0.0);
+                    for (size_t j = 0; j < len; j++) a[j] = log10(a[j]);
+                    break;
+                case 'N':
+                    for (size_t j = 0; j < len; j++) bad[j] |= (a[j] <= 0.0);
+                    for (size_t j = 0; j < len; j++) a[j] = log(a[j]);
+                    break;
+                case 'G':
+                    for (size_t j = 0; j < len; j++) bad[j] |= (a[j] <= 0.0);
+                    for (size_t j = 0; j < len; j++) a[j] = log2(a[j]);
+                    break;
+                case 'I':
+                    for (size_t j = 0; j < len; j++) a[j] = sin(a[j] * scale);
+                    for (size_t j = 0; j < len; j++) bad[j] |= (a[j] == 0.0);
+                    for (size_t j = 0; j < len; j++) a[j] = 1.0 / a[j];
+                    break;
+                case 'J':
+                    for (size_t j = 0; j < len; j++) a[j] = cos(a[j] * scale);
+                    for (size_t j = 0; j < len; j++) bad[j] |= (a[j] == 0.0);
+                    for (size_t j = 0; j < len; j++) a[j] = 1.0 / a[j];
+                    break;
+                case 'K':
+                    for (size_t j = 0; j < len; j++) a[j] = tan(a[j] * scale);
+                    for (size_t j = 0; j < len; j++) bad[j] |= (a[j] == 0.0);
+                    for (size_t j = 0; j < len; j++) a[j] = 1.0 / a[j];
+                    break;
+                case '!':
+                    for (size_t j = 0; j < len; j++) {
+                        double r = round(a[j]);
+                        if (a[j] < 0 || fabs(a[j] - r) > 1e-9 || r > 170) { bad[j] = 1; continue; }
+                        double acc = 1.0;
+                        for (int k = 2; k <= (int)r; k++) acc *= (double)k;
+                        a[j] = acc;
+                    }
+                    break;
+                default:
+                    for (size_t j = 0; j < len; j++) bad[j] = 1;
+                    break;
+            }
+            continue;
+        }
+
+        const double *restrict b = stack + (size_t)(top--) * stride;
+        double *restrict a = stack + (size_t)top * stride;
+        switch (t->op) {
+            case '+': for (size_t j = 0; j < len; j++) a[j] = a[j] + b[j]; break;
+            case '-': for (size_t j = 0; j < len; j++) a[j] = a[j] - b[j]; break;
+            case '*': for (size_t j = 0; j < len; j++) a[j] = a[j] * b[j]; break;
+            case '/':
+                for (size_t j = 0; j < len; j++) bad[j] |= (b[j] == 0.0);
+                for (size_t j = 0; j < len; j++) a[j] = a[j] / b[j];
+                break;
+            case '%':
+                for (size_t j = 0; j < len; j++) bad[j] |= (b[j] == 0.0);
+                for (size_t j = 0; j < len; j++) a[j] = fmod(a[j], b[j]);
+                break;
+            case '^':
+            case 'P':
+                for (size_t j = 0; j < len; j++) a[j] = pow(a[j], b[j]);
+                break;
+            default:
+                for (size_t j = 0; j < len; j++) bad[j] = 1;
+                break;
+        }
+    }
+}
+
+// Programs with matrix literals go through calc_program_eval() one row at a time.
+static size_t eval_rows(const CalcProgram *prog, const double *const *cols, size_t n, double *out, guint8 *status) {
+    double *vars = g_new(double, prog->n_vars + 1);
+    char err[64];
+    size_t ok = 0;
+    if (status) memset(status, 0, (n + 7) / 8);
+    for (size_t j = 0; j < n; j++) {
+        for (size_t k = 0; k < prog->n_vars; k++) vars[k] = cols[k][j];
+        if (calc_program_eval(prog, vars, &out[j], err, sizeof(err))) {
+            if (status) status[j / 8] |= (guint8)(1u << (j % 8));
+            ok++;
+        } else {
+            out[j] = NAN;
+        }
+    }
+    g_free(vars);
+    return ok;
+}
+
+size_t calc_program_eval_columns(const CalcProgram *prog, const double *const *cols, size_t n,
+                                 double *out, guint8 *status) {
+    if (prog->needs_complex) { // see calc_program_eval_columns_complex()
+        for (size_t j = 0; j < n; j++) out[j] = NAN;
+        if (status) memset(status, 0, (n + 7) / 8);
+        return 0;
+    }
+    if (prog->matrix) return eval_rows(prog, cols, n, out, status);
+    size_t depth = MAX(prog->max_depth, (size_t)1);
+    size_t stride = CLAMP(BATCH_STACK_BUDGET / depth, (size_t)BATCH_MIN_BLOCK, (size_t)BATCH_BLOCK);
+    double *stack = g_new(double, depth * stride);
+    double *data = read_data(prog);
+    guint8 bad[BATCH_BLOCK];
+    size_t ok = 0;
+
+    if (status) memset(status, 0, (n + 7) / 8);
+
+    for (size_t base = 0; base < n; base += stride) {
+        size_t len = MIN(n - base, stride);
+        eval_block(prog, cols, data, base, len, stride, stack, bad);
+        for (size_t j = 0; j < len; j++) {
+            if (bad[j]) {
+                out[base + j] = NAN;
+            } else {
+                out[base + j] = stack[j];
+                if (status) status[(base + j) / 8] |= (guint8)(1u << ((base + j) % 8));
+                ok++;
+            }
+        }
+    }
+
+    g_free(data);
+    g_free(stack);
+    return ok;
+}
@@ -0,0 +1,203 @@
+#include "calc_eval.h"
+#include "calc_internal.h"
+
+#include <string.h>
+
+// Compiled programs keyed by normalized expression text + degrees flag. The table is split
+// into shards with their own lock and LRU list so parallel callers rarely contend.
+// An expression is only admitted the second time it is seen (a small direct-mapped table of
+// key hashes acts as the doorkeeper), so streams of unique inputs don't churn the cache.
+#define CACHE_SHARDS 8
+#define CACHE_DOORKEEPER 512
+#define CACHE_DEFAULT_CAPACITY 256
+#define CACHE_KEY_INLINE 256
+
+typedef struct CacheEntry {
+    char *key;
+    CalcProgram *prog;
+    struct CacheEntry *prev; // towards most recently used
+    struct CacheEntry *next; // towards least recently used
+} CacheEntry;
+
+typedef struct {
+    GMutex lock;
+    GHashTable *table; // key -> CacheEntry*, entries owned by the LRU list
+    CacheEntry *head;
+    CacheEntry *tail;
+    size_t size;
+    size_t capacity;
+    guint64 hits;
+    guint64 misses;
+    guint64 evictions;
+    guint seen[CACHE_DOORKEEPER]; // key hashes seen once but not admitted yet
+} CacheShard;
+
+static CacheShard shards[CACHE_SHARDS];
+
+static void cache_init(void) {
+    static gsize once = 0;
+    if (g_once_init_enter(&once)) {
+        for (int i = 0; i < CACHE_SHARDS; i++) {
+            g_mutex_init(&shards[i].lock);
+            shards[i].table = g_hash_table_new(g_str_hash, g_str_equal);
+            shards[i].capacity = CACHE_DEFAULT_CAPACITY / CACHE_SHARDS;
+        }
+        g_once_init_leave(&once, 1);
+    }
+}
+
+static gboolean is_word_char(char c) {
+    return g_ascii_isalnum(c) || c == '.' || c == '_';
+}
+
+// Drops whitespace unless it separates two word characters ("1 2" must not become "12"),
+// then appends the degrees flag. Returns the key length.
+static size_t normalize_key(const char *expr, gboolean degrees, char *out) {
+    size_t n = 0;
+    char last = 0;
+    gboolean pending_space = FALSE;
+    for (const char *p = expr; *p; p++) {
+        if (g_ascii_isspace(*p)) {
+            pending_space = TRUE;
+            continue;
+        }
+        if (pending_space && is_word_char(last) && is_word_char(*p)) out[n++] = ' ';
+        pending_space = FALSE;
+        out[n++] = *p;
+        last = *p;
+    }
+    out[n++] = '\x1f';
+    out[n++] = degrees ? 'd' : 'r';
+    out[n] = '\0';
+    return n;
+}
+
+static void lru_unlink(CacheShard *s, CacheEntry *e) {
+    if (e->prev) e->prev->next = e->next; else s->head = e->next;
+    if (e->next) e->next->prev = e->prev; else s->tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push_front(CacheShard *s, CacheEntry *e) {
+    e->next = s->head;
+    e->prev = NULL;
+    if (s->head) s->head->prev = e;
+    s->head = e;
+    if (!s->tail) s->tail = e;
+}
+
+static void evict_to(CacheShard *s, size_t capacity) {
+    while (s->size > capacity && s->tail) {
+        CacheEntry *e = s->tail;
+        lru_unlink(s, e);
+        g_hash_table_remove(s->table, e->key);
+        calc_program_free(e->prog);
+        g_free(e->key);
+        g_free(e);
+        s->size--;
+        s->evictions++;
+    }
+}
+
+gboolean calc_cache_eval(const char *expr, gboolean degrees, double *result, char *err, size_t err_cap) {
+    cache_init();
+
+    CALC_TRACE_BEGIN(start);
+    char inline_key[CACHE_KEY_INLINE];
+    size_t expr_len = strlen(expr);
+    char *key = (expr_len + 3 <= sizeof(inline_key)) ? inline_key : g_malloc(expr_len + 3);
+    normalize_key(expr, degrees, key);
+
+    guint hash = g_str_hash(key);
+    CacheShard *s = &shards[hash % CACHE_SHARDS];
+    CalcProgram *prog = NULL;
+    gboolean admit = FALSE;
+
+    g_mutex_lock(&s->lock);
+    CacheEntry *e = g_hash_table_lookup(s->table, key);
+    if (e) {
+        s->hits++;
+        if (s->head != e) {
+            lru_unlink(s, e);
+            lru_push_front(s, e);
+        }
+        prog = calc_program_ref(e->prog);
+    } else {
+        s->misses++;
+        guint *slot = &s->seen[(hash / CACHE_SHARDS) % CACHE_DOORKEEPER];
+        admit = s->capacity > 0 && *slot == hash;
+        *slot = hash;
+    }
+    g_mutex_unlock(&s->lock);
+    CALC_TRACE_END(CALC_TRACE_CACHE, start);
+
+    if (!prog && !admit) {
+        if (key != inline_key) g_free(key);
+        return calc_eval_scratch(calc_scratch_get(), expr, degrees, result, err, err_cap);
+    }
+
+    if (!prog) {
+        // Compile outside the lock; a concurrent miss on the same key just compiles twice.
+        prog = calc_compile(expr, NULL, 0, degrees, err, err_cap);
+        if (!prog) {
+            if (key != inline_key) g_free(key);
+            return FALSE;
+        }
+
+        g_mutex_lock(&s->lock);
+        if (!g_hash_table_contains(s->table, key)) {
+            e = g_new0(CacheEntry, 1);
+            e->key = g_strdup(key);
+            e->prog = calc_program_ref(prog);
+            g_hash_table_insert(s->table, e->key, e);
+            lru_push_front(s, e);
+            s->size++;
+            evict_to(s, s->capacity);
+        }
+        g_mutex_unlock(&s->lock);
+    }
+
+    if (key != inline_key) g_free(key);
+    gboolean ok = calc_program_eval(prog, NULL, result, err, err_cap);
+    calc_program_free(prog);
+    return ok;
+}
+
+void calc_cache_set_capacity(size_t capacity) {
+    cache_init();
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard *s = &shards[i];
+        g_mutex_lock(&s->lock);
+        // Spread the budget over the shards; any non-zero capacity keeps every shard usable.
+        s->capacity = capacity == 0 ? 0 : MAX((capacity + CACHE_SHARDS - 1 - (size_t)i) / CACHE_SHARDS, (size_t)1);
+        evict_to(s, s->capacity);
+        g_mutex_unlock(&s->lock);
+    }
+}
+
+void calc_cache_clear(void) {
+    cache_init();
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard *s = &shards[i];
+        g_mutex_lock(&s->lock);
+        evict_to(s, 0);
+        s->hits = s->misses = s->evictions = 0;
+        memset(s->seen, 0, sizeof(s->seen));
+        g_mutex_unlock(&s->lock);
+    }
+}
+
+void calc_cache_get_stats(CalcCacheStats *stats) {
+    cache_init();
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard *s = &shards[i];
+        g_mutex_lock(&s->lock);
+        stats->hits += s->hits;
+        stats->misses += s->misses;
+        stats->evictions += s->evictions;
+        stats->size += s->size;
+        stats->capacity += s->capacity;
+        g_mutex_unlock(&s->lock);
+    }
+}
@@ -0,0 +1,453 @@
+#include "calc_eval.h"
+#include "calc_internal.h"
+
+#include <complex.h>
+#include <math.h>
+#include <string.h>
+
+// Complex mode. Expressions are compiled with one more variable, calc_imag_name, that reads i.
+// Each program is classified once, at compile time: if real inputs can only give real results it
+// keeps the real evaluators (interpreter, batch kernels, JIT) and complex mode costs nothing;
+// otherwise needs_complex is set and it runs here. Every operation on real operands tries the
+// real function first, so a value that is real all along gets the same bits as in real mode, and
+// only leaves the real line for the principal complex branch.
+
+const char calc_imag_name[] = "i";
+
+// Rows per batch block. Real and imaginary parts live in separate arrays, so the arithmetic loops
+// below vectorize like those of calc_batch.c.
+#define COMPLEX_BLOCK 256
+#define COMPLEX_STACK_BUDGET ((size_t)1 << 19)
+#define COMPLEX_MIN_BLOCK 8
+
+static CalcComplex from_c(double complex z) {
+    return (CalcComplex){ creal(z), cimag(z) };
+}
+
+// A zero imaginary part is taken as +0 whatever its sign, so -1 (parsed as 1 negated) lies on the
+// upper side of the branch cuts like 1-2 does: sqrt(-1) is i and ln(-2) has +pi.
+static double complex to_c(CalcComplex z) {
+    return CMPLX(z.re, z.im + 0.0);
+}
+
+static CalcComplex real(double x) {
+    return (CalcComplex){ x, 0.0 };
+}
+
+static CalcComplex c_mul(CalcComplex a, CalcComplex b) {
+    return (CalcComplex){ a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re };
+}
+
+// Smith's algorithm: no overflow for large divisors, and a real divisor divides each part exactly.
+static CalcComplex c_div(CalcComplex a, CalcComplex b) {
+    if (fabs(b.re) >= fabs(b.im)) {
+        double r = b.im / b.re, den = b.re + b.im * r;
+        return (CalcComplex){ (a.re + a.im * r) / den, (a.im - a.re * r) / den };
+    }
+    double r = b.re / b.im, den = b.re * r + b.im;
+    return (CalcComplex){ (a.re * r + a.im) / den, (a.im * r - a.re) / den };
+}
+
+// z^n for n >= 1 by repeated squaring, in the order calc_powi() uses.
+static CalcComplex c_powi(CalcComplex z, int n) {
+    if (z.im == 0.0) return real(calc_powi(z.re, n));
+    CalcComplex acc = { 1.0, 0.0 };
+    for (;;) {
+        if (n & 1) acc = c_mul(acc, z);
+        n >>= 1;
+        if (!n) break;
+        z = c_mul(z, z);
+    }
+    return acc;
+}
+
+static gboolean c_pow(CalcComplex a, CalcComplex b, CalcComplex *out, char *err, size_t err_cap) {
+    gboolean integer = b.im == 0.0 && b.re == floor(b.re);
+    if (a.im == 0.0 && b.im == 0.0 && (a.re >= 0.0 || integer)) {
+        *out = real(pow(a.re, b.re));
+    } else if (integer && fabs(b.re) <= 64.0) {
+        // Exact on Gaussian integers, where cpow() is off by rounding: i^2 is -1, not -1+1.2e-16i.
+        int n = (int)fabs(b.re);
+        CalcComplex r = n ? c_powi(a, n) : real(1.0);
+        *out = b.re < 0.0 ? c_div(real(1.0), r) : r;
+    } else if (a.re == 0.0 && a.im == 0.0) {
+        if (!(b.re > 0.0)) { g_snprintf(err, err_cap, "pow domain error"); return FALSE; }
+        *out = real(0.0);
+    } else {
+        *out = from_c(cpow(to_c(a), to_c(b)));
+    }
+    return TRUE;
+}
+
+// 1/z for csc, sec and cot, with the domain error of real mode at z == 0.
+static gboolean reciprocal(CalcComplex z, const char *name, CalcComplex *out, char *err, size_t err_cap) {
+    if (z.re == 0.0 && z.im == 0.0) { g_snprintf(err, err_cap, "%s domain error", name); return FALSE; }
+    *out = z.im == 0.0 ? real(1.0 / z.re) : c_div(real(1.0), z);
+    return TRUE;
+}
+
+static gboolean apply_unary(const Token *t, CalcComplex *a, gboolean degrees, char *err, size_t err_cap) {
+    const double k = degrees ? (G_PI / 180.0) : 1.0;
+    const CalcComplex z = *a;
+    const gboolean is_real = z.im == 0.0;
+    const double complex zk = to_c((CalcComplex){ z.re * k, z.im * k });
+    switch (t->op) {
+        case 'u': *a = (CalcComplex){ -z.re, -z.im }; break;
+        case 'w': *a = c_powi(z, (int)t->value); break;
+        case 'S': *a = is_real ? real(sin(z.re * k)) : from_c(csin(zk)); break;
+        case 'C': *a = is_real ? real(cos(z.re * k)) : from_c(ccos(zk)); break;
+        case 'T': *a = is_real ? real(tan(z.re * k)) : from_c(ctan(zk)); break;
+        case 'Q': *a = (is_real && z.re >= 0.0) ? real(sqrt(z.re)) : from_c(csqrt(to_c(z))); break;
+        case 'L':
+        case 'N':
+        case 'G': {
+            const char *name = t->op == 'L' ? "log" : t->op == 'N' ? "ln" : "log2";
+            if (z.re == 0.0 && z.im == 0.0) { g_snprintf(err, err_cap, "%s domain error", name); return FALSE; }
+            if (is_real && z.re > 0.0) {
+                *a = real(t->op == 'L' ? log10(z.re) : t->op == 'N' ? log(z.re) : log2(z.re));
+            } else {
+                double complex l = clog(to_c(z));
+                *a = from_c(t->op == 'L' ? l / G_LN10 : t->op == 'N' ? l : l / G_LN2);
+            }
+            break;
+        }
+        case 'A': *a = real(is_real ? fabs(z.re) : hypot(z.re, z.im)); break;
+        case 'E': *a = is_real ? real(exp(z.re)) : from_c(cexp(to_c(z))); break;
+        case 'I': return reciprocal(is_real ? real(sin(z.re * k)) : from_c(csin(zk)), "csc", a, err, err_cap);
+        case 'J': return reciprocal(is_real ? real(cos(z.re * k)) : from_c(ccos(zk)), "sec", a, err, err_cap);
+        case 'K': return reciprocal(is_real ? real(tan(z.re * k)) : from_c(ctan(zk)), "cot", a, err, err_cap);
+        case '!':
+            if (!is_real) { g_snprintf(err, err_cap, "factorial requires a non-negative integer"); return FALSE; }
+            return calc_factorial(z.re, &a->re, err, err_cap);
+        default:
+            g_snprintf(err, err_cap, "unknown operator");
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean apply_binary(char op, CalcComplex *a, CalcComplex b, char *err, size_t err_cap) {
+    switch (op) {
+        case '+': *a = (CalcComplex){ a->re + b.re, a->im + b.im }; break;
+        case '-': *a = (CalcComplex){ a->re - b.re, a->im - b.im }; break;
+        case '*': *a = c_mul(*a, b); break;
+        case '/':
+            if (b.re == 0.0 && b.im == 0.0) { g_snprintf(err, err_cap, "division by zero"); return FALSE; }
+            *a = c_div(*a, b);
+            break;
+        case '%':
+            if (a->im != 0.0 || b.im != 0.0) { g_snprintf(err, err_cap, "%% needs real operands"); return FALSE; }
+            if (b.re == 0.0) { g_snprintf(err, err_cap, "division by zero"); return FALSE; }
+            *a = real(fmod(a->re, b.re));
+            break;
+        case '^':
+        case 'P':
+            return c_pow(*a, b, a, err, err_cap);
+        default:
+            g_snprintf(err, err_cap, "unknown operator");
+            return FALSE;
+    }
+    return TRUE;
+}
+
+// Registered functions take real arguments. Built-ins with a complex extension use it off the
+// real line and outside their real domain (asin(2), acosh(0), cbrt of a complex number).
+static gboolean apply_func(int index, CalcComplex *args, gboolean degrees, char *err, size_t err_cap) {
+    const CalcFunc *fn = calc_func_get(index);
+    double re[CALC_FUNC_MAX_ARGS];
+    gboolean is_real = TRUE;
+    for (int k = 0; k < fn->arity; k++) {
+        re[k] = args[k].re;
+        is_real &= args[k].im == 0.0;
+    }
+    double r;
+    if (is_real && fn->fn(re, &r, fn->user_data)) {
+        args[0] = real(r);
+    } else {
+        double complex z = to_c(args[0]), w;
+        switch (index) {
+            case CALC_FN_ASIN:  w = casin(z); break;
+            case CALC_FN_ACOS:  w = cacos(z); break;
+            case CALC_FN_ATAN:  w = catan(z); break;
+            case CALC_FN_SINH:  w = csinh(z); break;
+            case CALC_FN_COSH:  w = ccosh(z); break;
+            case CALC_FN_TANH:  w = ctanh(z); break;
+            case CALC_FN_ASINH: w = casinh(z); break;
+            case CALC_FN_ACOSH: w = cacosh(z); break;
+            case CALC_FN_ATANH: w = catanh(z); break;
+            case CALC_FN_CBRT:  w = cpow(z, 1.0 / 3.0); break;
+            default:
+                g_snprintf(err, err_cap, is_real ? "%s domain error" : "%s needs real arguments", fn->name);
+                return FALSE;
+        }
+        if (isinf(creal(w)) || isinf(cimag(w))) { g_snprintf(err, err_cap, "%s domain error", fn->name); return FALSE; }
+        args[0] = from_c(w);
+    }
+    if (degrees && (fn->flags & CALC_FUNC_ANGLE_RESULT)) {
+        args[0].re *= 180.0 / G_PI;
+        args[0].im *= 180.0 / G_PI;
+    }
+    return TRUE;
+}
+
+// Applies the operator t to the arity operands at a.
+static gboolean apply(const Token *t, int arity, CalcComplex *a, gboolean degrees, char *err, size_t err_cap) {
+    if (t->op == 'F') return apply_func(t->slot, a, degrees, err, err_cap);
+    if (t->op == 'D') { g_snprintf(err, err_cap, "diff is not available for complex expressions"); return FALSE; }
+    if (t->op == 'M') { g_snprintf(err, err_cap, "matrices are not available for complex expressions"); return FALSE; }
+    if (t->op == 'R') {
+        double v;
+        if (!calc_data_value(t->slot, (int)t->value, 0, &v, err, err_cap)) return FALSE;
+        *a = real(v);
+        return TRUE;
+    }
+    if (arity == 1) return apply_unary(t, a, degrees, err, err_cap);
+    return apply_binary(t->op, a, a[1], err, err_cap);
+}
+
+static gboolean eval_rpn_complex(const Token *code, size_t count, const CalcComplex *vars, gboolean degrees,
+                                 CalcComplex *stack, CalcComplex *out, char *err, size_t err_cap) {
+    int top = -1;
+    for (size_t i = 0; i < count; i++) {
+        const Token *t = &code[i];
+        if (t->type == TOK_NUM) { stack[++top] = real(t->value); continue; }
+        if (t->type == TOK_VAR) { stack[++top] = vars[t->slot]; continue; }
+
+        int arity = calc_token_arity(t);
+        if (top + 1 < arity) { g_snprintf(err, err_cap, "invalid expression"); return FALSE; }
+        top -= arity - 1;
+        if (!apply(t, arity, &stack[top], degrees, err, err_cap)) return FALSE;
+    }
+    if (top != 0) { g_snprintf(err, err_cap, "invalid expression"); return FALSE; }
+    *out = stack[0];
+    return TRUE;
+}
+
+// TRUE if real inputs can only give real results: nothing reads i (slot imag), and there are no
+// roots or logarithms, no inverse functions with a bounded real domain, and no powers except
+// those of a non-negative literal or to an integer literal.
+static gboolean stays_real(const Token *code, size_t count, int imag) {
+    size_t *starts = g_new(size_t, count + 1); // first token of each operand on the stack
+    int top = -1;
+    gboolean is_real = TRUE;
+    for (size_t i = 0; i < count && is_real; i++) {
+        const Token *t = &code[i];
+        if (t->type != TOK_OP || t->op == 'R') {
+            is_real = !(t->type == TOK_VAR && t->slot == imag);
+            starts[++top] = i;
+            continue;
+        }
+        int arity = calc_token_arity(t);
+        if (top + 1 < arity) break; // malformed; check_rpn() reports it
+        size_t a = starts[top - arity + 1], b = starts[top];
+        switch (t->op) {
+            case 'Q': case 'L': case 'N': case 'G':
+                is_real = FALSE;
+                break;
+            case '^':
+            case 'P':
+                is_real = (b == a + 1 && code[a].type == TOK_NUM && code[a].value >= 0.0) ||
+                          (b == i - 1 && code[b].type == TOK_NUM && code[b].value == floor(code[b].value));
+                break;
+            case 'F':
+                is_real = t->slot != CALC_FN_ASIN && t->slot != CALC_FN_ACOS && t->slot != CALC_FN_ACOSH &&
+                          t->slot != CALC_FN_ATANH;
+                break;
+            case 'D':
+                i += (size_t)t->slot; // only real code differentiates
+                break;
+        }
+        top -= arity - 1;
+        starts[top] = a;
+    }
+    g_free(starts);
+    return is_real;
+}
+
+CalcProgram *calc_compile_complex(const char *expr, const char *const *var_names, size_t n_vars,
+                                  gboolean degrees, char *err, size_t err_cap) {
+    const char **names = g_new(const char *, n_vars + 1);
+    if (n_vars) memcpy(names, var_names, n_vars * sizeof(*names));
+    names[n_vars] = calc_imag_name;
+
+    CalcScratch *scratch = calc_scratch_get();
+    size_t count = 0;
+    CalcProgram *prog = NULL;
+    if (calc_parse(scratch, expr, names, n_vars + 1, &count, err, err_cap)) {
+        gboolean is_real = stays_real(scratch->rpn, count, (int)n_vars);
+        // Constant folding runs real arithmetic: (-8)^(1/3) would fold to NaN. Only real
+        // programs are optimized.
+        prog = calc_program_from_scratch(scratch, count, n_vars, degrees, is_real, err, err_cap);
+        if (prog) prog->needs_complex = !is_real;
+    }
+    g_free(names);
+    return prog;
+}
+
+gboolean calc_program_eval_complex(const CalcProgram *prog, const CalcComplex *vars, CalcComplex *result,
+                                   char *err, size_t err_cap) {
+    if (!prog->needs_complex) {
+        double local[16];
+        double *re = prog->n_vars <= G_N_ELEMENTS(local) ? local : g_new(double, prog->n_vars);
+        gboolean is_real = TRUE;
+        for (size_t k = 0; k < prog->n_vars; k++) {
+            re[k] = vars[k].re;
+            is_real &= vars[k].im == 0.0;
+        }
+        gboolean ok = FALSE;
+        if (is_real && calc_program_eval(prog, re, &result->re, err, err_cap)) {
+            result->im = 0.0;
+            ok = TRUE;
+        }
+        if (re != local) g_free(re);
+        if (is_real) return ok;
+    }
+
+    // Variable slot n_vars is i.
+    CalcComplex local_vars[16];
+    CalcComplex local_stack[64];
+    CalcComplex *values = prog->n_vars < G_N_ELEMENTS(local_vars) ? local_vars : g_new(CalcComplex, prog->n_vars + 1);
+    CalcComplex *stack = prog->max_depth <= G_N_ELEMENTS(local_stack) ? local_stack : g_new(CalcComplex, prog->max_depth);
+    if (prog->n_vars) memcpy(values, vars, prog->n_vars * sizeof(CalcComplex));
+    values[prog->n_vars] = (CalcComplex){ 0.0, 1.0 };
+    gboolean ok = eval_rpn_complex(prog->code, prog->count, values, prog->degrees, stack, result, err, err_cap);
+    if (values != local_vars) g_free(values);
+    if (stack != local_stack) g_free(stack);
+    return ok;
+}
+
+gboolean calc_eval_complex(const char *expr, gboolean degrees, CalcComplex *result, char *err, size_t err_cap) {
+    CalcProgram *prog = calc_compile_complex(expr, NULL, 0, degrees, err, err_cap);
+    if (!prog) return FALSE;
+    gboolean ok = calc_program_eval_complex(prog, NULL, result, err, err_cap);
+    calc_program_free(prog);
+    return ok;
+}
+
+static void eval_block(const CalcProgram *prog, const double *const *re, const double *const *im, size_t base,
+                       size_t len, size_t stride, double *stack_re, double *stack_im, guint8 *bad) {
+    char err[64];
+    int top = -1;
+
+    memset(bad, 0, len);
+
+    for (size_t i = 0; i < prog->count; i++) {
+        const Token *t = &prog->code[i];
+
+        if (t->type != TOK_OP) {
+            ++top;
+            double *restrict r = stack_re + (size_t)top * stride;
+            double *restrict m = stack_im + (size_t)top * stride;
+            if (t->type == TOK_NUM || (size_t)t->slot == prog->n_vars) {
+                double vr = t->type == TOK_NUM ? t->value : 0.0, vi = t->type == TOK_NUM ? 0.0 : 1.0;
+                for (size_t j = 0; j < len; j++) r[j] = vr;
+                for (size_t j = 0; j < len; j++) m[j] = vi;
+            } else {
+                memcpy(r, re[t->slot] + base, len * sizeof(double));
+                if (im) memcpy(m, im[t->slot] + base, len * sizeof(double));
+                else memset(m, 0, len * sizeof(double));
+            }
+            continue;
+        }
+
+        int arity = calc_token_arity(t);
+        top -= arity - 1;
+        double *restrict ar = stack_re + (size_t)top * stride;
+        double *restrict ai = stack_im + (size_t)top * stride;
+        const double *restrict br = ar + stride;
+        const double *restrict bi = ai + stride;
+        switch (arity == 2 ? t->op : 0) {
+            case '+':
+                for (size_t j = 0; j < len; j++) ar[j] = ar[j] + br[j];
+                for (size_t j = 0; j < len; j++) ai[j] = ai[j] + bi[j];
+                continue;
+            case '-':
+                for (size_t j = 0; j < len; j++) ar[j] = ar[j] - br[j];
+                for (size_t j = 0; j < len; j++) ai[j] = ai[j] - bi[j];
+                continue;
+            case '*':
+                for (size_t j = 0; j < len; j++) {
+                    CalcComplex p = c_mul((CalcComplex){ ar[j], ai[j] }, (CalcComplex){ br[j], bi[j] });
+                    ar[j] = p.re;
+                    ai[j] = p.im;
+                }
+                continue;
+            case '/':
+                for (size_t j = 0; j < len; j++) bad[j] |= (br[j] == 0.0 && bi[j] == 0.0);
+                for (size_t j = 0; j < len; j++) {
+                    CalcComplex q = c_div((CalcComplex){ ar[j], ai[j] }, (CalcComplex){ br[j], bi[j] });
+                    ar[j] = q.re;
+                    ai[j] = q.im;
+                }
+                continue;
+        }
+
+        // Everything else goes row by row through the scalar operations.
+        CalcComplex args[CALC_FUNC_MAX_ARGS];
+        for (size_t j = 0; j < len; j++) {
+            for (int k = 0; k < arity; k++) args[k] = (CalcComplex){ ar[(size_t)k * stride + j], ai[(size_t)k * stride + j] };
+            bad[j] |= !apply(t, arity, args, prog->degrees, err, sizeof(err));
+            ar[j] = args[0].re;
+            ai[j] = args[0].im;
+        }
+        if (t->op == 'D') i += (size_t)t->slot;
+    }
+}
+
+size_t calc_program_eval_columns_complex(const CalcProgram *prog, const double *const *re,
+                                         const double *const *im, size_t n, double *out_re, double *out_im,
+                                         guint8 *status) {
+    if (!prog->needs_complex && !im) {
+        // Real program, real inputs: the real batch kernels, with 0 or NaN for the imaginary parts.
+        guint8 *st = status ? status : g_new(guint8, (n + 7) / 8);
+        size_t ok = calc_program_eval_columns(prog, re, n, out_re, st);
+        for (size_t j = 0; j < n; j++) out_im[j] = (st[j / 8] >> (j % 8)) & 1 ? 0.0 : NAN;
+        if (st != status) g_free(st);
+        return ok;
+    }
+
+    size_t depth = MAX(prog->max_depth, (size_t)1);
+    size_t stride = CLAMP(COMPLEX_STACK_BUDGET / depth, (size_t)COMPLEX_MIN_BLOCK, (size_t)COMPLEX_BLOCK);
+    double *stack_re = g_new(double, depth * stride);
+    double *stack_im = g_new(double, depth * stride);
+    guint8 bad[COMPLEX_BLOCK];
+    size_t ok = 0;
+
+    if (status) memset(status, 0, (n + 7) / 8);
+
+    for (size_t base = 0; base < n; base += stride) {
+        size_t len = MIN(n - base, stride);
+        eval_block(prog, re, im, base, len, stride, stack_re, stack_im, bad);
+        for (size_t j = 0; j < len; j++) {
+            if (bad[j]) {
+                out_re[base + j] = NAN;
+                out_im[base + j] = NAN;
+            } else {
+                out_re[base + j] = stack_re[j];
+                out_im[base + j] = stack_im[j];
+                if (status) status[(base + j) / 8] |= (guint8)(1u << ((base + j) % 8));
+                ok++;
+            }
+        }
+    }
+
+    g_free(stack_re);
+    g_free(stack_im);
+    return ok;
+}
+
+void calc_format_complex(CalcComplex value, char *out, size_t out_cap) {
+    if (value.im == 0.0) {
+        calc_format_result(value.re, out, out_cap);
+        return;
+    }
+    char im[64] = "";
+    if (fabs(value.im) != 1.0) g_snprintf(im, sizeof(im), "%.12g", fabs(value.im)); // "i", not "1i"
+    if (value.re == 0.0) {
+        g_snprintf(out, out_cap, "%s%si", value.im < 0.0 ? "-" : "", im);
+        return;
+    }
+    char re[64];
+    calc_format_result(value.re, re, sizeof(re));
+    g_snprintf(out, out_cap, "%s%c%si", re, value.im < 0.0 ? '-' : '+', im);
+}
@@ -0,0 +1,486 @@
+// Statistics over numeric datasets. A file is memory-mapped and cut into fixed-size chunks that
+// worker threads parse independently; each chunk yields a partial result (count, compensated sum,
+// shifted sums of squares, min, max) and the partials are combined in chunk order, so the result is
+// the same bits whatever the thread count. The median takes a radix selection on the values' bit
+// patterns: each pass histograms 16 more bits among the values still in the median's bucket,
+// until that bucket is small enough to copy out.
+
+#define _DEFAULT_SOURCE
+
+#include "calc_data.h"
+#include "calc_internal.h"
+#include "calc_parallel.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <math.h>
+#include <string.h>
+
+#ifdef __unix__
+#include <sys/mman.h>
+#endif
+
+// Bytes of the file per parallel chunk. A value belongs to the chunk its first byte is in.
+#define DATA_CHUNK ((size_t)4 << 20)
+
+// Radix selection: key bits per pass, and the bucket size below which the values are copied out
+// and selected in memory.
+#define SELECT_BITS 16
+#define SELECT_BUCKETS ((size_t)1 << SELECT_BITS)
+#define SELECT_GATHER ((guint64)1 << 22)
+
+static const char *const stat_names[CALC_STAT_KINDS] = {
+    [CALC_STAT_SUM] = "sum",
+    [CALC_STAT_MEAN] = "mean",
+    [CALC_STAT_VAR] = "var",
+    [CALC_STAT_STDDEV] = "stddev",
+    [CALC_STAT_MIN] = "min",
+    [CALC_STAT_MAX] = "max",
+    [CALC_STAT_MEDIAN] = "median",
+    [CALC_STAT_COUNT] = "count",
+};
+
+int calc_data_stat_lookup(const char *name, size_t len) {
+    for (int i = 0; i < CALC_STAT_KINDS; i++) {
+        if (strlen(stat_names[i]) == len && memcmp(stat_names[i], name, len) == 0) return i;
+    }
+    return -1;
+}
+
+const char *calc_data_stat_name(int stat) {
+    return stat_names[stat];
+}
+
+typedef struct {
+    const char *path;
+    const char *text;
+    size_t start; // first byte after the header line, if any
+    size_t size;
+} Map;
+
+typedef struct {
+    guint64 count;
+    double sum, comp;        // Neumaier sum and its compensation
+    double shift, s1, s2;    // sums of x - shift and (x - shift)^2, shift = the chunk's first value
+    double min, max;
+    size_t bad;              // offset of the first field that is not a number, or G_MAXSIZE
+} Partial;
+
+typedef enum {
+    PASS_STATS,  // one Partial per chunk
+    PASS_COUNT,  // histogram of the next SELECT_BITS key bits, per worker
+    PASS_GATHER, // copy of the values in the selected bucket, per worker
+} PassKind;
+
+typedef struct {
+    const Map *map;
+    PassKind kind;
+    Partial *partials;
+    guint64 *hist;      // SELECT_BUCKETS per worker
+    GArray **gathered;  // one per worker
+    guint64 prefix;     // selection passes see only values whose key >> match_shift is prefix
+    int match_shift;    // 64: every value
+    int bucket_shift;   // PASS_COUNT: the bucket is (key >> bucket_shift) % SELECT_BUCKETS
+} Pass;
+
+static inline gboolean is_separator(char c) {
+    return c == ',' || c == ';' || calc_char_is(c, CALC_CC_SPACE);
+}
+
+// The number in the field at p, which may be signed. Returns FALSE if the field holds anything else.
+static inline gboolean read_field(const char *p, const char *end, double *x, const char **next) {
+    gboolean negative = (*p == '-');
+    const char *q = p + (*p == '-' || *p == '+');
+    const char *stop;
+    double v = calc_read_number(q, end, &stop);
+    if (stop == q || (stop < end && !is_separator(*stop))) return FALSE;
+    *x = negative ? -v : v;
+    *next = stop;
+    return TRUE;
+}
+
+// Orders like the doubles themselves when compared as unsigned integers.
+static inline guint64 sort_key(double x) {
+    guint64 bits;
+    memcpy(&bits, &x, sizeof(bits));
+    return (bits >> 63) ? ~bits : bits | ((guint64)1 << 63);
+}
+
+static double from_key(guint64 key) {
+    guint64 bits = (key >> 63) ? key & ~((guint64)1 << 63) : ~key;
+    double x;
+    memcpy(&x, &bits, sizeof(x));
+    return x;
+}
+
+static inline void neumaier_add(double *sum, double *comp, double x) {
+    double t = *sum + x;
+    *comp += (fabs(*sum) >= fabs(x)) ? (*sum - t) + x : (x - t) + *sum;
+    *sum = t;
+}
+
+static inline gboolean selected(const Pass *pass, guint64 key) {
+    return pass->match_shift == 64 || (key >> pass->match_shift) == pass->prefix;
+}
+
+// Parses chunk c and feeds its values to the pass. Parsing stops at a field that is not a number.
+static void scan_chunk(Pass *pass, guint worker, size_t c) {
+    const Map *m = pass->map;
+    const char *text = m->text;
+    const char *end = text + m->size;
+    const char *p = text + m->start + c * DATA_CHUNK;
+    const char *chunk_end = MIN(p + DATA_CHUNK, end);
+    // A field that started in the previous chunk is that chunk's.
+    if (c > 0 && !is_separator(p[-1])) {
+        while (p < chunk_end && !is_separator(*p)) p++;
+    }
+
+    Partial part = { .min = INFINITY, .max = -INFINITY, .bad = G_MAXSIZE };
+    guint64 *hist = pass->hist ? pass->hist + (size_t)worker * SELECT_BUCKETS : NULL;
+    GArray *gathered = pass->gathered ? pass->gathered[worker] : NULL;
+    for (;;) {
+        while (p < chunk_end && is_separator(*p)) p++;
+        if (p >= chunk_end) break;
+        double x;
+        if (!read_field(p, end, &x, &p)) {
+            part.bad = (size_t)(p - text);
+            break;
+        }
+        switch (pass->kind) {
+            case PASS_STATS: {
+                if (part.count++ == 0) part.shift = x;
+                neumaier_add(&part.sum, &part.comp, x);
+                double d = x - part.shift;
+                part.s1 += d;
+                part.s2 += d * d;
+                part.min = MIN(part.min, x);
+                part.max = MAX(part.max, x);
+                break;
+            }
+            case PASS_COUNT: {
+                guint64 key = sort_key(x);
+                if (selected(pass, key)) hist[(key >> pass->bucket_shift) & (SELECT_BUCKETS - 1)]++;
+                break;
+            }
+            case PASS_GATHER:
+                if (selected(pass, sort_key(x))) g_array_append_val(gathered, x);
+                break;
+        }
+    }
+    if (pass->kind == PASS_STATS) pass->partials[c] = part;
+}
+
+static void scan_range(gpointer data, guint worker, size_t begin, size_t end) {
+    Pass *pass = data;
+    for (size_t c = begin; c < end; c++) scan_chunk(pass, worker, c);
+}
+
+static size_t chunk_count(const Map *m) {
+    return (m->size - m->start + DATA_CHUNK - 1) / DATA_CHUNK;
+}
+
+static void run_pass(Pass *pass, guint n_threads) {
+    calc_parallel_for(chunk_count(pass->map), 1, n_threads, scan_range, pass);
+}
+
+static void report_bad(const Map *m, size_t offset, char *err, size_t err_cap) {
+    guint64 line = 1;
+    for (const char *p = m->text; (p = memchr(p, '\n', (size_t)(m->text + offset - p))); p++) line++;
+    size_t len = 0;
+    while (offset + len < m->size && len < 20 && !is_separator(m->text[offset + len])) len++;
+    g_snprintf(err, err_cap, "%s:%" G_GUINT64_FORMAT ": not a number: %.*s", m->path, line, (int)len,
+               m->text + offset);
+}
+
+static gboolean compute_stats(const Map *m, guint n_threads, CalcDataStats *st, char *err, size_t err_cap) {
+    size_t n_chunks = chunk_count(m);
+    Pass pass = { .map = m, .kind = PASS_STATS, .partials = g_new(Partial, n_chunks) };
+    run_pass(&pass, n_threads);
+
+    // Chunk by chunk, in file order: the compensated sum, and Chan et al.'s pairwise update
+    // for the mean and sum of squared deviations.
+    guint64 n = 0;
+    double sum = 0.0, comp = 0.0, mean = 0.0, m2 = 0.0;
+    double lo = INFINITY, hi = -INFINITY;
+    gboolean ok = TRUE;
+    for (size_t c = 0; c < n_chunks && ok; c++) {
+        const Partial *p = &pass.partials[c];
+        if (p->bad != G_MAXSIZE) {
+            report_bad(m, p->bad, err, err_cap);
+            ok = FALSE;
+        }
+        if (p->count == 0) continue;
+        neumaier_add(&sum, &comp, p->sum);
+        comp += p->comp;
+        double cn = (double)p->count;
+        double cmean = p->shift + p->s1 / cn;
+        double cm2 = MAX(p->s2 - p->s1 * p->s1 / cn, 0.0);
+        double total = (double)(n + p->count);
+        double delta = cmean - mean;
+        mean += delta * cn / total;
+        m2 += cm2 + delta * delta * (double)n * cn / total;
+        n += p->count;
+        lo = MIN(lo, p->min);
+        hi = MAX(hi, p->max);
+    }
+    g_free(pass.partials);
+    if (!ok) return FALSE;
+    if (n == 0) {
+        g_snprintf(err, err_cap, "no numbers in %s", m->path);
+        return FALSE;
+    }
+    st->count = n;
+    st->sum = sum + comp;
+    st->mean = st->sum / (double)n;
+    st->var = (n > 1) ? m2 / (double)(n - 1) : NAN;
+    st->stddev = sqrt(st->var);
+    st->min = lo;
+    st->max = hi;
+    return TRUE;
+}
+
+// Moves the k-th smallest of the n values to v[k], with none larger before it and none smaller
+// after it (Hoare's selection).
+static void select_nth(double *v, size_t n, size_t k) {
+    size_t lo = 0, hi = n - 1;
+    while (lo < hi) {
+        double a = v[lo], b = v[lo + (hi - lo) / 2], c = v[hi];
+        double pivot = MAX(MIN(a, b), MIN(MAX(a, b), c));
+        size_t i = lo, j = hi;
+        for (;;) {
+            while (v[i] < pivot) i++;
+            while (v[j] > pivot) j--;
+            if (i >= j) break;
+            double t = v[i];
+            v[i++] = v[j];
+            v[j--] = t;
+        }
+        if (k <= j) hi = j;
+        else lo = j + 1;
+    }
+}
+
+// The rank-th smallest value (from 0) of the n in the file, and with want == 2 the one after it.
+static void select_rank(const Map *m, guint n_threads, guint64 n, guint64 rank, int want, double *out) {
+    guint n_workers = calc_parallel_workers(n_threads);
+    Pass pass = { .map = m, .prefix = 0, .match_shift = 64 };
+    guint64 *hist = g_new(guint64, SELECT_BUCKETS * n_workers);
+    guint64 first = rank;
+    while (n > SELECT_GATHER && pass.match_shift > 0) {
+        pass.kind = PASS_COUNT;
+        pass.hist = hist;
+        pass.bucket_shift = pass.match_shift - SELECT_BITS;
+        memset(hist, 0, SELECT_BUCKETS * n_workers * sizeof(guint64));
+        run_pass(&pass, n_threads);
+        for (guint w = 1; w < n_workers; w++) {
+            for (size_t b = 0; b < SELECT_BUCKETS; b++) hist[b] += hist[(size_t)w * SELECT_BUCKETS + b];
+        }
+        size_t b = 0;
+        while (b < SELECT_BUCKETS - 1 && rank >= hist[b]) rank -= hist[b++];
+        // The next value is in a later bucket: look for it on its own.
+        if (want == 2 && rank + 1 == hist[b]) {
+            select_rank(m, n_threads, n, first + 1, 1, out + 1);
+            want = 1;
+        }
+        pass.prefix = (pass.prefix << SELECT_BITS) | b;
+        pass.match_shift = pass.bucket_shift;
+        n = hist[b];
+    }
+    g_free(hist);
+    pass.hist = NULL;
+
+    if (pass.match_shift == 0) { // every value left has the same bits
+        out[0] = from_key(pass.prefix);
+        if (want == 2) out[1] = out[0];
+    } else {
+        pass.kind = PASS_GATHER;
+        pass.gathered = g_new(GArray *, n_workers);
+        for (guint w = 0; w < n_workers; w++) pass.gathered[w] = g_array_new(FALSE, FALSE, sizeof(double));
+        run_pass(&pass, n_threads);
+        GArray *values = pass.gathered[0];
+        for (guint w = 1; w < n_workers; w++) {
+            g_array_append_vals(values, pass.gathered[w]->data, pass.gathered[w]->len);
+            g_array_free(pass.gathered[w], TRUE);
+        }
+        double *v = (double *)(void *)values->data;
+        if (rank >= values->len) { // the file changed under us
+            values = g_array_set_size(values, (guint)rank + 1);
+            v = (double *)(void *)values->data;
+            v[rank] = NAN;
+        }
+        select_nth(v, values->len, (size_t)rank);
+        out[0] = v[rank];
+        if (want == 2) {
+            double next = INFINITY;
+            for (size_t i = (size_t)rank + 1; i < values->len; i++) next = MIN(next, v[i]);
+            out[1] = next;
+        }
+        g_array_free(values, TRUE);
+        g_free(pass.gathered);
+    }
+}
+
+static double compute_median(const Map *m, guint n_threads, guint64 count) {
+    double mid[2];
+    select_rank(m, n_threads, count, (count - 1) / 2, (count % 2) ? 1 : 2, mid);
+    return (count % 2) ? mid[0] : mid[0] + (mid[1] - mid[0]) / 2.0;
+}
+
+// A file by path, with what was last computed from it.
+typedef struct {
+    char *path;
+    GMutex lock;
+    gboolean valid; // the fields below describe the file with this identity, size and mtime
+    guint64 dev, ino;
+    goffset size;
+    gint64 mtime_ns;
+    char *error;
+    CalcDataStats stats;
+    gboolean has_median;
+    double median;
+} Dataset;
+
+static GMutex registry_lock;
+static GPtrArray *datasets;
+static GHashTable *by_path;
+
+int calc_data_register(const char *path, size_t len) {
+    char *key = g_strndup(path, len);
+    g_mutex_lock(&registry_lock);
+    if (!datasets) {
+        datasets = g_ptr_array_new();
+        by_path = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+    gpointer found;
+    int index;
+    if (g_hash_table_lookup_extended(by_path, key, NULL, &found)) {
+        index = GPOINTER_TO_INT(found);
+        g_free(key);
+    } else {
+        Dataset *d = g_new0(Dataset, 1);
+        d->path = key;
+        g_mutex_init(&d->lock);
+        index = (int)datasets->len;
+        g_ptr_array_add(datasets, d);
+        g_hash_table_insert(by_path, key, GINT_TO_POINTER(index));
+    }
+    g_mutex_unlock(&registry_lock);
+    return index;
+}
+
+static Dataset *dataset_get(int index) {
+    g_mutex_lock(&registry_lock);
+    Dataset *d = g_ptr_array_index(datasets, index);
+    g_mutex_unlock(&registry_lock);
+    return d;
+}
+
+static GMappedFile *map_file(Dataset *d, Map *m, char *err, size_t err_cap) {
+    GError *error = NULL;
+    GMappedFile *file = g_mapped_file_new(d->path, FALSE, &error);
+    if (!file) {
+        g_snprintf(err, err_cap, "cannot read %s: %s", d->path, error->message);
+        g_error_free(error);
+        return NULL;
+    }
+    *m = (Map){ .path = d->path, .text = g_mapped_file_get_contents(file), .size = g_mapped_file_get_length(file) };
+    if (m->size == 0) return file;
+#ifdef __unix__
+    madvise((void *)m->text, m->size, MADV_SEQUENTIAL);
+#endif
+    // A first line that does not start with a number is a header.
+    const char *p = m->text, *end = m->text + m->size;
+    while (p < end && is_separator(*p) && *p != '\n') p++;
+    double x;
+    const char *next;
+    if (p < end && *p != '\n' && !read_field(p, end, &x, &next)) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        m->start = nl ? (size_t)(nl + 1 - m->text) : m->size;
+    }
+    return file;
+}
+
+// Modification time in nanoseconds, or whole seconds where the platform keeps no more.
+static gint64 mtime_ns(const GStatBuf *st) {
+#ifdef __unix__
+    return (gint64)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#else
+    return (gint64)st->st_mtime * 1000000000;
+#endif
+}
+
+// Brings d up to date with its file, with the median if need_median. Called with d->lock held.
+static gboolean refresh(Dataset *d, guint n_threads, gboolean need_median, char *err, size_t err_cap) {
+    GStatBuf st;
+    if (g_stat(d->path, &st) != 0) {
+        g_snprintf(err, err_cap, "cannot read %s: %s", d->path, g_strerror(errno));
+        return FALSE;
+    }
+    // A file replaced by another (a new inode) or rewritten within the same second is a change.
+    if (!d->valid || d->dev != (guint64)st.st_dev || d->ino != (guint64)st.st_ino ||
+        d->size != (goffset)st.st_size || d->mtime_ns != mtime_ns(&st)) {
+        g_clear_pointer(&d->error, g_free);
+        d->has_median = FALSE;
+        d->valid = TRUE;
+        d->dev = (guint64)st.st_dev;
+        d->ino = (guint64)st.st_ino;
+        d->size = (goffset)st.st_size;
+        d->mtime_ns = mtime_ns(&st);
+        Map m;
+        GMappedFile *file = map_file(d, &m, err, err_cap);
+        if (!file || !compute_stats(&m, n_threads, &d->stats, err, err_cap)) d->error = g_strdup(err);
+        if (file) g_mapped_file_unref(file);
+    }
+    if (d->error) {
+        g_snprintf(err, err_cap, "%s", d->error);
+        return FALSE;
+    }
+    if (need_median && !d->has_median) {
+        Map m;
+        GMappedFile *file = map_file(d, &m, err, err_cap);
+        if (!file) return FALSE;
+        d->median = compute_median(&m, n_threads, d->stats.count);
+        d->has_median = TRUE;
+        g_mapped_file_unref(file);
+    }
+    return TRUE;
+}
+
+gboolean calc_data_value(int dataset, int stat, guint n_threads, double *out, char *err, size_t err_cap) {
+    Dataset *d = dataset_get(dataset);
+    g_mutex_lock(&d->lock);
+    gboolean ok = refresh(d, n_threads, stat == CALC_STAT_MEDIAN, err, err_cap);
+    if (ok) {
+        const CalcDataStats *s = &d->stats;
+        switch (stat) {
+            case CALC_STAT_SUM: *out = s->sum; break;
+            case CALC_STAT_MEAN: *out = s->mean; break;
+            case CALC_STAT_VAR: *out = s->var; break;
+            case CALC_STAT_STDDEV: *out = s->stddev; break;
+            case CALC_STAT_MIN: *out = s->min; break;
+            case CALC_STAT_MAX: *out = s->max; break;
+            case CALC_STAT_MEDIAN: *out = d->median; break;
+            default: *out = (double)s->count; break;
+        }
+        if (isnan(*out)) {
+            g_snprintf(err, err_cap, "%s needs at least 2 values", stat_names[stat]);
+            ok = FALSE;
+        }
+    }
+    g_mutex_unlock(&d->lock);
+    return ok;
+}
+
+gboolean calc_data_stats(const char *path, guint n_threads, CalcDataStats *stats, char *err, size_t err_cap) {
+    Dataset *d = dataset_get(calc_data_register(path, strlen(path)));
+    g_mutex_lock(&d->lock);
+    gboolean ok = refresh(d, n_threads, FALSE, err, err_cap);
+    if (ok) *stats = d->stats;
+    g_mutex_unlock(&d->lock);
+    return ok;
+}
+
+gboolean calc_data_median(const char *path, guint n_threads, double *median, char *err, size_t err_cap) {
+    return calc_data_value(calc_data_register(path, strlen(path)), CALC_STAT_MEDIAN, n_threads, median, err,
+                           err_cap);
+}
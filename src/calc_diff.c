@@ -0,0 +1,286 @@
+#include "calc_eval.h"
+#include "calc_internal.h"
+
+#include <math.h>
+
+// Forward-mode automatic differentiation. Each stack entry is a dual number: a value and its
+// derivative with respect to one variable. Every operator computes its value exactly as
+// eval_rpn() does and applies its differentiation rule next to it, so one pass over the code
+// yields f(x) and f'(x) with no second evaluation and no step size to choose.
+
+typedef struct {
+    double v; // value
+    double d; // derivative
+} Dual;
+
+// f'(a) * da, taking a constant operand (da == 0) as having slope 0 even where f' is infinite.
+static double chain(double slope, double da) {
+    return da == 0.0 ? 0.0 : slope * da;
+}
+
+// TRUE if the block reads variable slot, i.e. depends on the variable being differentiated.
+static gboolean reads_slot(const Token *code, size_t count, int slot) {
+    for (size_t i = 0; i < count; i++) {
+        if (code[i].type == TOK_VAR && code[i].slot == slot) return TRUE;
+    }
+    return FALSE;
+}
+
+static gboolean diff_func(const Token *t, Dual *a, gboolean degrees, char *err, size_t err_cap) {
+    const CalcFunc *fn = calc_func_get(t->slot);
+    double args[CALC_FUNC_MAX_ARGS];
+    gboolean constant = TRUE;
+    for (int k = 0; k < fn->arity; k++) {
+        args[k] = a[k].v;
+        constant &= a[k].d == 0.0;
+    }
+    double r;
+    if (!fn->fn(args, &r, fn->user_data)) { g_snprintf(err, err_cap, "%s domain error", fn->name); return FALSE; }
+
+    double x = a[0].v, dx = a[0].d, d = 0.0;
+    if (constant) {
+        d = 0.0;
+    } else if (t->slot >= CALC_FN_BUILTIN_COUNT) {
+        g_snprintf(err, err_cap, "%s has no derivative", fn->name);
+        return FALSE;
+    } else {
+        switch ((CalcBuiltin)t->slot) {
+            case CALC_FN_ASIN:  d = chain(1.0 / sqrt(1.0 - x * x), dx); break;
+            case CALC_FN_ACOS:  d = chain(-1.0 / sqrt(1.0 - x * x), dx); break;
+            case CALC_FN_ATAN:  d = chain(1.0 / (1.0 + x * x), dx); break;
+            case CALC_FN_SINH:  d = chain(cosh(x), dx); break;
+            case CALC_FN_COSH:  d = chain(sinh(x), dx); break;
+            case CALC_FN_TANH:  d = chain(1.0 - r * r, dx); break;
+            case CALC_FN_ASINH: d = chain(1.0 / sqrt(x * x + 1.0), dx); break;
+            case CALC_FN_ACOSH: d = chain(1.0 / sqrt(x * x - 1.0), dx); break;
+            case CALC_FN_ATANH: d = chain(1.0 / (1.0 - x * x), dx); break;
+            case CALC_FN_ATAN2: { // atan2(y, x)
+                double y = a[0].v, xx = a[1].v, n = y * y + xx * xx;
+                d = chain(xx / n, a[0].d) + chain(-y / n, a[1].d);
+                break;
+            }
+            case CALC_FN_HYPOT:
+                d = r == 0.0 ? 0.0 : chain(a[0].v / r, a[0].d) + chain(a[1].v / r, a[1].d);
+                break;
+            case CALC_FN_MIN: d = (a[1].v < a[0].v) ? a[1].d : a[0].d; break;
+            case CALC_FN_MAX: d = (a[1].v > a[0].v) ? a[1].d : a[0].d; break;
+            case CALC_FN_CBRT: d = chain(1.0 / (3.0 * r * r), dx); break;
+            case CALC_FN_FLOOR:
+            case CALC_FN_CEIL:
+            case CALC_FN_ROUND: d = 0.0; break;
+            case CALC_FN_DET:
+            case CALC_FN_TRANSPOSE: d = dx; break;
+            case CALC_FN_INV: d = chain(-r * r, dx); break;
+            case CALC_FN_SOLVE: d = (a[1].d - chain(r, a[0].d)) / a[0].v; break; // b / a
+            case CALC_FN_DOT: d = chain(a[1].v, a[0].d) + chain(a[0].v, a[1].d); break;
+            default:
+                g_snprintf(err, err_cap, "%s has no derivative", fn->name);
+                return FALSE;
+        }
+    }
+    if (degrees && (fn->flags & CALC_FUNC_ANGLE_RESULT)) {
+        r *= 180.0 / G_PI;
+        d *= 180.0 / G_PI;
+    }
+    a[0] = (Dual){ r, d };
+    return TRUE;
+}
+
+static gboolean diff_unary(char op, Dual *a, gboolean degrees, char *err, size_t err_cap) {
+    // In degree mode trig reads k*a radians, so every trig slope picks up a factor k.
+    const double k = degrees ? (G_PI / 180.0) : 1.0;
+    const double x = a->v, dx = a->d;
+    switch (op) {
+        case 'u': *a = (Dual){ -x, -dx }; break;
+        case 'S': *a = (Dual){ sin(k * x), chain(k * cos(k * x), dx) }; break;
+        case 'C': *a = (Dual){ cos(k * x), chain(-k * sin(k * x), dx) }; break;
+        case 'T': {
+            double t = tan(k * x);
+            *a = (Dual){ t, chain(k * (1.0 + t * t), dx) };
+            break;
+        }
+        case 'Q': {
+            if (x < 0.0) { g_snprintf(err, err_cap, "sqrt domain error"); return FALSE; }
+            double r = sqrt(x);
+            *a = (Dual){ r, chain(0.5 / r, dx) };
+            break;
+        }
+        case 'L':
+            if (x <= 0.0) { g_snprintf(err, err_cap, "log domain error"); return FALSE; }
+            *a = (Dual){ log10(x), chain(1.0 / (x * G_LN10), dx) };
+            break;
+        case 'N':
+            if (x <= 0.0) { g_snprintf(err, err_cap, "ln domain error"); return FALSE; }
+            *a = (Dual){ log(x), chain(1.0 / x, dx) };
+            break;
+        case 'G':
+            if (x <= 0.0) { g_snprintf(err, err_cap, "log2 domain error"); return FALSE; }
+            *a = (Dual){ log2(x), chain(1.0 / (x * G_LN2), dx) };
+            break;
+        case 'A': *a = (Dual){ fabs(x), chain((double)((x > 0.0) - (x < 0.0)), dx) }; break;
+        case 'E': {
+            double r = exp(x);
+            *a = (Dual){ r, chain(r, dx) };
+            break;
+        }
+        case 'I': { // csc' = -csc cot
+            double s = sin(k * x);
+            if (s == 0.0) { g_snprintf(err, err_cap, "csc domain error"); return FALSE; }
+            *a = (Dual){ 1.0 / s, chain(-k * cos(k * x) / (s * s), dx) };
+            break;
+        }
+        case 'J': { // sec' = sec tan
+            double c = cos(k * x);
+            if (c == 0.0) { g_snprintf(err, err_cap, "sec domain error"); return FALSE; }
+            *a = (Dual){ 1.0 / c, chain(k * sin(k * x) / (c * c), dx) };
+            break;
+        }
+        case 'K': { // cot' = -(1 + cot^2)
+            double t = tan(k * x);
+            if (t == 0.0) { g_snprintf(err, err_cap, "cot domain error"); return FALSE; }
+            double r = 1.0 / t;
+            *a = (Dual){ r, chain(-k * (1.0 + r * r), dx) };
+            break;
+        }
+        case '!':
+            if (dx != 0.0) { g_snprintf(err, err_cap, "factorial has no derivative"); return FALSE; }
+            if (!calc_factorial(x, &a->v, err, err_cap)) return FALSE;
+            break;
+        default:
+            g_snprintf(err, err_cap, "unknown operator");
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean diff_binary(char op, Dual *a, const Dual *b, char *err, size_t err_cap) {
+    switch (op) {
+        case '+': *a = (Dual){ a->v + b->v, a->d + b->d }; break;
+        case '-': *a = (Dual){ a->v - b->v, a->d - b->d }; break;
+        case '*': *a = (Dual){ a->v * b->v, chain(b->v, a->d) + chain(a->v, b->d) }; break;
+        case '/': {
+            if (b->v == 0.0) { g_snprintf(err, err_cap, "division by zero"); return FALSE; }
+            double r = a->v / b->v;
+            *a = (Dual){ r, (a->d - chain(r, b->d)) / b->v };
+            break;
+        }
+        case '%': { // fmod(a, b) = a - trunc(a/b)*b
+            if (b->v == 0.0) { g_snprintf(err, err_cap, "division by zero"); return FALSE; }
+            *a = (Dual){ fmod(a->v, b->v), a->d - chain(trunc(a->v / b->v), b->d) };
+            break;
+        }
+        case '^':
+        case 'P': {
+            // d(a^b) = b a^(b-1) da + a^b ln(a) db; the ln term only exists for a variable exponent,
+            // so x^2 stays differentiable at negative x.
+            double r = pow(a->v, b->v);
+            double d = chain(b->v * pow(a->v, b->v - 1.0), a->d);
+            if (b->d != 0.0) d += chain(r * log(a->v), b->d);
+            *a = (Dual){ r, d };
+            break;
+        }
+        default:
+            g_snprintf(err, err_cap, "unknown operator");
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean diff_rpn(const Token *code, size_t count, const double *vars, int slot, double at, gboolean degrees,
+                         Dual *stack, Dual *out, char *err, size_t err_cap) {
+    int top = -1;
+    for (size_t i = 0; i < count; i++) {
+        const Token *t = &code[i];
+        if (t->type == TOK_NUM) { stack[++top] = (Dual){ t->value, 0.0 }; continue; }
+        if (t->type == TOK_VAR) {
+            stack[++top] = (t->slot == slot) ? (Dual){ at, 1.0 } : (Dual){ vars[t->slot], 0.0 };
+            continue;
+        }
+
+        int arity = calc_token_arity(t);
+        if (top + 1 < arity) { g_snprintf(err, err_cap, "invalid expression"); return FALSE; }
+        top -= arity - 1;
+        Dual *a = &stack[top];
+
+        if (t->op == 'M') {
+            g_snprintf(err, err_cap, "diff is not available for matrices");
+            return FALSE;
+        }
+        if (t->op == 'R') { // a dataset statistic is a constant
+            if (!calc_data_value(t->slot, (int)t->value, 0, &a->v, err, err_cap)) return FALSE;
+            a->d = 0.0;
+            continue;
+        }
+        if (t->op == 'D') {
+            // A derivative inside the code is a plain value unless it moves with our variable,
+            // which would take a second derivative.
+            size_t len = (size_t)t->slot;
+            if (a->d != 0.0 || reads_slot(code + i + 1, len, slot)) {
+                g_snprintf(err, err_cap, "nested diff() depends on its variable");
+                return FALSE;
+            }
+            double value;
+            if (!calc_diff_rpn(code + i + 1, len, vars, (int)t->value, a->v, degrees, &value, &a->v, err, err_cap)) {
+                return FALSE;
+            }
+            a->d = 0.0;
+            i += len;
+            continue;
+        }
+        if (t->op == 'F') {
+            if (!diff_func(t, a, degrees, err, err_cap)) return FALSE;
+            continue;
+        }
+        if (t->op == 'w') {
+            int n = (int)t->value;
+            double slope = (n == 1) ? 1.0 : n * calc_powi(a->v, n - 1);
+            *a = (Dual){ calc_powi(a->v, n), chain(slope, a->d) };
+            continue;
+        }
+        if (arity == 1) {
+            if (!diff_unary(t->op, a, degrees, err, err_cap)) return FALSE;
+            continue;
+        }
+        if (!diff_binary(t->op, a, a + 1, err, err_cap)) return FALSE;
+    }
+
+    if (top != 0) { g_snprintf(err, err_cap, "invalid expression"); return FALSE; }
+    *out = stack[0];
+    return TRUE;
+}
+
+gboolean calc_diff_rpn(const Token *code, size_t count, const double *vars, int slot, double at, gboolean degrees,
+                       double *value, double *derivative, char *err, size_t err_cap) {
+    Dual local[64];
+    Dual *stack = (count <= G_N_ELEMENTS(local)) ? local : g_new(Dual, count);
+    Dual out;
+    gboolean ok = diff_rpn(code, count, vars, slot, at, degrees, stack, &out, err, err_cap);
+    if (stack != local) g_free(stack);
+    if (!ok) return FALSE;
+    *value = out.v;
+    *derivative = out.d;
+    return TRUE;
+}
+
+gboolean calc_program_eval_diff(const CalcProgram *prog, const double *vars, size_t slot, double *result,
+                                double *derivative, char *err, size_t err_cap) {
+    if (slot >= prog->n_vars) {
+        g_snprintf(err, err_cap, "no variable slot %zu", slot);
+        return FALSE;
+    }
+    if (prog->needs_complex) {
+        g_snprintf(err, err_cap, "diff is not available for complex expressions");
+        return FALSE;
+    }
+    return calc_diff_rpn(prog->code, prog->count, vars, (int)slot, vars[slot], prog->degrees, result, derivative,
+                         err, err_cap);
+}
+
+gboolean calc_diff(const char *expr, const char *var, double at, gboolean degrees, double *result,
+                   double *derivative, char *err, size_t err_cap) {
+    CalcProgram *prog = calc_compile(expr, &var, 1, degrees, err, err_cap);
+    if (!prog) return FALSE;
+    gboolean ok = calc_program_eval_diff(prog, &at, 0, result, derivative, err, err_cap);
+    calc_program_free(prog);
+    return ok;
+}
@@ -1,28 +1,23 @@
 #include "calc_eval.h"
+#include "calc_internal.h"
 
 #include <math.h>
-#include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
 
-typedef enum {
-    TOK_NUM,
-    TOK_OP
-} TokenType;
-
-typedef struct {
-    TokenType type;
-    double value;
-    char op;
-} Token;
-
-static gboolean is_func_op(char op) {
+gboolean calc_op_is_func(char op) {
     return (op == 'S' || op == 'C' || op == 'T' || op == 'Q' ||
             op == 'L' || op == 'N' || op == 'G' || op == 'A' ||
-            op == 'E' || op == 'P' || op == 'I' || op == 'J' || op == 'K');
+            op == 'E' || op == 'P' || op == 'I' || op == 'J' || op == 'K' ||
+            op == 'F');
 }
 
-static int op_precedence(char op) {
+int calc_op_arity(char op) {
+    if (op == 'R') return 0;
+    return (op == 'u' || op == '!' || op == 'w' || op == 'D' || (calc_op_is_func(op) && op != 'P')) ? 1 : 2;
+}
+
+int calc_op_precedence(char op) {
     switch (op) {
         case '!': return 5;
         case 'S':
@@ -37,7 +32,8 @@ static int op_precedence(char op) {
         case 'P':
         case 'I':
         case 'J':
-        case 'K': return 5; // functions
+        case 'K':
+        case 'F': return 5; // functions
         case '^': return 4;
         case 'u': return 3; // unary minus
         case '*':
@@ -49,245 +45,378 @@ static int op_precedence(char op) {
     }
 }
 
-static gboolean op_right_assoc(char op) {
+gboolean calc_op_right_assoc(char op) {
     return (op == '^' || op == 'u');
 }
 
-static gboolean is_operator_char(char c) {
-    return (c == '+' || c == '-' || c == '*' || c == '/' || c == '^' || c == '%' || c == '!');
-}
-
 static double to_radians(double v, gboolean degrees) {
     return degrees ? (v * (G_PI / 180.0)) : v;
 }
 
-static int normalize_degrees(int deg) {
-    int d = deg % 360;
-    if (d < 0) d += 360;
-    return d;
-}
-
-static gboolean special_trig_func(const char *func, int deg, char *out, size_t out_cap, double *out_val,
-                                  char *err, size_t err_cap) {
-    int d = normalize_degrees(deg);
-
-    if (strcmp(func, "sin") == 0) {
-        switch (d) {
-            case 0:   *out_val = 0.0; g_snprintf(out, out_cap, "0"); return TRUE;
-            case 30:  *out_val = 0.5; g_snprintf(out, out_cap, "1/2"); return TRUE;
-            case 45:  *out_val = sqrt(2.0)/2.0; g_snprintf(out, out_cap, "sqrt(2)/2"); return TRUE;
-            case 60:  *out_val = sqrt(3.0)/2.0; g_snprintf(out, out_cap, "sqrt(3)/2"); return TRUE;
-            case 90:  *out_val = 1.0; g_snprintf(out, out_cap, "1"); return TRUE;
-            case 120: *out_val = sqrt(3.0)/2.0; g_snprintf(out, out_cap, "sqrt(3)/2"); return TRUE;
-            case 135: *out_val = sqrt(2.0)/2.0; g_snprintf(out, out_cap, "sqrt(2)/2"); return TRUE;
-            case 150: *out_val = 0.5; g_snprintf(out, out_cap, "1/2"); return TRUE;
-            case 180: *out_val = 0.0; g_snprintf(out, out_cap, "0"); return TRUE;
-            case 210: *out_val = -0.5; g_snprintf(out, out_cap, "-1/2"); return TRUE;
-            case 225: *out_val = -sqrt(2.0)/2.0; g_snprintf(out, out_cap, "-sqrt(2)/2"); return TRUE;
-            case 240: *out_val = -sqrt(3.0)/2.0; g_snprintf(out, out_cap, "-sqrt(3)/2"); return TRUE;
-            case 270: *out_val = -1.0; g_snprintf(out, out_cap, "-1"); return TRUE;
-            case 300: *out_val = -sqrt(3.0)/2.0; g_snprintf(out, out_cap, "-sqrt(3)/2"); return TRUE;
-            case 315: *out_val = -sqrt(2.0)/2.0; g_snprintf(out, out_cap, "-sqrt(2)/2"); return TRUE;
-            case 330: *out_val = -0.5; g_snprintf(out, out_cap, "-1/2"); return TRUE;
-        }
-    } else if (strcmp(func, "cos") == 0) {
-        switch (d) {
-            case 0:   *out_val = 1.0; g_snprintf(out, out_cap, "1"); return TRUE;
-            case 30:  *out_val = sqrt(3.0)/2.0; g_snprintf(out, out_cap, "sqrt(3)/2"); return TRUE;
-            case 45:  *out_val = sqrt(2.0)/2.0; g_snprintf(out, out_cap, "sqrt(2)/2"); return TRUE;
-            case 60:  *out_val = 0.5; g_snprintf(out, out_cap, "1/2"); return TRUE;
-            case 90:  *out_val = 0.0; g_snprintf(out, out_cap, "0"); return TRUE;
-            case 120: *out_val = -0.5; g_snprintf(out, out_cap, "-1/2"); return TRUE;
-            case 135: *out_val = -sqrt(2.0)/2.0; g_snprintf(out, out_cap, "-sqrt(2)/2"); return TRUE;
-            case 150: *out_val = -sqrt(3.0)/2.0; g_snprintf(out, out_cap, "-sqrt(3)/2"); return TRUE;
-            case 180: *out_val = -1.0; g_snprintf(out, out_cap, "-1"); return TRUE;
-            case 210: *out_val = -sqrt(3.0)/2.0; g_snprintf(out, out_cap, "-sqrt(3)/2"); return TRUE;
-            case 225: *out_val = -sqrt(2.0)/2.0; g_snprintf(out, out_cap, "-sqrt(2)/2"); return TRUE;
-            case 240: *out_val = -0.5; g_snprintf(out, out_cap, "-1/2"); return TRUE;
-            case 270: *out_val = 0.0; g_snprintf(out, out_cap, "0"); return TRUE;
-            case 300: *out_val = 0.5; g_snprintf(out, out_cap, "1/2"); return TRUE;
-            case 315: *out_val = sqrt(2.0)/2.0; g_snprintf(out, out_cap, "sqrt(2)/2"); return TRUE;
-            case 330: *out_val = sqrt(3.0)/2.0; g_snprintf(out, out_cap, "sqrt(3)/2"); return TRUE;
-        }
-    } else if (strcmp(func, "tan") == 0) {
-        switch (d) {
-            case 0:   *out_val = 0.0; g_snprintf(out, out_cap, "0"); return TRUE;
-            case 30:  *out_val = sqrt(3.0)/3.0; g_snprintf(out, out_cap, "sqrt(3)/3"); return TRUE;
-            case 45:  *out_val = 1.0; g_snprintf(out, out_cap, "1"); return TRUE;
-            case 60:  *out_val = sqrt(3.0); g_snprintf(out, out_cap, "sqrt(3)"); return TRUE;
-            case 90:
-            case 270:
-                g_snprintf(err, err_cap, "tan undefined");
-                return FALSE;
-            case 120: *out_val = -sqrt(3.0); g_snprintf(out, out_cap, "-sqrt(3)"); return TRUE;
-            case 135: *out_val = -1.0; g_snprintf(out, out_cap, "-1"); return TRUE;
-            case 150: *out_val = -sqrt(3.0)/3.0; g_snprintf(out, out_cap, "-sqrt(3)/3"); return TRUE;
-            case 180: *out_val = 0.0; g_snprintf(out, out_cap, "0"); return TRUE;
-            case 210: *out_val = sqrt(3.0)/3.0; g_snprintf(out, out_cap, "sqrt(3)/3"); return TRUE;
-            case 225: *out_val = 1.0; g_snprintf(out, out_cap, "1"); return TRUE;
-            case 240: *out_val = sqrt(3.0); g_snprintf(out, out_cap, "sqrt(3)"); return TRUE;
-            case 300: *out_val = -sqrt(3.0); g_snprintf(out, out_cap, "-sqrt(3)"); return TRUE;
-            case 315: *out_val = -1.0; g_snprintf(out, out_cap, "-1"); return TRUE;
-            case 330: *out_val = -sqrt(3.0)/3.0; g_snprintf(out, out_cap, "-sqrt(3)/3"); return TRUE;
-        }
-    } else if (strcmp(func, "csc") == 0) {
-        switch (d) {
-            case 0:
-            case 180:
-                g_snprintf(err, err_cap, "csc undefined");
-                return FALSE;
-            case 30:  *out_val = 2.0; g_snprintf(out, out_cap, "2"); return TRUE;
-            case 45:  *out_val = sqrt(2.0); g_snprintf(out, out_cap, "sqrt(2)"); return TRUE;
-            case 60:  *out_val = 2.0/sqrt(3.0); g_snprintf(out, out_cap, "2/sqrt(3)"); return TRUE;
-            case 90:  *out_val = 1.0; g_snprintf(out, out_cap, "1"); return TRUE;
-            case 120: *out_val = 2.0/sqrt(3.0); g_snprintf(out, out_cap, "2/sqrt(3)"); return TRUE;
-            case 135: *out_val = sqrt(2.0); g_snprintf(out, out_cap, "sqrt(2)"); return TRUE;
-            case 150: *out_val = 2.0; g_snprintf(out, out_cap, "2"); return TRUE;
-            case 210: *out_val = -2.0; g_snprintf(out, out_cap, "-2"); return TRUE;
-            case 225: *out_val = -sqrt(2.0); g_snprintf(out, out_cap, "-sqrt(2)"); return TRUE;
-            case 240: *out_val = -2.0/sqrt(3.0); g_snprintf(out, out_cap, "-2/sqrt(3)"); return TRUE;
-            case 270: *out_val = -1.0; g_snprintf(out, out_cap, "-1"); return TRUE;
-            case 300: *out_val = -2.0/sqrt(3.0); g_snprintf(out, out_cap, "-2/sqrt(3)"); return TRUE;
-            case 315: *out_val = -sqrt(2.0); g_snprintf(out, out_cap, "-sqrt(2)"); return TRUE;
-            case 330: *out_val = -2.0; g_snprintf(out, out_cap, "-2"); return TRUE;
-        }
-    } else if (strcmp(func, "sec") == 0) {
-        switch (d) {
-            case 90:
-            case 270:
-                g_snprintf(err, err_cap, "sec undefined");
-                return FALSE;
-            case 0:   *out_val = 1.0; g_snprintf(out, out_cap, "1"); return TRUE;
-            case 30:  *out_val = 2.0/sqrt(3.0); g_snprintf(out, out_cap, "2/sqrt(3)"); return TRUE;
-            case 45:  *out_val = sqrt(2.0); g_snprintf(out, out_cap, "sqrt(2)"); return TRUE;
-            case 60:  *out_val = 2.0; g_snprintf(out, out_cap, "2"); return TRUE;
-            case 120: *out_val = -2.0; g_snprintf(out, out_cap, "-2"); return TRUE;
-            case 135: *out_val = -sqrt(2.0); g_snprintf(out, out_cap, "-sqrt(2)"); return TRUE;
-            case 150: *out_val = -2.0/sqrt(3.0); g_snprintf(out, out_cap, "-2/sqrt(3)"); return TRUE;
-            case 180: *out_val = -1.0; g_snprintf(out, out_cap, "-1"); return TRUE;
-            case 210: *out_val = -2.0/sqrt(3.0); g_snprintf(out, out_cap, "-2/sqrt(3)"); return TRUE;
-            case 225: *out_val = -sqrt(2.0); g_snprintf(out, out_cap, "-sqrt(2)"); return TRUE;
-            case 240: *out_val = -2.0; g_snprintf(out, out_cap, "-2"); return TRUE;
-            case 300: *out_val = 2.0; g_snprintf(out, out_cap, "2"); return TRUE;
-            case 315: *out_val = sqrt(2.0); g_snprintf(out, out_cap, "sqrt(2)"); return TRUE;
-            case 330: *out_val = 2.0/sqrt(3.0); g_snprintf(out, out_cap, "2/sqrt(3)"); return TRUE;
-        }
-    } else if (strcmp(func, "cot") == 0) {
-        switch (d) {
-            case 0:
-            case 180:
-                g_snprintf(err, err_cap, "cot undefined");
-                return FALSE;
-            case 30:  *out_val = sqrt(3.0); g_snprintf(out, out_cap, "sqrt(3)"); return TRUE;
-            case 45:  *out_val = 1.0; g_snprintf(out, out_cap, "1"); return TRUE;
-            case 60:  *out_val = sqrt(3.0)/3.0; g_snprintf(out, out_cap, "sqrt(3)/3"); return TRUE;
-            case 90:  *out_val = 0.0; g_snprintf(out, out_cap, "0"); return TRUE;
-            case 120: *out_val = -sqrt(3.0)/3.0; g_snprintf(out, out_cap, "-sqrt(3)/3"); return TRUE;
-            case 135: *out_val = -1.0; g_snprintf(out, out_cap, "-1"); return TRUE;
-            case 150: *out_val = -sqrt(3.0); g_snprintf(out, out_cap, "-sqrt(3)"); return TRUE;
-            case 210: *out_val = sqrt(3.0); g_snprintf(out, out_cap, "sqrt(3)"); return TRUE;
-            case 225: *out_val = 1.0; g_snprintf(out, out_cap, "1"); return TRUE;
-            case 240: *out_val = sqrt(3.0)/3.0; g_snprintf(out, out_cap, "sqrt(3)/3"); return TRUE;
-            case 270: *out_val = 0.0; g_snprintf(out, out_cap, "0"); return TRUE;
-            case 300: *out_val = -sqrt(3.0)/3.0; g_snprintf(out, out_cap, "-sqrt(3)/3"); return TRUE;
-            case 315: *out_val = -1.0; g_snprintf(out, out_cap, "-1"); return TRUE;
-            case 330: *out_val = -sqrt(3.0); g_snprintf(out, out_cap, "-sqrt(3)"); return TRUE;
+void calc_scratch_init(CalcScratch *scratch) {
+    memset(scratch, 0, sizeof(*scratch));
+}
+
+void calc_scratch_clear(CalcScratch *scratch) {
+    g_free(scratch->rpn);
+    g_free(scratch->ops);
+    g_free(scratch->frames);
+    g_free(scratch->stack);
+    calc_scratch_init(scratch);
+}
+
+static void scratch_destroy(gpointer data) {
+    calc_scratch_clear(data);
+    g_free(data);
+}
+
+CalcScratch *calc_scratch_get(void) {
+    static GPrivate key = G_PRIVATE_INIT(scratch_destroy);
+    CalcScratch *scratch = g_private_get(&key);
+    if (!scratch) {
+        scratch = g_new0(CalcScratch, 1);
+        g_private_set(&key, scratch);
+    }
+    return scratch;
+}
+
+double *calc_scratch_stack(CalcScratch *scratch, size_t depth) {
+    if (depth > scratch->stack_cap) {
+        scratch->stack_cap = MAX(depth, scratch->stack_cap * 2);
+        scratch->stack = g_renew(double, scratch->stack, scratch->stack_cap);
+    }
+    return scratch->stack;
+}
+
+// Buffers grow geometrically and are kept by the scratch, so after warm-up parsing
+// allocates nothing and any length of input is accepted.
+static void add_token(CalcScratch *scratch, size_t *count, Token tok) {
+    if (*count == scratch->rpn_cap) {
+        scratch->rpn_cap = MAX(scratch->rpn_cap * 2, (size_t)64);
+        scratch->rpn = g_renew(Token, scratch->rpn, scratch->rpn_cap);
+    }
+    scratch->rpn[(*count)++] = tok;
+}
+
+static void push_op(CalcScratch *scratch, int *op_top, char op, int slot) {
+    if ((size_t)(*op_top + 1) == scratch->ops_cap) {
+        scratch->ops_cap = MAX(scratch->ops_cap * 2, (size_t)64);
+        scratch->ops = g_renew(Token, scratch->ops, scratch->ops_cap);
+    }
+    scratch->ops[++(*op_top)] = (Token){ .type = TOK_OP, .op = op, .slot = slot };
+}
+
+// Opens the frame of a matrix literal and returns its index.
+static int push_frame(CalcScratch *scratch) {
+    if (scratch->frames_len == scratch->frames_cap) {
+        scratch->frames_cap = MAX(scratch->frames_cap * 2, (size_t)16);
+        scratch->frames = g_renew(CalcMatrixFrame, scratch->frames, scratch->frames_cap);
+    }
+    scratch->frames[scratch->frames_len] = (CalcMatrixFrame){ 0, 0, 0 };
+    return (int)scratch->frames_len++;
+}
+
+static int find_var(const char *ident, size_t len, const char *const *var_names, size_t n_vars) {
+    for (size_t i = 0; i < n_vars; i++) {
+        if (var_names[i] && strncmp(ident, var_names[i], len) == 0 && var_names[i][len] == '\0') return (int)i;
+    }
+    return -1;
+}
+
+static gboolean parse_range(const char *expr, const char *p, const char *end, const char *const *var_names,
+                            size_t n_vars, CalcScratch *scratch, size_t *out_count, int op_base, char *err,
+                            size_t err_cap);
+
+// Parses "diff(e, v, at)" from the '(' at open: the code of at, then a 'D' token, then the code of
+// e with v as variable slot n_vars (see calc_internal.h). Stores the byte after ')' in *next.
+// Each level scans its arguments and parses them recursively, so nesting is capped at
+// CALC_DIFF_MAX_DEPTH; that also bounds the recursion of everything that runs 'D' blocks.
+static gboolean parse_diff(const char *expr, const char *open, const char *end, const char *const *var_names,
+                           size_t n_vars, CalcScratch *scratch, size_t *out_count, int op_base, const char **next,
+                           char *err, size_t err_cap) {
+    if (scratch->diff_depth == CALC_DIFF_MAX_DEPTH) {
+        g_snprintf(err, err_cap, "diff() nested more than %d deep", CALC_DIFF_MAX_DEPTH);
+        return FALSE;
+    }
+    const char *args[3];
+    const char *arg_ends[3];
+    int n_args = 0;
+    int level = 0;
+    const char *p = open + 1;
+    args[0] = p;
+    for (; p < end; p++) {
+        if (*p == '(' || *p == '[') level++;
+        else if ((*p == ')' || *p == ']') && level-- == 0) break;
+        else if (*p == ',' && level == 0) {
+            if (n_args == 2) break;
+            arg_ends[n_args++] = p;
+            args[n_args] = p + 1;
         }
     }
+    if (p == end) { g_snprintf(err, err_cap, "mismatched parentheses"); return FALSE; }
+    if (*p != ')' || n_args != 2) { g_snprintf(err, err_cap, "diff takes 3 arguments"); return FALSE; }
+    arg_ends[2] = p;
+    *next = p + 1;
+
+    const char *var = calc_skip_space(args[1], arg_ends[1]);
+    size_t len = 0;
+    while (var + len < arg_ends[1] && calc_char_is(var[len], len ? CALC_CC_IDENT : CALC_CC_ALPHA)) len++;
+    if (len == 0 || calc_skip_space(var + len, arg_ends[1]) != arg_ends[1]) {
+        g_snprintf(err, err_cap, "diff needs a variable name");
+        return FALSE;
+    }
 
-    return FALSE;
+    scratch->diff_depth++;
+    if (!parse_range(expr, args[2], arg_ends[2], var_names, n_vars, scratch, out_count, op_base, err, err_cap)) {
+        scratch->diff_depth--;
+        return FALSE;
+    }
+    size_t d = *out_count;
+    add_token(scratch, out_count, (Token){ .type = TOK_OP, .op = 'D', .value = (double)n_vars });
+
+    // The variable hides an outer one of the same name.
+    const char **names = g_new(const char *, n_vars + 1);
+    for (size_t i = 0; i < n_vars; i++) {
+        gboolean hidden = var_names[i] && strncmp(var_names[i], var, len) == 0 && var_names[i][len] == '\0';
+        names[i] = hidden ? NULL : var_names[i];
+    }
+    char *name = g_strndup(var, len);
+    names[n_vars] = name;
+    gboolean ok = parse_range(expr, args[0], arg_ends[0], names, n_vars + 1, scratch, out_count, op_base, err,
+                              err_cap);
+    g_free(name);
+    g_free(names);
+    scratch->rpn[d].slot = (int)(*out_count - d - 1);
+    scratch->diff_depth--;
+    return ok;
 }
 
-static gboolean add_token(Token *out, size_t *count, size_t cap, Token tok, char *err, size_t err_cap) {
-    if (*count >= cap) {
-        g_snprintf(err, err_cap, "expression too long");
+// Parses "load("path"))" at p, the argument of a statistic and the ')' that closes it, into an
+// 'R' token. Stores the byte after the ')' in *next.
+static gboolean parse_load(const char *p, const char *end, int stat, CalcScratch *scratch, size_t *out_count,
+                           const char **next, char *err, size_t err_cap) {
+    p = calc_skip_space(p + 4, end); // "load"
+    p = calc_skip_space(p + 1, end); // '('
+    if (p == end || *p != '"') {
+        g_snprintf(err, err_cap, "load needs a file name in quotes");
         return FALSE;
     }
-    out[(*count)++] = tok;
+    const char *path = p + 1;
+    const char *quote = memchr(path, '"', (size_t)(end - path));
+    if (!quote) {
+        g_snprintf(err, err_cap, "missing closing quote");
+        return FALSE;
+    }
+    if (quote == path) {
+        g_snprintf(err, err_cap, "load needs a file name in quotes");
+        return FALSE;
+    }
+    // The ')' of load, then the statistic's.
+    p = quote + 1;
+    for (int k = 0; k < 2; k++) {
+        p = calc_skip_space(p, end);
+        if (p < end && *p == ',') {
+            g_snprintf(err, err_cap, "%s takes 1 argument", k ? calc_data_stat_name(stat) : "load");
+            return FALSE;
+        }
+        if (p == end || *p != ')') {
+            g_snprintf(err, err_cap, "mismatched parentheses");
+            return FALSE;
+        }
+        p++;
+    }
+    int dataset = calc_data_register(path, (size_t)(quote - path));
+    add_token(scratch, out_count, (Token){ .type = TOK_OP, .op = 'R', .value = (double)stat, .slot = dataset });
+    *next = p;
     return TRUE;
 }
 
-static gboolean shunting_yard(const char *expr, Token *output, size_t *out_count, char *err, size_t err_cap) {
-    char op_stack[256];
-    int op_top = -1;
-    *out_count = 0;
+// TRUE if p starts a call of load().
+static gboolean is_load(const char *p, const char *end) {
+    if (end - p < 4 || memcmp(p, "load", 4) != 0) return FALSE;
+    p = calc_skip_space(p + 4, end);
+    return p < end && *p == '(';
+}
 
-    enum { PREV_NONE, PREV_NUM, PREV_OP, PREV_LPAREN, PREV_RPAREN } prev = PREV_NONE;
+// Parses [p, end) of expr onto the end of scratch->rpn. Operators go on scratch->ops above op_base,
+// which belongs to the caller. A matrix literal "[a, b; c, d]" is parsed in the same pass: '[' goes
+// on the operator stack like '(' with a frame counting rows and columns, each ',' or ';' at its
+// level ends an element, and ']' emits an 'M' token after the code of the elements, row by row.
+static gboolean parse_range(const char *expr, const char *p, const char *end, const char *const *var_names,
+                            size_t n_vars, CalcScratch *scratch, size_t *out_count, int op_base, char *err,
+                            size_t err_cap) {
+    int op_top = op_base;
+    int open_matrices = 0; // '[' entries above op_base
 
-    const char *p = expr;
-    while (*p) {
-        if (isspace((unsigned char)*p)) { p++; continue; }
+    enum { PREV_NONE, PREV_NUM, PREV_OP, PREV_LPAREN, PREV_RPAREN } prev = PREV_NONE;
 
-        if (isalpha((unsigned char)*p)) {
-            char ident[8] = {0};
-            size_t n = 0;
-            while (isalpha((unsigned char)*p) && n < sizeof(ident) - 1) {
-                ident[n++] = *p++;
+    while (p < end) {
+        if (calc_char_is(*p, CALC_CC_SPACE)) { p = calc_skip_space(p, end); continue; }
+
+        if (calc_char_is(*p, CALC_CC_ALPHA)) {
+            // The whole identifier names a function or a variable. Failing that, its leading
+            // letters may name a function applied to what follows, as in "sin30".
+            const char *ident = p;
+            size_t len = 1;
+            while (ident + len < end && calc_char_is(ident[len], CALC_CC_IDENT)) len++;
+            const char *after = calc_skip_space(ident + len, end);
+            if (len == 4 && memcmp(ident, "diff", 4) == 0 && after < end && *after == '(') {
+                if (prev == PREV_NUM || prev == PREV_RPAREN) { g_snprintf(err, err_cap, "operator missing value"); return FALSE; }
+                if (!parse_diff(expr, after, end, var_names, n_vars, scratch, out_count, op_top, &p, err, err_cap)) {
+                    return FALSE;
+                }
+                prev = PREV_NUM;
+                continue;
+            }
+            // Statistics of a dataset: "mean(load("file"))".
+            int stat = (after < end && *after == '(') ? calc_data_stat_lookup(ident, len) : -1;
+            if (stat >= 0 && is_load(calc_skip_space(after + 1, end), end)) {
+                if (prev == PREV_NUM || prev == PREV_RPAREN) { g_snprintf(err, err_cap, "operator missing value"); return FALSE; }
+                if (!parse_load(calc_skip_space(after + 1, end), end, stat, scratch, out_count, &p, err, err_cap)) {
+                    return FALSE;
+                }
+                prev = PREV_NUM;
+                continue;
+            }
+            if (len == 4 && is_load(ident, end)) {
+                g_snprintf(err, err_cap, "load() goes inside sum, mean, var, stddev, min, max, median or count");
+                return FALSE;
+            }
+            // Variables come before functions, so a function registered under a variable's name
+            // (say "x") cannot take the variable over.
+            int slot = find_var(ident, len, var_names, n_vars);
+            if (slot >= 0) {
+                Token t = { .type = TOK_VAR, .slot = slot };
+                add_token(scratch, out_count, t);
+                p += len;
+                prev = PREV_NUM;
+                continue;
             }
-            char op = 0;
-            if (strcmp(ident, "sin") == 0) op = 'S';
-            else if (strcmp(ident, "cos") == 0) op = 'C';
-            else if (strcmp(ident, "tan") == 0) op = 'T';
-            else if (strcmp(ident, "sqrt") == 0) op = 'Q';
-            else if (strcmp(ident, "log") == 0) op = 'L';
-            else if (strcmp(ident, "ln") == 0) op = 'N';
-            else if (strcmp(ident, "log2") == 0) op = 'G';
-            else if (strcmp(ident, "abs") == 0) op = 'A';
-            else if (strcmp(ident, "exp") == 0) op = 'E';
-            else if (strcmp(ident, "pow") == 0) op = 'P';
-            else if (strcmp(ident, "csc") == 0) op = 'I';
-            else if (strcmp(ident, "sec") == 0) op = 'J';
-            else if (strcmp(ident, "cot") == 0) op = 'K';
-            else {
-                g_snprintf(err, err_cap, "unknown function: %s", ident);
+            int index;
+            CALC_TRACE_BEGIN(lookup_start);
+            const CalcFunc *fn = calc_func_lookup(ident, len, &index);
+            CALC_TRACE_COUNT(CALC_TRACE_LOOKUP, lookup_start);
+            if (!fn && stat >= 0) {
+                g_snprintf(err, err_cap, "%.*s needs a dataset, as in %.*s(load(\"data.csv\"))", (int)len, ident,
+                           (int)len, ident);
                 return FALSE;
             }
-            op_stack[++op_top] = op;
+            if (!fn) {
+                size_t letters = 1;
+                while (ident + letters < end && calc_char_is(ident[letters], CALC_CC_ALPHA)) letters++;
+                if (letters < len) fn = calc_func_lookup(ident, letters, &index);
+                if (!fn) {
+                    g_snprintf(err, err_cap, "unknown function: %.*s", (int)len, ident);
+                    return FALSE;
+                }
+                len = letters;
+            }
+            push_op(scratch, &op_top, fn->op, index);
+            p += len;
             prev = PREV_OP;
             continue;
         }
 
-        if (isdigit((unsigned char)*p) || *p == '.') {
-            char *endptr = NULL;
-            double val = strtod(p, &endptr);
-            if (endptr == p) { g_snprintf(err, err_cap, "invalid number"); return FALSE; }
-            Token t = { .type = TOK_NUM, .value = val, .op = 0 };
-            if (!add_token(output, out_count, 512, t, err, err_cap)) return FALSE;
-            p = endptr;
+        if (calc_char_is(*p, CALC_CC_DIGIT) || *p == '.') {
+            const char *stop;
+            CALC_TRACE_BEGIN(lex_start);
+            double val = calc_read_number(p, end, &stop);
+            CALC_TRACE_COUNT(CALC_TRACE_LEX, lex_start);
+            if (stop == p) { g_snprintf(err, err_cap, "invalid number"); return FALSE; }
+            Token t = { .type = TOK_NUM, .value = val, .op = 0, .slot = (int)(p - expr) };
+            add_token(scratch, out_count, t);
+            p = stop;
+            if (p < end && *p == 'i' && !(p + 1 < end && calc_char_is(p[1], CALC_CC_IDENT))) {
+                int slot = find_var("i", 1, var_names, n_vars);
+                if (slot >= 0 && var_names[slot] == calc_imag_name) { // "4i": the literal times i
+                    add_token(scratch, out_count, (Token){ .type = TOK_VAR, .slot = slot });
+                    add_token(scratch, out_count, (Token){ .type = TOK_OP, .op = '*' });
+                    p++;
+                }
+            }
             prev = PREV_NUM;
             continue;
         }
 
-        if (*p == '(') { op_stack[++op_top] = '('; p++; prev = PREV_LPAREN; continue; }
+        if (*p == '(') { push_op(scratch, &op_top, '(', 1); p++; prev = PREV_LPAREN; continue; }
+
+        if (*p == '[') {
+            if (prev == PREV_NUM || prev == PREV_RPAREN) { g_snprintf(err, err_cap, "operator missing value"); return FALSE; }
+            push_op(scratch, &op_top, '[', push_frame(scratch));
+            open_matrices++;
+            p++;
+            prev = PREV_NONE; // an element starts like an expression
+            continue;
+        }
 
         if (*p == ')') {
-            gboolean found = FALSE;
-            while (op_top >= 0) {
-                char op = op_stack[op_top--];
-                if (op == '(') { found = TRUE; break; }
-                Token t = { .type = TOK_OP, .op = op };
-                if (!add_token(output, out_count, 512, t, err, err_cap)) return FALSE;
+            int n_args = -1;
+            while (op_top > op_base) {
+                Token t = scratch->ops[op_top--];
+                if (t.op == '[') { g_snprintf(err, err_cap, "mismatched brackets"); return FALSE; }
+                if (t.op == '(') { n_args = (prev == PREV_LPAREN) ? 0 : t.slot; break; }
+                add_token(scratch, out_count, t);
             }
-            if (!found) { g_snprintf(err, err_cap, "mismatched parentheses"); return FALSE; }
-            if (op_top >= 0 && is_func_op(op_stack[op_top])) {
-                char op = op_stack[op_top--];
-                Token t = { .type = TOK_OP, .op = op };
-                if (!add_token(output, out_count, 512, t, err, err_cap)) return FALSE;
+            if (n_args < 0) { g_snprintf(err, err_cap, "mismatched parentheses"); return FALSE; }
+            if (op_top > op_base && calc_op_is_func(scratch->ops[op_top].op)) {
+                Token t = scratch->ops[op_top--];
+                const CalcFunc *fn = calc_func_get(t.slot);
+                if (n_args != fn->arity) {
+                    g_snprintf(err, err_cap, "%s takes %d argument%s", fn->name, fn->arity, fn->arity == 1 ? "" : "s");
+                    return FALSE;
+                }
+                add_token(scratch, out_count, t);
             }
             p++; prev = PREV_RPAREN; continue;
         }
 
-        if (*p == ',') {
-            while (op_top >= 0 && op_stack[op_top] != '(') {
-                char op = op_stack[op_top--];
-                Token t = { .type = TOK_OP, .op = op };
-                if (!add_token(output, out_count, 512, t, err, err_cap)) return FALSE;
+        if (*p == ',' || *p == ';' || *p == ']') {
+            char sep = *p;
+            while (op_top > op_base && scratch->ops[op_top].op != '(' && scratch->ops[op_top].op != '[') {
+                add_token(scratch, out_count, scratch->ops[op_top--]);
+            }
+            gboolean in_matrix = op_top > op_base && scratch->ops[op_top].op == '[';
+            if (!in_matrix && sep == ',') {
+                if (op_top == op_base) { g_snprintf(err, err_cap, "misplaced comma"); return FALSE; }
+                scratch->ops[op_top].slot++;
+                p++; prev = PREV_OP; continue;
+            }
+            if (!in_matrix) {
+                if (sep == ']' && open_matrices > 0) g_snprintf(err, err_cap, "mismatched brackets");
+                else g_snprintf(err, err_cap, "invalid character: %c", sep);
+                return FALSE;
+            }
+
+            CalcMatrixFrame *frame = &scratch->frames[scratch->ops[op_top].slot];
+            if (prev == PREV_NONE) {
+                g_snprintf(err, err_cap, (sep == ']' && frame->rows == 0 && frame->in_row == 0) ? "empty matrix"
+                                                                                                : "missing matrix element");
+                return FALSE;
             }
-            if (op_top < 0) { g_snprintf(err, err_cap, "misplaced comma"); return FALSE; }
-            p++; prev = PREV_OP; continue;
+            frame->in_row++;
+            p++;
+            prev = PREV_NONE;
+            if (sep == ',') continue;
+            if (frame->rows > 0 && frame->in_row != frame->cols) {
+                g_snprintf(err, err_cap, "matrix rows differ in length");
+                return FALSE;
+            }
+            frame->cols = frame->in_row;
+            frame->in_row = 0;
+            frame->rows++;
+            if (sep == ';') continue;
+
+            add_token(scratch, out_count,
+                      (Token){ .type = TOK_OP, .op = 'M', .value = (double)frame->rows, .slot = (int)frame->cols });
+            scratch->matrix = TRUE;
+            scratch->frames_len--;
+            op_top--;
+            open_matrices--;
+            prev = PREV_NUM;
+            continue;
         }
 
-        if (is_operator_char(*p)) {
+        if (calc_char_is(*p, CALC_CC_OPERATOR)) {
             char op = *p;
             if (op == '-' && (prev == PREV_NONE || prev == PREV_OP || prev == PREV_LPAREN)) op = 'u';
 
@@ -297,19 +426,18 @@ static gboolean shunting_yard(const char *expr, Token *output, size_t *out_count
                 if (!(prev == PREV_NUM || prev == PREV_RPAREN) && op != 'u') { g_snprintf(err, err_cap, "operator missing value"); return FALSE; }
             }
 
-            while (op_top >= 0) {
-                char top = op_stack[op_top];
-                if (top == '(') break;
-                int p1 = op_precedence(op);
-                int p2 = op_precedence(top);
-                if ((!op_right_assoc(op) && p1 <= p2) || (op_right_assoc(op) && p1 < p2)) {
-                    op_stack[op_top--] = 0;
-                    Token t = { .type = TOK_OP, .op = top };
-                    if (!add_token(output, out_count, 512, t, err, err_cap)) return FALSE;
+            while (op_top > op_base) {
+                Token top = scratch->ops[op_top];
+                if (top.op == '(' || top.op == '[') break;
+                int p1 = calc_op_precedence(op);
+                int p2 = calc_op_precedence(top.op);
+                if ((!calc_op_right_assoc(op) && p1 <= p2) || (calc_op_right_assoc(op) && p1 < p2)) {
+                    op_top--;
+                    add_token(scratch, out_count, top);
                 } else break;
             }
 
-            op_stack[++op_top] = op;
+            push_op(scratch, &op_top, op, 0);
             p++;
             prev = (op == '!') ? PREV_NUM : PREV_OP;
             continue;
@@ -319,21 +447,61 @@ static gboolean shunting_yard(const char *expr, Token *output, size_t *out_count
         return FALSE;
     }
 
-    while (op_top >= 0) {
-        char op = op_stack[op_top--];
-        if (op == '(') { g_snprintf(err, err_cap, "mismatched parentheses"); return FALSE; }
-        Token t = { .type = TOK_OP, .op = op };
-        if (!add_token(output, out_count, 512, t, err, err_cap)) return FALSE;
+    while (op_top > op_base) {
+        Token t = scratch->ops[op_top--];
+        if (t.op == '(' || t.op == '[') {
+            g_snprintf(err, err_cap, open_matrices > 0 ? "mismatched brackets" : "mismatched parentheses");
+            return FALSE;
+        }
+        add_token(scratch, out_count, t);
     }
     return TRUE;
 }
 
-static gboolean eval_rpn(const Token *rpn, size_t count, gboolean degrees, double *out, char *err, size_t err_cap) {
-    double stack[512];
+static gboolean shunting_yard(const char *expr, const char *const *var_names, size_t n_vars,
+                              CalcScratch *scratch, size_t *out_count, char *err, size_t err_cap) {
+    *out_count = 0;
+    scratch->matrix = FALSE;
+    scratch->frames_len = 0;
+    scratch->diff_depth = 0;
+    CALC_TRACE_BEGIN(start);
+    gboolean ok = parse_range(expr, expr, expr + strlen(expr), var_names, n_vars, scratch, out_count, -1, err, err_cap);
+    CALC_TRACE_END(CALC_TRACE_PARSE, start);
+    return ok;
+}
+
+gboolean calc_parse(CalcScratch *scratch, const char *expr, const char *const *var_names, size_t n_vars,
+                    size_t *count, char *err, size_t err_cap) {
+    return shunting_yard(expr, var_names, n_vars, scratch, count, err, err_cap);
+}
+
+gboolean calc_factorial(double v, double *out, char *err, size_t err_cap) {
+    double r = round(v);
+    if (v < 0 || fabs(v - r) > 1e-9) { g_snprintf(err, err_cap, "factorial requires a non-negative integer"); return FALSE; }
+    if (r > 170) { g_snprintf(err, err_cap, "factorial overflow"); return FALSE; }
+    double acc = 1.0;
+    for (int k = 2; k <= (int)r; k++) acc *= (double)k;
+    *out = acc;
+    return TRUE;
+}
+
+double calc_powi(double x, int n) {
+    double acc = 1.0;
+    for (;;) {
+        if (n & 1) acc *= x;
+        n >>= 1;
+        if (!n) return acc;
+        x *= x;
+    }
+}
+
+static gboolean eval_rpn(const Token *rpn, size_t count, const double *vars, gboolean degrees,
+                         double *stack, double *out, char *err, size_t err_cap) {
     int top = -1;
 
     for (size_t i = 0; i < count; i++) {
         if (rpn[i].type == TOK_NUM) { stack[++top] = rpn[i].value; continue; }
+        if (rpn[i].type == TOK_VAR) { stack[++top] = vars[rpn[i].slot]; continue; }
 
         char op = rpn[i].op;
         if (op == 'u') {
@@ -342,19 +510,45 @@ static gboolean eval_rpn(const Token *rpn, size_t count, gboolean degrees, doubl
             continue;
         }
 
+        if (op == 'w') {
+            stack[top] = calc_powi(stack[top], (int)rpn[i].value);
+            continue;
+        }
+
         if (op == '!') {
             if (top < 0) { g_snprintf(err, err_cap, "invalid expression"); return FALSE; }
-            double v = stack[top];
-            double r = round(v);
-            if (v < 0 || fabs(v - r) > 1e-9) { g_snprintf(err, err_cap, "factorial requires a non-negative integer"); return FALSE; }
-            if (r > 170) { g_snprintf(err, err_cap, "factorial overflow"); return FALSE; }
-            double acc = 1.0;
-            for (int k = 2; k <= (int)r; k++) acc *= (double)k;
-            stack[top] = acc;
+            if (!calc_factorial(stack[top], &stack[top], err, err_cap)) return FALSE;
             continue;
         }
 
-        if (is_func_op(op)) {
+        if (op == 'D') {
+            if (top < 0) { g_snprintf(err, err_cap, "invalid expression"); return FALSE; }
+            double value;
+            if (!calc_diff_rpn(rpn + i + 1, (size_t)rpn[i].slot, vars, (int)rpn[i].value, stack[top], degrees,
+                               &value, &stack[top], err, err_cap)) {
+                return FALSE;
+            }
+            i += (size_t)rpn[i].slot;
+            continue;
+        }
+
+        if (op == 'R') {
+            if (!calc_data_value(rpn[i].slot, (int)rpn[i].value, 0, &stack[++top], err, err_cap)) return FALSE;
+            continue;
+        }
+
+        if (op == 'F') {
+            const CalcFunc *fn = calc_func_get(rpn[i].slot);
+            if (top + 1 < fn->arity) { g_snprintf(err, err_cap, "invalid expression"); return FALSE; }
+            top -= fn->arity - 1;
+            double r;
+            if (!fn->fn(&stack[top], &r, fn->user_data)) { g_snprintf(err, err_cap, "%s domain error", fn->name); return FALSE; }
+            if (degrees && (fn->flags & CALC_FUNC_ANGLE_RESULT)) r *= 180.0 / G_PI;
+            stack[top] = r;
+            continue;
+        }
+
+        if (calc_op_is_func(op) && op != 'P') {
             if (top < 0) { g_snprintf(err, err_cap, "invalid expression"); return FALSE; }
             double a = stack[top];
             switch (op) {
@@ -439,39 +633,150 @@ static gboolean eval_rpn(const Token *rpn, size_t count, gboolean degrees, doubl
     return TRUE;
 }
 
+gboolean calc_eval_rpn(const Token *rpn, size_t count, const double *vars, gboolean degrees,
+                       double *stack, double *out, char *err, size_t err_cap) {
+    return eval_rpn(rpn, count, vars, degrees, stack, out, err, err_cap);
+}
+
+// Checks that every operator has its operands, so a compiled program can only
+// fail at evaluation time because of a domain error. The code of a 'D' runs on a stack of its
+// own: the walk sets the enclosing code aside, checks the block in place and picks the enclosing
+// code up again where the block ends.
+static gboolean check_rpn(const Token *rpn, size_t count, size_t *max_depth, char *err, size_t err_cap) {
+    struct { size_t end, depth; } outer[CALC_DIFF_MAX_DEPTH];
+    int nested = 0;
+    size_t end = count;
+    size_t depth = 0;
+    size_t deepest = 0;
+    for (size_t i = 0;; i++) {
+        while (i == end) {
+            if (depth != 1) { g_snprintf(err, err_cap, "invalid expression"); return FALSE; }
+            if (nested == 0) {
+                *max_depth = deepest;
+                return TRUE;
+            }
+            nested--;
+            end = outer[nested].end;
+            depth = outer[nested].depth;
+        }
+        if (rpn[i].type != TOK_OP) {
+            if (++depth > deepest && nested == 0) deepest = depth;
+            continue;
+        }
+        size_t arity = (size_t)calc_token_arity(&rpn[i]);
+        if (depth < arity) { g_snprintf(err, err_cap, "invalid expression"); return FALSE; }
+        depth -= arity - 1;
+        if (depth > deepest && nested == 0) deepest = depth;
+        if (rpn[i].op == 'D') {
+            size_t block_end = i + 1 + (size_t)rpn[i].slot;
+            if (nested == CALC_DIFF_MAX_DEPTH || block_end > end) {
+                g_snprintf(err, err_cap, "invalid expression");
+                return FALSE;
+            }
+            outer[nested].end = end;
+            outer[nested].depth = depth;
+            nested++;
+            end = block_end;
+            depth = 0;
+        }
+    }
+}
+
+gboolean calc_eval_scratch(CalcScratch *scratch, const char *expr, gboolean degrees, double *result,
+                           char *err, size_t err_cap) {
+    size_t count = 0;
+
+    if (!shunting_yard(expr, NULL, 0, scratch, &count, err, err_cap)) return FALSE;
+    // The shape is checked before anything runs, as calc_compile() does, so a malformed expression
+    // reports the same error whether or not the cache has compiled it.
+    size_t depth;
+    if (!check_rpn(scratch->rpn, count, &depth, err, err_cap)) return FALSE;
+    if (scratch->matrix) return calc_matrix_eval_rpn(scratch->rpn, count, count, NULL, degrees, result, err, err_cap);
+    double *stack = calc_scratch_stack(scratch, count);
+    CALC_TRACE_BEGIN(start);
+    gboolean ok = eval_rpn(scratch->rpn, count, NULL, degrees, stack, result, err, err_cap);
+    CALC_TRACE_END(CALC_TRACE_RUN, start);
+    return ok;
+}
+
 gboolean calc_eval(const char *expr, gboolean degrees, double *result, char *err, size_t err_cap) {
-    Token rpn[512];
+    CALC_TRACE_BEGIN(start);
+    gboolean ok = calc_cache_eval(expr, degrees, result, err, err_cap);
+    CALC_TRACE_END(CALC_TRACE_EVAL, start);
+    return ok;
+}
+
+CalcProgram *calc_program_from_scratch(CalcScratch *scratch, size_t count, size_t n_vars, gboolean degrees,
+                                       gboolean optimize, char *err, size_t err_cap) {
+    size_t max_depth = 0;
+    if (!check_rpn(scratch->rpn, count, &max_depth, err, err_cap)) return NULL;
+    if (optimize) {
+        CALC_TRACE_BEGIN(start);
+        count = calc_optimize_rpn(scratch->rpn, count, degrees);
+        // Also recomputes max_depth. Code the optimizer left malformed is never run.
+        gboolean ok = check_rpn(scratch->rpn, count, &max_depth, err, err_cap);
+        CALC_TRACE_END(CALC_TRACE_OPTIMIZE, start);
+        if (!ok) return NULL;
+    }
+
+    CalcProgram *prog = g_new0(CalcProgram, 1);
+    prog->code = g_new(Token, count);
+    memcpy(prog->code, scratch->rpn, count * sizeof(Token));
+    prog->count = count;
+    prog->n_vars = n_vars;
+    prog->max_depth = max_depth;
+    prog->degrees = degrees;
+    prog->matrix = scratch->matrix;
+    prog->refs = 1;
+    return prog;
+}
+
+CalcProgram *calc_compile(const char *expr, const char *const *var_names, size_t n_vars, gboolean degrees,
+                          char *err, size_t err_cap) {
+    CalcScratch *scratch = calc_scratch_get();
     size_t count = 0;
+    if (!shunting_yard(expr, var_names, n_vars, scratch, &count, err, err_cap)) return NULL;
+    return calc_program_from_scratch(scratch, count, n_vars, degrees, TRUE, err, err_cap);
+}
 
-    if (!shunting_yard(expr, rpn, &count, err, err_cap)) return FALSE;
-    if (!eval_rpn(rpn, count, degrees, result, err, err_cap)) return FALSE;
-    return TRUE;
+gboolean calc_program_eval(const CalcProgram *prog, const double *vars, double *result, char *err, size_t err_cap) {
+    if (prog->needs_complex) {
+        g_snprintf(err, err_cap, "complex expression: use calc_program_eval_complex()");
+        return FALSE;
+    }
+    if (prog->matrix) {
+        return calc_matrix_eval_rpn(prog->code, prog->count, prog->max_depth, vars, prog->degrees, result, err, err_cap);
+    }
+    if (prog->jit) {
+        int code = prog->jit(vars, result);
+        if (code == 0) return TRUE;
+        g_snprintf(err, err_cap, "%s", calc_jit_error_message(code));
+        return FALSE;
+    }
+    // Typical programs fit the local stack; deep ones use the thread's scratch.
+    double local[64];
+    double *stack = prog->max_depth <= G_N_ELEMENTS(local) ? local
+                                                           : calc_scratch_stack(calc_scratch_get(), prog->max_depth);
+    CALC_TRACE_BEGIN(start);
+    gboolean ok = eval_rpn(prog->code, prog->count, vars, prog->degrees, stack, result, err, err_cap);
+    CALC_TRACE_END(CALC_TRACE_RUN, start);
+    return ok;
+}
+
+CalcProgram *calc_program_ref(CalcProgram *prog) {
+    g_atomic_int_inc(&prog->refs);
+    return prog;
+}
+
+void calc_program_free(CalcProgram *prog) {
+    if (!prog || !g_atomic_int_dec_and_test(&prog->refs)) return;
+    calc_jit_release(prog);
+    g_free(prog->code);
+    g_free(prog);
 }
 
-gboolean calc_try_special_trig(const char *expr, int *out_deg, char *display_out, size_t out_cap,
-                               double *out_val, char *err, size_t err_cap) {
-    // Recognize: <func>(<int-deg>) with optional whitespace.
-    char name[8] = {0};
-    const char *p = expr;
-    while (isspace((unsigned char)*p)) p++;
-    size_t n = 0;
-    while (isalpha((unsigned char)*p) && n < sizeof(name) - 1) name[n++] = *p++;
-    while (isspace((unsigned char)*p)) p++;
-    if (n == 0 || *p != '(') return FALSE;
-    p++;
-    while (isspace((unsigned char)*p)) p++;
-    char *endptr = NULL;
-    double angle = strtod(p, &endptr);
-    if (endptr == p) return FALSE;
-    p = endptr;
-    while (isspace((unsigned char)*p)) p++;
-    if (*p != ')') return FALSE;
-    p++;
-    while (isspace((unsigned char)*p)) p++;
-    if (*p != '\0') return FALSE;
-
-    int deg = (int)llround(angle);
-    if (fabs(angle - (double)deg) > 1e-9) return FALSE;
-    if (out_deg) *out_deg = deg;
-    return special_trig_func(name, deg, display_out, out_cap, out_val, err, err_cap);
+void calc_format_result(double value, char *out, size_t out_cap) {
+    CALC_TRACE_BEGIN(start);
+    g_snprintf(out, out_cap, "%.12g", value);
+    CALC_TRACE_END(CALC_TRACE_FORMAT, start);
 }
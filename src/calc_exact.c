@@ -0,0 +1,665 @@
+#include "calc_eval.h"
+#include "calc_internal.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Exact (symbolic) results for expressions built from trig functions at multiples of 15 and
+// 18 degrees. A value is a sum of terms c * sqrt(s) * N with c rational, s squarefree and N one
+// of 1, A = sqrt(10+2*sqrt(5)) or B = sqrt(10-2*sqrt(5)). Every such value at those angles has
+// this form, and the set is closed under +, -, * and division because
+// A*A = 10+2*sqrt(5), B*B = 10-2*sqrt(5) and A*B = 4*sqrt(5).
+
+#define EXACT_MAX_TERMS 16
+// Coefficient numerators and denominators stay below this, so products fit in 64 bits.
+#define EXACT_COEF_LIMIT ((gint64)1 << 31)
+// Results with larger coefficients read better as decimals and are left to calc_eval().
+#define EXACT_DISPLAY_LIMIT 10000
+#define EXACT_MAX_POWER 64
+
+typedef enum {
+    NEST_NONE,
+    NEST_A, // sqrt(10+2*sqrt(5))
+    NEST_B  // sqrt(10-2*sqrt(5))
+} Nest;
+
+typedef struct {
+    gint64 num;
+    gint64 den; // > 0, coprime with num
+    gint64 s;   // squarefree radicand, 1 for none
+    int nest;
+} ExactTerm;
+
+typedef struct {
+    int n; // 0 is zero
+    ExactTerm t[EXACT_MAX_TERMS];
+} ExactNum;
+
+typedef struct {
+    const char *display; // NULL: no exact form at this angle
+    double approx;       // value rounded to double
+    gboolean pole;       // the function is undefined here
+    ExactNum value;
+} TrigEntry;
+
+#define Q(num, den) { (num), (den), 1, NEST_NONE }
+#define R(num, den, s) { (num), (den), (s), NEST_NONE }
+#define RA(num, den, s) { (num), (den), (s), NEST_A }
+#define RB(num, den, s) { (num), (den), (s), NEST_B }
+
+// First-quadrant values indexed by degrees / 3. The other functions and quadrants follow from
+// cos(x) = sin(90-x), cot(x) = tan(90-x), csc(x) = sec(90-x) and the quadrant signs.
+static const TrigEntry sin_table[31] = {
+    [0]  = { "0", 0.0, FALSE, { 0, { { 0 } } } },
+    [5]  = { "(sqrt(6)-sqrt(2))/4", 0.25881904510252074, FALSE, { 2, { R(-1, 4, 2), R(1, 4, 6) } } },
+    [6]  = { "(sqrt(5)-1)/4", 0.30901699437494745, FALSE, { 2, { Q(-1, 4), R(1, 4, 5) } } },
+    [10] = { "1/2", 0.5, FALSE, { 1, { Q(1, 2) } } },
+    [12] = { "sqrt(10-2*sqrt(5))/4", 0.5877852522924731, FALSE, { 1, { RB(1, 4, 1) } } },
+    [15] = { "sqrt(2)/2", 0.7071067811865476, FALSE, { 1, { R(1, 2, 2) } } },
+    [18] = { "(sqrt(5)+1)/4", 0.8090169943749475, FALSE, { 2, { Q(1, 4), R(1, 4, 5) } } },
+    [20] = { "sqrt(3)/2", 0.8660254037844386, FALSE, { 1, { R(1, 2, 3) } } },
+    [24] = { "sqrt(10+2*sqrt(5))/4", 0.9510565162951535, FALSE, { 1, { RA(1, 4, 1) } } },
+    [25] = { "(sqrt(6)+sqrt(2))/4", 0.9659258262890683, FALSE, { 2, { R(1, 4, 2), R(1, 4, 6) } } },
+    [30] = { "1", 1.0, FALSE, { 1, { Q(1, 1) } } },
+};
+
+static const TrigEntry tan_table[31] = {
+    [0]  = { "0", 0.0, FALSE, { 0, { { 0 } } } },
+    [5]  = { "2-sqrt(3)", 0.2679491924311227, FALSE, { 2, { Q(2, 1), R(-1, 1, 3) } } },
+    [6]  = { "sqrt(25-10*sqrt(5))/5", 0.32491969623290634, FALSE, { 2, { RA(-1, 4, 1), RA(3, 20, 5) } } },
+    [10] = { "sqrt(3)/3", 0.5773502691896257, FALSE, { 1, { R(1, 3, 3) } } },
+    [12] = { "sqrt(5-2*sqrt(5))", 0.7265425280053609, FALSE, { 2, { RB(-1, 4, 1), RB(1, 4, 5) } } },
+    [15] = { "1", 1.0, FALSE, { 1, { Q(1, 1) } } },
+    [18] = { "sqrt(25+10*sqrt(5))/5", 1.3763819204711736, FALSE, { 2, { RB(1, 4, 1), RB(3, 20, 5) } } },
+    [20] = { "sqrt(3)", 1.7320508075688772, FALSE, { 1, { R(1, 1, 3) } } },
+    [24] = { "sqrt(5+2*sqrt(5))", 3.0776835371752536, FALSE, { 2, { RA(1, 4, 1), RA(1, 4, 5) } } },
+    [25] = { "2+sqrt(3)", 3.732050807568877, FALSE, { 2, { Q(2, 1), R(1, 1, 3) } } },
+    [30] = { "", 0.0, TRUE, { 0, { { 0 } } } },
+};
+
+static const TrigEntry sec_table[31] = {
+    [0]  = { "1", 1.0, FALSE, { 1, { Q(1, 1) } } },
+    [5]  = { "sqrt(6)-sqrt(2)", 1.035276180410083, FALSE, { 2, { R(-1, 1, 2), R(1, 1, 6) } } },
+    [6]  = { "sqrt(50-10*sqrt(5))/5", 1.0514622242382672, FALSE, { 2, { RA(1, 2, 1), RA(-1, 10, 5) } } },
+    [10] = { "2/sqrt(3)", 1.1547005383792515, FALSE, { 1, { R(2, 3, 3) } } },
+    [12] = { "sqrt(5)-1", 1.2360679774997898, FALSE, { 2, { Q(-1, 1), R(1, 1, 5) } } },
+    [15] = { "sqrt(2)", 1.4142135623730951, FALSE, { 1, { R(1, 1, 2) } } },
+    [18] = { "sqrt(50+10*sqrt(5))/5", 1.7013016167040798, FALSE, { 2, { RB(1, 2, 1), RB(1, 10, 5) } } },
+    [20] = { "2", 2.0, FALSE, { 1, { Q(2, 1) } } },
+    [24] = { "sqrt(5)+1", 3.23606797749979, FALSE, { 2, { Q(1, 1), R(1, 1, 5) } } },
+    [25] = { "sqrt(6)+sqrt(2)", 3.8637033051562732, FALSE, { 2, { R(1, 1, 2), R(1, 1, 6) } } },
+    [30] = { "", 0.0, TRUE, { 0, { { 0 } } } },
+};
+
+#undef Q
+#undef R
+#undef RA
+#undef RB
+
+typedef enum { TRIG_SIN, TRIG_COS, TRIG_TAN, TRIG_CSC, TRIG_SEC, TRIG_COT, TRIG_NONE } TrigFunc;
+
+typedef struct {
+    const char *name;
+    const TrigEntry *table;
+    gboolean complement; // read the table at 90 - angle
+    guint8 negative;     // bit q set: the function is negative in quadrant q
+} TrigSpec;
+
+static const TrigSpec trig_specs[] = {
+    [TRIG_SIN] = { "sin", sin_table, FALSE, 0xC },
+    [TRIG_COS] = { "cos", sin_table, TRUE, 0x6 },
+    [TRIG_TAN] = { "tan", tan_table, FALSE, 0xA },
+    [TRIG_CSC] = { "csc", sec_table, TRUE, 0xC },
+    [TRIG_SEC] = { "sec", sec_table, FALSE, 0x6 },
+    [TRIG_COT] = { "cot", tan_table, TRUE, 0xA },
+};
+
+static TrigFunc trig_from_name(const char *name, size_t len) {
+    if (len != 3) return TRIG_NONE;
+    switch (name[0]) {
+        case 's':
+            if (name[1] == 'i' && name[2] == 'n') return TRIG_SIN;
+            if (name[1] == 'e' && name[2] == 'c') return TRIG_SEC;
+            return TRIG_NONE;
+        case 'c':
+            if (name[1] == 'o' && name[2] == 's') return TRIG_COS;
+            if (name[1] == 's' && name[2] == 'c') return TRIG_CSC;
+            if (name[1] == 'o' && name[2] == 't') return TRIG_COT;
+            return TRIG_NONE;
+        case 't':
+            return (name[1] == 'a' && name[2] == 'n') ? TRIG_TAN : TRIG_NONE;
+    }
+    return TRIG_NONE;
+}
+
+static TrigFunc trig_from_op(char op) {
+    switch (op) {
+        case 'S': return TRIG_SIN;
+        case 'C': return TRIG_COS;
+        case 'T': return TRIG_TAN;
+        case 'I': return TRIG_CSC;
+        case 'J': return TRIG_SEC;
+        case 'K': return TRIG_COT;
+    }
+    return TRIG_NONE;
+}
+
+// Reduces the angle to its first-quadrant reference and reads the table. Returns NULL when the
+// angle has no exact form; *negative gets the sign for the angle's quadrant.
+static const TrigEntry *trig_lookup(TrigFunc f, gint64 deg, gboolean *negative) {
+    gint64 d = deg % 360;
+    if (d < 0) d += 360;
+
+    int quadrant;
+    gint64 ref;
+    if (d <= 90) { quadrant = 0; ref = d; }
+    else if (d <= 180) { quadrant = 1; ref = 180 - d; }
+    else if (d <= 270) { quadrant = 2; ref = d - 180; }
+    else { quadrant = 3; ref = 360 - d; }
+    if (ref % 3 != 0) return NULL;
+
+    const TrigSpec *spec = &trig_specs[f];
+    if (spec->complement) ref = 90 - ref;
+    const TrigEntry *e = &spec->table[ref / 3];
+    if (!e->display) return NULL;
+    *negative = (spec->negative >> quadrant) & 1;
+    return e;
+}
+
+static gint64 gcd64(gint64 a, gint64 b) {
+    if (a < 0) a = -a;
+    if (b < 0) b = -b;
+    while (b) {
+        gint64 t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static gboolean rat_normalize(gint64 *num, gint64 *den) {
+    if (*den < 0) { *num = -*num; *den = -*den; }
+    gint64 g = gcd64(*num, *den);
+    if (g > 1) { *num /= g; *den /= g; }
+    if (*num == 0) *den = 1;
+    return *num > -EXACT_COEF_LIMIT && *num < EXACT_COEF_LIMIT && *den < EXACT_COEF_LIMIT;
+}
+
+static gboolean exact_is_rational(const ExactNum *x) {
+    return x->n == 0 || (x->n == 1 && x->t[0].s == 1 && x->t[0].nest == NEST_NONE);
+}
+
+// Adds num/den * sqrt(s1) * sqrt(s2) * N to x, merging like terms.
+static gboolean exact_add_term(ExactNum *x, gint64 num, gint64 den, gint64 s1, gint64 s2, int nest) {
+    gint64 g = gcd64(s1, s2);
+    gint64 s = (s1 / g) * (s2 / g);
+    num *= g;
+    if (s >= EXACT_COEF_LIMIT || !rat_normalize(&num, &den)) return FALSE;
+    if (num == 0) return TRUE;
+
+    for (int i = 0; i < x->n; i++) {
+        ExactTerm *t = &x->t[i];
+        if (t->s != s || t->nest != nest) continue;
+        gint64 n2 = t->num * den + num * t->den;
+        gint64 d2 = t->den * den;
+        if (!rat_normalize(&n2, &d2)) return FALSE;
+        if (n2 == 0) {
+            x->t[i] = x->t[--x->n];
+        } else {
+            t->num = n2;
+            t->den = d2;
+        }
+        return TRUE;
+    }
+    if (x->n == EXACT_MAX_TERMS) return FALSE;
+    x->t[x->n++] = (ExactTerm){ num, den, s, nest };
+    return TRUE;
+}
+
+static gboolean exact_add(ExactNum *out, const ExactNum *a, const ExactNum *b, int sign) {
+    ExactNum r = *a;
+    for (int i = 0; i < b->n; i++) {
+        const ExactTerm *t = &b->t[i];
+        if (!exact_add_term(&r, sign * t->num, t->den, t->s, 1, t->nest)) return FALSE;
+    }
+    *out = r;
+    return TRUE;
+}
+
+static gboolean exact_mul(ExactNum *out, const ExactNum *a, const ExactNum *b) {
+    ExactNum r = { 0 };
+    for (int i = 0; i < a->n; i++) {
+        for (int j = 0; j < b->n; j++) {
+            const ExactTerm *x = &a->t[i];
+            const ExactTerm *y = &b->t[j];
+            gint64 num = x->num * y->num;
+            gint64 den = x->den * y->den;
+            if (!rat_normalize(&num, &den)) return FALSE;
+
+            gint64 g = gcd64(x->s, y->s);
+            gint64 s = (x->s / g) * (y->s / g);
+            num *= g;
+            if (s >= EXACT_COEF_LIMIT || !rat_normalize(&num, &den)) return FALSE;
+
+            gboolean ok;
+            if (x->nest == NEST_NONE || y->nest == NEST_NONE) {
+                ok = exact_add_term(&r, num, den, s, 1, x->nest | y->nest);
+            } else if (x->nest == y->nest) {
+                // A*A = 10+2*sqrt(5), B*B = 10-2*sqrt(5)
+                int sign = (x->nest == NEST_A) ? 1 : -1;
+                ok = exact_add_term(&r, num * 10, den, s, 1, NEST_NONE) &&
+                     exact_add_term(&r, num * 2 * sign, den, s, 5, NEST_NONE);
+            } else {
+                // A*B = 4*sqrt(5)
+                ok = exact_add_term(&r, num * 4, den, s, 5, NEST_NONE);
+            }
+            if (!ok) return FALSE;
+        }
+    }
+    *out = r;
+    return TRUE;
+}
+
+static int smallest_prime_factor(gint64 s) {
+    for (gint64 p = 2; p * p <= s; p++) {
+        if (s % p == 0) return (int)p;
+    }
+    return (int)s;
+}
+
+// 1/x by multiplying through by conjugates: first A -> -A, B -> -B, which leaves a value without
+// nested radicals, then sqrt(p) -> -sqrt(p) for each prime p left under a radical.
+static gboolean exact_inv(ExactNum *out, const ExactNum *x) {
+    if (x->n == 0) return FALSE;
+    ExactNum num = { 1, { { 1, 1, 1, NEST_NONE } } };
+    ExactNum den = *x;
+
+    for (int round = 0; round < EXACT_MAX_TERMS && !exact_is_rational(&den); round++) {
+        ExactNum conj = den;
+        gboolean nested = FALSE;
+        for (int i = 0; i < den.n; i++) nested |= den.t[i].nest != NEST_NONE;
+        if (nested) {
+            for (int i = 0; i < conj.n; i++) {
+                if (conj.t[i].nest != NEST_NONE) conj.t[i].num = -conj.t[i].num;
+            }
+        } else {
+            int p = 0;
+            for (int i = 0; i < den.n && !p; i++) {
+                if (den.t[i].s > 1) p = smallest_prime_factor(den.t[i].s);
+            }
+            if (!p) return FALSE;
+            for (int i = 0; i < conj.n; i++) {
+                if (conj.t[i].s % p == 0) conj.t[i].num = -conj.t[i].num;
+            }
+        }
+        if (!exact_mul(&num, &num, &conj) || !exact_mul(&den, &den, &conj)) return FALSE;
+    }
+    if (!exact_is_rational(&den) || den.n == 0) return FALSE;
+
+    ExactNum scale = { 1, { { den.t[0].den, den.t[0].num, 1, NEST_NONE } } };
+    if (!rat_normalize(&scale.t[0].num, &scale.t[0].den)) return FALSE;
+    return exact_mul(out, &num, &scale);
+}
+
+static gboolean exact_pow(ExactNum *out, const ExactNum *x, gint64 n) {
+    ExactNum base = *x;
+    ExactNum acc = { 1, { { 1, 1, 1, NEST_NONE } } };
+    if (n < 0) {
+        if (!exact_inv(&base, &base)) return FALSE;
+        n = -n;
+    }
+    for (;;) {
+        if ((n & 1) && !exact_mul(&acc, &acc, &base)) return FALSE;
+        n >>= 1;
+        if (!n) break;
+        if (!exact_mul(&base, &base, &base)) return FALSE;
+    }
+    *out = acc;
+    return TRUE;
+}
+
+// sqrt of a non-negative rational: sqrt(p/q) = sqrt(p*q)/q with square factors pulled out.
+static gboolean exact_sqrt(ExactNum *out, const ExactNum *x) {
+    if (!exact_is_rational(x)) return FALSE;
+    if (x->n == 0) { out->n = 0; return TRUE; }
+    if (x->t[0].num < 0) return FALSE;
+    gint64 radicand = x->t[0].num * x->t[0].den;
+    if (radicand >= ((gint64)1 << 32)) return FALSE;
+
+    gint64 outside = 1;
+    for (gint64 f = 2; f * f <= radicand; f++) {
+        while (radicand % (f * f) == 0) {
+            radicand /= f * f;
+            outside *= f;
+        }
+    }
+    ExactNum r = { 0 };
+    if (!exact_add_term(&r, outside, x->t[0].den, radicand, 1, NEST_NONE)) return FALSE;
+    *out = r;
+    return TRUE;
+}
+
+static const ExactNum *entry_value(const TrigEntry *e, gboolean negative, ExactNum *tmp) {
+    if (!negative) return &e->value;
+    *tmp = e->value;
+    for (int i = 0; i < tmp->n; i++) tmp->t[i].num = -tmp->t[i].num;
+    return tmp;
+}
+
+static double nest_value(int nest) {
+    if (nest == NEST_A) return sqrt(10.0 + 2.0 * sqrt(5.0));
+    if (nest == NEST_B) return sqrt(10.0 - 2.0 * sqrt(5.0));
+    return 1.0;
+}
+
+static double exact_to_double(const ExactNum *x) {
+    double sum = 0.0;
+    for (int i = 0; i < x->n; i++) {
+        const ExactTerm *t = &x->t[i];
+        double r = (t->s == 1) ? 1.0 : sqrt((double)t->s);
+        sum += (double)t->num * r * nest_value(t->nest) / (double)t->den;
+    }
+    return sum;
+}
+
+static int term_order(const void *a, const void *b) {
+    const ExactTerm *x = a;
+    const ExactTerm *y = b;
+    if (x->nest != y->nest) return x->nest - y->nest;
+    return (x->s > y->s) - (x->s < y->s);
+}
+
+// Writes terms like "1+sqrt(2)/2" or "sqrt(5)*sqrt(10-2*sqrt(5))/4".
+static void exact_format(const ExactNum *x, char *out, size_t out_cap) {
+    if (x->n == 0) {
+        g_snprintf(out, out_cap, "0");
+        return;
+    }
+    ExactNum sorted = *x;
+    qsort(sorted.t, (size_t)sorted.n, sizeof(ExactTerm), term_order);
+
+    GString *s = g_string_sized_new(64);
+    for (int i = 0; i < sorted.n; i++) {
+        const ExactTerm *t = &sorted.t[i];
+        gint64 mag = t->num < 0 ? -t->num : t->num;
+        if (t->num < 0) g_string_append_c(s, '-');
+        else if (i > 0) g_string_append_c(s, '+');
+
+        gboolean radical = t->s > 1 || t->nest != NEST_NONE;
+        if (!radical || mag != 1) {
+            g_string_append_printf(s, "%" G_GINT64_FORMAT, mag);
+            if (radical) g_string_append_c(s, '*');
+        }
+        if (t->s > 1) {
+            g_string_append_printf(s, "sqrt(%" G_GINT64_FORMAT ")", t->s);
+            if (t->nest != NEST_NONE) g_string_append_c(s, '*');
+        }
+        if (t->nest == NEST_A) g_string_append(s, "sqrt(10+2*sqrt(5))");
+        if (t->nest == NEST_B) g_string_append(s, "sqrt(10-2*sqrt(5))");
+        if (t->den != 1) g_string_append_printf(s, "/%" G_GINT64_FORMAT, t->den);
+    }
+    g_snprintf(out, out_cap, "%s", s->str);
+    g_string_free(s, TRUE);
+}
+
+// Reads a literal with an integer value ("12", "30.0", "1.5e3"). Other literals, such as "0.1",
+// are decimals the user typed and stay decimals: the numeric path handles them.
+static gboolean parse_integer(const char *p, ExactNum *out) {
+    gint64 num = 0;
+    gint64 den = 1;
+    int digits = 0;
+    gboolean fraction = FALSE;
+
+    for (;; p++) {
+        if (*p == '.' && !fraction) { fraction = TRUE; continue; }
+        if (!g_ascii_isdigit(*p)) break;
+        if (num >= EXACT_COEF_LIMIT || den >= EXACT_COEF_LIMIT) return FALSE;
+        num = num * 10 + (*p - '0');
+        if (fraction) den *= 10;
+        digits++;
+    }
+    if (digits == 0) return FALSE;
+    if (*p == 'e' || *p == 'E') {
+        char *end = NULL;
+        long e = strtol(p + 1, &end, 10);
+        if (end == p + 1 || e > 9 || e < -9) return FALSE;
+        for (; e > 0; e--) num *= 10;
+        for (; e < 0; e++) den *= 10;
+    } else if (*p == 'x' || *p == 'X' || *p == 'p' || *p == 'P') {
+        return FALSE; // hexadecimal float
+    }
+    if (!rat_normalize(&num, &den) || den != 1) return FALSE;
+    out->n = 0;
+    if (num != 0) out->t[out->n++] = (ExactTerm){ num, den, 1, NEST_NONE };
+    return TRUE;
+}
+
+// The value as an integer, if it is one.
+static gboolean exact_integer(const ExactNum *x, gint64 *deg) {
+    if (!exact_is_rational(x)) return FALSE;
+    if (x->n == 0) { *deg = 0; return TRUE; }
+    if (x->t[0].den != 1) return FALSE;
+    *deg = x->t[0].num;
+    return TRUE;
+}
+
+// Evaluates the RPN exactly. Returns FALSE (err empty) as soon as anything falls outside the
+// exact forms, or with err set when a trig function is hit at one of its poles.
+static gboolean eval_exact_rpn(const char *expr, const Token *rpn, size_t count, ExactNum *stack,
+                               ExactNum *out, gboolean *used_table, char *err, size_t err_cap) {
+    size_t depth = 0;
+    ExactNum tmp;
+
+    for (size_t i = 0; i < count; i++) {
+        const Token *t = &rpn[i];
+        if (t->type == TOK_NUM) {
+            if (!parse_integer(expr + t->slot, &stack[depth++])) return FALSE;
+            continue;
+        }
+        if (t->type != TOK_OP || t->op == 'F' || t->op == 'D' || t->op == 'M' || t->op == 'R') return FALSE;
+
+        if (calc_op_arity(t->op) == 1) {
+            if (depth < 1) return FALSE;
+            ExactNum *a = &stack[depth - 1];
+            TrigFunc f = trig_from_op(t->op);
+            gint64 deg;
+            if (f != TRIG_NONE) {
+                gboolean negative = FALSE;
+                const TrigEntry *e;
+                if (!exact_integer(a, &deg) || !(e = trig_lookup(f, deg, &negative))) return FALSE;
+                if (e->pole) {
+                    g_snprintf(err, err_cap, "%s undefined", trig_specs[f].name);
+                    return FALSE;
+                }
+                *a = *entry_value(e, negative, &tmp);
+                *used_table = TRUE;
+                continue;
+            }
+            switch (t->op) {
+                case 'u':
+                    for (int k = 0; k < a->n; k++) a->t[k].num = -a->t[k].num;
+                    break;
+                case 'Q':
+                    if (!exact_sqrt(a, a)) return FALSE;
+                    break;
+                default:
+                    return FALSE;
+            }
+            continue;
+        }
+
+        if (depth < 2) return FALSE;
+        ExactNum *b = &stack[--depth];
+        ExactNum *a = &stack[depth - 1];
+        gint64 n;
+        switch (t->op) {
+            case '+': if (!exact_add(a, a, b, 1)) return FALSE; break;
+            case '-': if (!exact_add(a, a, b, -1)) return FALSE; break;
+            case '*': if (!exact_mul(a, a, b)) return FALSE; break;
+            case '/':
+                if (!exact_inv(&tmp, b) || !exact_mul(a, a, &tmp)) return FALSE;
+                break;
+            case '^':
+            case 'P':
+                if (!exact_integer(b, &n) || n > EXACT_MAX_POWER || n < -EXACT_MAX_POWER) return FALSE;
+                if (n == 0 && a->n == 0) return FALSE;
+                if (!exact_pow(a, a, n)) return FALSE;
+                break;
+            default:
+                return FALSE;
+        }
+    }
+    if (depth != 1) return FALSE;
+    *out = stack[0];
+    return TRUE;
+}
+
+static gboolean exact_displayable(const ExactNum *x) {
+    for (int i = 0; i < x->n; i++) {
+        if (x->t[i].num <= -EXACT_DISPLAY_LIMIT || x->t[i].num >= EXACT_DISPLAY_LIMIT) return FALSE;
+        if (x->t[i].den >= EXACT_DISPLAY_LIMIT) return FALSE;
+    }
+    return TRUE;
+}
+
+// A display string needs parentheses before a leading minus if it is a sum at the top level.
+static gboolean is_sum(const char *s) {
+    int level = 0;
+    for (const char *p = s; *p; p++) {
+        if (*p == '(') level++;
+        else if (*p == ')') level--;
+        else if (level == 0 && p != s && (*p == '+' || *p == '-')) return TRUE;
+    }
+    return FALSE;
+}
+
+// Bare "<func>(<integer>)": answered straight from the table with its stored display string.
+static int try_bare_call(const char *expr, int *out_deg, char *display_out, size_t out_cap,
+                         double *out_val, char *err, size_t err_cap) {
+    const char *p = expr;
+    while (g_ascii_isspace(*p)) p++;
+    const char *name = p;
+    while (g_ascii_isalpha(*p)) p++;
+    TrigFunc f = trig_from_name(name, (size_t)(p - name));
+    while (g_ascii_isspace(*p)) p++;
+    if (f == TRIG_NONE || *p != '(') return -1;
+    p++;
+    while (g_ascii_isspace(*p)) p++;
+    // Integer angles are read directly; anything else ("30.0", "3e1") goes through calc_read_number().
+    gint64 deg = 0;
+    const char *q = p + (*p == '-' || *p == '+');
+    const char *digits = q;
+    while (g_ascii_isdigit(*q) && q - digits < 15) deg = deg * 10 + (*q++ - '0');
+    if (q > digits && !g_ascii_isdigit(*q) && *q != '.' && *q != 'e' && *q != 'E' && *q != 'x' && *q != 'X') {
+        if (*p == '-') deg = -deg;
+        p = q;
+    } else {
+        const char *stop;
+        double angle = calc_read_number(digits, digits + strlen(digits), &stop);
+        if (stop == digits || !(fabs(angle) < 1e15)) return -1;
+        if (*p == '-') angle = -angle;
+        deg = llround(angle);
+        if (fabs(angle - (double)deg) > 1e-9) return -1;
+        p = stop;
+    }
+    while (g_ascii_isspace(*p)) p++;
+    if (*p != ')') return -1;
+    p++;
+    while (g_ascii_isspace(*p)) p++;
+    if (*p != '\0') return -1;
+    if (out_deg) *out_deg = (int)deg;
+
+    gboolean negative = FALSE;
+    const TrigEntry *e = trig_lookup(f, deg, &negative);
+    if (!e) return 0;
+    if (e->pole) {
+        g_snprintf(err, err_cap, "%s undefined", trig_specs[f].name);
+        return 0;
+    }
+    *out_val = (negative && e->value.n) ? -e->approx : e->approx;
+    if (!negative || e->value.n == 0) {
+        g_strlcpy(display_out, e->display, out_cap);
+    } else if (is_sum(e->display)) {
+        g_snprintf(display_out, out_cap, "-(%s)", e->display);
+    } else if (out_cap > 1) {
+        display_out[0] = '-';
+        g_strlcpy(display_out + 1, e->display, out_cap - 1);
+    }
+    return 1;
+}
+
+// Cheap scan before parsing. A trig call with a literal angle at one of its poles is an error
+// wherever it appears, with err set, so that "tan(90)+sin(1)" fails like "1+tan(90)" does rather
+// than going on to the numeric path. Otherwise the exact path fails outright if any call has a
+// literal angle the table does not cover, and can only succeed if some call may hit the table.
+static gboolean worth_parsing(const char *expr, char *err, size_t err_cap) {
+    gboolean candidate = FALSE;
+    gboolean covered = TRUE;
+    for (const char *p = expr; *p; p++) {
+        if (!g_ascii_isalpha(*p) || (p > expr && g_ascii_isalpha(p[-1]))) continue;
+        const char *name = p;
+        while (g_ascii_isalpha(p[1])) p++;
+        TrigFunc f = trig_from_name(name, (size_t)(p - name + 1));
+        if (f == TRIG_NONE) continue;
+
+        const char *q = p + 1;
+        while (g_ascii_isspace(*q)) q++;
+        if (*q != '(') continue;
+        q++;
+        while (g_ascii_isspace(*q)) q++;
+        gboolean minus = (*q == '-');
+        if (*q == '-' || *q == '+') q++;
+        const char *digits = q;
+        gint64 deg = 0;
+        while (g_ascii_isdigit(*q) && q - digits < 15) deg = deg * 10 + (*q++ - '0');
+        while (g_ascii_isspace(*q)) q++;
+        if (q > digits && *q == ')') {
+            gboolean negative;
+            const TrigEntry *e = trig_lookup(f, minus ? -deg : deg, &negative);
+            if (!e) {
+                covered = FALSE;
+                continue;
+            }
+            if (e->pole) {
+                g_snprintf(err, err_cap, "%s undefined", trig_specs[f].name);
+                return FALSE;
+            }
+        }
+        candidate = TRUE;
+    }
+    return candidate && covered;
+}
+
+static gboolean try_special_trig(const char *expr, int *out_deg, char *display_out, size_t out_cap,
+                                 double *out_val, char *err, size_t err_cap) {
+    int bare = try_bare_call(expr, out_deg, display_out, out_cap, out_val, err, err_cap);
+    if (bare >= 0) return bare;
+
+    if (!worth_parsing(expr, err, err_cap)) return FALSE;
+
+    CalcScratch *scratch = calc_scratch_get();
+    size_t count = 0;
+    char parse_err[8];
+    if (!calc_parse(scratch, expr, NULL, 0, &count, parse_err, sizeof(parse_err))) return FALSE;
+
+    ExactNum *stack = g_new(ExactNum, MAX(count, (size_t)1));
+    ExactNum value;
+    gboolean used_table = FALSE;
+    gboolean ok = eval_exact_rpn(expr, scratch->rpn, count, stack, &value, &used_table, err, err_cap) &&
+                  used_table && exact_displayable(&value);
+    g_free(stack);
+    if (!ok) return FALSE;
+
+    exact_format(&value, display_out, out_cap);
+    *out_val = exact_to_double(&value);
+    return TRUE;
+}
+
+gboolean calc_try_special_trig(const char *expr, int *out_deg, char *display_out, size_t out_cap,
+                               double *out_val, char *err, size_t err_cap) {
+    CALC_TRACE_BEGIN(start);
+    gboolean ok = try_special_trig(expr, out_deg, display_out, out_cap, out_val, err, err_cap);
+    CALC_TRACE_END(CALC_TRACE_EXACT, start);
+    return ok;
+}
@@ -0,0 +1,331 @@
+#include "calc_eval.h"
+#include "calc_internal.h"
+
+#include <math.h>
+#include <string.h>
+
+// Function registry. Built-in names resolve through a perfect hash over a fixed table; names
+// registered at runtime live in a hash table behind a reader/writer lock, which the parser only
+// consults when the built-in lookup misses. Functions are never removed, so a compiled 'F'
+// token can keep its function's index for the lifetime of the process.
+
+#define USER_FUNCS_MAX 1024
+
+// (11*first + 2*last + second + length) mod 128 is collision-free for the built-in names. C cannot
+// hash string literals in a constant expression, so the bench suite checks it instead, through
+// calc_func_builtin_collision(): `make bench` fails before a colliding table ships.
+#define BUILTIN_HASH_SIZE 128
+
+static guint builtin_hash(const char *name, size_t len) {
+    return (11u * (guchar)name[0] + 2u * (guchar)name[len - 1] + (guchar)name[1] + (guint)len) % BUILTIN_HASH_SIZE;
+}
+
+static gboolean fn_asin(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    if (a[0] < -1.0 || a[0] > 1.0) return FALSE;
+    *out = asin(a[0]);
+    return TRUE;
+}
+
+static gboolean fn_acos(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    if (a[0] < -1.0 || a[0] > 1.0) return FALSE;
+    *out = acos(a[0]);
+    return TRUE;
+}
+
+static gboolean fn_atan(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    *out = atan(a[0]);
+    return TRUE;
+}
+
+static gboolean fn_sinh(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    *out = sinh(a[0]);
+    return TRUE;
+}
+
+static gboolean fn_cosh(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    *out = cosh(a[0]);
+    return TRUE;
+}
+
+static gboolean fn_tanh(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    *out = tanh(a[0]);
+    return TRUE;
+}
+
+static gboolean fn_asinh(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    *out = asinh(a[0]);
+    return TRUE;
+}
+
+static gboolean fn_acosh(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    if (a[0] < 1.0) return FALSE;
+    *out = acosh(a[0]);
+    return TRUE;
+}
+
+static gboolean fn_atanh(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    if (a[0] <= -1.0 || a[0] >= 1.0) return FALSE;
+    *out = atanh(a[0]);
+    return TRUE;
+}
+
+static gboolean fn_atan2(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    *out = atan2(a[0], a[1]);
+    return TRUE;
+}
+
+static gboolean fn_hypot(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    *out = hypot(a[0], a[1]);
+    return TRUE;
+}
+
+static gboolean fn_min(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    *out = (a[1] < a[0]) ? a[1] : a[0];
+    return TRUE;
+}
+
+static gboolean fn_max(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    *out = (a[1] > a[0]) ? a[1] : a[0];
+    return TRUE;
+}
+
+static gboolean fn_cbrt(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    *out = cbrt(a[0]);
+    return TRUE;
+}
+
+static gboolean fn_floor(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    *out = floor(a[0]);
+    return TRUE;
+}
+
+static gboolean fn_ceil(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    *out = ceil(a[0]);
+    return TRUE;
+}
+
+static gboolean fn_round(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    *out = round(a[0]);
+    return TRUE;
+}
+
+// The matrix functions on numbers, which are 1x1 matrices; calc_matrix.c handles the rest.
+// det() and transpose() of a number are the number.
+static gboolean fn_same(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    *out = a[0];
+    return TRUE;
+}
+
+static gboolean fn_inv(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    if (a[0] == 0.0) return FALSE;
+    *out = 1.0 / a[0];
+    return TRUE;
+}
+
+static gboolean fn_solve(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    if (a[0] == 0.0) return FALSE;
+    *out = a[1] / a[0];
+    return TRUE;
+}
+
+static gboolean fn_dot(const double *a, double *out, gpointer user_data) {
+    (void)user_data;
+    *out = a[0] * a[1];
+    return TRUE;
+}
+
+#define PURE CALC_FUNC_PURE
+#define ANGLE (CALC_FUNC_PURE | CALC_FUNC_ANGLE_RESULT)
+
+// Indexed by CalcBuiltin. Functions with their own opcode are evaluated inline by every backend;
+// the rest compile to 'F' calls.
+static const CalcFunc builtins[CALC_FN_BUILTIN_COUNT] = {
+    [CALC_FN_SIN]   = { "sin", 'S', 1, PURE, NULL, NULL },
+    [CALC_FN_COS]   = { "cos", 'C', 1, PURE, NULL, NULL },
+    [CALC_FN_TAN]   = { "tan", 'T', 1, PURE, NULL, NULL },
+    [CALC_FN_SQRT]  = { "sqrt", 'Q', 1, PURE, NULL, NULL },
+    [CALC_FN_LOG]   = { "log", 'L', 1, PURE, NULL, NULL },
+    [CALC_FN_LN]    = { "ln", 'N', 1, PURE, NULL, NULL },
+    [CALC_FN_LOG2]  = { "log2", 'G', 1, PURE, NULL, NULL },
+    [CALC_FN_ABS]   = { "abs", 'A', 1, PURE, NULL, NULL },
+    [CALC_FN_EXP]   = { "exp", 'E', 1, PURE, NULL, NULL },
+    [CALC_FN_POW]   = { "pow", 'P', 2, PURE, NULL, NULL },
+    [CALC_FN_CSC]   = { "csc", 'I', 1, PURE, NULL, NULL },
+    [CALC_FN_SEC]   = { "sec", 'J', 1, PURE, NULL, NULL },
+    [CALC_FN_COT]   = { "cot", 'K', 1, PURE, NULL, NULL },
+    [CALC_FN_ASIN]  = { "asin", 'F', 1, ANGLE, fn_asin, NULL },
+    [CALC_FN_ACOS]  = { "acos", 'F', 1, ANGLE, fn_acos, NULL },
+    [CALC_FN_ATAN]  = { "atan", 'F', 1, ANGLE, fn_atan, NULL },
+    [CALC_FN_SINH]  = { "sinh", 'F', 1, PURE, fn_sinh, NULL },
+    [CALC_FN_COSH]  = { "cosh", 'F', 1, PURE, fn_cosh, NULL },
+    [CALC_FN_TANH]  = { "tanh", 'F', 1, PURE, fn_tanh, NULL },
+    [CALC_FN_ASINH] = { "asinh", 'F', 1, PURE, fn_asinh, NULL },
+    [CALC_FN_ACOSH] = { "acosh", 'F', 1, PURE, fn_acosh, NULL },
+    [CALC_FN_ATANH] = { "atanh", 'F', 1, PURE, fn_atanh, NULL },
+    [CALC_FN_ATAN2] = { "atan2", 'F', 2, ANGLE, fn_atan2, NULL },
+    [CALC_FN_HYPOT] = { "hypot", 'F', 2, PURE, fn_hypot, NULL },
+    [CALC_FN_MIN]   = { "min", 'F', 2, PURE, fn_min, NULL },
+    [CALC_FN_MAX]   = { "max", 'F', 2, PURE, fn_max, NULL },
+    [CALC_FN_CBRT]  = { "cbrt", 'F', 1, PURE, fn_cbrt, NULL },
+    [CALC_FN_FLOOR] = { "floor", 'F', 1, PURE, fn_floor, NULL },
+    [CALC_FN_CEIL]  = { "ceil", 'F', 1, PURE, fn_ceil, NULL },
+    [CALC_FN_ROUND] = { "round", 'F', 1, PURE, fn_round, NULL },
+    [CALC_FN_DET]   = { "det", 'F', 1, PURE, fn_same, NULL },
+    [CALC_FN_INV]   = { "inv", 'F', 1, PURE, fn_inv, NULL },
+    [CALC_FN_TRANSPOSE] = { "transpose", 'F', 1, PURE, fn_same, NULL },
+    [CALC_FN_SOLVE] = { "solve", 'F', 2, PURE, fn_solve, NULL },
+    [CALC_FN_DOT]   = { "dot", 'F', 2, PURE, fn_dot, NULL },
+};
+
+#undef PURE
+#undef ANGLE
+
+static gint8 builtin_slots[BUILTIN_HASH_SIZE]; // hash -> builtin index, -1 when empty
+
+static CalcFunc *user_funcs[USER_FUNCS_MAX];
+static gint n_user_funcs;
+static GHashTable *user_index; // name -> index + 1
+static GRWLock user_lock;
+
+static void builtin_slots_init(void) {
+    static gsize done = 0;
+    if (!g_once_init_enter(&done)) return;
+    memset(builtin_slots, -1, sizeof(builtin_slots));
+    for (int i = 0; i < CALC_FN_BUILTIN_COUNT; i++) {
+        builtin_slots[builtin_hash(builtins[i].name, strlen(builtins[i].name))] = (gint8)i;
+    }
+    user_index = g_hash_table_new(g_str_hash, g_str_equal);
+    g_once_init_leave(&done, 1);
+}
+
+const char *calc_func_builtin_collision(void) {
+    gint8 seen[BUILTIN_HASH_SIZE];
+    memset(seen, -1, sizeof(seen));
+    for (int i = 0; i < CALC_FN_BUILTIN_COUNT; i++) {
+        guint h = builtin_hash(builtins[i].name, strlen(builtins[i].name));
+        if (seen[h] >= 0) return builtins[i].name;
+        seen[h] = (gint8)i;
+    }
+    return NULL;
+}
+
+static int builtin_find(const char *name, size_t len) {
+    if (len < 2) return -1;
+    int i = builtin_slots[builtin_hash(name, len)];
+    if (i >= 0 && strncmp(builtins[i].name, name, len) == 0 && builtins[i].name[len] == '\0') return i;
+    return -1;
+}
+
+const CalcFunc *calc_func_lookup(const char *name, size_t len, int *index) {
+    builtin_slots_init();
+
+    int i = builtin_find(name, len);
+    if (i >= 0) {
+        *index = i;
+        return &builtins[i];
+    }
+    if (g_atomic_int_get(&n_user_funcs) == 0) return NULL;
+
+    char inline_name[64];
+    char *key = (len < sizeof(inline_name)) ? inline_name : g_malloc(len + 1);
+    memcpy(key, name, len);
+    key[len] = '\0';
+    g_rw_lock_reader_lock(&user_lock);
+    gsize slot = GPOINTER_TO_SIZE(g_hash_table_lookup(user_index, key));
+    g_rw_lock_reader_unlock(&user_lock);
+    if (key != inline_name) g_free(key);
+
+    if (slot == 0) return NULL;
+    *index = CALC_FN_BUILTIN_COUNT + (int)slot - 1;
+    return user_funcs[slot - 1];
+}
+
+const CalcFunc *calc_func_get(int index) {
+    if (index < CALC_FN_BUILTIN_COUNT) return &builtins[index];
+    return user_funcs[index - CALC_FN_BUILTIN_COUNT];
+}
+
+guint calc_func_generation(void) {
+    return (guint)g_atomic_int_get(&n_user_funcs);
+}
+
+int calc_token_arity(const Token *t) {
+    if (t->op == 'F') return calc_func_get(t->slot)->arity;
+    if (t->op == 'M') return (int)t->value * t->slot;
+    return calc_op_arity(t->op);
+}
+
+gboolean calc_token_pure(const Token *t) {
+    if (t->op == 'R') return FALSE;
+    return t->op != 'F' || (calc_func_get(t->slot)->flags & CALC_FUNC_PURE);
+}
+
+static gboolean valid_name(const char *name) {
+    if (!g_ascii_isalpha(name[0])) return FALSE;
+    for (const char *p = name; *p; p++) {
+        if (!g_ascii_isalnum(*p) && *p != '_') return FALSE;
+    }
+    return TRUE;
+}
+
+gboolean calc_register_function(const char *name, guint arity, CalcFuncFlags flags, CalcNativeFn fn,
+                                gpointer user_data, char *err, size_t err_cap) {
+    builtin_slots_init();
+
+    if (!name || !valid_name(name)) {
+        g_snprintf(err, err_cap, "invalid function name");
+        return FALSE;
+    }
+    if (arity < 1 || arity > CALC_FUNC_MAX_ARGS) {
+        g_snprintf(err, err_cap, "arity must be between 1 and %d", CALC_FUNC_MAX_ARGS);
+        return FALSE;
+    }
+    if (!fn) {
+        g_snprintf(err, err_cap, "missing function");
+        return FALSE;
+    }
+
+    gboolean ok = FALSE;
+    g_rw_lock_writer_lock(&user_lock);
+    gint n = g_atomic_int_get(&n_user_funcs);
+    // diff is parsed as a form of its own (see parse_diff() in calc_eval.c), not a registry call.
+    if (builtin_find(name, strlen(name)) >= 0 || strcmp(name, "diff") == 0 || g_hash_table_contains(user_index, name)) {
+        g_snprintf(err, err_cap, "function already defined: %s", name);
+    } else if (n == USER_FUNCS_MAX) {
+        g_snprintf(err, err_cap, "too many functions");
+    } else {
+        CalcFunc *f = g_new0(CalcFunc, 1);
+        f->name = g_strdup(name);
+        f->op = 'F';
+        f->arity = (int)arity;
+        f->flags = flags;
+        f->fn = fn;
+        f->user_data = user_data;
+        user_funcs[n] = f;
+        g_hash_table_insert(user_index, (gpointer)f->name, GSIZE_TO_POINTER((gsize)n + 1));
+        g_atomic_int_set(&n_user_funcs, n + 1);
+        ok = TRUE;
+    }
+    g_rw_lock_writer_unlock(&user_lock);
+    return ok;
+}
@@ -0,0 +1,505 @@
+#include "calc_incremental.h"
+#include "calc_internal.h"
+#include "calc_workspace.h"
+
+#include <math.h>
+#include <string.h>
+
+// Incremental evaluation for the live preview. The parser is shunting_yard() from calc_eval.c
+// with each operator applied as soon as it leaves the operator stack, so after every token the
+// complete parse state is two stacks and a few flags. Both stacks are linked lists in append-only
+// arenas: saving the state at a token boundary is one Checkpoint record, and going back to it is
+// truncating the arenas. An edit at byte k keeps every token whose lexing never looked at byte k
+// or beyond and parses the rest again; typing at the end re-reads only the last token.
+
+typedef struct {
+    double value;
+    gint32 below; // next value down the stack, -1 at the bottom
+} ValNode;
+
+typedef struct {
+    Token op; // '(' entries count their arguments in slot, as in calc_eval.c
+    gint32 below;
+} OpNode;
+
+enum { PREV_NONE, PREV_NUM, PREV_OP, PREV_LPAREN, PREV_RPAREN };
+
+typedef struct {
+    gint32 vals;     // top of the value stack, -1 when empty
+    gint32 ops;      // top of the operator stack, -1 when empty
+    gint32 error;    // first evaluation error, index into CalcIncremental.errors; -1 if none
+    guint8 prev;     // kind of the previous token, as in shunting_yard()
+    gboolean domain; // an operation left the reals, see calc_incremental_left_reals()
+    gboolean malformed; // an operator lacked operands; outranks error, as in calc_eval()
+    size_t offset;   // bytes of text consumed
+    size_t scan_end; // bytes the lexer looked at to get here; reading the end of the text counts
+    guint n_vals;    // arena lengths when the checkpoint was taken
+    guint n_ops;
+    guint n_errors;
+} Checkpoint;
+
+struct CalcIncremental {
+    GString *text;
+    gboolean degrees;
+    GArray *vals;        // ValNode
+    GArray *ops;         // OpNode
+    GPtrArray *errors;   // evaluation error messages
+    GArray *checkpoints; // state after each token; [0] is the state before the first
+    char *parse_error;   // error that stopped the parse, NULL if it reached the end of the text
+    CalcIncrementalConstruct unsupported; // what stopped the parse, if the parser does not handle it
+    size_t parse_error_scan_end;
+    size_t dirty;        // first byte edited since the last parse, G_MAXSIZE if none
+    guint funcs;         // calc_func_generation() when the text was parsed
+    gboolean left_reals; // set by the last calc_incremental_result()
+    CalcIncrementalLookup lookup;
+    gpointer lookup_data;
+    size_t first_name;   // offset of the first name passed to lookup, G_MAXSIZE if none
+    guint n_equals;      // '=' in the text
+    guint n_separators;  // ';' and newlines in the text
+    guint n_nesting;     // '(' and '[' in the text
+    guint n_quotes;      // '"' in the text
+};
+
+CalcIncremental *calc_incremental_new(void) {
+    CalcIncremental *inc = g_new0(CalcIncremental, 1);
+    inc->text = g_string_new(NULL);
+    inc->vals = g_array_new(FALSE, FALSE, sizeof(ValNode));
+    inc->ops = g_array_new(FALSE, FALSE, sizeof(OpNode));
+    inc->errors = g_ptr_array_new_with_free_func(g_free);
+    inc->checkpoints = g_array_new(FALSE, FALSE, sizeof(Checkpoint));
+    Checkpoint start = { .vals = -1, .ops = -1, .error = -1, .prev = PREV_NONE };
+    g_array_append_val(inc->checkpoints, start);
+    inc->funcs = calc_func_generation();
+    inc->first_name = G_MAXSIZE;
+    return inc;
+}
+
+void calc_incremental_free(CalcIncremental *inc) {
+    if (!inc) return;
+    g_string_free(inc->text, TRUE);
+    g_array_unref(inc->vals);
+    g_array_unref(inc->ops);
+    g_ptr_array_unref(inc->errors);
+    g_array_unref(inc->checkpoints);
+    g_free(inc->parse_error);
+    g_free(inc);
+}
+
+static void mark_dirty(CalcIncremental *inc, size_t offset) {
+    if (offset < inc->dirty) inc->dirty = offset;
+}
+
+void calc_incremental_set_degrees(CalcIncremental *inc, gboolean degrees) {
+    if (inc->degrees == degrees) return;
+    inc->degrees = degrees;
+    mark_dirty(inc, 0);
+    g_clear_pointer(&inc->parse_error, g_free);
+    inc->unsupported = CALC_INCREMENTAL_SUPPORTED;
+}
+
+void calc_incremental_set_lookup(CalcIncremental *inc, CalcIncrementalLookup lookup, gpointer user_data) {
+    inc->lookup = lookup;
+    inc->lookup_data = user_data;
+    mark_dirty(inc, 0);
+    g_clear_pointer(&inc->parse_error, g_free);
+    inc->unsupported = CALC_INCREMENTAL_SUPPORTED;
+}
+
+void calc_incremental_names_changed(CalcIncremental *inc) {
+    if (inc->first_name == G_MAXSIZE) return;
+    mark_dirty(inc, inc->first_name);
+}
+
+// Keeps the counts behind calc_incremental_is_program() as text is inserted (+1) or removed (-1).
+static void count_statement_chars(CalcIncremental *inc, const char *text, size_t len, int sign) {
+    for (size_t i = 0; i < len; i++) {
+        switch (text[i]) {
+            case '=': inc->n_equals += sign; break;
+            case ';': case '\n': inc->n_separators += sign; break;
+            case '(': case '[': inc->n_nesting += sign; break;
+            case '"': inc->n_quotes += sign; break;
+        }
+    }
+}
+
+void calc_incremental_insert(CalcIncremental *inc, size_t offset, const char *text, size_t len) {
+    g_return_if_fail(offset <= inc->text->len);
+    count_statement_chars(inc, text, len, 1);
+    g_string_insert_len(inc->text, (gssize)offset, text, (gssize)len);
+    mark_dirty(inc, offset);
+}
+
+void calc_incremental_delete(CalcIncremental *inc, size_t offset, size_t len) {
+    g_return_if_fail(offset + len <= inc->text->len);
+    count_statement_chars(inc, inc->text->str + offset, len, -1);
+    g_string_erase(inc->text, (gssize)offset, (gssize)len);
+    mark_dirty(inc, offset);
+}
+
+gboolean calc_incremental_is_program(const CalcIncremental *inc) {
+    // A quoted load() path may hold '=' or ';' that are neither.
+    if (inc->n_quotes > 0) return calc_workspace_is_program(inc->text->str);
+    if (inc->n_equals > 0) return TRUE;
+    if (inc->n_separators == 0) return FALSE;
+    // A ';' inside brackets separates matrix rows or is an error, not a statement; only then does
+    // the text need reading.
+    return inc->n_nesting == 0 || calc_workspace_is_program(inc->text->str);
+}
+
+const char *calc_incremental_text(const CalcIncremental *inc) {
+    return inc->text->str;
+}
+
+size_t calc_incremental_length(const CalcIncremental *inc) {
+    return inc->text->len;
+}
+
+static void push_val(CalcIncremental *inc, Checkpoint *st, double value, gint32 below) {
+    ValNode n = { value, below };
+    g_array_append_val(inc->vals, n);
+    st->vals = (gint32)inc->vals->len - 1;
+}
+
+static void push_op(CalcIncremental *inc, Checkpoint *st, Token op) {
+    OpNode n = { op, st->ops };
+    g_array_append_val(inc->ops, n);
+    st->ops = (gint32)inc->ops->len - 1;
+}
+
+// The '(' entry on top is copied before its argument count changes; nodes are never modified.
+static void count_argument(CalcIncremental *inc, Checkpoint *st) {
+    OpNode paren = g_array_index(inc->ops, OpNode, st->ops);
+    paren.op.slot++;
+    st->ops = paren.below;
+    push_op(inc, st, paren.op);
+}
+
+static Token pop_op(CalcIncremental *inc, Checkpoint *st) {
+    const OpNode *n = &g_array_index(inc->ops, OpNode, st->ops);
+    st->ops = n->below;
+    return n->op;
+}
+
+static char top_op(const CalcIncremental *inc, const Checkpoint *st) {
+    return st->ops >= 0 ? g_array_index(inc->ops, OpNode, st->ops).op.op : 0;
+}
+
+static void record_error(CalcIncremental *inc, Checkpoint *st, const char *msg, gboolean domain) {
+    g_ptr_array_add(inc->errors, g_strdup(msg));
+    st->error = (gint32)inc->errors->len - 1;
+    st->domain = domain;
+}
+
+// Replaces the operator's operands with its result, computed by the same evaluator as calc_eval()
+// so values and messages agree. After the first error values no longer matter, and the stacks are
+// only kept in shape for the parse and structure errors that still take precedence.
+static void apply(CalcIncremental *inc, Checkpoint *st, Token op) {
+    int arity = calc_token_arity(&op);
+    Token code[CALC_FUNC_MAX_ARGS + 1];
+    gint32 node = st->vals;
+    int have = 0;
+    for (; have < arity && node >= 0; have++) {
+        const ValNode *v = &g_array_index(inc->vals, ValNode, node);
+        code[arity - 1 - have] = (Token){ .type = TOK_NUM, .value = v->value };
+        node = v->below;
+    }
+
+    double r = NAN;
+    if (have < arity) st->malformed = TRUE;
+    if (st->error < 0) {
+        if (have < arity) {
+            record_error(inc, st, "invalid expression", FALSE);
+        } else {
+            double stack[CALC_FUNC_MAX_ARGS + 1];
+            char err[128];
+            code[arity] = op;
+            if (!calc_eval_rpn(code, (size_t)arity + 1, NULL, inc->degrees, stack, &r, err, sizeof(err))) {
+                // With the operands all there, these fail only for arguments outside their real domain.
+                char o = op.op;
+                record_error(inc, st, err, o == 'Q' || o == 'L' || o == 'N' || o == 'G' || o == 'F');
+            } else if ((op.op == '^' || op.op == 'P') && isnan(r) && !isnan(code[0].value) && !isnan(code[1].value)) {
+                st->domain = TRUE; // a negative base to a fractional power
+            }
+        }
+    }
+    push_val(inc, st, r, node);
+}
+
+// Pops the call of the function an argument list belongs to, if there is one.
+static gboolean close_call(CalcIncremental *inc, Checkpoint *st, int n_args, char *err, size_t err_cap) {
+    if (!calc_op_is_func(top_op(inc, st))) return TRUE;
+    Token t = pop_op(inc, st);
+    const CalcFunc *fn = calc_func_get(t.slot);
+    if (n_args != fn->arity) {
+        g_snprintf(err, err_cap, "%s takes %d argument%s", fn->name, fn->arity, fn->arity == 1 ? "" : "s");
+        return FALSE;
+    }
+    apply(inc, st, t);
+    return TRUE;
+}
+
+// Names the full parser treats as forms of their own rather than registry calls.
+static CalcIncrementalConstruct unsupported_name(const char *ident, size_t len) {
+    if (len == 1 && *ident == calc_imag_name[0]) return CALC_INCREMENTAL_COMPLEX;
+    if (len == 4 && memcmp(ident, "diff", 4) == 0) return CALC_INCREMENTAL_DIFF;
+    if ((len == 4 && memcmp(ident, "load", 4) == 0) || calc_data_stat_lookup(ident, len) >= 0) {
+        return CALC_INCREMENTAL_DATA;
+    }
+    return CALC_INCREMENTAL_SUPPORTED;
+}
+
+// Parses the token at st->offset. Returns FALSE at the end of the text, leaving err empty, or on
+// a parse error with the message in err. A construct the parser leaves to calc_eval() stops the
+// parse like an error, with inc->unsupported saying which.
+static gboolean parse_token(CalcIncremental *inc, Checkpoint *st, char *err, size_t err_cap) {
+    const char *text = inc->text->str;
+    const char *end = text + inc->text->len;
+    const char *p = calc_skip_space(text + st->offset, end);
+    err[0] = '\0';
+    if (p == end) return FALSE;
+
+    const char *scan = p + 1;
+    gboolean ok = TRUE;
+
+    if (calc_char_is(*p, CALC_CC_ALPHA)) {
+        const char *ident = p;
+        size_t len = 1;
+        while (calc_char_is(ident[len], CALC_CC_IDENT)) len++;
+        scan = ident + len + 1;
+        int index;
+        const CalcFunc *fn = calc_func_lookup(ident, len, &index);
+        CalcIncrementalConstruct construct = fn ? CALC_INCREMENTAL_SUPPORTED : unsupported_name(ident, len);
+        CalcIncrementalName name = CALC_INCREMENTAL_NAME_UNKNOWN;
+        double value = NAN;
+        char name_err[128];
+        if (!fn && construct == CALC_INCREMENTAL_SUPPORTED && inc->lookup) {
+            inc->first_name = MIN(inc->first_name, (size_t)(ident - text));
+            name = inc->lookup(ident, len, &value, name_err, sizeof(name_err), inc->lookup_data);
+            if (name == CALC_INCREMENTAL_NAME_FUNCTION) construct = CALC_INCREMENTAL_CALL;
+        }
+        if (construct != CALC_INCREMENTAL_SUPPORTED) {
+            inc->unsupported = construct;
+            g_snprintf(err, err_cap, "unsupported: %.*s", (int)len, ident);
+            ok = FALSE;
+        } else if (name == CALC_INCREMENTAL_NAME_VALUE || name == CALC_INCREMENTAL_NAME_ERROR) {
+            // A name with a value reads like a number; one without is an evaluation error.
+            if (name == CALC_INCREMENTAL_NAME_ERROR && st->error < 0) record_error(inc, st, name_err, FALSE);
+            push_val(inc, st, value, st->vals);
+            p += len;
+            st->prev = PREV_NUM;
+        } else {
+            if (!fn) {
+                size_t letters = 1;
+                while (calc_char_is(ident[letters], CALC_CC_ALPHA)) letters++;
+                if (letters < len) fn = calc_func_lookup(ident, letters, &index);
+                if (!fn) {
+                    g_snprintf(err, err_cap, "unknown function: %.*s", (int)len, ident);
+                    ok = FALSE;
+                }
+                len = letters;
+            }
+            if (ok) {
+                push_op(inc, st, (Token){ .type = TOK_OP, .op = fn->op, .slot = index });
+                p += len;
+                st->prev = PREV_OP;
+            }
+        }
+    } else if (calc_char_is(*p, CALC_CC_DIGIT) || *p == '.') {
+        // Exponents are recognised by looking up to two bytes past the end of the literal.
+        const char *stop;
+        double val = calc_read_number(p, end, &stop);
+        scan = stop + 3;
+        if (stop == p) {
+            g_snprintf(err, err_cap, "invalid number");
+            ok = FALSE;
+        } else {
+            push_val(inc, st, val, st->vals);
+            p = stop;
+            st->prev = PREV_NUM;
+        }
+    } else if (*p == '(') {
+        push_op(inc, st, (Token){ .type = TOK_OP, .op = '(', .slot = 1 });
+        p++;
+        st->prev = PREV_LPAREN;
+    } else if (*p == ')') {
+        int n_args = -1;
+        while (st->ops >= 0) {
+            Token t = pop_op(inc, st);
+            if (t.op == '(') { n_args = (st->prev == PREV_LPAREN) ? 0 : t.slot; break; }
+            apply(inc, st, t);
+        }
+        if (n_args < 0) {
+            g_snprintf(err, err_cap, "mismatched parentheses");
+            ok = FALSE;
+        } else {
+            ok = close_call(inc, st, n_args, err, err_cap);
+        }
+        p++;
+        st->prev = PREV_RPAREN;
+    } else if (*p == ',') {
+        while (st->ops >= 0 && top_op(inc, st) != '(') apply(inc, st, pop_op(inc, st));
+        if (st->ops < 0) {
+            g_snprintf(err, err_cap, "misplaced comma");
+            ok = FALSE;
+        } else {
+            count_argument(inc, st);
+        }
+        p++;
+        st->prev = PREV_OP;
+    } else if (calc_char_is(*p, CALC_CC_OPERATOR)) {
+        char op = *p;
+        if (op == '-' && (st->prev == PREV_NONE || st->prev == PREV_OP || st->prev == PREV_LPAREN)) op = 'u';
+
+        gboolean has_value = (st->prev == PREV_NUM || st->prev == PREV_RPAREN);
+        if (op == '!' && !has_value) {
+            g_snprintf(err, err_cap, "factorial needs a value");
+            ok = FALSE;
+        } else if (op != '!' && op != 'u' && !has_value) {
+            g_snprintf(err, err_cap, "operator missing value");
+            ok = FALSE;
+        } else {
+            while (st->ops >= 0) {
+                char top = top_op(inc, st);
+                if (top == '(') break;
+                int p1 = calc_op_precedence(op);
+                int p2 = calc_op_precedence(top);
+                if ((!calc_op_right_assoc(op) && p1 <= p2) || (calc_op_right_assoc(op) && p1 < p2)) {
+                    apply(inc, st, pop_op(inc, st));
+                } else break;
+            }
+            push_op(inc, st, (Token){ .type = TOK_OP, .op = op });
+            p++;
+            st->prev = (op == '!') ? PREV_NUM : PREV_OP;
+        }
+    } else if (*p == '[' || *p == '"') {
+        inc->unsupported = (*p == '[') ? CALC_INCREMENTAL_MATRIX : CALC_INCREMENTAL_DATA;
+        g_snprintf(err, err_cap, "unsupported: %c", *p);
+        ok = FALSE;
+    } else {
+        g_snprintf(err, err_cap, "invalid character: %c", *p);
+        ok = FALSE;
+    }
+
+    st->scan_end = MAX(st->scan_end, (size_t)(scan - text));
+    st->offset = (size_t)(p - text);
+    return ok;
+}
+
+static const Checkpoint *last_checkpoint(const CalcIncremental *inc) {
+    return &g_array_index(inc->checkpoints, Checkpoint, inc->checkpoints->len - 1);
+}
+
+// Drops the checkpoints an edit at byte `dirty` may have invalidated, along with their nodes.
+static void rewind_to(CalcIncremental *inc, size_t dirty) {
+    guint lo = 0;
+    guint hi = inc->checkpoints->len - 1;
+    while (lo < hi) {
+        guint mid = lo + (hi - lo + 1) / 2;
+        if (g_array_index(inc->checkpoints, Checkpoint, mid).scan_end <= dirty) lo = mid;
+        else hi = mid - 1;
+    }
+    g_array_set_size(inc->checkpoints, lo + 1);
+    const Checkpoint *cp = last_checkpoint(inc);
+    g_array_set_size(inc->vals, cp->n_vals);
+    g_array_set_size(inc->ops, cp->n_ops);
+    g_ptr_array_set_size(inc->errors, (gint)cp->n_errors);
+}
+
+static void reparse(CalcIncremental *inc) {
+    guint funcs = calc_func_generation();
+    if (funcs != inc->funcs) {
+        inc->funcs = funcs;
+        mark_dirty(inc, 0);
+        g_clear_pointer(&inc->parse_error, g_free);
+        inc->unsupported = CALC_INCREMENTAL_SUPPORTED;
+    }
+    if (inc->dirty == G_MAXSIZE) return;
+
+    if (inc->parse_error && inc->parse_error_scan_end <= inc->dirty) {
+        // The edit came after everything the failed token depended on.
+        inc->dirty = G_MAXSIZE;
+        return;
+    }
+    g_clear_pointer(&inc->parse_error, g_free);
+    inc->unsupported = CALC_INCREMENTAL_SUPPORTED;
+    rewind_to(inc, inc->dirty);
+    inc->dirty = G_MAXSIZE;
+    if (inc->first_name >= last_checkpoint(inc)->offset) inc->first_name = G_MAXSIZE; // parsed again
+
+    Checkpoint st = *last_checkpoint(inc);
+    char err[128];
+    for (;;) {
+        if (!parse_token(inc, &st, err, sizeof(err))) {
+            if (err[0]) {
+                inc->parse_error = g_strdup(err);
+                inc->parse_error_scan_end = st.scan_end;
+            }
+            break;
+        }
+        st.n_vals = inc->vals->len;
+        st.n_ops = inc->ops->len;
+        st.n_errors = inc->errors->len;
+        g_array_append_val(inc->checkpoints, st);
+    }
+}
+
+// Closes what is still open at the end of the text. Works on a copy of the last state; the
+// nodes it adds are dropped by the caller.
+static gboolean finish(CalcIncremental *inc, double *result, char *err, size_t err_cap) {
+    Checkpoint st = *last_checkpoint(inc);
+    while (st.ops >= 0) {
+        Token t = pop_op(inc, &st);
+        if (t.op == '(') {
+            int n_args = (st.prev == PREV_LPAREN) ? 0 : t.slot;
+            st.prev = PREV_RPAREN;
+            if (!close_call(inc, &st, n_args, err, err_cap)) return FALSE;
+            continue;
+        }
+        apply(inc, &st, t);
+    }
+
+    // calc_eval() checks the shape of the whole program before it evaluates anything, so a
+    // malformed expression reports that even after an evaluation error further left.
+    if (st.malformed || st.vals < 0 || g_array_index(inc->vals, ValNode, st.vals).below >= 0) {
+        g_snprintf(err, err_cap, "invalid expression");
+        return FALSE;
+    }
+    inc->left_reals = st.domain;
+    if (st.error >= 0) {
+        g_snprintf(err, err_cap, "%s", (const char *)g_ptr_array_index(inc->errors, st.error));
+        return FALSE;
+    }
+    *result = g_array_index(inc->vals, ValNode, st.vals).value;
+    return TRUE;
+}
+
+gboolean calc_incremental_result(CalcIncremental *inc, double *result, char *err, size_t err_cap) {
+    reparse(inc);
+    inc->left_reals = FALSE;
+    // diff() evaluates its first argument at a point that comes after it, which a left-to-right
+    // parse cannot do, matrices and i are not real numbers, and load("file") is not an expression;
+    // such text goes through the full parser instead.
+    if (inc->unsupported != CALC_INCREMENTAL_SUPPORTED) {
+        return calc_eval(inc->text->str, inc->degrees, result, err, err_cap);
+    }
+    if (inc->parse_error) {
+        g_snprintf(err, err_cap, "%s", inc->parse_error);
+        return FALSE;
+    }
+    gboolean ok = finish(inc, result, err, err_cap);
+
+    const Checkpoint *cp = last_checkpoint(inc);
+    g_array_set_size(inc->vals, cp->n_vals);
+    g_array_set_size(inc->ops, cp->n_ops);
+    g_ptr_array_set_size(inc->errors, (gint)cp->n_errors);
+    return ok;
+}
+
+CalcIncrementalConstruct calc_incremental_unsupported(CalcIncremental *inc) {
+    reparse(inc);
+    return inc->unsupported;
+}
+
+gboolean calc_incremental_left_reals(const CalcIncremental *inc) {
+    return inc->left_reals;
+}
@@ -0,0 +1,256 @@
+#pragma once
+
+// Engine internals shared by the calc_* translation units. Not part of the public API.
+
+#include "calc_eval.h"
+#include "calc_trace.h"
+
+typedef enum {
+    TOK_NUM,
+    TOK_VAR,
+    TOK_OP
+} TokenType;
+
+// Deepest nesting of diff() calls the parser accepts.
+#define CALC_DIFF_MAX_DEPTH 64
+
+// Besides the parser's operators, TOK_OP may hold:
+//   'F'  call of a registered function, registry index stored in slot (see calc_func.c)
+//   'w'  integer power x^n by repeated squaring, n stored in value (optimizer only)
+//   'D'  diff(e, v, at): pops at and pushes de/dv there. The slot tokens after it are the code of
+//        e, reading v as variable slot (int)value; evaluators run them with calc_diff_rpn() and
+//        continue after them. Blocks nest at most CALC_DIFF_MAX_DEPTH deep
+//   'M'  matrix literal: pops value * slot numbers, row by row, and pushes them as a matrix of
+//        value rows and slot columns. Only calc_matrix.c evaluates programs that contain one
+//   'R'  statistic of a dataset, as in mean(load("file")): pops nothing and pushes statistic
+//        (CalcStat)value of dataset slot, read with calc_data_value()
+typedef struct {
+    TokenType type;
+    double value;
+    char op;
+    int slot; // TOK_VAR: index into the caller's variable array
+              // TOK_NUM (parser output): byte offset of the literal in the source text
+              // TOK_OP 'F': index of the function in the registry
+} Token;
+
+// Native code for a program (see calc_jit.c). Returns 0 or an error code for
+// calc_jit_error_message().
+typedef int (*CalcJitFn)(const double *vars, double *out);
+
+struct CalcProgram {
+    Token *code;
+    size_t count;
+    size_t n_vars;
+    size_t max_depth; // deepest value stack the code needs
+    gboolean degrees;
+    gint refs;        // calc_program_free() drops one reference
+    CalcJitFn jit;    // NULL unless calc_program_jit() succeeded
+    size_t jit_size;
+    gboolean needs_complex; // compiled by calc_compile_complex() and able to leave the reals (it
+                            // reads i, or takes a root or log): only calc_complex.c evaluates it
+    gboolean matrix;        // contains a matrix literal: calc_program_eval() hands it to calc_matrix.c
+};
+
+// Shape of a matrix literal while the parser is inside it.
+typedef struct {
+    size_t rows;   // rows completed so far
+    size_t cols;   // elements in the first row, once it is complete
+    size_t in_row; // elements of the current row so far
+} CalcMatrixFrame;
+
+// Working memory for parsing and evaluating expressions: growable token, operator and value
+// stacks that are reused from call to call, so steady-state evaluation does not allocate and
+// expressions have no length limit. Each thread that evaluates concurrently needs its own;
+// calc_scratch_get() returns the calling thread's.
+typedef struct {
+    Token *rpn;
+    size_t rpn_cap;
+    Token *ops; // operator stack; '(' entries count their arguments in slot, '[' entries index frames
+    size_t ops_cap;
+    CalcMatrixFrame *frames; // one per '[' on the operator stack
+    size_t frames_len;
+    size_t frames_cap;
+    int diff_depth; // diff() calls the parser is inside
+    double *stack;
+    size_t stack_cap;
+    gboolean matrix; // the last parse emitted a matrix literal ('M')
+} CalcScratch;
+
+void calc_scratch_init(CalcScratch *scratch);
+void calc_scratch_clear(CalcScratch *scratch);
+CalcScratch *calc_scratch_get(void);
+
+// Returns the scratch value stack with room for at least depth values.
+double *calc_scratch_stack(CalcScratch *scratch, size_t depth);
+
+// Parses expr into RPN in scratch->rpn and stores the token count in *count.
+// A var_names entry that is calc_imag_name (compared by address) is the imaginary unit, which a
+// number may also be written directly against: "4i" parses as 4*i.
+gboolean calc_parse(CalcScratch *scratch, const char *expr, const char *const *var_names, size_t n_vars,
+                    size_t *count, char *err, size_t err_cap);
+
+extern const char calc_imag_name[];
+
+// Checks the code in scratch->rpn[0..count) and copies it into a new program with n_vars input
+// slots, optimized if optimize is set. Returns NULL and writes err if the code is malformed.
+CalcProgram *calc_program_from_scratch(CalcScratch *scratch, size_t count, size_t n_vars, gboolean degrees,
+                                       gboolean optimize, char *err, size_t err_cap);
+
+// calc_eval() using caller-provided working memory.
+gboolean calc_eval_scratch(CalcScratch *scratch, const char *expr, gboolean degrees, double *result,
+                           char *err, size_t err_cap);
+
+CalcProgram *calc_program_ref(CalcProgram *prog);
+
+// calc_eval() through the compiled-expression cache (see calc_cache.c).
+gboolean calc_cache_eval(const char *expr, gboolean degrees, double *result, char *err, size_t err_cap);
+
+// Evaluates RPN code with caller-provided stack space (at least as deep as the code needs).
+gboolean calc_eval_rpn(const Token *rpn, size_t count, const double *vars, gboolean degrees,
+                       double *stack, double *out, char *err, size_t err_cap);
+
+// x^n for n >= 1 by repeated squaring.
+double calc_powi(double x, int n);
+
+// v! for a non-negative integer v (up to 170).
+gboolean calc_factorial(double v, double *out, char *err, size_t err_cap);
+
+// Value and derivative of code[0..count) with respect to variable slot, at the point where that
+// variable is at and the others are vars[] (see calc_diff.c). Errors are those of eval_rpn().
+gboolean calc_diff_rpn(const Token *code, size_t count, const double *vars, int slot, double at, gboolean degrees,
+                       double *value, double *derivative, char *err, size_t err_cap);
+
+// Evaluates code with matrix literals (see calc_matrix.c) for number inputs vars, using a value
+// stack of depth entries. Fails with "result is a matrix" unless the result is a number.
+gboolean calc_matrix_eval_rpn(const Token *code, size_t count, size_t depth, const double *vars, gboolean degrees,
+                              double *out, char *err, size_t err_cap);
+
+// Dataset statistics (see calc_data.c).
+typedef enum {
+    CALC_STAT_SUM,
+    CALC_STAT_MEAN,
+    CALC_STAT_VAR,
+    CALC_STAT_STDDEV,
+    CALC_STAT_MIN,
+    CALC_STAT_MAX,
+    CALC_STAT_MEDIAN,
+    CALC_STAT_COUNT,
+    CALC_STAT_KINDS
+} CalcStat;
+
+// The CalcStat called name (len bytes), or -1.
+int calc_data_stat_lookup(const char *name, size_t len);
+const char *calc_data_stat_name(int stat);
+
+// Index of the dataset read from path (len bytes). Entries are never removed. Thread-safe.
+int calc_data_register(const char *path, size_t len);
+
+// Statistic stat of a registered dataset, read on n_threads workers if the file changed since
+// the last call. Thread-safe.
+gboolean calc_data_value(int dataset, int stat, guint n_threads, double *out, char *err, size_t err_cap);
+
+// Folds constant subexpressions and applies strength reductions in place (see calc_optimize.c).
+// Returns the new token count. Evaluation results and error messages are unchanged.
+size_t calc_optimize_rpn(Token *code, size_t count, gboolean degrees);
+
+void calc_jit_release(CalcProgram *prog);
+const char *calc_jit_error_message(int code);
+
+// Number of operands an RPN operator pops (1 or 2; 0 for 'R').
+int calc_op_arity(char op);
+
+// Operator-stack rules of the parser, shared with the incremental parser (calc_incremental.c).
+gboolean calc_op_is_func(char op);
+int calc_op_precedence(char op);
+gboolean calc_op_right_assoc(char op);
+
+// Built-in functions in registry order. The first ones have their own opcodes; from
+// CALC_FN_ASIN on they compile to 'F' calls.
+typedef enum {
+    CALC_FN_SIN,
+    CALC_FN_COS,
+    CALC_FN_TAN,
+    CALC_FN_SQRT,
+    CALC_FN_LOG,
+    CALC_FN_LN,
+    CALC_FN_LOG2,
+    CALC_FN_ABS,
+    CALC_FN_EXP,
+    CALC_FN_POW,
+    CALC_FN_CSC,
+    CALC_FN_SEC,
+    CALC_FN_COT,
+    CALC_FN_ASIN,
+    CALC_FN_ACOS,
+    CALC_FN_ATAN,
+    CALC_FN_SINH,
+    CALC_FN_COSH,
+    CALC_FN_TANH,
+    CALC_FN_ASINH,
+    CALC_FN_ACOSH,
+    CALC_FN_ATANH,
+    CALC_FN_ATAN2,
+    CALC_FN_HYPOT,
+    CALC_FN_MIN,
+    CALC_FN_MAX,
+    CALC_FN_CBRT,
+    CALC_FN_FLOOR,
+    CALC_FN_CEIL,
+    CALC_FN_ROUND,
+    CALC_FN_DET,
+    CALC_FN_INV,
+    CALC_FN_TRANSPOSE,
+    CALC_FN_SOLVE,
+    CALC_FN_DOT,
+    CALC_FN_BUILTIN_COUNT
+} CalcBuiltin;
+
+typedef struct {
+    const char *name;
+    char op; // opcode the parser emits; 'F' for calls through fn
+    int arity;
+    CalcFuncFlags flags;
+    CalcNativeFn fn;
+    gpointer user_data;
+} CalcFunc;
+
+// Looks up a function by name (len bytes, not necessarily NUL-terminated). Returns NULL if
+// there is none; otherwise stores its registry index in *index. Thread-safe.
+const CalcFunc *calc_func_lookup(const char *name, size_t len, int *index);
+
+// Function at a registry index returned by calc_func_lookup(). Entries are never removed.
+const CalcFunc *calc_func_get(int index);
+
+// Number of functions registered so far; a name that failed to resolve may resolve once it grows.
+guint calc_func_generation(void);
+
+// Name of a built-in function whose perfect-hash slot an earlier one already holds, or NULL.
+const char *calc_func_builtin_collision(void);
+
+// Number of operands a TOK_OP token pops, including 'F' calls and matrix literals; 0 for 'R'.
+int calc_token_arity(const Token *t);
+
+// FALSE for calls of functions registered without CALC_FUNC_PURE, and for dataset statistics,
+// which change with their file.
+gboolean calc_token_pure(const Token *t);
+
+// Character classes for the lexer (see calc_lex.c). Locale-independent; bytes >= 0x80 have none.
+enum {
+    CALC_CC_SPACE = 1 << 0,    // ' ', \t, \n, \v, \f, \r
+    CALC_CC_DIGIT = 1 << 1,    // 0-9
+    CALC_CC_ALPHA = 1 << 2,    // A-Z, a-z
+    CALC_CC_IDENT = 1 << 3,    // letters, digits and '_'
+    CALC_CC_OPERATOR = 1 << 4, // + - * / ^ % !
+};
+
+extern const guint8 calc_char_class[256];
+
+#define calc_char_is(c, classes) ((calc_char_class[(guchar)(c)] & (classes)) != 0)
+
+// First byte at or after p (and before end) that is not whitespace.
+const char *calc_skip_space(const char *p, const char *end);
+
+// Converts the number literal at p, which ends no later than end, exactly as strtod() would in
+// the C locale: same value, same bits, same stopping point. Stores the first unread byte in
+// *stop, or p if there is no number there.
+double calc_read_number(const char *p, const char *end, const char **stop);
@@ -0,0 +1,457 @@
+// Native x86-64 backend for compiled programs. Each program becomes one function
+//   int fn(const double *vars, double *out)
+// that keeps the value stack in xmm0..xmm13, calls libm for transcendental functions and
+// returns 0 on success or a JitError code. Programs the backend cannot lower (other CPUs,
+// deeper stacks) keep using the interpreter.
+
+#define _DEFAULT_SOURCE
+
+#include "calc_eval.h"
+#include "calc_internal.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__unix__) && !defined(CALC_NO_JIT)
+#define CALC_HAVE_JIT 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+typedef enum {
+    JIT_OK = 0,
+    JIT_ERR_DIV_ZERO,
+    JIT_ERR_SQRT,
+    JIT_ERR_LOG,
+    JIT_ERR_LN,
+    JIT_ERR_LOG2,
+    JIT_ERR_CSC,
+    JIT_ERR_SEC,
+    JIT_ERR_COT,
+    JIT_ERR_FACT_DOMAIN,
+    JIT_ERR_FACT_OVERFLOW,
+    JIT_ERR_COUNT
+} JitError;
+
+// Same wording as eval_rpn().
+static const char *const jit_messages[JIT_ERR_COUNT] = {
+    [JIT_ERR_DIV_ZERO] = "division by zero",
+    [JIT_ERR_SQRT] = "sqrt domain error",
+    [JIT_ERR_LOG] = "log domain error",
+    [JIT_ERR_LN] = "ln domain error",
+    [JIT_ERR_LOG2] = "log2 domain error",
+    [JIT_ERR_CSC] = "csc domain error",
+    [JIT_ERR_SEC] = "sec domain error",
+    [JIT_ERR_COT] = "cot domain error",
+    [JIT_ERR_FACT_DOMAIN] = "factorial requires a non-negative integer",
+    [JIT_ERR_FACT_OVERFLOW] = "factorial overflow",
+};
+
+const char *calc_jit_error_message(int code) {
+    if (code <= 0 || code >= JIT_ERR_COUNT) return "invalid expression";
+    return jit_messages[code];
+}
+
+#ifdef CALC_HAVE_JIT
+
+// xmm0..xmm13 hold the value stack, xmm14/xmm15 are scratch.
+#define JIT_MAX_DEPTH 14
+#define XMM_T0 14
+#define XMM_T1 15
+
+// Frame below the saved rbx: 16 spill slots, the out pointer and a status word for helpers.
+// 168 keeps rsp 16-byte aligned at call sites (entry 8 + rbp 8 + rbx 8 + 168).
+#define FRAME_SIZE 168
+#define FRAME_OUT 128
+#define FRAME_STATUS 136
+
+typedef struct {
+    guint8 *buf;
+    size_t len;
+    size_t cap;
+    // Pending rel32 jumps to error stubs: position of the rel32 field and the error code
+    // (JIT_OK means "code is in the status slot").
+    size_t *fix_pos;
+    int *fix_code;
+    size_t n_fix;
+    size_t fix_cap;
+} Asm;
+
+static void emit(Asm *a, const void *bytes, size_t n) {
+    if (a->len + n > a->cap) {
+        a->cap = MAX(a->cap * 2, a->len + n + 256);
+        a->buf = g_realloc(a->buf, a->cap);
+    }
+    memcpy(a->buf + a->len, bytes, n);
+    a->len += n;
+}
+
+static void emit1(Asm *a, guint8 b) {
+    emit(a, &b, 1);
+}
+
+static void emit32(Asm *a, guint32 v) {
+    emit(a, &v, 4);
+}
+
+static void emit64(Asm *a, guint64 v) {
+    emit(a, &v, 8);
+}
+
+// <prefix> [REX] 0F <op> modrm(reg, rm) for register-register SSE forms.
+static void sse_rr(Asm *a, guint8 prefix, guint8 op, int reg, int rm) {
+    emit1(a, prefix);
+    if (reg >= 8 || rm >= 8) emit1(a, (guint8)(0x40 | ((reg >> 3) << 2) | (rm >> 3)));
+    emit1(a, 0x0F);
+    emit1(a, op);
+    emit1(a, (guint8)(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+}
+
+#define ADDSD(a, d, s) sse_rr(a, 0xF2, 0x58, d, s)
+#define MULSD(a, d, s) sse_rr(a, 0xF2, 0x59, d, s)
+#define SUBSD(a, d, s) sse_rr(a, 0xF2, 0x5C, d, s)
+#define DIVSD(a, d, s) sse_rr(a, 0xF2, 0x5E, d, s)
+#define SQRTSD(a, d, s) sse_rr(a, 0xF2, 0x51, d, s)
+#define MOVAPD(a, d, s) sse_rr(a, 0x66, 0x28, d, s)
+#define XORPD(a, d, s) sse_rr(a, 0x66, 0x57, d, s)
+#define ANDPD(a, d, s) sse_rr(a, 0x66, 0x54, d, s)
+#define UCOMISD(a, x, y) sse_rr(a, 0x66, 0x2E, x, y)
+
+static void mov_reg(Asm *a, int dst, int src) {
+    if (dst != src) MOVAPD(a, dst, src);
+}
+
+// mov rax, imm64; movq xmm, rax
+static void load_const(Asm *a, int xmm, double v) {
+    guint64 bits;
+    memcpy(&bits, &v, sizeof(bits));
+    emit1(a, 0x48);
+    emit1(a, 0xB8);
+    emit64(a, bits);
+    emit1(a, 0x66);
+    emit1(a, (guint8)(0x48 | ((xmm >> 3) << 2)));
+    emit1(a, 0x0F);
+    emit1(a, 0x6E);
+    emit1(a, (guint8)(0xC0 | ((xmm & 7) << 3)));
+}
+
+static void load_mask(Asm *a, int xmm, guint64 bits) {
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    load_const(a, xmm, v);
+}
+
+// movsd xmm, [rbx + disp32]
+static void load_var(Asm *a, int xmm, int slot) {
+    emit1(a, 0xF2);
+    if (xmm >= 8) emit1(a, 0x44);
+    emit1(a, 0x0F);
+    emit1(a, 0x10);
+    emit1(a, (guint8)(0x80 | ((xmm & 7) << 3) | 3));
+    emit32(a, (guint32)(slot * 8));
+}
+
+// movsd [rsp + disp32], xmm  /  movsd xmm, [rsp + disp32]
+static void spill_rsp(Asm *a, int xmm, guint32 disp, gboolean store) {
+    emit1(a, 0xF2);
+    if (xmm >= 8) emit1(a, 0x44);
+    emit1(a, 0x0F);
+    emit1(a, store ? 0x11 : 0x10);
+    emit1(a, (guint8)(0x84 | ((xmm & 7) << 3)));
+    emit1(a, 0x24);
+    emit32(a, disp);
+}
+
+static void jump_to_error(Asm *a, guint8 jcc, int code) {
+    emit1(a, 0x0F);
+    emit1(a, jcc);
+    if (a->n_fix == a->fix_cap) {
+        a->fix_cap = MAX(a->fix_cap * 2, 16);
+        a->fix_pos = g_renew(size_t, a->fix_pos, a->fix_cap);
+        a->fix_code = g_renew(int, a->fix_code, a->fix_cap);
+    }
+    a->fix_pos[a->n_fix] = a->len;
+    a->fix_code[a->n_fix] = code;
+    a->n_fix++;
+    emit32(a, 0);
+}
+
+#define JCC_JE 0x84
+#define JCC_JNE 0x85
+#define JCC_JA 0x87
+#define JCC_JAE 0x83
+
+// Error if xmm == 0 (NaN compares unordered and passes, as in the interpreter).
+static void check_nonzero(Asm *a, int xmm, int code) {
+    XORPD(a, XMM_T1, XMM_T1);
+    UCOMISD(a, xmm, XMM_T1);
+    emit1(a, 0x7A); // jp +6: unordered
+    emit1(a, 0x06);
+    jump_to_error(a, JCC_JE, code);
+}
+
+// Calls fn with the values in xmm[args..args+n_args) and leaves the result in xmm[args].
+// Everything below args is live and gets spilled around the call.
+static void call_libm(Asm *a, guintptr fn, int args, int n_args) {
+    for (int r = 0; r < args; r++) spill_rsp(a, r, (guint32)(r * 8), TRUE);
+    for (int k = 0; k < n_args; k++) mov_reg(a, k, args + k);
+    emit1(a, 0x48);
+    emit1(a, 0xB8);
+    emit64(a, (guint64)fn);
+    emit1(a, 0xFF); // call rax
+    emit1(a, 0xD0);
+    mov_reg(a, args, 0);
+    for (int r = 0; r < args; r++) spill_rsp(a, r, (guint32)(r * 8), FALSE);
+}
+
+static double jit_factorial(double v, int *status) {
+    double r = round(v);
+    if (v < 0 || fabs(v - r) > 1e-9) { *status = JIT_ERR_FACT_DOMAIN; return 0.0; }
+    if (r > 170) { *status = JIT_ERR_FACT_OVERFLOW; return 0.0; }
+    double acc = 1.0;
+    for (int k = 2; k <= (int)r; k++) acc *= (double)k;
+    return acc;
+}
+
+static void emit_factorial(Asm *a, int t) {
+    // status = 0; rdi = &status; xmm0 = v; call
+    emit1(a, 0xC7);
+    emit1(a, 0x84);
+    emit1(a, 0x24);
+    emit32(a, FRAME_STATUS);
+    emit32(a, 0);
+    emit1(a, 0x48);
+    emit1(a, 0x8D);
+    emit1(a, 0xBC);
+    emit1(a, 0x24);
+    emit32(a, FRAME_STATUS);
+    call_libm(a, (guintptr)jit_factorial, t, 1);
+    emit1(a, 0x83); // cmp dword [rsp + FRAME_STATUS], 0
+    emit1(a, 0xBC);
+    emit1(a, 0x24);
+    emit32(a, FRAME_STATUS);
+    emit1(a, 0x00);
+    jump_to_error(a, JCC_JNE, JIT_OK);
+}
+
+// sin/cos/tan with the interpreter's degree conversion (same multiply, same constant).
+static void emit_trig(Asm *a, int t, double (*fn)(double), gboolean degrees) {
+    if (degrees) {
+        load_const(a, XMM_T1, G_PI / 180.0);
+        MULSD(a, t, XMM_T1);
+    }
+    call_libm(a, (guintptr)fn, t, 1);
+}
+
+static void emit_reciprocal(Asm *a, int t) {
+    MOVAPD(a, XMM_T0, t);
+    load_const(a, t, 1.0);
+    DIVSD(a, t, XMM_T0);
+}
+
+static gboolean emit_op(Asm *a, const Token *tok, int *top, gboolean degrees) {
+    int t = *top;
+    char op = tok->op;
+
+    // Registered functions, derivatives and dataset statistics run in the interpreter.
+    if (op == 'F' || op == 'D' || op == 'R') return FALSE;
+    if (calc_op_arity(op) == 1) {
+        switch (op) {
+            case 'u':
+                load_mask(a, XMM_T1, 0x8000000000000000ull);
+                XORPD(a, t, XMM_T1);
+                break;
+            case 'A':
+                load_mask(a, XMM_T1, 0x7FFFFFFFFFFFFFFFull);
+                ANDPD(a, t, XMM_T1);
+                break;
+            case 'w': {
+                MOVAPD(a, XMM_T0, t);
+                load_const(a, t, 1.0);
+                for (int e = (int)tok->value;;) {
+                    if (e & 1) MULSD(a, t, XMM_T0);
+                    e >>= 1;
+                    if (!e) break;
+                    MULSD(a, XMM_T0, XMM_T0);
+                }
+                break;
+            }
+            case 'Q':
+                XORPD(a, XMM_T1, XMM_T1);
+                UCOMISD(a, XMM_T1, t);
+                jump_to_error(a, JCC_JA, JIT_ERR_SQRT); // 0 > a
+                SQRTSD(a, t, t);
+                break;
+            case 'L':
+            case 'N':
+            case 'G': {
+                XORPD(a, XMM_T1, XMM_T1);
+                UCOMISD(a, XMM_T1, t);
+                int code = op == 'L' ? JIT_ERR_LOG : op == 'N' ? JIT_ERR_LN : JIT_ERR_LOG2;
+                jump_to_error(a, JCC_JAE, code); // 0 >= a
+                call_libm(a, op == 'L' ? (guintptr)log10 : op == 'N' ? (guintptr)log : (guintptr)log2, t, 1);
+                break;
+            }
+            case 'E': call_libm(a, (guintptr)exp, t, 1); break;
+            case 'S': emit_trig(a, t, sin, degrees); break;
+            case 'C': emit_trig(a, t, cos, degrees); break;
+            case 'T': emit_trig(a, t, tan, degrees); break;
+            case 'I':
+                emit_trig(a, t, sin, degrees);
+                check_nonzero(a, t, JIT_ERR_CSC);
+                emit_reciprocal(a, t);
+                break;
+            case 'J':
+                emit_trig(a, t, cos, degrees);
+                check_nonzero(a, t, JIT_ERR_SEC);
+                emit_reciprocal(a, t);
+                break;
+            case 'K':
+                emit_trig(a, t, tan, degrees);
+                check_nonzero(a, t, JIT_ERR_COT);
+                emit_reciprocal(a, t);
+                break;
+            case '!': emit_factorial(a, t); break;
+            default: return FALSE;
+        }
+        return TRUE;
+    }
+
+    int l = t - 1;
+    switch (op) {
+        case '+': ADDSD(a, l, t); break;
+        case '-': SUBSD(a, l, t); break;
+        case '*': MULSD(a, l, t); break;
+        case '/':
+            check_nonzero(a, t, JIT_ERR_DIV_ZERO);
+            DIVSD(a, l, t);
+            break;
+        case '%':
+            check_nonzero(a, t, JIT_ERR_DIV_ZERO);
+            call_libm(a, (guintptr)fmod, l, 2);
+            break;
+        case '^':
+        case 'P':
+            call_libm(a, (guintptr)pow, l, 2);
+            break;
+        default: return FALSE;
+    }
+    *top = l;
+    return TRUE;
+}
+
+static gboolean assemble(const CalcProgram *prog, Asm *a) {
+    static const guint8 prologue[] = {
+        0x55,                   // push rbp
+        0x48, 0x89, 0xE5,       // mov rbp, rsp
+        0x53,                   // push rbx
+        0x48, 0x81, 0xEC,       // sub rsp, imm32
+    };
+    emit(a, prologue, sizeof(prologue));
+    emit32(a, FRAME_SIZE);
+    static const guint8 save_args[] = { 0x48, 0x89, 0xFB, 0x48, 0x89, 0xB4, 0x24 }; // mov rbx, rdi; mov [rsp+..], rsi
+    emit(a, save_args, sizeof(save_args));
+    emit32(a, FRAME_OUT);
+
+    int top = -1;
+    for (size_t i = 0; i < prog->count; i++) {
+        const Token *tok = &prog->code[i];
+        if (tok->type == TOK_NUM) {
+            load_const(a, ++top, tok->value);
+        } else if (tok->type == TOK_VAR) {
+            load_var(a, ++top, tok->slot);
+        } else if (!emit_op(a, tok, &top, prog->degrees)) {
+            return FALSE;
+        }
+    }
+
+    static const guint8 store_result[] = {
+        0x48, 0x8B, 0x84, 0x24, // mov rax, [rsp + FRAME_OUT]
+    };
+    emit(a, store_result, sizeof(store_result));
+    emit32(a, FRAME_OUT);
+    static const guint8 ok_tail[] = { 0xF2, 0x0F, 0x11, 0x00, 0x31, 0xC0 }; // movsd [rax], xmm0; xor eax, eax
+    emit(a, ok_tail, sizeof(ok_tail));
+
+    size_t exit_pos = a->len;
+    static const guint8 epilogue_head[] = { 0x48, 0x81, 0xC4 }; // add rsp, imm32
+    emit(a, epilogue_head, sizeof(epilogue_head));
+    emit32(a, FRAME_SIZE);
+    static const guint8 epilogue_tail[] = { 0x5B, 0x5D, 0xC3 }; // pop rbx; pop rbp; ret
+    emit(a, epilogue_tail, sizeof(epilogue_tail));
+
+    // One stub per check: load the error code into eax and jump to the epilogue.
+    for (size_t k = 0; k < a->n_fix; k++) {
+        guint32 rel = (guint32)(a->len - (a->fix_pos[k] + 4));
+        memcpy(a->buf + a->fix_pos[k], &rel, 4);
+        if (a->fix_code[k] == JIT_OK) {
+            emit1(a, 0x8B); // mov eax, [rsp + FRAME_STATUS]
+            emit1(a, 0x84);
+            emit1(a, 0x24);
+            emit32(a, FRAME_STATUS);
+        } else {
+            emit1(a, 0xB8); // mov eax, imm32
+            emit32(a, (guint32)a->fix_code[k]);
+        }
+        emit1(a, 0xE9); // jmp exit
+        emit32(a, (guint32)(exit_pos - (a->len + 4)));
+    }
+    return TRUE;
+}
+
+gboolean calc_program_jit(CalcProgram *prog) {
+    if (prog->jit) return TRUE;
+    if (prog->max_depth > JIT_MAX_DEPTH || prog->needs_complex || prog->matrix) return FALSE;
+
+    Asm a = {0};
+    gboolean ok = assemble(prog, &a);
+    if (ok) {
+        long page = sysconf(_SC_PAGESIZE);
+        size_t size = (a.len + (size_t)page - 1) & ~((size_t)page - 1);
+        void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            ok = FALSE;
+        } else {
+            memcpy(mem, a.buf, a.len);
+            // Never writable and executable at the same time.
+            if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+                munmap(mem, size);
+                ok = FALSE;
+            } else {
+                CalcJitFn fn;
+                G_STATIC_ASSERT(sizeof(fn) == sizeof(mem));
+                memcpy(&fn, &mem, sizeof(fn));
+                prog->jit = fn;
+                prog->jit_size = size;
+            }
+        }
+    }
+
+    g_free(a.buf);
+    g_free(a.fix_pos);
+    g_free(a.fix_code);
+    return ok;
+}
+
+void calc_jit_release(CalcProgram *prog) {
+    if (prog->jit) {
+        void *mem;
+        memcpy(&mem, &prog->jit, sizeof(mem));
+        munmap(mem, prog->jit_size);
+    }
+    prog->jit = NULL;
+    prog->jit_size = 0;
+}
+
+#else
+
+gboolean calc_program_jit(CalcProgram *prog) {
+    (void)prog;
+    return FALSE;
+}
+
+void calc_jit_release(CalcProgram *prog) {
+    (void)prog;
+}
+
+#endif
@@ -0,0 +1,311 @@
+#include "calc_eval.h"
+#include "calc_internal.h"
+
+#include <string.h>
+
+// Lexing helpers for the parser. Character classes come from a fixed table rather than
+// <ctype.h>, and number literals are converted without strtod(), so expressions mean the
+// same thing under every locale (a comma-decimal LC_NUMERIC used to cut "1.5" short).
+
+#define _ 0
+#define S CALC_CC_SPACE
+#define D (CALC_CC_DIGIT | CALC_CC_IDENT)
+#define A (CALC_CC_ALPHA | CALC_CC_IDENT)
+#define U CALC_CC_IDENT
+#define O CALC_CC_OPERATOR
+
+// Bytes from 0x80 up have no class.
+const guint8 calc_char_class[256] = {
+    _, _, _, _, _, _, _, _, _, S, S, S, S, S, _, _, // 0x00
+    _, _, _, _, _, _, _, _, _, _, _, _, _, _, _, _, // 0x10
+    S, O, _, _, _, O, _, _, _, _, O, O, _, O, _, O, // 0x20
+    D, D, D, D, D, D, D, D, D, D, _, _, _, _, _, _, // 0x30
+    _, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A, // 0x40
+    A, A, A, A, A, A, A, A, A, A, A, _, _, _, O, U, // 0x50
+    _, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A, // 0x60
+    A, A, A, A, A, A, A, A, A, A, A, _, _, _, _, _, // 0x70
+};
+
+#undef _
+#undef S
+#undef D
+#undef A
+#undef U
+#undef O
+
+#define EIGHT_SPACES 0x2020202020202020ULL
+
+// Mantissas of up to 19 decimal digits fit in 64 bits.
+#define MAX_MANTISSA_DIGITS 19
+
+static guint64 load8(const char *p) {
+    guint64 v;
+    memcpy(&v, p, sizeof(v));
+    return GUINT64_FROM_LE(v);
+}
+
+static gboolean is_eight_digits(guint64 v) {
+    return ((v & 0xF0F0F0F0F0F0F0F0ULL) | (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+           0x3333333333333333ULL;
+}
+
+// Value of eight ASCII digits (first digit in the lowest byte), combined pairwise in three
+// multiplies instead of eight.
+static guint32 eight_digits_value(guint64 v) {
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+         (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return (guint32)v;
+}
+
+const char *calc_skip_space(const char *p, const char *end) {
+    while (end - p >= 8 && load8(p) == EIGHT_SPACES) p += 8;
+    while (p < end && calc_char_is(*p, CALC_CC_SPACE)) p++;
+    return p;
+}
+
+// Reads a run of digits into *mantissa, eight at a time where possible. *n_digits counts the
+// digits taken after the leading zeros; digits past MAX_MANTISSA_DIGITS set *truncated.
+static const char *read_digits(const char *p, const char *end, guint64 *mantissa, int *n_digits,
+                               gboolean *truncated) {
+    while (end - p >= 8 && *n_digits + 8 <= MAX_MANTISSA_DIGITS) {
+        guint64 v = load8(p);
+        if (!is_eight_digits(v)) break;
+        *mantissa = *mantissa * 100000000ULL + eight_digits_value(v);
+        *n_digits += 8;
+        p += 8;
+    }
+    for (; p < end && calc_char_is(*p, CALC_CC_DIGIT); p++) {
+        if (*mantissa == 0 && *p == '0') {
+            continue; // leading zeros do not use up mantissa digits
+        }
+        if (*n_digits == MAX_MANTISSA_DIGITS) {
+            *truncated = TRUE;
+            continue;
+        }
+        *mantissa = *mantissa * 10 + (guint64)(*p - '0');
+        (*n_digits)++;
+    }
+    return p;
+}
+
+// Powers of ten that are exact doubles.
+static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+#define MAX_EXACT_POW10 22
+#define MAX_EXACT_INT ((guint64)1 << 53)
+
+// 128-bit truncated mantissas of 5^q (equivalently 10^q) for q = POW5_MIN..POW5_MAX, most
+// significant half first, generated as in Lemire's fast_float. The range covers the literals
+// people type, physical constants included; others take the fallback.
+#define POW5_MIN (-64)
+#define POW5_MAX 64
+
+static const guint64 pow5_128[POW5_MAX - POW5_MIN + 1][2] = {
+    { 0xA87FEA27A539E9A5ULL, 0x3F2398D747B36224ULL }, { 0xD29FE4B18E88640EULL, 0x8EEC7F0D19A03AADULL },
+    { 0x83A3EEEEF9153E89ULL, 0x1953CF68300424ACULL }, { 0xA48CEAAAB75A8E2BULL, 0x5FA8C3423C052DD7ULL },
+    { 0xCDB02555653131B6ULL, 0x3792F412CB06794DULL }, { 0x808E17555F3EBF11ULL, 0xE2BBD88BBEE40BD0ULL },
+    { 0xA0B19D2AB70E6ED6ULL, 0x5B6ACEAEAE9D0EC4ULL }, { 0xC8DE047564D20A8BULL, 0xF245825A5A445275ULL },
+    { 0xFB158592BE068D2EULL, 0xEED6E2F0F0D56712ULL }, { 0x9CED737BB6C4183DULL, 0x55464DD69685606BULL },
+    { 0xC428D05AA4751E4CULL, 0xAA97E14C3C26B886ULL }, { 0xF53304714D9265DFULL, 0xD53DD99F4B3066A8ULL },
+    { 0x993FE2C6D07B7FABULL, 0xE546A8038EFE4029ULL }, { 0xBF8FDB78849A5F96ULL, 0xDE98520472BDD033ULL },
+    { 0xEF73D256A5C0F77CULL, 0x963E66858F6D4440ULL }, { 0x95A8637627989AADULL, 0xDDE7001379A44AA8ULL },
+    { 0xBB127C53B17EC159ULL, 0x5560C018580D5D52ULL }, { 0xE9D71B689DDE71AFULL, 0xAAB8F01E6E10B4A6ULL },
+    { 0x9226712162AB070DULL, 0xCAB3961304CA70E8ULL }, { 0xB6B00D69BB55C8D1ULL, 0x3D607B97C5FD0D22ULL },
+    { 0xE45C10C42A2B3B05ULL, 0x8CB89A7DB77C506AULL }, { 0x8EB98A7A9A5B04E3ULL, 0x77F3608E92ADB242ULL },
+    { 0xB267ED1940F1C61CULL, 0x55F038B237591ED3ULL }, { 0xDF01E85F912E37A3ULL, 0x6B6C46DEC52F6688ULL },
+    { 0x8B61313BBABCE2C6ULL, 0x2323AC4B3B3DA015ULL }, { 0xAE397D8AA96C1B77ULL, 0xABEC975E0A0D081AULL },
+    { 0xD9C7DCED53C72255ULL, 0x96E7BD358C904A21ULL }, { 0x881CEA14545C7575ULL, 0x7E50D64177DA2E54ULL },
+    { 0xAA242499697392D2ULL, 0xDDE50BD1D5D0B9E9ULL }, { 0xD4AD2DBFC3D07787ULL, 0x955E4EC64B44E864ULL },
+    { 0x84EC3C97DA624AB4ULL, 0xBD5AF13BEF0B113EULL }, { 0xA6274BBDD0FADD61ULL, 0xECB1AD8AEACDD58EULL },
+    { 0xCFB11EAD453994BAULL, 0x67DE18EDA5814AF2ULL }, { 0x81CEB32C4B43FCF4ULL, 0x80EACF948770CED7ULL },
+    { 0xA2425FF75E14FC31ULL, 0xA1258379A94D028DULL }, { 0xCAD2F7F5359A3B3EULL, 0x096EE45813A04330ULL },
+    { 0xFD87B5F28300CA0DULL, 0x8BCA9D6E188853FCULL }, { 0x9E74D1B791E07E48ULL, 0x775EA264CF55347EULL },
+    { 0xC612062576589DDAULL, 0x95364AFE032A819EULL }, { 0xF79687AED3EEC551ULL, 0x3A83DDBD83F52205ULL },
+    { 0x9ABE14CD44753B52ULL, 0xC4926A9672793543ULL }, { 0xC16D9A0095928A27ULL, 0x75B7053C0F178294ULL },
+    { 0xF1C90080BAF72CB1ULL, 0x5324C68B12DD6339ULL }, { 0x971DA05074DA7BEEULL, 0xD3F6FC16EBCA5E04ULL },
+    { 0xBCE5086492111AEAULL, 0x88F4BB1CA6BCF585ULL }, { 0xEC1E4A7DB69561A5ULL, 0x2B31E9E3D06C32E6ULL },
+    { 0x9392EE8E921D5D07ULL, 0x3AFF322E62439FD0ULL }, { 0xB877AA3236A4B449ULL, 0x09BEFEB9FAD487C3ULL },
+    { 0xE69594BEC44DE15BULL, 0x4C2EBE687989A9B4ULL }, { 0x901D7CF73AB0ACD9ULL, 0x0F9D37014BF60A11ULL },
+    { 0xB424DC35095CD80FULL, 0x538484C19EF38C95ULL }, { 0xE12E13424BB40E13ULL, 0x2865A5F206B06FBAULL },
+    { 0x8CBCCC096F5088CBULL, 0xF93F87B7442E45D4ULL }, { 0xAFEBFF0BCB24AAFEULL, 0xF78F69A51539D749ULL },
+    { 0xDBE6FECEBDEDD5BEULL, 0xB573440E5A884D1CULL }, { 0x89705F4136B4A597ULL, 0x31680A88F8953031ULL },
+    { 0xABCC77118461CEFCULL, 0xFDC20D2B36BA7C3EULL }, { 0xD6BF94D5E57A42BCULL, 0x3D32907604691B4DULL },
+    { 0x8637BD05AF6C69B5ULL, 0xA63F9A49C2C1B110ULL }, { 0xA7C5AC471B478423ULL, 0x0FCF80DC33721D54ULL },
+    { 0xD1B71758E219652BULL, 0xD3C36113404EA4A9ULL }, { 0x83126E978D4FDF3BULL, 0x645A1CAC083126EAULL },
+    { 0xA3D70A3D70A3D70AULL, 0x3D70A3D70A3D70A4ULL }, { 0xCCCCCCCCCCCCCCCCULL, 0xCCCCCCCCCCCCCCCDULL },
+    { 0x8000000000000000ULL, 0x0000000000000000ULL }, { 0xA000000000000000ULL, 0x0000000000000000ULL },
+    { 0xC800000000000000ULL, 0x0000000000000000ULL }, { 0xFA00000000000000ULL, 0x0000000000000000ULL },
+    { 0x9C40000000000000ULL, 0x0000000000000000ULL }, { 0xC350000000000000ULL, 0x0000000000000000ULL },
+    { 0xF424000000000000ULL, 0x0000000000000000ULL }, { 0x9896800000000000ULL, 0x0000000000000000ULL },
+    { 0xBEBC200000000000ULL, 0x0000000000000000ULL }, { 0xEE6B280000000000ULL, 0x0000000000000000ULL },
+    { 0x9502F90000000000ULL, 0x0000000000000000ULL }, { 0xBA43B74000000000ULL, 0x0000000000000000ULL },
+    { 0xE8D4A51000000000ULL, 0x0000000000000000ULL }, { 0x9184E72A00000000ULL, 0x0000000000000000ULL },
+    { 0xB5E620F480000000ULL, 0x0000000000000000ULL }, { 0xE35FA931A0000000ULL, 0x0000000000000000ULL },
+    { 0x8E1BC9BF04000000ULL, 0x0000000000000000ULL }, { 0xB1A2BC2EC5000000ULL, 0x0000000000000000ULL },
+    { 0xDE0B6B3A76400000ULL, 0x0000000000000000ULL }, { 0x8AC7230489E80000ULL, 0x0000000000000000ULL },
+    { 0xAD78EBC5AC620000ULL, 0x0000000000000000ULL }, { 0xD8D726B7177A8000ULL, 0x0000000000000000ULL },
+    { 0x878678326EAC9000ULL, 0x0000000000000000ULL }, { 0xA968163F0A57B400ULL, 0x0000000000000000ULL },
+    { 0xD3C21BCECCEDA100ULL, 0x0000000000000000ULL }, { 0x84595161401484A0ULL, 0x0000000000000000ULL },
+    { 0xA56FA5B99019A5C8ULL, 0x0000000000000000ULL }, { 0xCECB8F27F4200F3AULL, 0x0000000000000000ULL },
+    { 0x813F3978F8940984ULL, 0x4000000000000000ULL }, { 0xA18F07D736B90BE5ULL, 0x5000000000000000ULL },
+    { 0xC9F2C9CD04674EDEULL, 0xA400000000000000ULL }, { 0xFC6F7C4045812296ULL, 0x4D00000000000000ULL },
+    { 0x9DC5ADA82B70B59DULL, 0xF020000000000000ULL }, { 0xC5371912364CE305ULL, 0x6C28000000000000ULL },
+    { 0xF684DF56C3E01BC6ULL, 0xC732000000000000ULL }, { 0x9A130B963A6C115CULL, 0x3C7F400000000000ULL },
+    { 0xC097CE7BC90715B3ULL, 0x4B9F100000000000ULL }, { 0xF0BDC21ABB48DB20ULL, 0x1E86D40000000000ULL },
+    { 0x96769950B50D88F4ULL, 0x1314448000000000ULL }, { 0xBC143FA4E250EB31ULL, 0x17D955A000000000ULL },
+    { 0xEB194F8E1AE525FDULL, 0x5DCFAB0800000000ULL }, { 0x92EFD1B8D0CF37BEULL, 0x5AA1CAE500000000ULL },
+    { 0xB7ABC627050305ADULL, 0xF14A3D9E40000000ULL }, { 0xE596B7B0C643C719ULL, 0x6D9CCD05D0000000ULL },
+    { 0x8F7E32CE7BEA5C6FULL, 0xE4820023A2000000ULL }, { 0xB35DBF821AE4F38BULL, 0xDDA2802C8A800000ULL },
+    { 0xE0352F62A19E306EULL, 0xD50B2037AD200000ULL }, { 0x8C213D9DA502DE45ULL, 0x4526F422CC340000ULL },
+    { 0xAF298D050E4395D6ULL, 0x9670B12B7F410000ULL }, { 0xDAF3F04651D47B4CULL, 0x3C0CDD765F114000ULL },
+    { 0x88D8762BF324CD0FULL, 0xA5880A69FB6AC800ULL }, { 0xAB0E93B6EFEE0053ULL, 0x8EEA0D047A457A00ULL },
+    { 0xD5D238A4ABE98068ULL, 0x72A4904598D6D880ULL }, { 0x85A36366EB71F041ULL, 0x47A6DA2B7F864750ULL },
+    { 0xA70C3C40A64E6C51ULL, 0x999090B65F67D924ULL }, { 0xD0CF4B50CFE20765ULL, 0xFFF4B4E3F741CF6DULL },
+    { 0x82818F1281ED449FULL, 0xBFF8F10E7A8921A4ULL }, { 0xA321F2D7226895C7ULL, 0xAFF72D52192B6A0DULL },
+    { 0xCBEA6F8CEB02BB39ULL, 0x9BF4F8A69F764490ULL }, { 0xFEE50B7025C36A08ULL, 0x02F236D04753D5B4ULL },
+    { 0x9F4F2726179A2245ULL, 0x01D762422C946590ULL }, { 0xC722F0EF9D80AAD6ULL, 0x424D3AD2B7B97EF5ULL },
+    { 0xF8EBAD2B84E0D58BULL, 0xD2E0898765A7DEB2ULL }, { 0x9B934C3B330C8577ULL, 0x63CC55F49F88EB2FULL },
+    { 0xC2781F49FFCFA6D5ULL, 0x3CBF6B71C76B25FBULL },
+};
+
+static void mul64(guint64 a, guint64 b, guint64 *hi, guint64 *lo) {
+    guint64 a_lo = (guint32)a, a_hi = a >> 32;
+    guint64 b_lo = (guint32)b, b_hi = b >> 32;
+    guint64 p0 = a_lo * b_lo, p1 = a_lo * b_hi, p2 = a_hi * b_lo, p3 = a_hi * b_hi;
+    guint64 mid = (p0 >> 32) + (guint32)p1 + (guint32)p2;
+    *lo = (mid << 32) | (guint32)p0;
+    *hi = p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+}
+
+static int leading_zeros(guint64 v) {
+    int n = 0;
+    for (int shift = 32; shift > 0; shift >>= 1) {
+        if (!(v >> (64 - shift))) {
+            v <<= shift;
+            n += shift;
+        }
+    }
+    return n;
+}
+
+// Eisel-Lemire: mantissa * 10^exp10 from one (rarely two) 64x64-bit multiplies by a truncated
+// power of ten. Returns FALSE when the product is too close to a rounding boundary to decide,
+// or the result would be subnormal or infinite.
+static gboolean eisel_lemire(guint64 mantissa, int exp10, double *out) {
+    if (exp10 < POW5_MIN || exp10 > POW5_MAX) return FALSE;
+
+    int clz = leading_zeros(mantissa);
+    mantissa <<= clz;
+    // floor(exp10 * log2(10)), with 217706 / 2^16 ~ log2(10). The offset keeps the shifted
+    // value non-negative; 217706 * 32768 / 2^16 = 108853 exactly.
+    gint64 exp2 = ((217706 * ((gint64)exp10 + 32768)) >> 16) - 108853;
+    guint64 biased = (guint64)(exp2 + 64 + 1023 - clz);
+
+    const guint64 *pow = pow5_128[exp10 - POW5_MIN];
+    guint64 hi, lo;
+    mul64(mantissa, pow[0], &hi, &lo);
+    if ((hi & 0x1FF) == 0x1FF && lo + mantissa < mantissa) {
+        // The low bits may carry into the result: include the second half of the power.
+        guint64 y_hi, y_lo;
+        mul64(mantissa, pow[1], &y_hi, &y_lo);
+        guint64 merged_hi = hi;
+        guint64 merged_lo = lo + y_hi;
+        if (merged_lo < lo) merged_hi++;
+        if ((merged_hi & 0x1FF) == 0x1FF && merged_lo + 1 == 0 && y_lo + mantissa < mantissa) return FALSE;
+        hi = merged_hi;
+        lo = merged_lo;
+    }
+
+    guint64 msb = hi >> 63;
+    guint64 bits = hi >> (msb + 9); // 54 bits: the mantissa plus one rounding bit
+    biased -= 1 ^ msb;
+    if (lo == 0 && (hi & 0x1FF) == 0 && (bits & 3) == 1) return FALSE; // exactly half-way
+    bits += bits & 1;
+    bits >>= 1;
+    if (bits >> 53) {
+        bits >>= 1;
+        biased++;
+    }
+    if (biased - 1 >= 0x7FF - 1) return FALSE;
+
+    bits = (biased << 52) | (bits & 0x000FFFFFFFFFFFFFULL);
+    memcpy(out, &bits, sizeof(*out));
+    return TRUE;
+}
+
+// Long mantissas, large exponents and hexadecimal floats: g_ascii_strtod() rounds correctly
+// too, and ignores the locale.
+static double read_number_slow(const char *p, const char **stop) {
+    char *endptr = NULL;
+    double v = g_ascii_strtod(p, &endptr);
+    *stop = endptr;
+    return v;
+}
+
+double calc_read_number(const char *p, const char *end, const char **stop) {
+    if (end - p >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) return read_number_slow(p, stop);
+
+    guint64 mantissa = 0;
+    int n_digits = 0;
+    int exp10 = 0;
+    gboolean truncated = FALSE;
+
+    const char *q = read_digits(p, end, &mantissa, &n_digits, &truncated);
+    gboolean any = (q > p);
+    if (q < end && *q == '.') {
+        const char *digits = ++q;
+        // Leading fraction zeros of a zero integer part only move the decimal point.
+        if (mantissa == 0) {
+            while (q < end && *q == '0') q++;
+            exp10 -= (int)(q - digits);
+        }
+        int before = n_digits;
+        q = read_digits(q, end, &mantissa, &n_digits, &truncated);
+        exp10 -= n_digits - before;
+        any = any || (q > digits);
+    }
+    if (!any) {
+        *stop = p;
+        return 0.0;
+    }
+    if (truncated) return read_number_slow(p, stop);
+
+    // An exponent needs at least one digit; otherwise the 'e' is not part of the number.
+    if (q < end && (*q == 'e' || *q == 'E')) {
+        const char *r = q + 1;
+        gboolean negative = (r < end && *r == '-');
+        if (r < end && (*r == '-' || *r == '+')) r++;
+        if (r < end && calc_char_is(*r, CALC_CC_DIGIT)) {
+            int e = 0;
+            for (; r < end && calc_char_is(*r, CALC_CC_DIGIT); r++) {
+                if (e < 100000) e = e * 10 + (*r - '0');
+            }
+            exp10 += negative ? -e : e;
+            q = r;
+        }
+    }
+
+    *stop = q;
+    if (mantissa == 0) return 0.0;
+
+    // Clinger's fast path: the mantissa and the power of ten are both exact doubles, so one
+    // correctly rounded multiply or divide gives the correctly rounded result.
+    if (mantissa <= MAX_EXACT_INT) {
+        if (exp10 >= 0 && exp10 <= MAX_EXACT_POW10) return (double)mantissa * exact_pow10[exp10];
+        if (exp10 < 0 && exp10 >= -MAX_EXACT_POW10) return (double)mantissa / exact_pow10[-exp10];
+        // "12e25": move the extra zeros into the mantissa while it stays exact.
+        if (exp10 > MAX_EXACT_POW10 && exp10 <= MAX_EXACT_POW10 + 15) {
+            guint64 scaled = mantissa;
+            for (int k = MAX_EXACT_POW10; k < exp10 && scaled <= MAX_EXACT_INT; k++) scaled *= 10;
+            if (scaled <= MAX_EXACT_INT) return (double)scaled * exact_pow10[MAX_EXACT_POW10];
+        }
+    }
+    double v;
+    if (eisel_lemire(mantissa, exp10, &v)) return v;
+    return read_number_slow(p, stop);
+}
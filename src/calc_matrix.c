@@ -0,0 +1,690 @@
+#include "calc_eval.h"
+#include "calc_internal.h"
+
+#include <math.h>
+#include <string.h>
+
+// Matrix values. The parser turns "[a, b; c, d]" into the code of the elements and an 'M' token,
+// and programs with one come here instead of going to the scalar evaluators, which never see a
+// matrix. On the value stack below a number stays a plain double; a matrix result with one
+// element becomes a number again. Matrix storage comes from a per-thread arena that is rewound
+// after each evaluation and keeps its memory, so once an expression has run, running it again
+// on values of the same size allocates nothing. Products, the LU factorization and triangular
+// solves all spend their time in one cache-blocked kernel, gemm().
+
+// gemm() copies KC x NC blocks of B into panels of NR columns, so that the kernel reads one
+// panel (KC * NR doubles, in L1) for each MR rows of A, and it walks MC rows of A (an MC x KC
+// block, in L2) before moving to the next panel.
+#define GEMM_MR 4
+#define GEMM_NR 4
+#define GEMM_MC 64
+#define GEMM_KC 256
+#define GEMM_NC 512
+
+// Columns factored at a time before the rest of the matrix is updated with gemm(); also the
+// row block of the triangular solves.
+#define LU_NB 64
+
+#define TRANSPOSE_TILE 32
+
+// Largest arena kept between evaluations; bigger ones spill the rest to the heap.
+#define MATRIX_ARENA_KEEP ((size_t)64 << 20)
+
+// Most elements a matrix may have (2 GiB of doubles).
+#define MATRIX_MAX_ELEMENTS ((size_t)1 << 28)
+
+typedef struct {
+    guint8 *base;
+    size_t cap;
+    size_t used;      // bytes of base handed out
+    size_t wanted;    // bytes requested since the outermost evaluation began, spills included
+    GPtrArray *spill; // blocks allocated after base ran out; freed when the arena is rewound
+    guint depth;      // evaluations in progress (a registered function may evaluate an expression)
+} Arena;
+
+typedef struct {
+    size_t used;
+    guint spill;
+} ArenaMark;
+
+static void arena_destroy(gpointer data) {
+    Arena *arena = data;
+    g_ptr_array_unref(arena->spill);
+    g_free(arena->base);
+    g_free(arena);
+}
+
+static Arena *arena_get(void) {
+    static GPrivate key = G_PRIVATE_INIT(arena_destroy);
+    Arena *arena = g_private_get(&key);
+    if (!arena) {
+        arena = g_new0(Arena, 1);
+        arena->spill = g_ptr_array_new_with_free_func(g_free);
+        g_private_set(&key, arena);
+    }
+    return arena;
+}
+
+static void *arena_alloc(Arena *arena, size_t bytes) {
+    bytes = (bytes + 63) & ~(size_t)63; // keeps every block cache-line aligned within base
+    arena->wanted += bytes;
+    if (bytes <= arena->cap - arena->used) {
+        void *p = arena->base + arena->used;
+        arena->used += bytes;
+        return p;
+    }
+    void *p = g_malloc(bytes);
+    g_ptr_array_add(arena->spill, p);
+    return p;
+}
+
+static ArenaMark arena_enter(Arena *arena) {
+    arena->depth++;
+    return (ArenaMark){ arena->used, arena->spill->len };
+}
+
+// Frees everything allocated since the mark. When the outermost evaluation ends, an arena that
+// spilled is replaced by one block big enough for next time.
+static void arena_leave(Arena *arena, ArenaMark mark) {
+    g_ptr_array_set_size(arena->spill, (gint)mark.spill);
+    arena->used = mark.used;
+    if (--arena->depth > 0) return;
+    if (arena->wanted > arena->cap && arena->cap < MATRIX_ARENA_KEEP) {
+        g_free(arena->base);
+        arena->cap = MIN(arena->wanted, MATRIX_ARENA_KEEP);
+        arena->base = g_malloc(arena->cap);
+    }
+    arena->wanted = 0;
+}
+
+typedef struct {
+    double *data; // rows * cols values, row by row; NULL for a number
+    size_t rows;
+    size_t cols;
+    double value;  // the number when data is NULL
+    gboolean temp; // data is arena memory nothing else refers to, so it may be overwritten
+} Value;
+
+typedef struct {
+    Arena *arena;
+    gboolean degrees;
+    const double *vars;      // number inputs
+    const CalcMatrix *mvars; // matrix inputs, used instead of vars when set
+    char *err;
+    size_t err_cap;
+} Eval;
+
+static Value number(double v) {
+    return (Value){ .value = v, .rows = 1, .cols = 1 };
+}
+
+static gboolean new_matrix(Eval *e, size_t rows, size_t cols, Value *out) {
+    if (rows > MATRIX_MAX_ELEMENTS / cols) {
+        g_snprintf(e->err, e->err_cap, "matrix too large");
+        return FALSE;
+    }
+    *out = (Value){ .data = arena_alloc(e->arena, rows * cols * sizeof(double)), .rows = rows, .cols = cols,
+                    .temp = TRUE };
+    return TRUE;
+}
+
+// Somewhere to write a result shaped like a: a itself if it may be overwritten.
+static gboolean reuse(Eval *e, const Value *a, Value *out) {
+    if (a->temp) {
+        *out = *a;
+        return TRUE;
+    }
+    return new_matrix(e, a->rows, a->cols, out);
+}
+
+static gboolean fail(Eval *e, const char *msg) {
+    g_snprintf(e->err, e->err_cap, "%s", msg);
+    return FALSE;
+}
+
+// Applies an operator to numbers through calc_eval_rpn(), so values and errors are real mode's.
+static gboolean scalar_op(Eval *e, const Token *t, const double *args, int arity, double *out) {
+    Token code[CALC_FUNC_MAX_ARGS + 1];
+    double stack[CALC_FUNC_MAX_ARGS + 1];
+    for (int k = 0; k < arity; k++) code[k] = (Token){ .type = TOK_NUM, .value = args[k] };
+    code[arity] = *t;
+    return calc_eval_rpn(code, (size_t)arity + 1, NULL, e->degrees, stack, out, e->err, e->err_cap);
+}
+
+// --- Kernels. Matrices are row-major with a leading dimension (row stride) of their own, so the
+// kernels also work on blocks of a larger matrix.
+
+// c[0..4)[0..nr) += alpha * a[0..4)[0..kc) * panel, where the panel holds kc rows of GEMM_NR
+// columns. The 16 sums stay in registers, and the compiler pairs them into vector operations.
+static void kernel_4x4(size_t kc, const double *a, size_t lda, const double *panel, double alpha, double *c,
+                       size_t ldc, size_t nr) {
+    const double *a0 = a, *a1 = a + lda, *a2 = a + 2 * lda, *a3 = a + 3 * lda;
+    double c00 = 0.0, c01 = 0.0, c02 = 0.0, c03 = 0.0;
+    double c10 = 0.0, c11 = 0.0, c12 = 0.0, c13 = 0.0;
+    double c20 = 0.0, c21 = 0.0, c22 = 0.0, c23 = 0.0;
+    double c30 = 0.0, c31 = 0.0, c32 = 0.0, c33 = 0.0;
+    for (size_t k = 0; k < kc; k++) {
+        const double *b = panel + k * GEMM_NR;
+        double b0 = b[0], b1 = b[1], b2 = b[2], b3 = b[3];
+        double x = a0[k];
+        c00 += x * b0; c01 += x * b1; c02 += x * b2; c03 += x * b3;
+        x = a1[k];
+        c10 += x * b0; c11 += x * b1; c12 += x * b2; c13 += x * b3;
+        x = a2[k];
+        c20 += x * b0; c21 += x * b1; c22 += x * b2; c23 += x * b3;
+        x = a3[k];
+        c30 += x * b0; c31 += x * b1; c32 += x * b2; c33 += x * b3;
+    }
+    const double sums[GEMM_MR][GEMM_NR] = {
+        { c00, c01, c02, c03 }, { c10, c11, c12, c13 }, { c20, c21, c22, c23 }, { c30, c31, c32, c33 },
+    };
+    for (size_t r = 0; r < GEMM_MR; r++) {
+        for (size_t j = 0; j < nr; j++) c[r * ldc + j] += alpha * sums[r][j];
+    }
+}
+
+// The last mr < GEMM_MR rows.
+static void kernel_rows(size_t mr, size_t kc, const double *a, size_t lda, const double *panel, double alpha,
+                        double *c, size_t ldc, size_t nr) {
+    for (size_t r = 0; r < mr; r++) {
+        double sums[GEMM_NR] = { 0.0 };
+        for (size_t k = 0; k < kc; k++) {
+            double x = a[r * lda + k];
+            for (size_t j = 0; j < GEMM_NR; j++) sums[j] += x * panel[k * GEMM_NR + j];
+        }
+        for (size_t j = 0; j < nr; j++) c[r * ldc + j] += alpha * sums[j];
+    }
+}
+
+// C += alpha * A * B for an m x k matrix A and a k x n matrix B.
+static void gemm(Arena *arena, size_t m, size_t n, size_t k, double alpha, const double *a, size_t lda,
+                 const double *b, size_t ldb, double *c, size_t ldc) {
+    if (m == 0 || n == 0 || k == 0) return;
+    ArenaMark mark = arena_enter(arena);
+    size_t panel_cols = (MIN(n, (size_t)GEMM_NC) + GEMM_NR - 1) / GEMM_NR * GEMM_NR;
+    double *panels = arena_alloc(arena, MIN(k, (size_t)GEMM_KC) * panel_cols * sizeof(double));
+
+    for (size_t jc = 0; jc < n; jc += GEMM_NC) {
+        size_t nc = MIN(n - jc, (size_t)GEMM_NC);
+        for (size_t pc = 0; pc < k; pc += GEMM_KC) {
+            size_t kc = MIN(k - pc, (size_t)GEMM_KC);
+            // Each panel holds kc rows of GEMM_NR columns, zero-padded at the right edge.
+            for (size_t jr = 0; jr < nc; jr += GEMM_NR) {
+                size_t nr = MIN(nc - jr, (size_t)GEMM_NR);
+                double *p = panels + jr * kc;
+                for (size_t q = 0; q < kc; q++) {
+                    const double *src = b + (pc + q) * ldb + jc + jr;
+                    size_t j = 0;
+                    for (; j < nr; j++) p[q * GEMM_NR + j] = src[j];
+                    for (; j < GEMM_NR; j++) p[q * GEMM_NR + j] = 0.0;
+                }
+            }
+            for (size_t ic = 0; ic < m; ic += GEMM_MC) {
+                size_t mc = MIN(m - ic, (size_t)GEMM_MC);
+                for (size_t jr = 0; jr < nc; jr += GEMM_NR) {
+                    size_t nr = MIN(nc - jr, (size_t)GEMM_NR);
+                    const double *p = panels + jr * kc;
+                    const double *ab = a + ic * lda + pc;
+                    double *cb = c + ic * ldc + jc + jr;
+                    size_t i = 0;
+                    for (; i + GEMM_MR <= mc; i += GEMM_MR) {
+                        kernel_4x4(kc, ab + i * lda, lda, p, alpha, cb + i * ldc, ldc, nr);
+                    }
+                    if (i < mc) kernel_rows(mc - i, kc, ab + i * lda, lda, p, alpha, cb + i * ldc, ldc, nr);
+                }
+            }
+        }
+    }
+    arena_leave(arena, mark);
+}
+
+// y += alpha * x
+static void axpy(double *restrict y, double alpha, const double *restrict x, size_t n) {
+    for (size_t j = 0; j < n; j++) y[j] += alpha * x[j];
+}
+
+static void swap_rows(double *restrict a, double *restrict b, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        double t = a[j];
+        a[j] = b[j];
+        b[j] = t;
+    }
+}
+
+// Factors the n x n matrix a in place as P A = L U with partial pivoting: L is unit lower
+// triangular (below the diagonal), U upper triangular, and row i of P A is row perm[i] of A.
+// Blocked: each LU_NB columns are factored on their own, then the rest of the matrix is
+// brought up to date with one gemm(). Returns FALSE if A is singular; otherwise *sign is the
+// determinant of P.
+static gboolean lu_factor(Arena *arena, double *a, size_t n, size_t *perm, double *sign) {
+    *sign = 1.0;
+    for (size_t i = 0; i < n; i++) perm[i] = i;
+
+    for (size_t k0 = 0; k0 < n; k0 += LU_NB) {
+        size_t k1 = MIN(k0 + LU_NB, n);
+        for (size_t j = k0; j < k1; j++) {
+            size_t p = j;
+            double best = fabs(a[j * n + j]);
+            for (size_t i = j + 1; i < n; i++) {
+                if (fabs(a[i * n + j]) > best) {
+                    best = fabs(a[i * n + j]);
+                    p = i;
+                }
+            }
+            if (best == 0.0) return FALSE;
+            if (p != j) {
+                swap_rows(a + j * n, a + p * n, n);
+                size_t t = perm[j];
+                perm[j] = perm[p];
+                perm[p] = t;
+                *sign = -*sign;
+            }
+            const double *pivot = a + j * n;
+            for (size_t i = j + 1; i < n; i++) {
+                double *row = a + i * n;
+                double l = row[j] /= pivot[j];
+                axpy(row + j + 1, -l, pivot + j + 1, k1 - j - 1);
+            }
+        }
+        // U12 = L11^-1 A12, then A22 -= L21 U12.
+        for (size_t r = k0 + 1; r < k1; r++) {
+            for (size_t q = k0; q < r; q++) axpy(a + r * n + k1, -a[r * n + q], a + q * n + k1, n - k1);
+        }
+        gemm(arena, n - k1, n - k1, k1 - k0, -1.0, a + k1 * n + k0, n, a + k0 * n + k1, n, a + k1 * n + k1, n);
+    }
+    return TRUE;
+}
+
+// Solves L U X = B in place for the n x m right-hand side x = B (already permuted), one row block
+// at a time: the rows solved so far are subtracted from a block with gemm().
+static void lu_solve(Arena *arena, const double *lu, size_t n, double *x, size_t m) {
+    for (size_t i0 = 0; i0 < n; i0 += LU_NB) {
+        size_t i1 = MIN(i0 + LU_NB, n);
+        gemm(arena, i1 - i0, m, i0, -1.0, lu + i0 * n, n, x, m, x + i0 * m, m);
+        for (size_t i = i0 + 1; i < i1; i++) {
+            for (size_t q = i0; q < i; q++) axpy(x + i * m, -lu[i * n + q], x + q * m, m);
+        }
+    }
+    for (size_t i1 = n; i1 > 0;) {
+        size_t i0 = i1 > LU_NB ? i1 - LU_NB : 0;
+        gemm(arena, i1 - i0, m, n - i1, -1.0, lu + i0 * n + i1, n, x + i1 * m, m, x + i0 * m, m);
+        for (size_t i = i1; i-- > i0;) {
+            double *row = x + i * m;
+            for (size_t q = i + 1; q < i1; q++) axpy(row, -lu[i * n + q], x + q * m, m);
+            double d = lu[i * n + i];
+            for (size_t j = 0; j < m; j++) row[j] /= d;
+        }
+        i1 = i0;
+    }
+}
+
+// --- Operations. Each leaves its result in *a, the first operand's stack slot.
+
+static gboolean square(Eval *e, const Value *a) {
+    return a->rows == a->cols || fail(e, "matrix is not square");
+}
+
+// A copy of the square matrix a, factored. Returns FALSE if it is singular.
+static gboolean factor(Eval *e, const Value *a, double **lu, size_t **perm, double *sign) {
+    size_t n = a->rows;
+    *lu = arena_alloc(e->arena, n * n * sizeof(double));
+    *perm = arena_alloc(e->arena, n * sizeof(size_t));
+    memcpy(*lu, a->data, n * n * sizeof(double));
+    return lu_factor(e->arena, *lu, n, *perm, sign);
+}
+
+static gboolean det(Eval *e, Value *a) {
+    if (!square(e, a)) return FALSE;
+    double *lu, sign;
+    size_t *perm;
+    double d = 0.0;
+    if (factor(e, a, &lu, &perm, &sign)) {
+        d = sign;
+        for (size_t i = 0; i < a->rows; i++) d *= lu[i * a->rows + i];
+    }
+    *a = number(d);
+    return TRUE;
+}
+
+// Solves A X = B for the rows of b; inverts A when b is NULL.
+static gboolean solve(Eval *e, Value *a, const Value *b) {
+    if (!square(e, a)) return FALSE;
+    size_t n = a->rows;
+    size_t m = b ? b->cols : n;
+    if (b && b->rows != n) {
+        if (b->rows * b->cols != n || b->rows != 1) return fail(e, "matrix sizes do not match");
+        m = 1; // a row vector is taken as a column
+    }
+    double *lu, sign;
+    size_t *perm;
+    if (!factor(e, a, &lu, &perm, &sign)) return fail(e, "matrix is singular");
+
+    Value x;
+    if (!new_matrix(e, n, m, &x)) return FALSE;
+    if (b) {
+        for (size_t i = 0; i < n; i++) memcpy(x.data + i * m, b->data + perm[i] * m, m * sizeof(double));
+    } else {
+        memset(x.data, 0, n * n * sizeof(double));
+        for (size_t i = 0; i < n; i++) x.data[i * n + perm[i]] = 1.0;
+    }
+    lu_solve(e->arena, lu, n, x.data, m);
+    *a = x;
+    return TRUE;
+}
+
+static gboolean transpose(Eval *e, Value *a) {
+    Value t;
+    if (!new_matrix(e, a->cols, a->rows, &t)) return FALSE;
+    for (size_t i0 = 0; i0 < a->rows; i0 += TRANSPOSE_TILE) {
+        size_t i1 = MIN(i0 + TRANSPOSE_TILE, a->rows);
+        for (size_t j0 = 0; j0 < a->cols; j0 += TRANSPOSE_TILE) {
+            size_t j1 = MIN(j0 + TRANSPOSE_TILE, a->cols);
+            for (size_t i = i0; i < i1; i++) {
+                for (size_t j = j0; j < j1; j++) t.data[j * a->rows + i] = a->data[i * a->cols + j];
+            }
+        }
+    }
+    *a = t;
+    return TRUE;
+}
+
+// Sum of the products of corresponding elements, in four interleaved sums the compiler can
+// vectorize.
+static gboolean dot(Eval *e, Value *a, const Value *b) {
+    size_t n = a->rows * a->cols;
+    if (!a->data || !b->data || b->rows * b->cols != n) return fail(e, "matrix sizes do not match");
+    double s[4] = { 0.0, 0.0, 0.0, 0.0 };
+    size_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+        for (size_t k = 0; k < 4; k++) s[k] += a->data[j + k] * b->data[j + k];
+    }
+    for (; j < n; j++) s[0] += a->data[j] * b->data[j];
+    *a = number((s[0] + s[1]) + (s[2] + s[3]));
+    return TRUE;
+}
+
+static gboolean multiply(Eval *e, Value *a, const Value *b) {
+    if (!a->data || !b->data) { // scaling
+        const Value *m = a->data ? a : b;
+        double s = a->data ? b->value : a->value;
+        Value r;
+        if (!reuse(e, m, &r)) return FALSE;
+        for (size_t j = 0; j < m->rows * m->cols; j++) r.data[j] = m->data[j] * s;
+        *a = r;
+        return TRUE;
+    }
+    if (a->cols != b->rows) return fail(e, "matrix sizes do not match");
+    Value r;
+    if (!new_matrix(e, a->rows, b->cols, &r)) return FALSE;
+    memset(r.data, 0, r.rows * r.cols * sizeof(double));
+    gemm(e->arena, a->rows, b->cols, a->cols, 1.0, a->data, a->cols, b->data, b->cols, r.data, r.cols);
+    *a = r;
+    return TRUE;
+}
+
+// a + sign * b, where either may be a number.
+static gboolean add(Eval *e, Value *a, const Value *b, double sign) {
+    if (a->data && b->data && (a->rows != b->rows || a->cols != b->cols)) {
+        return fail(e, "matrix sizes do not match");
+    }
+    const Value *m = a->data ? a : b;
+    size_t n = m->rows * m->cols;
+    Value r;
+    if (!reuse(e, (b->data && b->temp && !(a->data && a->temp)) ? b : m, &r)) return FALSE;
+    if (a->data && b->data) {
+        for (size_t j = 0; j < n; j++) r.data[j] = a->data[j] + sign * b->data[j];
+    } else if (a->data) {
+        double v = sign * b->value;
+        for (size_t j = 0; j < n; j++) r.data[j] = a->data[j] + v;
+    } else {
+        for (size_t j = 0; j < n; j++) r.data[j] = a->value + sign * b->data[j];
+    }
+    *a = r;
+    return TRUE;
+}
+
+// Every element of a through the operator t, with number operands args[1..arity).
+static gboolean map(Eval *e, const Token *t, Value *a, const double *args, int arity) {
+    Value r;
+    if (!reuse(e, a, &r)) return FALSE;
+    size_t n = a->rows * a->cols;
+    if (t->op == 'u') {
+        for (size_t j = 0; j < n; j++) r.data[j] = -a->data[j];
+    } else if (t->op == 'A') {
+        for (size_t j = 0; j < n; j++) r.data[j] = fabs(a->data[j]);
+    } else {
+        double x[CALC_FUNC_MAX_ARGS];
+        for (int k = 1; k < arity; k++) x[k] = args[k];
+        for (size_t j = 0; j < n; j++) {
+            x[0] = a->data[j];
+            if (!scalar_op(e, t, x, arity, &r.data[j])) return FALSE;
+        }
+    }
+    *a = r;
+    return TRUE;
+}
+
+// a^n for a square matrix and an integer n, by repeated squaring; a^-n is inv(a)^n.
+static gboolean power(Eval *e, Value *a, double exponent) {
+    if (!square(e, a)) return FALSE;
+    if (exponent != floor(exponent) || fabs(exponent) > G_MAXINT) {
+        return fail(e, "matrix power needs an integer exponent");
+    }
+    if (exponent < 0 && !solve(e, a, NULL)) return FALSE;
+    guint64 n = (guint64)fabs(exponent);
+    Value acc = { 0 }, base = *a;
+    for (;;) {
+        if (n & 1) {
+            if (!acc.data) acc = base;
+            else if (!multiply(e, &acc, &base)) return FALSE;
+        }
+        n >>= 1;
+        if (!n) break;
+        Value sq = base;
+        if (!multiply(e, &sq, &base)) return FALSE;
+        base = sq;
+    }
+    if (!acc.data) { // a^0
+        if (!new_matrix(e, a->rows, a->rows, &acc)) return FALSE;
+        memset(acc.data, 0, a->rows * a->rows * sizeof(double));
+        for (size_t i = 0; i < a->rows; i++) acc.data[i * a->rows + i] = 1.0;
+    }
+    // acc may still be the operand itself (a^1); it is only read from here on.
+    *a = acc;
+    return TRUE;
+}
+
+static gboolean binary(Eval *e, char op, Value *a, const Value *b) {
+    switch (op) {
+        case '+': return add(e, a, b, 1.0);
+        case '-': return add(e, a, b, -1.0);
+        case '*': return multiply(e, a, b);
+        case '/':
+        case '%':
+            if (b->data) return fail(e, "cannot divide by a matrix");
+            return map(e, &(Token){ .type = TOK_OP, .op = op }, a, (double[]){ 0.0, b->value }, 2);
+        case '^':
+        case 'P':
+            if (b->data) return fail(e, "exponent must be a number");
+            return power(e, a, b->value);
+        default:
+            return fail(e, "unknown operator");
+    }
+}
+
+// The matrix functions, and the others element by element.
+static gboolean call(Eval *e, const Token *t, Value *a) {
+    const CalcFunc *fn = calc_func_get(t->slot);
+    switch (t->slot) {
+        case CALC_FN_DET: return det(e, a);
+        case CALC_FN_INV: return solve(e, a, NULL);
+        case CALC_FN_TRANSPOSE: return transpose(e, a);
+        case CALC_FN_SOLVE:
+            if (!a->data) { // a x = B for a number a
+                if (a->value == 0.0) return fail(e, "matrix is singular");
+                if (!map(e, &(Token){ .type = TOK_OP, .op = '/' }, &a[1], (double[]){ 0.0, a->value }, 2)) return FALSE;
+                *a = a[1];
+                return TRUE;
+            }
+            if (!a[1].data) return fail(e, "matrix sizes do not match");
+            return solve(e, a, &a[1]);
+        case CALC_FN_DOT: return dot(e, a, &a[1]);
+    }
+    if (fn->arity > 1) {
+        g_snprintf(e->err, e->err_cap, "%s needs numbers", fn->name);
+        return FALSE;
+    }
+    return map(e, t, a, NULL, 1);
+}
+
+// A literal's elements, which must be numbers.
+static gboolean literal(Eval *e, const Token *t, Value *a) {
+    size_t rows = (size_t)t->value, cols = (size_t)t->slot;
+    Value m;
+    if (!new_matrix(e, rows, cols, &m)) return FALSE;
+    for (size_t j = 0; j < rows * cols; j++) {
+        if (a[j].data) return fail(e, "matrix elements must be numbers");
+        m.data[j] = a[j].value;
+    }
+    *a = m;
+    return TRUE;
+}
+
+// diff() differentiates scalar code: the point and every input must be numbers.
+static gboolean derivative(Eval *e, const Token *t, Value *a) {
+    if (a->data) return fail(e, "diff needs a number");
+    const double *vars = e->vars;
+    if (e->mvars) {
+        double *v = arena_alloc(e->arena, ((size_t)t->value + 1) * sizeof(double));
+        for (size_t k = 0; k < (size_t)t->value; k++) {
+            if (e->mvars[k].rows * e->mvars[k].cols != 1) return fail(e, "diff needs numbers, not matrices");
+            v[k] = e->mvars[k].data[0];
+        }
+        vars = v;
+    }
+    double value;
+    return calc_diff_rpn(t + 1, (size_t)t->slot, vars, (int)t->value, a->value, e->degrees, &value, &a->value,
+                         e->err, e->err_cap);
+}
+
+static gboolean apply(Eval *e, const Token *t, int arity, Value *a) {
+    if (t->op == 'M') return literal(e, t, a);
+    if (t->op == 'D') return derivative(e, t, a);
+    if (t->op == 'R') *a = number(0.0); // pushes onto a fresh slot
+
+    gboolean numbers = TRUE;
+    for (int k = 0; k < arity; k++) numbers &= !a[k].data;
+    if (numbers) {
+        double args[CALC_FUNC_MAX_ARGS];
+        for (int k = 0; k < arity; k++) args[k] = a[k].value;
+        return scalar_op(e, t, args, arity, &a->value);
+    }
+
+    if (t->op == 'F') return call(e, t, a);
+    if (t->op == 'w') return power(e, a, t->value);
+    if (arity == 2) return binary(e, t->op, a, &a[1]);
+    return map(e, t, a, NULL, 1);
+}
+
+static gboolean eval(Eval *e, const Token *code, size_t count, Value *stack, Value *out) {
+    int top = -1;
+    for (size_t i = 0; i < count; i++) {
+        const Token *t = &code[i];
+        if (t->type == TOK_NUM) {
+            stack[++top] = number(t->value);
+            continue;
+        }
+        if (t->type == TOK_VAR) {
+            const CalcMatrix *m = e->mvars ? &e->mvars[t->slot] : NULL;
+            if (!m) stack[++top] = number(e->vars[t->slot]);
+            else if (m->rows * m->cols == 1) stack[++top] = number(m->data[0]);
+            else stack[++top] = (Value){ .data = m->data, .rows = m->rows, .cols = m->cols };
+            continue;
+        }
+
+        int arity = calc_token_arity(t);
+        if (top + 1 < arity) return fail(e, "invalid expression");
+        top -= arity - 1;
+        Value *a = &stack[top];
+        if (!apply(e, t, arity, a)) return FALSE;
+        if (a->data && a->rows * a->cols == 1) *a = number(a->data[0]);
+        if (t->op == 'D') i += (size_t)t->slot;
+    }
+    if (top != 0) return fail(e, "invalid expression");
+    *out = stack[0];
+    return TRUE;
+}
+
+// Evaluates code with the given inputs and hands the result out as a number or a CalcMatrix.
+static gboolean run(const Token *code, size_t count, size_t depth, const double *vars, const CalcMatrix *mvars,
+                    gboolean degrees, double *result, CalcMatrix *mresult, char *err, size_t err_cap) {
+    Arena *arena = arena_get();
+    ArenaMark mark = arena_enter(arena);
+    Eval e = { arena, degrees, vars, mvars, err, err_cap };
+    Value *stack = arena_alloc(arena, MAX(depth, (size_t)1) * sizeof(Value));
+    Value v = { 0 };
+    gboolean ok = eval(&e, code, count, stack, &v);
+    if (ok && result) {
+        if (v.data) ok = fail(&e, "result is a matrix");
+        else *result = v.value;
+    }
+    if (ok && mresult) {
+        mresult->rows = v.rows;
+        mresult->cols = v.cols;
+        mresult->data = g_new(double, v.rows * v.cols);
+        if (v.data) memcpy(mresult->data, v.data, v.rows * v.cols * sizeof(double));
+        else mresult->data[0] = v.value;
+    }
+    arena_leave(arena, mark);
+    return ok;
+}
+
+gboolean calc_matrix_eval_rpn(const Token *code, size_t count, size_t depth, const double *vars, gboolean degrees,
+                              double *out, char *err, size_t err_cap) {
+    return run(code, count, depth, vars, NULL, degrees, out, NULL, err, err_cap);
+}
+
+gboolean calc_program_eval_matrix(const CalcProgram *prog, const CalcMatrix *vars, CalcMatrix *result, char *err,
+                                  size_t err_cap) {
+    if (prog->needs_complex) {
+        g_snprintf(err, err_cap, "complex expression: use calc_program_eval_complex()");
+        return FALSE;
+    }
+    for (size_t k = 0; k < prog->n_vars; k++) {
+        if (vars[k].rows == 0 || vars[k].cols == 0) {
+            g_snprintf(err, err_cap, "empty matrix");
+            return FALSE;
+        }
+    }
+    return run(prog->code, prog->count, prog->max_depth, NULL, vars, prog->degrees, NULL, result, err, err_cap);
+}
+
+gboolean calc_eval_matrix(const char *expr, gboolean degrees, CalcMatrix *result, char *err, size_t err_cap) {
+    CalcProgram *prog = calc_compile(expr, NULL, 0, degrees, err, err_cap);
+    if (!prog) return FALSE;
+    gboolean ok = calc_program_eval_matrix(prog, NULL, result, err, err_cap);
+    calc_program_free(prog);
+    return ok;
+}
+
+void calc_format_matrix(const CalcMatrix *m, char *out, size_t out_cap) {
+    if (m->rows * m->cols == 1) {
+        calc_format_result(m->data[0], out, out_cap);
+        return;
+    }
+    size_t len = 0;
+    for (size_t i = 0; i < m->rows; i++) {
+        for (size_t j = 0; j < m->cols; j++) {
+            char num[64];
+            calc_format_result(m->data[i * m->cols + j], num, sizeof(num));
+            const char *sep = j > 0 ? ", " : i > 0 ? "; " : "[";
+            int n = g_snprintf(out + len, out_cap - len, "%s%s", sep, num);
+            if ((size_t)n + 2 > out_cap - len) { // no room for it and the closing bracket
+                g_snprintf(out, out_cap, "%zux%zu matrix", m->rows, m->cols);
+                return;
+            }
+            len += (size_t)n;
+        }
+    }
+    g_snprintf(out + len, out_cap - len, "]");
+}
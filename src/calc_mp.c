@@ -0,0 +1,337 @@
+#include "calc_eval.h"
+#include "calc_internal.h"
+
+#include <gmp.h>
+#include <mpfr.h>
+#include <string.h>
+
+// Arbitrary-precision evaluation with MPFR. The expression goes through the same parser as
+// calc_eval(); number literals are re-read from the source text so they are not first
+// rounded to double. Every operation is correctly rounded at the working precision, which
+// carries a few guard bits beyond the requested digits.
+
+#define GUARD_BITS 32
+
+// Largest n accepted by n!. The exact product has about n*log2(n) bits (18M bits at 10^6).
+#define FACTORIAL_MAX 1000000UL
+
+// Below this many factors a range product is a plain loop of single-limb multiplies.
+#define PRODUCT_LEAF 32
+
+static mpfr_prec_t digits_to_bits(guint digits) {
+    // log2(10) = 3.3219..., rounded up
+    return (mpfr_prec_t)((guint64)digits * 33220 / 10000) + 1 + GUARD_BITS;
+}
+
+// lo * (lo+1) * ... * hi by binary splitting: the two halves have similar sizes, so the large
+// multiplies run in GMP's subquadratic algorithms instead of a long chain of
+// big-by-small multiplies.
+static void product_range(mpz_t out, unsigned long lo, unsigned long hi) {
+    if (hi - lo < PRODUCT_LEAF) {
+        mpz_set_ui(out, lo);
+        for (unsigned long k = lo + 1; k <= hi; k++) mpz_mul_ui(out, out, k);
+        return;
+    }
+    unsigned long mid = lo + (hi - lo) / 2;
+    mpz_t right;
+    mpz_init(right);
+    product_range(out, lo, mid);
+    product_range(right, mid + 1, hi);
+    mpz_mul(out, out, right);
+    mpz_clear(right);
+}
+
+static gboolean factorial(mpfr_t v, char *err, size_t err_cap) {
+    if (!mpfr_number_p(v) || mpfr_sgn(v) < 0) {
+        g_snprintf(err, err_cap, "factorial requires a non-negative integer");
+        return FALSE;
+    }
+    mpfr_t r;
+    mpfr_init2(r, mpfr_get_prec(v));
+    mpfr_rint(r, v, MPFR_RNDN);
+    // Values within rounding noise of an integer count as that integer, like calc_eval()'s 1e-9.
+    mpfr_sub(v, v, r, MPFR_RNDN);
+    mpfr_exp_t scale = mpfr_zero_p(r) ? 1 : mpfr_get_exp(r);
+    if (!mpfr_zero_p(v) && mpfr_get_exp(v) > scale - (mpfr_get_prec(v) - GUARD_BITS)) {
+        mpfr_clear(r);
+        g_snprintf(err, err_cap, "factorial requires a non-negative integer");
+        return FALSE;
+    }
+    if (mpfr_cmp_ui(r, FACTORIAL_MAX) > 0) {
+        mpfr_clear(r);
+        g_snprintf(err, err_cap, "factorial overflow");
+        return FALSE;
+    }
+    unsigned long n = mpfr_get_ui(r, MPFR_RNDN);
+    mpfr_clear(r);
+
+    if (n < 2) {
+        mpfr_set_ui(v, 1, MPFR_RNDN);
+        return TRUE;
+    }
+    // The product is exact, so the result is rounded only once.
+    mpz_t p;
+    mpz_init(p);
+    product_range(p, 2, n);
+    mpfr_set_z(v, p, MPFR_RNDN);
+    mpz_clear(p);
+    return TRUE;
+}
+
+// a^b. Integer exponents go through mpfr_pow_si/mpfr_pow_z (square-and-multiply with a single
+// final rounding); others through mpfr_pow.
+static void power(mpfr_t a, const mpfr_t b) {
+    if (mpfr_integer_p(b)) {
+        if (mpfr_fits_slong_p(b, MPFR_RNDN)) {
+            mpfr_pow_si(a, a, mpfr_get_si(b, MPFR_RNDN), MPFR_RNDN);
+        } else {
+            mpz_t e;
+            mpz_init(e);
+            mpfr_get_z(e, b, MPFR_RNDN);
+            mpfr_pow_z(a, a, e, MPFR_RNDN);
+            mpz_clear(e);
+        }
+        return;
+    }
+    mpfr_pow(a, a, b, MPFR_RNDN);
+}
+
+// sin/cos/tan of an angle in the current unit. Degrees use MPFR's exact-period functions
+// where available, so sin(30) is exactly 1/2 and cos(90) exactly 0.
+static void trig(char op, mpfr_t v, gboolean degrees) {
+    if (degrees) {
+#if MPFR_VERSION >= MPFR_VERSION_NUM(4, 2, 0)
+        switch (op) {
+            case 'S': mpfr_sinu(v, v, 360, MPFR_RNDN); return;
+            case 'C': mpfr_cosu(v, v, 360, MPFR_RNDN); return;
+            default:  mpfr_tanu(v, v, 360, MPFR_RNDN); return;
+        }
+#else
+        mpfr_t scale;
+        mpfr_init2(scale, mpfr_get_prec(v));
+        mpfr_const_pi(scale, MPFR_RNDN);
+        mpfr_div_ui(scale, scale, 180, MPFR_RNDN);
+        mpfr_mul(v, v, scale, MPFR_RNDN);
+        mpfr_clear(scale);
+#endif
+    }
+    switch (op) {
+        case 'S': mpfr_sin(v, v, MPFR_RNDN); return;
+        case 'C': mpfr_cos(v, v, MPFR_RNDN); return;
+        default:  mpfr_tan(v, v, MPFR_RNDN); return;
+    }
+}
+
+// Inverse trig results in the current unit. Degrees use MPFR's exact-period functions where
+// available, so asin(1/2) is exactly 30.
+static void inverse_trig(int index, mpfr_t a, const mpfr_t b, gboolean degrees) {
+#if MPFR_VERSION >= MPFR_VERSION_NUM(4, 2, 0)
+    if (degrees) {
+        switch (index) {
+            case CALC_FN_ASIN: mpfr_asinu(a, a, 360, MPFR_RNDN); return;
+            case CALC_FN_ACOS: mpfr_acosu(a, a, 360, MPFR_RNDN); return;
+            case CALC_FN_ATAN: mpfr_atanu(a, a, 360, MPFR_RNDN); return;
+            default:           mpfr_atan2u(a, a, b, 360, MPFR_RNDN); return;
+        }
+    }
+#endif
+    switch (index) {
+        case CALC_FN_ASIN: mpfr_asin(a, a, MPFR_RNDN); break;
+        case CALC_FN_ACOS: mpfr_acos(a, a, MPFR_RNDN); break;
+        case CALC_FN_ATAN: mpfr_atan(a, a, MPFR_RNDN); break;
+        default:           mpfr_atan2(a, a, b, MPFR_RNDN); break;
+    }
+    if (degrees) {
+        mpfr_t scale;
+        mpfr_init2(scale, mpfr_get_prec(a));
+        mpfr_const_pi(scale, MPFR_RNDN);
+        mpfr_div(a, a, scale, MPFR_RNDN);
+        mpfr_mul_ui(a, a, 180, MPFR_RNDN);
+        mpfr_clear(scale);
+    }
+}
+
+// Built-in functions that compile to 'F' calls; args[0] receives the result. Functions
+// registered at runtime only have a double implementation.
+static gboolean apply_func(int index, mpfr_t *args, gboolean degrees, char *err, size_t err_cap) {
+    mpfr_ptr a = args[0];
+    gboolean domain_ok = TRUE;
+    switch (index) {
+        case CALC_FN_ASIN:
+        case CALC_FN_ACOS:
+            domain_ok = mpfr_cmp_si(a, -1) >= 0 && mpfr_cmp_ui(a, 1) <= 0;
+            if (domain_ok) inverse_trig(index, a, a, degrees);
+            break;
+        case CALC_FN_ATAN: inverse_trig(index, a, a, degrees); break;
+        case CALC_FN_ATAN2: inverse_trig(index, a, args[1], degrees); break;
+        case CALC_FN_SINH: mpfr_sinh(a, a, MPFR_RNDN); break;
+        case CALC_FN_COSH: mpfr_cosh(a, a, MPFR_RNDN); break;
+        case CALC_FN_TANH: mpfr_tanh(a, a, MPFR_RNDN); break;
+        case CALC_FN_ASINH: mpfr_asinh(a, a, MPFR_RNDN); break;
+        case CALC_FN_ACOSH:
+            domain_ok = mpfr_cmp_ui(a, 1) >= 0;
+            if (domain_ok) mpfr_acosh(a, a, MPFR_RNDN);
+            break;
+        case CALC_FN_ATANH:
+            domain_ok = mpfr_cmp_si(a, -1) > 0 && mpfr_cmp_ui(a, 1) < 0;
+            if (domain_ok) mpfr_atanh(a, a, MPFR_RNDN);
+            break;
+        case CALC_FN_HYPOT: mpfr_hypot(a, a, args[1], MPFR_RNDN); break;
+        case CALC_FN_MIN: mpfr_min(a, a, args[1], MPFR_RNDN); break;
+        case CALC_FN_MAX: mpfr_max(a, a, args[1], MPFR_RNDN); break;
+        case CALC_FN_CBRT: mpfr_cbrt(a, a, MPFR_RNDN); break;
+        case CALC_FN_FLOOR: mpfr_floor(a, a); break;
+        case CALC_FN_CEIL: mpfr_ceil(a, a); break;
+        case CALC_FN_ROUND: mpfr_round(a, a); break;
+        default:
+            g_snprintf(err, err_cap, "%s is not available in arbitrary precision", calc_func_get(index)->name);
+            return FALSE;
+    }
+    if (!domain_ok) {
+        g_snprintf(err, err_cap, "%s domain error", calc_func_get(index)->name);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean apply_unary(char op, mpfr_t a, gboolean degrees, char *err, size_t err_cap) {
+    switch (op) {
+        case 'u': mpfr_neg(a, a, MPFR_RNDN); return TRUE;
+        case '!': return factorial(a, err, err_cap);
+        case 'S':
+        case 'C':
+        case 'T': trig(op, a, degrees); return TRUE;
+        case 'Q':
+            if (mpfr_sgn(a) < 0) { g_snprintf(err, err_cap, "sqrt domain error"); return FALSE; }
+            mpfr_sqrt(a, a, MPFR_RNDN);
+            return TRUE;
+        case 'L':
+            if (mpfr_sgn(a) <= 0) { g_snprintf(err, err_cap, "log domain error"); return FALSE; }
+            mpfr_log10(a, a, MPFR_RNDN);
+            return TRUE;
+        case 'N':
+            if (mpfr_sgn(a) <= 0) { g_snprintf(err, err_cap, "ln domain error"); return FALSE; }
+            mpfr_log(a, a, MPFR_RNDN);
+            return TRUE;
+        case 'G':
+            if (mpfr_sgn(a) <= 0) { g_snprintf(err, err_cap, "log2 domain error"); return FALSE; }
+            mpfr_log2(a, a, MPFR_RNDN);
+            return TRUE;
+        case 'A': mpfr_abs(a, a, MPFR_RNDN); return TRUE;
+        case 'E': mpfr_exp(a, a, MPFR_RNDN); return TRUE;
+        case 'I':
+        case 'J':
+        case 'K':
+            trig(op == 'I' ? 'S' : op == 'J' ? 'C' : 'T', a, degrees);
+            if (mpfr_zero_p(a)) {
+                g_snprintf(err, err_cap, "%s domain error", op == 'I' ? "csc" : op == 'J' ? "sec" : "cot");
+                return FALSE;
+            }
+            mpfr_ui_div(a, 1, a, MPFR_RNDN);
+            return TRUE;
+    }
+    g_snprintf(err, err_cap, "unknown operator");
+    return FALSE;
+}
+
+static gboolean apply_binary(char op, mpfr_t a, const mpfr_t b, char *err, size_t err_cap) {
+    switch (op) {
+        case '+': mpfr_add(a, a, b, MPFR_RNDN); return TRUE;
+        case '-': mpfr_sub(a, a, b, MPFR_RNDN); return TRUE;
+        case '*': mpfr_mul(a, a, b, MPFR_RNDN); return TRUE;
+        case '/':
+            if (mpfr_zero_p(b)) { g_snprintf(err, err_cap, "division by zero"); return FALSE; }
+            mpfr_div(a, a, b, MPFR_RNDN);
+            return TRUE;
+        case '%':
+            if (mpfr_zero_p(b)) { g_snprintf(err, err_cap, "division by zero"); return FALSE; }
+            mpfr_fmod(a, a, b, MPFR_RNDN);
+            return TRUE;
+        case '^':
+        case 'P': power(a, b); return TRUE;
+    }
+    g_snprintf(err, err_cap, "unknown operator");
+    return FALSE;
+}
+
+static gboolean eval_rpn_mp(const char *expr, const Token *rpn, size_t count, gboolean degrees,
+                            mpfr_prec_t prec, mpfr_t *stack, size_t *n_init, mpfr_t out,
+                            char *err, size_t err_cap) {
+    size_t depth = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const Token *t = &rpn[i];
+        if (t->type == TOK_NUM) {
+            // Values are initialised on first use and reused after that.
+            if (depth == *n_init) mpfr_init2(stack[(*n_init)++], prec);
+            mpfr_strtofr(stack[depth++], expr + t->slot, NULL, 0, MPFR_RNDN);
+            continue;
+        }
+
+        if (t->op == 'D') { g_snprintf(err, err_cap, "diff is not available in arbitrary precision"); return FALSE; }
+        if (t->op == 'M') { g_snprintf(err, err_cap, "matrices are not available in arbitrary precision"); return FALSE; }
+
+        if (t->op == 'R') { // datasets are read in double precision
+            double v;
+            if (!calc_data_value(t->slot, (int)t->value, 0, &v, err, err_cap)) return FALSE;
+            if (depth == *n_init) mpfr_init2(stack[(*n_init)++], prec);
+            mpfr_set_d(stack[depth++], v, MPFR_RNDN);
+            continue;
+        }
+
+        if (t->op == 'F') {
+            int arity = calc_token_arity(t);
+            if (depth < (size_t)arity) { g_snprintf(err, err_cap, "invalid expression"); return FALSE; }
+            depth -= (size_t)arity - 1;
+            if (!apply_func(t->slot, &stack[depth - 1], degrees, err, err_cap)) return FALSE;
+            continue;
+        }
+
+        if (calc_op_arity(t->op) == 1) {
+            if (depth < 1) { g_snprintf(err, err_cap, "invalid expression"); return FALSE; }
+            if (!apply_unary(t->op, stack[depth - 1], degrees, err, err_cap)) return FALSE;
+            continue;
+        }
+
+        if (depth < 2) { g_snprintf(err, err_cap, "invalid expression"); return FALSE; }
+        depth--;
+        if (!apply_binary(t->op, stack[depth - 1], stack[depth], err, err_cap)) return FALSE;
+    }
+
+    if (depth != 1) { g_snprintf(err, err_cap, "invalid expression"); return FALSE; }
+    mpfr_set(out, stack[0], MPFR_RNDN);
+    return TRUE;
+}
+
+char *calc_eval_precise(const char *expr, gboolean degrees, guint digits, char *err, size_t err_cap) {
+    if (digits == 0 || digits > CALC_PRECISE_MAX_DIGITS) {
+        g_snprintf(err, err_cap, "digits must be between 1 and %d", CALC_PRECISE_MAX_DIGITS);
+        return NULL;
+    }
+
+    CalcScratch *scratch = calc_scratch_get();
+    size_t count = 0;
+    if (!calc_parse(scratch, expr, NULL, 0, &count, err, err_cap)) return NULL;
+
+    mpfr_prec_t prec = digits_to_bits(digits);
+    mpfr_t *stack = g_new(mpfr_t, MAX(count, (size_t)1));
+    size_t n_init = 0;
+    mpfr_t value;
+    mpfr_init2(value, prec);
+
+    char *result = NULL;
+    if (eval_rpn_mp(expr, scratch->rpn, count, degrees, prec, stack, &n_init, value, err, err_cap)) {
+        char *text = NULL;
+        if (mpfr_asprintf(&text, "%.*Rg", (int)digits, value) >= 0) {
+            result = g_strdup(text);
+            mpfr_free_str(text);
+        } else {
+            g_snprintf(err, err_cap, "out of memory");
+        }
+    }
+
+    for (size_t i = 0; i < n_init; i++) mpfr_clear(stack[i]);
+    g_free(stack);
+    mpfr_clear(value);
+    return result;
+}
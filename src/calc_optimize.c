@@ -0,0 +1,98 @@
+#include "calc_eval.h"
+#include "calc_internal.h"
+
+#include <math.h>
+#include <string.h>
+
+// Largest integer exponent rewritten into a multiply chain. x^2 is exact (one rounding, like
+// pow()); longer chains accumulate about one ulp per multiply, so they are kept short.
+#define POWI_MAX 4
+
+typedef struct {
+    size_t start;      // first token of the subexpression that produced this value
+    gboolean constant; // the subexpression is a single TOK_NUM
+} Operand;
+
+// 1/c is exact when c is a finite power of two, and then a/c == a*(1/c) for every a:
+// both round the same exact real number once.
+static gboolean exact_reciprocal(double c, double *inv) {
+    if (c == 0.0 || !isfinite(c)) return FALSE;
+    int e;
+    if (fabs(frexp(c, &e)) != 0.5) return FALSE;
+    double r = 1.0 / c;
+    if (!isfinite(r)) return FALSE;
+    *inv = r;
+    return TRUE;
+}
+
+size_t calc_optimize_rpn(Token *code, size_t count, gboolean degrees) {
+    if (count == 0) return 0;
+
+    Operand *stack = g_new(Operand, count);
+    double *values = g_new(double, count);
+    char err[64];
+    int top = -1;
+    size_t n = 0; // tokens kept so far; rewriting happens in place behind the read index
+
+    for (size_t i = 0; i < count; i++) {
+        Token t = code[i];
+        if (t.type != TOK_OP || t.op == 'R') { // dataset statistics are operands that are never constant
+            code[n] = t;
+            stack[++top] = (Operand){ .start = n, .constant = (t.type == TOK_NUM) };
+            n++;
+            continue;
+        }
+
+        int arity = calc_token_arity(&t);
+        Operand a = stack[top - arity + 1];
+        Operand b = stack[top];
+        gboolean constant = calc_token_pure(&t);
+        for (int k = top - arity + 1; k <= top; k++) constant &= stack[k].constant;
+        top -= arity - 1;
+        code[n++] = t;
+
+        if (t.op == 'D') {
+            // The block after diff() is code of its own: optimize it, then move it up behind the
+            // token. The derivative is a constant if the point is and the block reads nothing
+            // but its own variable.
+            size_t len = (size_t)t.slot;
+            size_t kept = calc_optimize_rpn(code + i + 1, len, degrees);
+            memmove(code + n, code + i + 1, kept * sizeof(Token));
+            code[n - 1].slot = (int)kept;
+            for (size_t k = n; k < n + kept; k++) {
+                constant &= calc_token_pure(&code[k]) && !(code[k].type == TOK_VAR && code[k].slot < (int)t.value);
+            }
+            n += kept;
+            i += len;
+        }
+
+        // Constant folding: evaluate the subexpression now. If it fails (division by zero,
+        // domain error) it is left alone so the same error is reported at evaluation time.
+        if (constant) {
+            double v;
+            if (calc_eval_rpn(code + a.start, n - a.start, NULL, degrees, values, &v, err, sizeof(err))) {
+                n = a.start;
+                code[n++] = (Token){ .type = TOK_NUM, .value = v };
+                stack[top] = (Operand){ .start = a.start, .constant = TRUE };
+                continue;
+            }
+        } else if (arity == 2 && b.constant) {
+            double c = code[b.start].value;
+            double inv;
+            if ((t.op == '^' || t.op == 'P') && c == 1.0) {
+                n -= 2; // pow(x, 1) == x exactly
+            } else if ((t.op == '^' || t.op == 'P') && c >= 2.0 && c <= POWI_MAX && c == floor(c)) {
+                n -= 1;
+                code[n - 1] = (Token){ .type = TOK_OP, .op = 'w', .value = c };
+            } else if (t.op == '/' && exact_reciprocal(c, &inv)) {
+                code[n - 2].value = inv;
+                code[n - 1].op = '*';
+            }
+        }
+        stack[top] = (Operand){ .start = a.start, .constant = FALSE };
+    }
+
+    g_free(stack);
+    g_free(values);
+    return n;
+}
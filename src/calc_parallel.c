@@ -0,0 +1,242 @@
+#include "calc_parallel.h"
+#include "calc_internal.h"
+
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+
+// Per-worker deque of chunk indices. Chunks are contiguous, so a deque is just the range
+// [lo, hi) packed into one word: the owner takes from lo, thieves take the upper half.
+// Every transition is a single CAS, which keeps both sides lock-free.
+typedef struct {
+    _Atomic guint64 range;
+    char pad[56]; // one deque per cache line
+} WorkDeque;
+
+typedef struct {
+    WorkDeque *deques;
+    guint n_workers;
+    size_t n;
+    size_t grain;
+    CalcRangeFunc fn;
+    gpointer data;
+    atomic_uint next_worker;
+    GMutex lock;
+    GCond done;
+    guint finished;
+} ParallelJob;
+
+static guint64 pack_range(guint32 lo, guint32 hi) {
+    return ((guint64)hi << 32) | lo;
+}
+
+static gboolean pop_own(WorkDeque *d, size_t *chunk) {
+    guint64 r = atomic_load(&d->range);
+    for (;;) {
+        guint32 lo = (guint32)r;
+        guint32 hi = (guint32)(r >> 32);
+        if (lo >= hi) return FALSE;
+        if (atomic_compare_exchange_weak(&d->range, &r, pack_range(lo + 1, hi))) {
+            *chunk = lo;
+            return TRUE;
+        }
+    }
+}
+
+static gboolean steal_half(WorkDeque *victim, WorkDeque *thief) {
+    guint64 r = atomic_load(&victim->range);
+    for (;;) {
+        guint32 lo = (guint32)r;
+        guint32 hi = (guint32)(r >> 32);
+        if (lo >= hi) return FALSE;
+        guint32 mid = hi - (hi - lo + 1) / 2;
+        if (atomic_compare_exchange_weak(&victim->range, &r, pack_range(lo, mid))) {
+            atomic_store(&thief->range, pack_range(mid, hi));
+            return TRUE;
+        }
+    }
+}
+
+static void run_worker(ParallelJob *job, guint w) {
+    WorkDeque *own = &job->deques[w];
+    for (;;) {
+        size_t chunk;
+        while (pop_own(own, &chunk)) {
+            size_t begin = chunk * job->grain;
+            size_t end = MIN(begin + job->grain, job->n);
+            job->fn(job->data, w, begin, end);
+        }
+
+        gboolean stole = FALSE;
+        for (guint k = 1; k < job->n_workers && !stole; k++) {
+            stole = steal_half(&job->deques[(w + k) % job->n_workers], own);
+        }
+        // Nothing left to steal: remaining chunks are already running elsewhere.
+        if (!stole) return;
+    }
+}
+
+static void pool_task(gpointer task_data, gpointer pool_data) {
+    (void)pool_data;
+    ParallelJob *job = task_data;
+    guint w = atomic_fetch_add(&job->next_worker, 1);
+    run_worker(job, w);
+
+    g_mutex_lock(&job->lock);
+    job->finished++;
+    g_cond_signal(&job->done);
+    g_mutex_unlock(&job->lock);
+}
+
+static GThreadPool *shared_pool(void) {
+    static gsize once = 0;
+    static GThreadPool *pool = NULL;
+    if (g_once_init_enter(&once)) {
+        pool = g_thread_pool_new(pool_task, NULL, -1, FALSE, NULL);
+        g_once_init_leave(&once, 1);
+    }
+    return pool;
+}
+
+guint calc_parallel_workers(guint n_threads) {
+    return n_threads > 0 ? n_threads : MAX(g_get_num_processors(), 1u);
+}
+
+void calc_parallel_for(size_t n, size_t grain, guint n_threads, CalcRangeFunc fn, gpointer data) {
+    if (n == 0) return;
+    if (grain == 0) grain = 1;
+
+    size_t n_chunks = (n + grain - 1) / grain;
+    guint n_workers = (guint)MIN((size_t)calc_parallel_workers(n_threads), n_chunks);
+    if (n_workers <= 1 || n_chunks > G_MAXUINT32) {
+        for (size_t begin = 0; begin < n; begin += grain) fn(data, 0, begin, MIN(begin + grain, n));
+        return;
+    }
+
+    ParallelJob job = {
+        .deques = g_new0(WorkDeque, n_workers),
+        .n_workers = n_workers,
+        .n = n,
+        .grain = grain,
+        .fn = fn,
+        .data = data,
+    };
+    atomic_init(&job.next_worker, 1);
+    g_mutex_init(&job.lock);
+    g_cond_init(&job.done);
+
+    // Start with an even split; stealing rebalances uneven chunks.
+    for (guint w = 0; w < n_workers; w++) {
+        guint32 lo = (guint32)(n_chunks * w / n_workers);
+        guint32 hi = (guint32)(n_chunks * (w + 1) / n_workers);
+        atomic_init(&job.deques[w].range, pack_range(lo, hi));
+    }
+
+    GThreadPool *pool = shared_pool();
+    for (guint w = 1; w < n_workers; w++) g_thread_pool_push(pool, &job, NULL);
+
+    run_worker(&job, 0);
+
+    g_mutex_lock(&job.lock);
+    while (job.finished < n_workers - 1) g_cond_wait(&job.done, &job.lock);
+    g_mutex_unlock(&job.lock);
+
+    g_cond_clear(&job.done);
+    g_mutex_clear(&job.lock);
+    g_free(job.deques);
+}
+
+// Status bytes are never shared between chunks because chunk starts are multiples of 8.
+#define EXPR_GRAIN 1024
+#define ROW_GRAIN 4096
+
+typedef struct {
+    const char *const *exprs;
+    gboolean degrees;
+    double *results;
+    guint8 *status;
+    CalcScratch *scratch; // one per worker
+    size_t *ok;           // one per worker
+} ExprJob;
+
+static void eval_expr_range(gpointer data, guint worker, size_t begin, size_t end) {
+    ExprJob *job = data;
+    CalcScratch *scratch = &job->scratch[worker];
+    char err[128];
+    size_t ok = 0;
+
+    for (size_t i = begin; i < end; i++) {
+        double r = 0.0;
+        if (calc_eval_scratch(scratch, job->exprs[i], job->degrees, &r, err, sizeof(err))) {
+            job->results[i] = r;
+            if (job->status) job->status[i / 8] |= (guint8)(1u << (i % 8));
+            ok++;
+        } else {
+            job->results[i] = NAN;
+        }
+    }
+    job->ok[worker] += ok;
+}
+
+size_t calc_eval_parallel(const char *const *exprs, size_t n, gboolean degrees, guint n_threads,
+                          double *results, guint8 *status) {
+    guint n_workers = calc_parallel_workers(n_threads);
+    ExprJob job = {
+        .exprs = exprs,
+        .degrees = degrees,
+        .results = results,
+        .status = status,
+        .scratch = g_new0(CalcScratch, n_workers),
+        .ok = g_new0(size_t, n_workers),
+    };
+    if (status) memset(status, 0, (n + 7) / 8);
+
+    calc_parallel_for(n, EXPR_GRAIN, n_threads, eval_expr_range, &job);
+
+    size_t ok = 0;
+    for (guint w = 0; w < n_workers; w++) {
+        ok += job.ok[w];
+        calc_scratch_clear(&job.scratch[w]);
+    }
+    g_free(job.scratch);
+    g_free(job.ok);
+    return ok;
+}
+
+typedef struct {
+    const CalcProgram *prog;
+    const double *const *cols;
+    double *out;
+    guint8 *status;
+    size_t *ok; // one per worker
+} RowJob;
+
+static void eval_row_range(gpointer data, guint worker, size_t begin, size_t end) {
+    RowJob *job = data;
+    size_t n_vars = MAX(job->prog->n_vars, (size_t)1);
+    const double **cols = g_new(const double *, n_vars);
+    for (size_t v = 0; v < job->prog->n_vars; v++) cols[v] = job->cols[v] + begin;
+
+    job->ok[worker] += calc_program_eval_columns(job->prog, cols, end - begin, job->out + begin,
+                                                 job->status ? job->status + begin / 8 : NULL);
+    g_free(cols);
+}
+
+size_t calc_program_eval_columns_parallel(const CalcProgram *prog, const double *const *cols, size_t n,
+                                          double *out, guint8 *status, guint n_threads) {
+    guint n_workers = calc_parallel_workers(n_threads);
+    RowJob job = {
+        .prog = prog,
+        .cols = cols,
+        .out = out,
+        .status = status,
+        .ok = g_new0(size_t, n_workers),
+    };
+
+    calc_parallel_for(n, ROW_GRAIN, n_threads, eval_row_range, &job);
+
+    size_t ok = 0;
+    for (guint w = 0; w < n_workers; w++) ok += job.ok[w];
+    g_free(job.ok);
+    return ok;
+}
@@ -0,0 +1,184 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "calc_trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Each thread writes its events and counters into a ring of its own, so recording takes no lock
+// and no atomic read-modify-write: the owner stores the event, then publishes the new head.
+// Rings are registered once per thread and outlive it, so a trace written at exit still has the
+// events of pool workers that are gone. Readers sum the counters and copy the newest events.
+#define TRACE_RING_EVENTS 65536
+
+typedef struct {
+    guint64 start; // ns since tracing was first enabled
+    guint64 dur;
+    CalcTracePhase phase;
+} TraceEvent;
+
+typedef struct {
+    guint tid;
+    gsize head; // events written so far; the slot is head % TRACE_RING_EVENTS
+    CalcTraceCounter counters[CALC_TRACE_PHASES];
+    TraceEvent events[TRACE_RING_EVENTS];
+} TraceRing;
+
+static const char *const phase_names[CALC_TRACE_PHASES] = {
+    [CALC_TRACE_EVAL] = "calc_eval",
+    [CALC_TRACE_CACHE] = "cache",
+    [CALC_TRACE_PARSE] = "parse",
+    [CALC_TRACE_LEX] = "lex",
+    [CALC_TRACE_LOOKUP] = "lookup",
+    [CALC_TRACE_OPTIMIZE] = "optimize",
+    [CALC_TRACE_RUN] = "run",
+    [CALC_TRACE_EXACT] = "exact_trig",
+    [CALC_TRACE_FORMAT] = "format",
+    [CALC_TRACE_UI_EVALUATE] = "ui_evaluate",
+    [CALC_TRACE_FIRST_FRAME] = "first_frame",
+    [CALC_TRACE_THEME] = "theme_switch",
+};
+
+gint calc_trace_on = 0;
+
+static guint64 epoch = 0; // calc_trace_now() when tracing was first enabled
+static GMutex registry_lock;
+static GPtrArray *registry = NULL; // TraceRing*, in order of first use
+static char *exit_path = NULL;
+
+guint64 calc_trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (guint64)ts.tv_sec * 1000000000u + (guint64)ts.tv_nsec;
+}
+
+static TraceRing *ring_get(void) {
+    static GPrivate key = G_PRIVATE_INIT(NULL);
+    TraceRing *ring = g_private_get(&key);
+    if (!ring) {
+        ring = g_new0(TraceRing, 1);
+        g_mutex_lock(&registry_lock);
+        if (!registry) registry = g_ptr_array_new();
+        g_ptr_array_add(registry, ring);
+        ring->tid = registry->len;
+        g_mutex_unlock(&registry_lock);
+        g_private_set(&key, ring);
+    }
+    return ring;
+}
+
+guint64 calc_trace_enabled_at(void) {
+    return epoch;
+}
+
+void calc_trace_count(CalcTracePhase phase, guint64 start) {
+    TraceRing *ring = ring_get();
+    ring->counters[phase].count++;
+    ring->counters[phase].ns += calc_trace_now() - start;
+}
+
+void calc_trace_record(CalcTracePhase phase, guint64 start) {
+    guint64 end = calc_trace_now();
+    TraceRing *ring = ring_get();
+    ring->counters[phase].count++;
+    ring->counters[phase].ns += end - start;
+
+    gsize head = ring->head;
+    TraceEvent *ev = &ring->events[head % TRACE_RING_EVENTS];
+    ev->start = start - epoch;
+    ev->dur = end - start;
+    ev->phase = phase;
+    g_atomic_pointer_set(&ring->head, head + 1);
+}
+
+void calc_trace_enable(gboolean on) {
+    g_mutex_lock(&registry_lock);
+    if (on && epoch == 0) epoch = calc_trace_now();
+    g_mutex_unlock(&registry_lock);
+    g_atomic_int_set(&calc_trace_on, on ? 1 : 0);
+}
+
+static void write_at_exit(void) {
+    char err[256];
+    calc_trace_enable(FALSE);
+    if (!calc_trace_write(exit_path, err, sizeof(err))) g_printerr("%s\n", err);
+    g_free(exit_path);
+    exit_path = NULL;
+}
+
+void calc_trace_start(const char *path) {
+    if (!exit_path) atexit(write_at_exit);
+    g_free(exit_path);
+    exit_path = g_strdup(path);
+    calc_trace_enable(TRUE);
+}
+
+void calc_trace_start_from_env(void) {
+    const char *path = g_getenv("CALC_TRACE");
+    if (path && *path) calc_trace_start(path);
+}
+
+void calc_trace_get_counters(CalcTraceCounter counters[CALC_TRACE_PHASES]) {
+    memset(counters, 0, CALC_TRACE_PHASES * sizeof(CalcTraceCounter));
+    g_mutex_lock(&registry_lock);
+    for (guint i = 0; registry && i < registry->len; i++) {
+        const TraceRing *ring = registry->pdata[i];
+        for (int p = 0; p < CALC_TRACE_PHASES; p++) {
+            counters[p].count += ring->counters[p].count;
+            counters[p].ns += ring->counters[p].ns;
+        }
+    }
+    g_mutex_unlock(&registry_lock);
+}
+
+const char *calc_trace_phase_name(CalcTracePhase phase) {
+    return ((int)phase >= 0 && phase < CALC_TRACE_PHASES) ? phase_names[phase] : "?";
+}
+
+// Chrome's trace-event format: complete ("X") events with times in microseconds, one track per
+// thread. Times are printed from integer nanoseconds, as printf's %f would follow LC_NUMERIC and
+// could write a decimal comma into the JSON.
+gboolean calc_trace_write(const char *path, char *err, size_t err_cap) {
+    GString *json = g_string_new("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    guint64 dropped = 0;
+    gboolean first = TRUE;
+
+    g_mutex_lock(&registry_lock);
+    for (guint i = 0; registry && i < registry->len; i++) {
+        const TraceRing *ring = registry->pdata[i];
+        gsize head = (gsize)g_atomic_pointer_get(&ring->head);
+        gsize begin = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+        dropped += begin;
+
+        g_string_append_printf(json, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                               "\"args\":{\"name\":\"calc thread %u\"}}", first ? "" : ",\n", ring->tid, ring->tid);
+        first = FALSE;
+        for (gsize e = begin; e < head; e++) {
+            const TraceEvent *ev = &ring->events[e % TRACE_RING_EVENTS];
+            g_string_append_printf(json, ",\n{\"name\":\"%s\",\"cat\":\"calc\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                                   "\"ts\":%" G_GUINT64_FORMAT ".%03u,\"dur\":%" G_GUINT64_FORMAT ".%03u}",
+                                   calc_trace_phase_name(ev->phase), ring->tid, ev->start / 1000,
+                                   (guint)(ev->start % 1000), ev->dur / 1000, (guint)(ev->dur % 1000));
+        }
+    }
+    g_mutex_unlock(&registry_lock);
+
+    CalcTraceCounter counters[CALC_TRACE_PHASES];
+    calc_trace_get_counters(counters);
+    g_string_append_printf(json, "\n],\"otherData\":{\"dropped_events\":\"%" G_GUINT64_FORMAT "\"", dropped);
+    for (int p = 0; p < CALC_TRACE_PHASES; p++) {
+        g_string_append_printf(json, ",\"%s_count\":\"%" G_GUINT64_FORMAT "\",\"%s_ns\":\"%" G_GUINT64_FORMAT "\"",
+                               phase_names[p], counters[p].count, phase_names[p], counters[p].ns);
+    }
+    g_string_append(json, "}}\n");
+
+    GError *error = NULL;
+    gboolean ok = g_file_set_contents(path, json->str, (gssize)json->len, &error);
+    if (!ok) {
+        g_snprintf(err, err_cap, "cannot write %s: %s", path, error->message);
+        g_error_free(error);
+    }
+    g_string_free(json, TRUE);
+    return ok;
+}
@@ -0,0 +1,790 @@
+#include "calc_workspace.h"
+#include "calc_internal.h"
+
+#include <math.h>
+#include <string.h>
+
+// Definitions form a dependency graph. A variable's formula is expanded (calls of workspace
+// functions inlined, "ans" replaced by its value) and compiled once, with the variables it reads
+// as the program's inputs. Edges to those variables and to the functions it calls are kept in both
+// directions. Redefinitions are queued; recalc() recompiles them (and the users of changed
+// functions, which inlined the old body), collects everything reachable through the reverse edges
+// and evaluates it in topological order, so each affected variable is computed once and the rest
+// of the graph is not looked at. A name that is used before it is defined gets a node too, so
+// defining it later reaches its users.
+
+// Nesting of function calls in one expansion; deeper means a function calls itself.
+#define MAX_CALL_DEPTH 64
+
+// Longest expanded formula: inlining nested calls can multiply the size of a definition.
+#define MAX_EXPANSION (1 << 20)
+
+typedef struct {
+    char *name;
+    char **params;        // function parameters, NULL-terminated; NULL for variables
+    char *source;         // definition as written; NULL while the name is only referred to
+    char *body;           // source with "ans" replaced by its value at the time of definition
+    CalcProgram *prog;    // variables: compiled body, reading deps[0..n_inputs) as its slots
+    GArray *deps;         // guint ids of the nodes the body refers to, inputs first
+    guint n_inputs;
+    GArray *users;        // guint ids of the nodes whose deps contain this one
+    double value;
+    char *error;          // why there is no value; NULL if there is one
+    guint seen;           // last recalculation pass that collected the node
+    guint done;           // last recalculation pass that evaluated it
+    gboolean changed;     // queued in pending
+    gboolean was_function; // kind the users were compiled against, before the redefinition
+} Node;
+
+struct CalcWorkspace {
+    GPtrArray *nodes; // Node *, indexed by id
+    GHashTable *ids;  // name -> id + 1
+    GArray *pending;  // guint ids redefined since the last recalculation
+    gboolean degrees;
+    double ans;
+    guint pass;
+};
+
+typedef struct {
+    CalcWorkspace *ws;
+    GArray *inputs; // compile mode: variable ids in slot order; NULL to substitute values instead
+    GArray *calls;  // compile mode: ids of the functions inlined and of undefined names called
+    char *err;
+    size_t err_cap;
+} Expansion;
+
+#define NODE(ws, id) ((Node *)g_ptr_array_index((ws)->nodes, (id)))
+
+static void node_free(gpointer data) {
+    Node *n = data;
+    g_free(n->name);
+    g_strfreev(n->params);
+    g_free(n->source);
+    g_free(n->body);
+    calc_program_free(n->prog);
+    g_array_unref(n->deps);
+    g_array_unref(n->users);
+    g_free(n->error);
+    g_free(n);
+}
+
+CalcWorkspace *calc_workspace_new(gboolean degrees) {
+    CalcWorkspace *ws = g_new0(CalcWorkspace, 1);
+    ws->nodes = g_ptr_array_new_with_free_func(node_free);
+    ws->ids = g_hash_table_new(g_str_hash, g_str_equal);
+    ws->pending = g_array_new(FALSE, FALSE, sizeof(guint));
+    ws->degrees = degrees;
+    return ws;
+}
+
+void calc_workspace_free(CalcWorkspace *ws) {
+    if (!ws) return;
+    g_hash_table_destroy(ws->ids);
+    g_ptr_array_unref(ws->nodes);
+    g_array_unref(ws->pending);
+    g_free(ws);
+}
+
+void calc_workspace_set_ans(CalcWorkspace *ws, double value) {
+    ws->ans = value;
+}
+
+// Returns id + 1 of the node named by the len bytes at name, or 0.
+static guint find_node(const CalcWorkspace *ws, const char *name, size_t len) {
+    char inline_name[64];
+    char *key = (len < sizeof(inline_name)) ? inline_name : g_malloc(len + 1);
+    memcpy(key, name, len);
+    key[len] = '\0';
+    guint slot = GPOINTER_TO_UINT(g_hash_table_lookup(ws->ids, key));
+    if (key != inline_name) g_free(key);
+    return slot;
+}
+
+static guint add_node(CalcWorkspace *ws, const char *name, size_t len) {
+    Node *n = g_new0(Node, 1);
+    n->name = g_strndup(name, len);
+    n->deps = g_array_new(FALSE, FALSE, sizeof(guint));
+    n->users = g_array_new(FALSE, FALSE, sizeof(guint));
+    n->value = NAN;
+    n->error = g_strdup_printf("undefined variable: %s", n->name);
+    guint id = ws->nodes->len;
+    g_ptr_array_add(ws->nodes, n);
+    g_hash_table_insert(ws->ids, n->name, GUINT_TO_POINTER(id + 1));
+    return id;
+}
+
+static gboolean array_contains(const GArray *a, guint v) {
+    for (guint i = 0; i < a->len; i++) {
+        if (g_array_index(a, guint, i) == v) return TRUE;
+    }
+    return FALSE;
+}
+
+// Appends a literal that reads back as exactly v, independent of the locale.
+static gboolean append_value(GString *out, double v) {
+    if (isnan(v)) return FALSE;
+    if (isinf(v)) {
+        g_string_append(out, v > 0 ? "(1e999)" : "(-1e999)");
+        return TRUE;
+    }
+    char buf[G_ASCII_DTOSTR_BUF_SIZE];
+    g_string_append_c(out, '(');
+    g_string_append(out, g_ascii_dtostr(buf, sizeof(buf), v));
+    g_string_append_c(out, ')');
+    return TRUE;
+}
+
+// End of the number literal at p, copied through unchanged so that "1e5" is not read as a name.
+static const char *skip_number(const char *p, const char *end) {
+    const char *stop;
+    calc_read_number(p, end, &stop);
+    return (stop == p) ? p + 1 : stop;
+}
+
+// End of the quoted file name at p, as in load("data.csv"), copied through unchanged.
+static const char *skip_quoted(const char *p, const char *end) {
+    const char *q = memchr(p + 1, '"', (size_t)(end - p - 1));
+    return q ? q + 1 : end;
+}
+
+static size_t ident_length(const char *p, const char *end) {
+    size_t len = 1;
+    while (p + len < end && calc_char_is(p[len], CALC_CC_IDENT)) len++;
+    return len;
+}
+
+static char *replace_ans(const char *text, double ans) {
+    GString *out = g_string_new(NULL);
+    const char *end = text + strlen(text);
+    for (const char *p = text; p < end;) {
+        if (calc_char_is(*p, CALC_CC_DIGIT) || *p == '.') {
+            const char *stop = skip_number(p, end);
+            g_string_append_len(out, p, stop - p);
+            p = stop;
+        } else if (*p == '"') {
+            const char *stop = skip_quoted(p, end);
+            g_string_append_len(out, p, stop - p);
+            p = stop;
+        } else if (calc_char_is(*p, CALC_CC_ALPHA)) {
+            size_t len = ident_length(p, end);
+            if (len != 3 || memcmp(p, "ans", 3) != 0 || !append_value(out, ans)) g_string_append_len(out, p, len);
+            p += len;
+        } else {
+            g_string_append_c(out, *p++);
+        }
+    }
+    return g_string_free(out, FALSE);
+}
+
+static gboolean expand(Expansion *x, const char *p, const char *end, char **params, char **args, int depth,
+                       GString *out);
+
+// Inlines the call of function id whose argument list starts at the '(' at open. Arguments are
+// expanded in the caller's scope (params/args) and substituted for the parameters in parentheses.
+static gboolean expand_call(Expansion *x, guint id, const char *open, const char *end, const char **next,
+                            char **params, char **args, int depth, GString *out) {
+    Node *fn = NODE(x->ws, id);
+    if (x->calls && !array_contains(x->calls, id) && !array_contains(x->inputs, id)) g_array_append_val(x->calls, id);
+    // The body is inlined as written, so errors in it surface here as well as in the function's
+    // own definition, whatever order the two were compiled in.
+    if (depth >= MAX_CALL_DEPTH) {
+        g_snprintf(x->err, x->err_cap, "recursive function: %s", fn->name);
+        return FALSE;
+    }
+
+    GPtrArray *values = g_ptr_array_new_with_free_func(g_free);
+    const char *start = open + 1;
+    const char *p = start;
+    int level = 0;
+    gboolean ok = TRUE;
+    for (; p < end; p++) {
+        if (*p == '(' || *p == '[') level++;
+        else if ((*p == ')' || *p == ']') && level-- == 0) break;
+        else if (*p == ',' && level == 0) {
+            GString *arg = g_string_new(NULL);
+            ok = ok && expand(x, start, p, params, args, depth, arg);
+            g_ptr_array_add(values, g_string_free(arg, FALSE));
+            start = p + 1;
+        }
+    }
+    if (ok && p == end) {
+        g_snprintf(x->err, x->err_cap, "mismatched parentheses");
+        ok = FALSE;
+    }
+    if (ok && (values->len > 0 || calc_skip_space(start, p) < p)) {
+        GString *arg = g_string_new(NULL);
+        ok = expand(x, start, p, params, args, depth, arg);
+        g_ptr_array_add(values, g_string_free(arg, FALSE));
+    }
+    guint arity = g_strv_length(fn->params);
+    if (ok && values->len != arity) {
+        g_snprintf(x->err, x->err_cap, "%s takes %u argument%s", fn->name, arity, arity == 1 ? "" : "s");
+        ok = FALSE;
+    }
+    if (ok) {
+        g_ptr_array_add(values, NULL);
+        g_string_append_c(out, '(');
+        ok = expand(x, fn->body, fn->body + strlen(fn->body), fn->params, (char **)values->pdata, depth + 1, out);
+        g_string_append_c(out, ')');
+    }
+    g_ptr_array_unref(values);
+    *next = p + 1;
+    return ok;
+}
+
+// Expands diff(e, v, at) from the '(' at open. v stays a name inside e, hiding any workspace
+// variable or parameter called v, so the parser can bind it (see parse_diff() in calc_eval.c).
+static gboolean expand_diff(Expansion *x, const char *open, const char *end, const char **next, char **params,
+                            char **args, int depth, GString *out) {
+    const char *starts[3] = {open + 1};
+    const char *stops[3];
+    int n_args = 0;
+    int level = 0;
+    const char *p = open + 1;
+    for (; p < end; p++) {
+        if (*p == '(' || *p == '[') level++;
+        else if ((*p == ')' || *p == ']') && level-- == 0) break;
+        else if (*p == ',' && level == 0) {
+            if (n_args == 2) break;
+            stops[n_args++] = p;
+            starts[n_args] = p + 1;
+        }
+    }
+    if (p == end) { g_snprintf(x->err, x->err_cap, "mismatched parentheses"); return FALSE; }
+    if (*p != ')' || n_args != 2) { g_snprintf(x->err, x->err_cap, "diff takes 3 arguments"); return FALSE; }
+    stops[2] = p;
+    *next = p + 1;
+
+    const char *var = calc_skip_space(starts[1], stops[1]);
+    size_t len = calc_char_is(*var, CALC_CC_ALPHA) ? ident_length(var, stops[1]) : 0;
+    if (len == 0 || calc_skip_space(var + len, stops[1]) != stops[1]) {
+        g_snprintf(x->err, x->err_cap, "diff needs a variable name");
+        return FALSE;
+    }
+
+    guint n_params = params ? g_strv_length(params) : 0;
+    char *name = g_strndup(var, len);
+    char **inner_params = g_new0(char *, n_params + 2);
+    char **inner_args = g_new0(char *, n_params + 2);
+    inner_params[0] = inner_args[0] = name;
+    for (guint i = 0; i < n_params; i++) {
+        inner_params[i + 1] = params[i];
+        inner_args[i + 1] = args[i];
+    }
+    g_string_append(out, "diff(");
+    gboolean ok = expand(x, starts[0], stops[0], inner_params, inner_args, depth, out);
+    g_string_append_printf(out, ",%s,", name);
+    ok = ok && expand(x, starts[2], stops[2], params, args, depth, out);
+    g_string_append_c(out, ')');
+    g_free(inner_params);
+    g_free(inner_args);
+    g_free(name);
+    return ok;
+}
+
+// Handles the identifier of len bytes at ident; *next is the first byte not consumed.
+static gboolean expand_name(Expansion *x, const char *ident, size_t len, const char *end, const char **next,
+                            char **params, char **args, int depth, GString *out) {
+    *next = ident + len;
+    for (guint i = 0; params && params[i]; i++) {
+        if (strlen(params[i]) == len && memcmp(params[i], ident, len) == 0) {
+            g_string_append_c(out, '(');
+            g_string_append(out, args[i]);
+            g_string_append_c(out, ')');
+            return TRUE;
+        }
+    }
+    if (len == 3 && memcmp(ident, "ans", 3) == 0) {
+        if (append_value(out, x->ws->ans)) return TRUE;
+        g_snprintf(x->err, x->err_cap, "ans is not a number");
+        return FALSE;
+    }
+
+    const char *after = calc_skip_space(ident + len, end);
+    gboolean call = after < end && *after == '(';
+    if (call && len == 4 && memcmp(ident, "diff", 4) == 0) {
+        return expand_diff(x, after, end, next, params, args, depth, out);
+    }
+    guint slot = find_node(x->ws, ident, len);
+    Node *n = slot ? NODE(x->ws, slot - 1) : NULL;
+    if (n && n->params) {
+        if (call) return expand_call(x, slot - 1, after, end, next, params, args, depth, out);
+        g_snprintf(x->err, x->err_cap, "%s is a function", n->name);
+        return FALSE;
+    }
+
+    if (!n || (call && !n->source)) {
+        // Not a workspace name: a function, a function name run into its argument ("sin30", which
+        // the parser splits the same way), a dataset statistic, or a name nobody defined.
+        if (call && (calc_data_stat_lookup(ident, len) >= 0 || (len == 4 && memcmp(ident, "load", 4) == 0))) {
+            g_string_append_len(out, ident, len);
+            return TRUE;
+        }
+        int index;
+        size_t letters = 1;
+        while (letters < len && calc_char_is(ident[letters], CALC_CC_ALPHA)) letters++;
+        if (!calc_func_lookup(ident, len, &index) && letters < len && calc_func_lookup(ident, letters, &index)) {
+            len = letters;
+            *next = ident + len;
+        }
+        if (calc_func_lookup(ident, len, &index) || !x->inputs) {
+            g_string_append_len(out, ident, len);
+            return TRUE;
+        }
+        guint id = slot ? slot - 1 : add_node(x->ws, ident, len);
+        if (call) {
+            if (!array_contains(x->calls, id) && !array_contains(x->inputs, id)) g_array_append_val(x->calls, id);
+            g_snprintf(x->err, x->err_cap, "unknown function: %.*s", (int)len, ident);
+            return FALSE;
+        }
+        slot = id + 1;
+        n = NODE(x->ws, id);
+    }
+
+    if (!x->inputs) {
+        if (!n->error && append_value(out, n->value)) return TRUE;
+        g_snprintf(x->err, x->err_cap, "%s", n->error ? n->error : "not a number");
+        return FALSE;
+    }
+    guint id = slot - 1;
+    if (!array_contains(x->inputs, id)) {
+        g_array_append_val(x->inputs, id);
+        // Calls recorded before are dropped, so the same id does not appear twice in deps.
+        for (guint i = 0; i < x->calls->len; i++) {
+            if (g_array_index(x->calls, guint, i) == id) g_array_remove_index(x->calls, i);
+        }
+    }
+    g_string_append_len(out, ident, len);
+    return TRUE;
+}
+
+static gboolean expand(Expansion *x, const char *p, const char *end, char **params, char **args, int depth,
+                       GString *out) {
+    while (p < end) {
+        if (calc_char_is(*p, CALC_CC_DIGIT) || *p == '.') {
+            const char *stop = skip_number(p, end);
+            g_string_append_len(out, p, stop - p);
+            p = stop;
+        } else if (*p == '"') {
+            const char *stop = skip_quoted(p, end);
+            g_string_append_len(out, p, stop - p);
+            p = stop;
+        } else if (calc_char_is(*p, CALC_CC_ALPHA)) {
+            if (!expand_name(x, p, ident_length(p, end), end, &p, params, args, depth, out)) return FALSE;
+            if (out->len > MAX_EXPANSION) {
+                g_snprintf(x->err, x->err_cap, "expression too long");
+                return FALSE;
+            }
+        } else {
+            g_string_append_c(out, *p++);
+        }
+    }
+    return TRUE;
+}
+
+static void unlink_deps(CalcWorkspace *ws, guint id) {
+    Node *n = NODE(ws, id);
+    for (guint i = 0; i < n->deps->len; i++) {
+        GArray *users = NODE(ws, g_array_index(n->deps, guint, i))->users;
+        for (guint k = 0; k < users->len; k++) {
+            if (g_array_index(users, guint, k) == id) {
+                g_array_remove_index_fast(users, k);
+                break;
+            }
+        }
+    }
+    g_array_set_size(n->deps, 0);
+    n->n_inputs = 0;
+}
+
+// Expands and compiles a definition and links it to what it refers to. Errors stay with the node;
+// the links are kept even then, so fixing a name the definition refers to reaches it.
+static void compile_node(CalcWorkspace *ws, guint id) {
+    Node *n = NODE(ws, id);
+    unlink_deps(ws, id);
+    g_clear_pointer(&n->prog, calc_program_free);
+    g_clear_pointer(&n->error, g_free);
+    n->value = NAN;
+    if (!n->source) {
+        n->error = g_strdup_printf("undefined variable: %s", n->name);
+        return;
+    }
+
+    char err[128] = {0};
+    GArray *inputs = g_array_new(FALSE, FALSE, sizeof(guint));
+    GArray *calls = g_array_new(FALSE, FALSE, sizeof(guint));
+    Expansion x = { ws, inputs, calls, err, sizeof(err) };
+    GString *text = g_string_new(NULL);
+    // A function body is checked with its parameters standing for themselves.
+    gboolean ok = expand(&x, n->body, n->body + strlen(n->body), n->params, n->params, 0, text);
+    if (ok) {
+        guint n_params = n->params ? g_strv_length(n->params) : 0;
+        const char **names = g_new(const char *, n_params + inputs->len);
+        for (guint i = 0; i < n_params; i++) names[i] = n->params[i];
+        for (guint i = 0; i < inputs->len; i++) names[n_params + i] = NODE(ws, g_array_index(inputs, guint, i))->name;
+        CalcProgram *prog = calc_compile(text->str, names, n_params + inputs->len, ws->degrees, err, sizeof(err));
+        g_free(names);
+        ok = prog != NULL;
+        if (n->params) calc_program_free(prog);
+        else n->prog = prog;
+    }
+    if (!ok) n->error = g_strdup(err);
+    g_string_free(text, TRUE);
+
+    n->n_inputs = inputs->len;
+    g_array_append_vals(n->deps, inputs->data, inputs->len);
+    g_array_append_vals(n->deps, calls->data, calls->len);
+    for (guint i = 0; i < n->deps->len; i++) g_array_append_val(NODE(ws, g_array_index(n->deps, guint, i))->users, id);
+    g_array_unref(inputs);
+    g_array_unref(calls);
+}
+
+static void evaluate_node(CalcWorkspace *ws, guint id) {
+    Node *n = NODE(ws, id);
+    if (!n->prog) { // functions, and variables whose error is already set
+        n->done = ws->pass;
+        return;
+    }
+    g_clear_pointer(&n->error, g_free);
+
+    double local[16];
+    double *values = (n->n_inputs <= G_N_ELEMENTS(local)) ? local : g_new(double, n->n_inputs);
+    for (guint i = 0; i < n->n_inputs && !n->error; i++) {
+        const Node *d = NODE(ws, g_array_index(n->deps, guint, i));
+        // Collected in this pass but not evaluated yet: the edge closes a cycle.
+        if (d->seen == ws->pass && d->done != ws->pass) n->error = g_strdup_printf("circular definition: %s", n->name);
+        else if (d->error) n->error = g_strdup(d->error);
+        else values[i] = d->value;
+    }
+    char err[128];
+    if (!n->error && !calc_program_eval(n->prog, values, &n->value, err, sizeof(err))) n->error = g_strdup(err);
+    if (n->error) n->value = NAN;
+    if (values != local) g_free(values);
+    n->done = ws->pass;
+}
+
+// Appends the nodes reachable from root through users, each after all nodes reachable from it.
+static void collect(CalcWorkspace *ws, guint root, GArray *order, GArray *stack) {
+    if (NODE(ws, root)->seen == ws->pass) return;
+    NODE(ws, root)->seen = ws->pass;
+    g_array_set_size(stack, 0);
+    guint frame[2] = { root, 0 }; // node, next user to visit
+    g_array_append_vals(stack, frame, 2);
+    while (stack->len > 0) {
+        guint *top = &g_array_index(stack, guint, stack->len - 2);
+        const Node *n = NODE(ws, top[0]);
+        if (top[1] < n->users->len) {
+            guint user = g_array_index(n->users, guint, top[1]++);
+            if (NODE(ws, user)->seen != ws->pass) {
+                NODE(ws, user)->seen = ws->pass;
+                frame[0] = user;
+                g_array_append_vals(stack, frame, 2);
+            }
+        } else {
+            g_array_append_val(order, top[0]);
+            g_array_set_size(stack, stack->len - 2);
+        }
+    }
+}
+
+static void recalc(CalcWorkspace *ws) {
+    if (ws->pending->len == 0) return;
+
+    // Recompile the redefinitions, and the users of functions that changed: they inlined the old
+    // body (or compiled a call of an unknown name, or read the name as a variable).
+    ws->pass++;
+    GArray *work = g_array_new(FALSE, FALSE, sizeof(guint));
+    g_array_append_vals(work, ws->pending->data, ws->pending->len);
+    for (guint i = 0; i < work->len; i++) NODE(ws, g_array_index(work, guint, i))->seen = ws->pass;
+    for (guint i = 0; i < work->len; i++) {
+        guint id = g_array_index(work, guint, i);
+        Node *n = NODE(ws, id);
+        gboolean inlined = n->params || (n->changed && n->was_function);
+        compile_node(ws, id);
+        if (!inlined) continue;
+        for (guint k = 0; k < n->users->len; k++) {
+            guint user = g_array_index(n->users, guint, k);
+            if (NODE(ws, user)->seen == ws->pass) continue;
+            NODE(ws, user)->seen = ws->pass;
+            g_array_append_val(work, user);
+        }
+    }
+
+    // Evaluate everything downstream once, dependencies first.
+    ws->pass++;
+    GArray *order = g_array_new(FALSE, FALSE, sizeof(guint));
+    GArray *stack = g_array_new(FALSE, FALSE, sizeof(guint));
+    for (guint i = 0; i < ws->pending->len; i++) collect(ws, g_array_index(ws->pending, guint, i), order, stack);
+    for (guint i = order->len; i-- > 0;) evaluate_node(ws, g_array_index(order, guint, i));
+
+    for (guint i = 0; i < ws->pending->len; i++) NODE(ws, g_array_index(ws->pending, guint, i))->changed = FALSE;
+    g_array_set_size(ws->pending, 0);
+    g_array_unref(work);
+    g_array_unref(order);
+    g_array_unref(stack);
+}
+
+static void mark_changed(CalcWorkspace *ws, guint id) {
+    Node *n = NODE(ws, id);
+    if (n->changed) return;
+    n->changed = TRUE;
+    n->was_function = n->params != NULL;
+    g_array_append_val(ws->pending, id);
+}
+
+void calc_workspace_set_degrees(CalcWorkspace *ws, gboolean degrees) {
+    if (ws->degrees == degrees) return;
+    ws->degrees = degrees;
+    for (guint id = 0; id < ws->nodes->len; id++) {
+        if (NODE(ws, id)->source) mark_changed(ws, id);
+    }
+    recalc(ws);
+}
+
+static gboolean check_name(const char *name, size_t len, char *err, size_t err_cap) {
+    int index;
+    if (calc_func_lookup(name, len, &index) || (len == 4 && memcmp(name, "diff", 4) == 0) ||
+        (len == 4 && memcmp(name, "load", 4) == 0) || calc_data_stat_lookup(name, len) >= 0) {
+        g_snprintf(err, err_cap, "%.*s is a built-in function", (int)len, name);
+        return FALSE;
+    }
+    if (len == 3 && memcmp(name, "ans", 3) == 0) {
+        g_snprintf(err, err_cap, "ans cannot be redefined");
+        return FALSE;
+    }
+    if (len == strlen(calc_imag_name) && memcmp(name, calc_imag_name, len) == 0) {
+        g_snprintf(err, err_cap, "%s is the imaginary unit", calc_imag_name);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean same_params(char **a, char **b) {
+    if (!a || !b) return a == b;
+    return g_strv_equal((const char *const *)a, (const char *const *)b);
+}
+
+// Parses "name" or "name(a, b)" in [p, end). Returns the node id + 1, or 0 and writes err.
+static guint parse_target(CalcWorkspace *ws, const char *p, const char *end, char ***params, char *err,
+                          size_t err_cap) {
+    *params = NULL;
+    if (p == end || !calc_char_is(*p, CALC_CC_ALPHA)) {
+        g_snprintf(err, err_cap, "invalid definition");
+        return 0;
+    }
+    const char *name = p;
+    size_t len = ident_length(p, end);
+    if (!check_name(name, len, err, err_cap)) return 0;
+    p = calc_skip_space(p + len, end);
+
+    if (p < end && *p == '(') {
+        GPtrArray *names = g_ptr_array_new();
+        for (;;) {
+            p = calc_skip_space(p + 1, end);
+            if (p == end || !calc_char_is(*p, CALC_CC_ALPHA)) break;
+            size_t n = ident_length(p, end);
+            if (!check_name(p, n, err, err_cap)) break;
+            char *param = g_strndup(p, n);
+            g_ptr_array_add(names, param);
+            p = calc_skip_space(p + n, end);
+            for (guint i = 0; i + 1 < names->len; i++) {
+                if (strcmp(g_ptr_array_index(names, i), param) == 0) {
+                    g_snprintf(err, err_cap, "duplicate parameter: %s", param);
+                    p = end;
+                }
+            }
+            if (p == end || *p != ',') break;
+        }
+        g_ptr_array_add(names, NULL);
+        *params = (char **)g_ptr_array_free(names, FALSE);
+        if (p == end || *p != ')' || !(*params)[0]) {
+            if (!err[0]) g_snprintf(err, err_cap, "invalid parameter list");
+            g_clear_pointer(params, g_strfreev);
+            return 0;
+        }
+        p = calc_skip_space(p + 1, end);
+    }
+    if (p != end) {
+        g_snprintf(err, err_cap, "invalid definition");
+        g_clear_pointer(params, g_strfreev);
+        return 0;
+    }
+    guint slot = find_node(ws, name, len);
+    return slot ? slot : add_node(ws, name, len) + 1;
+}
+
+// Queues a new definition (len bytes at source) for the node unless it is the same as the
+// current one, which is the common case when a whole model is run again after a small edit.
+static void define(CalcWorkspace *ws, guint id, char **params, const char *source, size_t len) {
+    Node *n = NODE(ws, id);
+    if (n->source && strncmp(n->source, source, len) == 0 && n->source[len] == '\0' &&
+        same_params(n->params, params)) {
+        g_strfreev(params);
+        return;
+    }
+    mark_changed(ws, id);
+    g_strfreev(n->params);
+    n->params = params;
+    g_free(n->source);
+    n->source = g_strndup(source, len);
+    g_free(n->body);
+    n->body = replace_ans(n->source, ws->ans);
+}
+
+// Bytes statement_end() has to look at; the rest are skipped with one table load each.
+static const guint8 statement_stops[256] = {
+    ['\0'] = 1, ['\n'] = 1, [';'] = 1, ['('] = 1, [')'] = 1, ['['] = 1, [']'] = 1, ['"'] = 1,
+};
+
+// Next ';' or newline outside brackets and quoted load() paths, or the terminating NUL.
+static const char *statement_end(const char *p) {
+    int level = 0;
+    for (;; p++) {
+        while (!statement_stops[(guchar)*p]) p++;
+        if (*p == '\0') return p;
+        if (*p == '"') {
+            const char *quote = strchr(p + 1, '"');
+            if (!quote) return p + strlen(p); // unclosed: the parser reports it
+            p = quote;
+        } else if (*p == '(' || *p == '[') level++;
+        else if (*p == ')' || *p == ']') level -= level > 0;
+        else if (level == 0) return p;
+    }
+}
+
+// First c in [p, end) outside a quoted load() path, or NULL.
+static const char *find_unquoted(const char *p, const char *end, char c) {
+    for (; p < end; p++) {
+        if (*p == '"') {
+            p = memchr(p + 1, '"', (size_t)(end - p - 1));
+            if (!p) return NULL;
+        } else if (*p == c) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+gboolean calc_workspace_is_program(const char *text) {
+    const char *end = statement_end(text);
+    return *end != '\0' || find_unquoted(text, end, '=') != NULL;
+}
+
+gboolean calc_workspace_run(CalcWorkspace *ws, const char *text, double *result, gboolean *has_value,
+                            char *err, size_t err_cap) {
+    GArray *defined = g_array_new(FALSE, FALSE, sizeof(guint));
+    gboolean ok = TRUE;
+    gboolean last_is_value = FALSE;
+    double value = NAN;
+    err[0] = '\0';
+
+    // Definitions are recalculated together, before the first expression that reads them and at
+    // the end, so a model entered in one go evaluates each variable once whatever the order.
+    for (const char *p = text; ok && *p;) {
+        const char *stop = statement_end(p);
+        const char *start = calc_skip_space(p, stop);
+        const char *end = stop;
+        while (end > start && calc_char_is(end[-1], CALC_CC_SPACE)) end--;
+        p = *stop ? stop + 1 : stop;
+        if (start == end) continue;
+
+        const char *eq = find_unquoted(start, end, '=');
+        if (eq) {
+            const char *lhs_end = eq;
+            while (lhs_end > start && calc_char_is(lhs_end[-1], CALC_CC_SPACE)) lhs_end--;
+            const char *rhs = calc_skip_space(eq + 1, end);
+            char **params;
+            guint slot = parse_target(ws, start, lhs_end, &params, err, err_cap);
+            if (!slot) {
+                ok = FALSE;
+            } else if (rhs == end) {
+                g_snprintf(err, err_cap, "missing expression after =");
+                g_strfreev(params);
+                ok = FALSE;
+            } else {
+                define(ws, slot - 1, params, rhs, (size_t)(end - rhs));
+                guint id = slot - 1;
+                g_array_append_val(defined, id);
+                last_is_value = FALSE;
+            }
+        } else {
+            recalc(ws);
+            char *expr = g_strndup(start, (size_t)(end - start));
+            char *expanded = calc_workspace_expand(ws, expr, err, err_cap);
+            ok = expanded && calc_eval(expanded, ws->degrees, &value, err, err_cap);
+            g_free(expanded);
+            g_free(expr);
+            last_is_value = TRUE;
+        }
+    }
+    recalc(ws);
+
+    // A definition that does not work is an error even when a later statement has a value.
+    for (guint i = 0; ok && i < defined->len; i++) {
+        const Node *n = NODE(ws, g_array_index(defined, guint, i));
+        if (n->error) {
+            g_snprintf(err, err_cap, "%s: %s", n->name, n->error);
+            ok = FALSE;
+        }
+    }
+    *has_value = FALSE;
+    if (ok && !last_is_value && defined->len > 0) {
+        const Node *n = NODE(ws, g_array_index(defined, guint, defined->len - 1));
+        last_is_value = n->params == NULL;
+        value = n->value;
+    }
+    if (ok && last_is_value) {
+        *result = value;
+        *has_value = TRUE;
+    }
+    g_array_unref(defined);
+    return ok;
+}
+
+char *calc_workspace_expand(CalcWorkspace *ws, const char *expr, char *err, size_t err_cap) {
+    Expansion x = { ws, NULL, NULL, err, err_cap };
+    GString *out = g_string_new(NULL);
+    if (!expand(&x, expr, expr + strlen(expr), NULL, NULL, 0, out)) {
+        g_string_free(out, TRUE);
+        return NULL;
+    }
+    return g_string_free(out, FALSE);
+}
+
+CalcIncrementalName calc_workspace_resolve(CalcWorkspace *ws, const char *name, size_t len, double *value,
+                                           char *err, size_t err_cap) {
+    if (len == 3 && memcmp(name, "ans", 3) == 0) {
+        *value = ws->ans;
+        if (!isnan(ws->ans)) return CALC_INCREMENTAL_NAME_VALUE;
+        g_snprintf(err, err_cap, "ans is not a number");
+        return CALC_INCREMENTAL_NAME_ERROR;
+    }
+    guint slot = find_node(ws, name, len);
+    const Node *n = slot ? NODE(ws, slot - 1) : NULL;
+    // Names only ever referred to are left to the parser, as calc_workspace_expand() leaves them.
+    if (!n || (n->params == NULL && !n->source)) return CALC_INCREMENTAL_NAME_UNKNOWN;
+    if (n->params) return CALC_INCREMENTAL_NAME_FUNCTION;
+    *value = n->value;
+    if (!n->error && !isnan(n->value)) return CALC_INCREMENTAL_NAME_VALUE;
+    g_snprintf(err, err_cap, "%s", n->error ? n->error : "not a number");
+    return CALC_INCREMENTAL_NAME_ERROR;
+}
+
+gboolean calc_workspace_lookup(CalcWorkspace *ws, const char *name, double *value, char *err, size_t err_cap) {
+    guint slot = find_node(ws, name, strlen(name));
+    const Node *n = slot ? NODE(ws, slot - 1) : NULL;
+    if (!n || (n->params == NULL && !n->source)) {
+        g_snprintf(err, err_cap, "undefined variable: %s", name);
+        return FALSE;
+    }
+    if (n->params) {
+        g_snprintf(err, err_cap, "%s is a function", name);
+        return FALSE;
+    }
+    if (n->error) {
+        g_snprintf(err, err_cap, "%s", n->error);
+        return FALSE;
+    }
+    *value = n->value;
+    return TRUE;
+}
@@ -0,0 +1,131 @@
+#include "expr_buffer.h"
+
+#include <string.h>
+
+// Gap buffer: data holds the text before the cursor, a gap of free bytes, then the rest of the
+// text. Edits at the gap only copy the new characters; moving the gap copies the text between the
+// old and new positions. GtkText reads the whole text to lay it out, which closes the gap at the
+// end, so appending, the common case, never moves anything. One byte past cap is always free for
+// the terminating NUL.
+#define EXPR_BUFFER_MIN_CAP 64
+
+struct _ExprBuffer {
+    GtkEntryBuffer parent_instance;
+    char *data;       // cap + 1 bytes
+    gsize cap;
+    gsize gap_start;  // byte offset of the gap
+    gsize gap_end;    // byte offset of the text after the gap
+    guint gap_chars;  // characters before the gap
+    guint n_chars;
+};
+
+G_DEFINE_TYPE(ExprBuffer, expr_buffer, GTK_TYPE_ENTRY_BUFFER)
+
+static gsize text_bytes(const ExprBuffer *self) {
+    return self->cap - (self->gap_end - self->gap_start);
+}
+
+// Byte offset of character position, counted from the gap in whichever direction is shorter.
+static gsize byte_offset(const ExprBuffer *self, guint position) {
+    if (position >= self->gap_chars) {
+        const char *after = self->data + self->gap_end;
+        return self->gap_start + (gsize)(g_utf8_offset_to_pointer(after, position - self->gap_chars) - after);
+    }
+    const char *before = self->data + self->gap_start;
+    return self->gap_start - (gsize)(before - g_utf8_offset_to_pointer(before, -(glong)(self->gap_chars - position)));
+}
+
+// Moves the gap to byte offset, which is the start of character position.
+static void move_gap(ExprBuffer *self, gsize offset, guint position) {
+    if (offset < self->gap_start) {
+        gsize n = self->gap_start - offset;
+        memmove(self->data + self->gap_end - n, self->data + offset, n);
+        self->gap_end -= n;
+    } else if (offset > self->gap_start) {
+        gsize n = offset - self->gap_start;
+        memmove(self->data + self->gap_start, self->data + self->gap_end, n);
+        self->gap_end += n;
+    }
+    self->gap_start = offset;
+    self->gap_chars = position;
+}
+
+// Makes the gap at least len bytes, doubling the allocation so a long paste or a run of typing
+// reallocates a logarithmic number of times.
+static void reserve_gap(ExprBuffer *self, gsize len) {
+    if (self->gap_end - self->gap_start >= len) return;
+    gsize tail = self->cap - self->gap_end;
+    gsize cap = MAX(self->cap * 2, EXPR_BUFFER_MIN_CAP);
+    while (cap - text_bytes(self) < len) cap *= 2;
+    self->data = g_realloc(self->data, cap + 1);
+    memmove(self->data + cap - tail, self->data + self->gap_end, tail);
+    self->gap_end = cap - tail;
+    self->cap = cap;
+}
+
+static const char *expr_buffer_get_text(GtkEntryBuffer *buffer, gsize *n_bytes) {
+    ExprBuffer *self = EXPR_BUFFER(buffer);
+    if (self->gap_end != self->cap) move_gap(self, text_bytes(self), self->n_chars);
+    self->data[self->gap_start] = '\0';
+    if (n_bytes) *n_bytes = self->gap_start;
+    return self->data;
+}
+
+static guint expr_buffer_get_length(GtkEntryBuffer *buffer) {
+    return EXPR_BUFFER(buffer)->n_chars;
+}
+
+static guint expr_buffer_insert_text(GtkEntryBuffer *buffer, guint position, const char *chars, guint n_chars) {
+    ExprBuffer *self = EXPR_BUFFER(buffer);
+    gsize len = (gsize)(g_utf8_offset_to_pointer(chars, n_chars) - chars);
+    position = MIN(position, self->n_chars);
+    reserve_gap(self, len);
+    move_gap(self, byte_offset(self, position), position);
+    memcpy(self->data + self->gap_start, chars, len);
+    self->gap_start += len;
+    self->gap_chars += n_chars;
+    self->n_chars += n_chars;
+    gtk_entry_buffer_emit_inserted_text(buffer, position, chars, n_chars);
+    return n_chars;
+}
+
+static guint expr_buffer_delete_text(GtkEntryBuffer *buffer, guint position, guint n_chars) {
+    ExprBuffer *self = EXPR_BUFFER(buffer);
+    if (position > self->n_chars) position = self->n_chars;
+    n_chars = MIN(n_chars, self->n_chars - position);
+    if (n_chars == 0) return 0;
+    move_gap(self, byte_offset(self, position), position);
+    const char *after = self->data + self->gap_end;
+    self->gap_end += (gsize)(g_utf8_offset_to_pointer(after, n_chars) - after);
+    self->n_chars -= n_chars;
+    gtk_entry_buffer_emit_deleted_text(buffer, position, n_chars);
+    return n_chars;
+}
+
+static void expr_buffer_finalize(GObject *object) {
+    g_free(EXPR_BUFFER(object)->data);
+    G_OBJECT_CLASS(expr_buffer_parent_class)->finalize(object);
+}
+
+static void expr_buffer_class_init(ExprBufferClass *klass) {
+    GtkEntryBufferClass *buffer_class = GTK_ENTRY_BUFFER_CLASS(klass);
+    buffer_class->get_text = expr_buffer_get_text;
+    buffer_class->get_length = expr_buffer_get_length;
+    buffer_class->insert_text = expr_buffer_insert_text;
+    buffer_class->delete_text = expr_buffer_delete_text;
+    G_OBJECT_CLASS(klass)->finalize = expr_buffer_finalize;
+}
+
+static void expr_buffer_init(ExprBuffer *self) {
+    self->cap = EXPR_BUFFER_MIN_CAP;
+    self->data = g_malloc(self->cap + 1);
+    self->gap_end = self->cap;
+}
+
+GtkEntryBuffer *expr_buffer_new(void) {
+    return g_object_new(EXPR_TYPE_BUFFER, NULL);
+}
+
+gsize expr_buffer_byte_offset(ExprBuffer *self, guint position) {
+    return byte_offset(self, MIN(position, self->n_chars));
+}
@@ -0,0 +1,368 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "history_log.h"
+
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Two files, each starting with an 8-byte magic. history.log holds the records back to back: a
+// RecordHeader, then the expression and result bytes. history.idx holds the 64-bit log offset of
+// every record, so the record count is known from its size and record i is one lookup away. Both
+// are memory-mapped as they were at open; records appended later stay in memory as well as
+// going to disk.
+//
+// The writer appends to the log before the index, so after a crash the index can only be short.
+// Opening drops index entries past the end of the log and indexes the records after the last
+// indexed one; only that tail is read.
+
+#define LOG_MAGIC "CALCLOG1"
+#define INDEX_MAGIC "CALCIDX1"
+#define MAGIC_LEN 8
+
+typedef struct {
+    guint32 expression_len;
+    guint32 result_len;
+    gint64 time;
+} RecordHeader;
+
+typedef struct {
+    char *expression;
+    char *result;
+    guint32 expression_len;
+    guint32 result_len;
+    gint64 time;
+} Entry;
+
+struct HistoryLog {
+    int log_fd;
+    int index_fd;
+    GMappedFile *log_map;
+    GMappedFile *index_map;
+    const char *log_data;
+    guint64 log_size;
+    const guint64 *offsets; // index entries, after the magic
+    guint n_mapped;         // records in the mapped files
+    GPtrArray *recent;      // Entry, appended since open
+
+    GAsyncQueue *queue;     // Entry to write; &stop_marker ends the writer
+    GThread *writer;
+    guint64 log_end;        // writer thread only
+
+    GHashTable *trigrams;   // trigram -> GArray of guint record indices; NULL until searched
+    guint n_indexed;
+};
+
+static Entry stop_marker;
+
+static void entry_free(gpointer data) {
+    Entry *e = data;
+    g_free(e->expression);
+    g_free(e->result);
+    g_free(e);
+}
+
+static gboolean write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FALSE;
+        p += n;
+        len -= (size_t)n;
+    }
+    return TRUE;
+}
+
+static gpointer writer_main(gpointer data) {
+    HistoryLog *log = data;
+    GByteArray *records = g_byte_array_new();
+    GArray *offsets = g_array_new(FALSE, FALSE, sizeof(guint64));
+    gboolean failed = FALSE;
+
+    for (gboolean stop = FALSE; !stop;) {
+        // Whatever queued up meanwhile goes out with one write per file.
+        for (Entry *e = g_async_queue_pop(log->queue); e; e = g_async_queue_try_pop(log->queue)) {
+            if (e == &stop_marker) { stop = TRUE; break; }
+            guint64 offset = log->log_end + records->len;
+            RecordHeader h = { e->expression_len, e->result_len, e->time };
+            g_byte_array_append(records, (const guint8 *)&h, sizeof(h));
+            g_byte_array_append(records, (const guint8 *)e->expression, e->expression_len);
+            g_byte_array_append(records, (const guint8 *)e->result, e->result_len);
+            g_array_append_val(offsets, offset);
+        }
+        // After a failed write the offsets of later records are unknown, so writing stops; the
+        // next open repairs the files.
+        if (records->len > 0 && !failed) {
+            if (write_all(log->log_fd, records->data, records->len) &&
+                write_all(log->index_fd, offsets->data, offsets->len * sizeof(guint64))) {
+                log->log_end += records->len;
+            } else {
+                g_warning("history: cannot write the log: %s", g_strerror(errno));
+                failed = TRUE;
+            }
+        }
+        g_byte_array_set_size(records, 0);
+        g_array_set_size(offsets, 0);
+    }
+
+    g_byte_array_unref(records);
+    g_array_unref(offsets);
+    return NULL;
+}
+
+// Returns FALSE if the file is missing its magic (an empty file gets one).
+static gboolean check_magic(int fd, const char *magic) {
+    char head[MAGIC_LEN];
+    struct stat st;
+    if (fstat(fd, &st) != 0) return FALSE;
+    if (st.st_size == 0) return write_all(fd, magic, MAGIC_LEN);
+    return pread(fd, head, MAGIC_LEN, 0) == MAGIC_LEN && memcmp(head, magic, MAGIC_LEN) == 0;
+}
+
+static int open_file(const char *dir, const char *name, const char *magic, char *err, size_t err_cap) {
+    char *path = g_build_filename(dir, name, NULL);
+    int fd = g_open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        g_snprintf(err, err_cap, "cannot open %s: %s", path, g_strerror(errno));
+    } else if (!check_magic(fd, magic)) {
+        g_snprintf(err, err_cap, "%s is not a history file", path);
+        close(fd);
+        fd = -1;
+    }
+    g_free(path);
+    return fd;
+}
+
+static gboolean map_files(HistoryLog *log, char *err, size_t err_cap) {
+    GError *error = NULL;
+    log->log_map = g_mapped_file_new_from_fd(log->log_fd, FALSE, &error);
+    if (log->log_map) log->index_map = g_mapped_file_new_from_fd(log->index_fd, FALSE, &error);
+    if (!log->index_map) {
+        g_snprintf(err, err_cap, "cannot map the history: %s", error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    log->log_data = g_mapped_file_get_contents(log->log_map);
+    log->log_size = g_mapped_file_get_length(log->log_map);
+    log->offsets = (const guint64 *)(g_mapped_file_get_contents(log->index_map) + MAGIC_LEN);
+    log->n_mapped = (guint)((g_mapped_file_get_length(log->index_map) - MAGIC_LEN) / sizeof(guint64));
+    return TRUE;
+}
+
+static void unmap_files(HistoryLog *log) {
+    g_clear_pointer(&log->log_map, g_mapped_file_unref);
+    g_clear_pointer(&log->index_map, g_mapped_file_unref);
+}
+
+// End of the record at offset, or 0 if it does not fit in size bytes of log.
+static guint64 record_end(const char *data, guint64 size, guint64 offset) {
+    RecordHeader h;
+    if (offset < MAGIC_LEN || offset > size || size - offset < sizeof(h)) return 0;
+    memcpy(&h, data + offset, sizeof(h));
+    guint64 end = offset + sizeof(h) + h.expression_len + h.result_len;
+    return end <= size ? end : 0;
+}
+
+// Makes the index match the log after an interrupted write. Returns TRUE if a file changed.
+static gboolean repair(HistoryLog *log) {
+    guint64 size = g_mapped_file_get_length(log->log_map);
+    guint n = log->n_mapped;
+    guint64 end = MAGIC_LEN;
+    while (n > 0 && (end = record_end(log->log_data, size, log->offsets[n - 1])) == 0) n--;
+    if (n == 0) end = MAGIC_LEN;
+
+    GArray *missing = g_array_new(FALSE, FALSE, sizeof(guint64));
+    for (guint64 next; (next = record_end(log->log_data, size, end)) != 0; end = next) {
+        g_array_append_val(missing, end);
+    }
+
+    gboolean changed = FALSE;
+    guint64 index_size = MAGIC_LEN + (guint64)n * sizeof(guint64);
+    if (g_mapped_file_get_length(log->index_map) != index_size) {
+        changed = ftruncate(log->index_fd, (off_t)index_size) == 0;
+    }
+    if (missing->len > 0) {
+        changed = write_all(log->index_fd, missing->data, missing->len * sizeof(guint64)) || changed;
+    }
+    if (end < size) changed = ftruncate(log->log_fd, (off_t)end) == 0 || changed; // torn last record
+    log->log_end = end;
+    g_array_unref(missing);
+    return changed;
+}
+
+HistoryLog *history_log_open(const char *dir, char *err, size_t err_cap) {
+    if (g_mkdir_with_parents(dir, 0700) != 0) {
+        g_snprintf(err, err_cap, "cannot create %s: %s", dir, g_strerror(errno));
+        return NULL;
+    }
+
+    HistoryLog *log = g_new0(HistoryLog, 1);
+    log->index_fd = -1;
+    log->log_fd = open_file(dir, "history.log", LOG_MAGIC, err, err_cap);
+    if (log->log_fd >= 0) log->index_fd = open_file(dir, "history.idx", INDEX_MAGIC, err, err_cap);
+    gboolean ok = log->index_fd >= 0 && map_files(log, err, err_cap);
+    if (ok && repair(log)) {
+        unmap_files(log);
+        ok = map_files(log, err, err_cap);
+    }
+    if (!ok) {
+        unmap_files(log);
+        if (log->log_fd >= 0) close(log->log_fd);
+        if (log->index_fd >= 0) close(log->index_fd);
+        g_free(log);
+        return NULL;
+    }
+
+    log->recent = g_ptr_array_new_with_free_func(entry_free);
+    log->queue = g_async_queue_new();
+    log->writer = g_thread_new("history-writer", writer_main, log);
+    return log;
+}
+
+void history_log_close(HistoryLog *log) {
+    if (!log) return;
+    g_async_queue_push(log->queue, &stop_marker);
+    g_thread_join(log->writer);
+    g_async_queue_unref(log->queue);
+    close(log->log_fd);
+    close(log->index_fd);
+    unmap_files(log);
+    g_ptr_array_unref(log->recent);
+    if (log->trigrams) g_hash_table_unref(log->trigrams);
+    g_free(log);
+}
+
+guint history_log_count(const HistoryLog *log) {
+    return log->n_mapped + log->recent->len;
+}
+
+gboolean history_log_get(const HistoryLog *log, guint index, HistoryRecord *rec) {
+    if (index < log->n_mapped) {
+        // repair() only checks the last index entry, and checking them all at open would read
+        // every record. An entry that points outside the log reads as a missing record instead.
+        guint64 offset = log->offsets[index];
+        if (record_end(log->log_data, log->log_size, offset) == 0) return FALSE;
+        const char *p = log->log_data + offset;
+        RecordHeader h;
+        memcpy(&h, p, sizeof(h));
+        rec->expression = p + sizeof(h);
+        rec->expression_len = h.expression_len;
+        rec->result = rec->expression + h.expression_len;
+        rec->result_len = h.result_len;
+        rec->time = h.time;
+        return TRUE;
+    }
+    if (index - log->n_mapped >= log->recent->len) return FALSE;
+    const Entry *e = g_ptr_array_index(log->recent, index - log->n_mapped);
+    rec->expression = e->expression;
+    rec->expression_len = e->expression_len;
+    rec->result = e->result;
+    rec->result_len = e->result_len;
+    rec->time = e->time;
+    return TRUE;
+}
+
+void history_log_append(HistoryLog *log, const char *expression, const char *result) {
+    Entry *e = g_new(Entry, 1);
+    e->expression = g_strdup(expression);
+    e->result = g_strdup(result);
+    e->expression_len = (guint32)strlen(expression);
+    e->result_len = (guint32)strlen(result);
+    e->time = g_get_real_time();
+    // The writer only reads the entry, which lives in recent until the log is closed.
+    g_ptr_array_add(log->recent, e);
+    g_async_queue_push(log->queue, e);
+}
+
+static inline guchar fold(char c) {
+    return (c >= 'A' && c <= 'Z') ? (guchar)(c + ('a' - 'A')) : (guchar)c;
+}
+
+static gboolean contains(const char *s, guint32 len, const char *query, size_t n) {
+    if (n == 0) return TRUE;
+    guchar first = fold(query[0]);
+    for (size_t i = 0; i + n <= len; i++) {
+        if (fold(s[i]) != first) continue;
+        size_t k = 1;
+        while (k < n && fold(s[i + k]) == fold(query[k])) k++;
+        if (k == n) return TRUE;
+    }
+    return FALSE;
+}
+
+gboolean history_log_matches(const HistoryLog *log, guint index, const char *query) {
+    HistoryRecord rec;
+    size_t n = strlen(query);
+    return history_log_get(log, index, &rec) &&
+           (contains(rec.expression, rec.expression_len, query, n) || contains(rec.result, rec.result_len, query, n));
+}
+
+// Three case-folded bytes. Text has no NUL bytes, so no trigram is 0 and each can be a hash key.
+static guint trigram(const char *s) {
+    return ((guint)fold(s[0]) << 16) | ((guint)fold(s[1]) << 8) | (guint)fold(s[2]);
+}
+
+static void index_text(HistoryLog *log, guint id, const char *s, guint32 len) {
+    for (guint32 i = 0; i + 3 <= len; i++) {
+        gpointer key = GUINT_TO_POINTER(trigram(s + i));
+        GArray *list = g_hash_table_lookup(log->trigrams, key);
+        if (!list) {
+            list = g_array_new(FALSE, FALSE, sizeof(guint));
+            g_hash_table_insert(log->trigrams, key, list);
+        }
+        if (list->len == 0 || g_array_index(list, guint, list->len - 1) != id) g_array_append_val(list, id);
+    }
+}
+
+gboolean history_log_index_step(HistoryLog *log, guint max_records) {
+    if (!log->trigrams) {
+        log->trigrams = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)g_array_unref);
+    }
+    guint count = history_log_count(log);
+    guint stop = count - log->n_indexed > max_records ? log->n_indexed + max_records : count;
+    for (; log->n_indexed < stop; log->n_indexed++) {
+        HistoryRecord rec;
+        if (!history_log_get(log, log->n_indexed, &rec)) continue;
+        index_text(log, log->n_indexed, rec.expression, rec.expression_len);
+        index_text(log, log->n_indexed, rec.result, rec.result_len);
+    }
+    return log->n_indexed < count;
+}
+
+static void check(const HistoryLog *log, guint id, const char *query, GArray *matches) {
+    if (history_log_matches(log, id, query)) g_array_append_val(matches, id);
+}
+
+void history_log_search(const HistoryLog *log, const char *query, const GArray *within, GArray *matches) {
+    size_t n = strlen(query);
+    const GArray *indexed = NULL; // candidates among indexed records when the index narrows them
+    gboolean indexed_none = FALSE;
+    guint unindexed = 0;          // first record the index does not cover
+
+    g_array_set_size(matches, 0);
+    if (n >= 3 && log->trigrams) {
+        // Every match contains each of the query's trigrams; the rarest one bounds the candidates.
+        unindexed = log->n_indexed;
+        for (size_t i = 0; i + 3 <= n && !indexed_none; i++) {
+            const GArray *list = g_hash_table_lookup(log->trigrams, GUINT_TO_POINTER(trigram(query + i)));
+            if (!list) indexed_none = TRUE;
+            else if (!indexed || list->len < indexed->len) indexed = list;
+        }
+    }
+
+    if (!indexed_none) {
+        if (within && (!indexed || within->len <= indexed->len)) {
+            for (guint i = 0; i < within->len; i++) check(log, g_array_index(within, guint, i), query, matches);
+            return;
+        }
+        if (indexed) {
+            for (guint i = 0; i < indexed->len; i++) check(log, g_array_index(indexed, guint, i), query, matches);
+        }
+    }
+    guint count = history_log_count(log);
+    for (guint id = unindexed; id < count; id++) check(log, id, query, matches);
+}
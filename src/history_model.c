@@ -0,0 +1,197 @@
+#include "history_model.h"
+
+#include <string.h>
+
+// Records indexed per idle callback while the search index is built (roughly 15 ms of work).
+#define INDEX_STEP 20000
+
+// HistoryModel is shared by every window: it owns the log and its search index. Each window's
+// history panel shows it through a HistoryFilter of its own, which holds that window's query and
+// matches and follows the appends the model announces.
+
+struct _HistoryModel {
+    GObject parent_instance;
+    HistoryLog *log;
+    gboolean indexing;   // history_model_prepare_search() was called
+    guint index_source;  // idle source building the index, 0 when done
+};
+
+struct _HistoryFilter {
+    GObject parent_instance;
+    HistoryModel *model;
+    char *query;         // NULL while every entry is shown
+    GArray *matches;     // guint record indices matching query, ascending
+    GArray *scratch;     // next matches while a query is replaced
+};
+
+// Item for a record, a GtkStringObject holding the expression. A record a damaged index lost
+// still needs an item at its position, so it gets an empty one.
+static gpointer record_item(HistoryLog *log, guint record) {
+    HistoryRecord rec;
+    if (!history_log_get(log, record, &rec)) return gtk_string_object_new("");
+    char *expression = g_strndup(rec.expression, rec.expression_len);
+    GtkStringObject *item = gtk_string_object_new(expression);
+    g_free(expression);
+    return item;
+}
+
+static guint history_model_get_n_items(GListModel *list) {
+    return history_log_count(HISTORY_MODEL(list)->log);
+}
+
+static GType history_model_get_item_type(GListModel *list) {
+    (void)list;
+    return GTK_TYPE_STRING_OBJECT;
+}
+
+static gpointer history_model_get_item(GListModel *list, guint position) {
+    guint n = history_model_get_n_items(list);
+    if (position >= n) return NULL;
+    return record_item(HISTORY_MODEL(list)->log, n - 1 - position); // newest first
+}
+
+static void history_model_list_model_init(GListModelInterface *iface) {
+    iface->get_item_type = history_model_get_item_type;
+    iface->get_n_items = history_model_get_n_items;
+    iface->get_item = history_model_get_item;
+}
+
+G_DEFINE_TYPE_WITH_CODE(HistoryModel, history_model, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(G_TYPE_LIST_MODEL, history_model_list_model_init))
+
+static void history_model_finalize(GObject *object) {
+    HistoryModel *self = HISTORY_MODEL(object);
+    if (self->index_source) g_source_remove(self->index_source);
+    history_log_close(self->log);
+    G_OBJECT_CLASS(history_model_parent_class)->finalize(object);
+}
+
+static void history_model_class_init(HistoryModelClass *klass) {
+    G_OBJECT_CLASS(klass)->finalize = history_model_finalize;
+}
+
+static void history_model_init(HistoryModel *self) {
+    (void)self;
+}
+
+HistoryModel *history_model_new(HistoryLog *log) {
+    HistoryModel *self = g_object_new(HISTORY_TYPE_MODEL, NULL);
+    self->log = log;
+    return self;
+}
+
+void history_model_append(HistoryModel *self, const char *expression, const char *result) {
+    history_log_append(self->log, expression, result);
+    if (self->indexing && !self->index_source) history_log_index_step(self->log, G_MAXUINT);
+    g_list_model_items_changed(G_LIST_MODEL(self), 0, 0, 1);
+}
+
+static gboolean index_some(gpointer data) {
+    HistoryModel *self = data;
+    if (history_log_index_step(self->log, INDEX_STEP)) return G_SOURCE_CONTINUE;
+    self->index_source = 0;
+    return G_SOURCE_REMOVE;
+}
+
+void history_model_prepare_search(HistoryModel *self) {
+    if (self->indexing) return;
+    self->indexing = TRUE;
+    self->index_source = g_idle_add_full(G_PRIORITY_LOW, index_some, self, NULL);
+}
+
+static guint history_filter_get_n_items(GListModel *list) {
+    HistoryFilter *self = HISTORY_FILTER(list);
+    return self->query ? self->matches->len : history_log_count(self->model->log);
+}
+
+// Record shown at position, newest first.
+static gboolean filter_record(HistoryFilter *self, guint position, guint *record) {
+    guint n = history_filter_get_n_items(G_LIST_MODEL(self));
+    if (position >= n) return FALSE;
+    guint last = n - 1 - position;
+    *record = self->query ? g_array_index(self->matches, guint, last) : last;
+    return TRUE;
+}
+
+static gpointer history_filter_get_item(GListModel *list, guint position) {
+    HistoryFilter *self = HISTORY_FILTER(list);
+    guint record;
+    return filter_record(self, position, &record) ? record_item(self->model->log, record) : NULL;
+}
+
+static void history_filter_list_model_init(GListModelInterface *iface) {
+    iface->get_item_type = history_model_get_item_type;
+    iface->get_n_items = history_filter_get_n_items;
+    iface->get_item = history_filter_get_item;
+}
+
+G_DEFINE_TYPE_WITH_CODE(HistoryFilter, history_filter, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(G_TYPE_LIST_MODEL, history_filter_list_model_init))
+
+// The model only ever adds records at the top, so the new ones are the last `added` in the log.
+static void on_model_items_changed(GListModel *model, guint position, guint removed, guint added,
+                                   gpointer user_data) {
+    HistoryFilter *self = user_data;
+    if (!self->query) {
+        g_list_model_items_changed(G_LIST_MODEL(self), position, removed, added);
+        return;
+    }
+    HistoryLog *log = HISTORY_MODEL(model)->log;
+    guint count = history_log_count(log);
+    guint matched = 0;
+    for (guint record = count - added; record < count; record++) {
+        if (!history_log_matches(log, record, self->query)) continue;
+        g_array_append_val(self->matches, record);
+        matched++;
+    }
+    if (matched) g_list_model_items_changed(G_LIST_MODEL(self), 0, 0, matched);
+}
+
+static void history_filter_finalize(GObject *object) {
+    HistoryFilter *self = HISTORY_FILTER(object);
+    g_signal_handlers_disconnect_by_data(self->model, self);
+    g_object_unref(self->model);
+    g_free(self->query);
+    g_array_unref(self->matches);
+    g_array_unref(self->scratch);
+    G_OBJECT_CLASS(history_filter_parent_class)->finalize(object);
+}
+
+static void history_filter_class_init(HistoryFilterClass *klass) {
+    G_OBJECT_CLASS(klass)->finalize = history_filter_finalize;
+}
+
+static void history_filter_init(HistoryFilter *self) {
+    self->matches = g_array_new(FALSE, FALSE, sizeof(guint));
+    self->scratch = g_array_new(FALSE, FALSE, sizeof(guint));
+}
+
+HistoryFilter *history_filter_new(HistoryModel *model) {
+    HistoryFilter *self = g_object_new(HISTORY_TYPE_FILTER, NULL);
+    self->model = g_object_ref(model);
+    g_signal_connect(model, "items-changed", G_CALLBACK(on_model_items_changed), self);
+    return self;
+}
+
+void history_filter_set_query(HistoryFilter *self, const char *query) {
+    if (query && !query[0]) query = NULL;
+    if (g_strcmp0(query, self->query) == 0) return;
+
+    guint before = history_filter_get_n_items(G_LIST_MODEL(self));
+    if (query) {
+        // Typing more only narrows the matches: anything containing the new query contains the old.
+        gboolean narrows = self->query && strstr(query, self->query);
+        history_log_search(self->model->log, query, narrows ? self->matches : NULL, self->scratch);
+        GArray *tmp = self->matches;
+        self->matches = self->scratch;
+        self->scratch = tmp;
+    }
+    g_free(self->query);
+    self->query = g_strdup(query);
+    g_list_model_items_changed(G_LIST_MODEL(self), 0, before, history_filter_get_n_items(G_LIST_MODEL(self)));
+}
+
+gboolean history_filter_get_record(HistoryFilter *self, guint position, HistoryRecord *rec) {
+    guint record;
+    return filter_record(self, position, &record) && history_log_get(self->model->log, record, rec);
+}
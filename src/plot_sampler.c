@@ -0,0 +1,247 @@
+#include "plot_sampler.h"
+
+#include <math.h>
+
+// Base samples per tile. A tile at level k has samples 2^k apart, and level k is used when a
+// pixel is between 2^k and 2^(k+1) wide, so every pan of the same zoom lands on the same tiles.
+#define TILE_SAMPLES 256
+// Times a base interval may be halved, i.e. the finest spacing is 1/64 of the base one.
+#define MAX_DEPTH 6
+// An interval is halved while its midpoint is further than this many pixels from the chord.
+#define TOLERANCE 0.25
+// An interval that keeps this share of its parent's rise for JUMP_STREAK halvings in a row does
+// not get steeper as it gets shorter: the curve jumps there instead of being steep.
+#define JUMP_RATIO 0.9
+#define JUMP_STREAK 4
+// Tiles kept per curve; past this, tiles the last frame did not use are dropped.
+#define MAX_TILES 512
+
+typedef struct {
+    int level;
+    gint64 index;
+    guint frame;    // last plot_curve_sample() call that used the tile
+    GArray *points; // PlotPoint from the start of the tile up to, not including, its end
+} Tile;
+
+typedef struct {
+    double x;
+    double y;         // NaN where the evaluation failed
+    guint next;       // following sample in x order
+    gboolean jump;    // the curve jumps between this sample and the next
+} Sample;
+
+typedef struct {
+    guint a;          // samples at the ends, in PlotCurve.samples
+    guint b;
+    int depth;        // halvings since the base interval
+    int streak;       // halvings in a row that kept most of the rise
+} Interval;
+
+struct PlotCurve {
+    CalcProgram *prog;
+    GHashTable *tiles; // Tile, keyed by (level, index)
+    guint frame;
+    GArray *samples;   // Sample, scratch for the tile being built
+    GArray *work;      // Interval to halve this round
+    GArray *next;      // Interval to halve next round
+    GArray *xs;        // double, one batch of arguments
+    GArray *ys;        // double, their results
+};
+
+static guint tile_hash(gconstpointer key) {
+    const Tile *t = key;
+    return (guint)((guint64)t->index ^ ((guint64)t->index >> 32)) * 31u + (guint)t->level;
+}
+
+static gboolean tile_equal(gconstpointer a, gconstpointer b) {
+    const Tile *ta = a, *tb = b;
+    return ta->level == tb->level && ta->index == tb->index;
+}
+
+static void tile_free(gpointer data) {
+    Tile *t = data;
+    g_array_unref(t->points);
+    g_free(t);
+}
+
+PlotCurve *plot_curve_new(const char *expr, gboolean degrees, char *err, size_t err_cap) {
+    static const char *const vars[] = {"x"};
+    CalcProgram *prog = calc_compile(expr, vars, 1, degrees, err, err_cap);
+    if (!prog) return NULL;
+
+    PlotCurve *curve = g_new0(PlotCurve, 1);
+    curve->prog = prog;
+    curve->tiles = g_hash_table_new_full(tile_hash, tile_equal, tile_free, NULL);
+    curve->samples = g_array_new(FALSE, FALSE, sizeof(Sample));
+    curve->work = g_array_new(FALSE, FALSE, sizeof(Interval));
+    curve->next = g_array_new(FALSE, FALSE, sizeof(Interval));
+    curve->xs = g_array_new(FALSE, FALSE, sizeof(double));
+    curve->ys = g_array_new(FALSE, FALSE, sizeof(double));
+    return curve;
+}
+
+void plot_curve_free(PlotCurve *curve) {
+    if (!curve) return;
+    calc_program_free(curve->prog);
+    g_hash_table_destroy(curve->tiles);
+    g_array_unref(curve->samples);
+    g_array_unref(curve->work);
+    g_array_unref(curve->next);
+    g_array_unref(curve->xs);
+    g_array_unref(curve->ys);
+    g_free(curve);
+}
+
+// Evaluates the program at every x in curve->xs, in one batch. Infinities count as failures:
+// there is nothing to draw at them either.
+static void evaluate(PlotCurve *curve) {
+    const double *cols[] = {(const double *)curve->xs->data};
+    g_array_set_size(curve->ys, curve->xs->len);
+    double *ys = (double *)curve->ys->data;
+    calc_program_eval_columns(curve->prog, cols, curve->xs->len, ys, NULL);
+    for (guint i = 0; i < curve->xs->len; i++) {
+        if (!isfinite(ys[i])) ys[i] = NAN;
+    }
+}
+
+// Queues [a, b] for halving if one end failed and the other did not (a domain edge to locate),
+// or if bent says the curve is not straight across it.
+static void queue_interval(PlotCurve *curve, guint a, guint b, int depth, int streak, gboolean bent) {
+    const Sample *s = (const Sample *)curve->samples->data;
+    if (depth >= MAX_DEPTH) return;
+    if (isnan(s[a].y) != isnan(s[b].y) || (bent && !isnan(s[a].y))) {
+        Interval iv = {a, b, depth, streak};
+        g_array_append_val(curve->next, iv);
+    }
+}
+
+// Second difference around sample j of the base samples, in pixels. A straight chord between
+// neighbours is off by about an eighth of it, which decides where the first halvings go.
+static double bend_at(const Sample *s, guint j, guint n, double step) {
+    if (j == 0 || j + 1 >= n) return 0.0;
+    return fabs(s[j - 1].y - 2.0 * s[j].y + s[j + 1].y) / step;
+}
+
+static Tile *build_tile(PlotCurve *curve, int level, gint64 index, size_t *evaluations) {
+    const double step = ldexp(1.0, level);
+    GArray *samples = curve->samples;
+
+    // Base samples, including the tile's end so the last interval can be judged.
+    g_array_set_size(curve->xs, TILE_SAMPLES + 1);
+    for (guint j = 0; j <= TILE_SAMPLES; j++) {
+        g_array_index(curve->xs, double, j) = (double)(index * TILE_SAMPLES + j) * step;
+    }
+    evaluate(curve);
+    *evaluations += curve->xs->len;
+
+    g_array_set_size(samples, TILE_SAMPLES + 1);
+    for (guint j = 0; j <= TILE_SAMPLES; j++) {
+        Sample *s = &g_array_index(samples, Sample, j);
+        s->x = g_array_index(curve->xs, double, j);
+        s->y = g_array_index(curve->ys, double, j);
+        s->next = j + 1;
+        s->jump = FALSE;
+    }
+
+    g_array_set_size(curve->next, 0);
+    const Sample *s = (const Sample *)samples->data;
+    for (guint j = 0; j < TILE_SAMPLES; j++) {
+        double bend = MAX(bend_at(s, j, TILE_SAMPLES + 1, step), bend_at(s, j + 1, TILE_SAMPLES + 1, step));
+        queue_interval(curve, j, j + 1, 0, 0, bend > 8.0 * TOLERANCE || isnan(bend));
+    }
+
+    // Halve breadth first, so each round's midpoints go through the evaluator as one batch.
+    while (curve->next->len) {
+        GArray *tmp = curve->work;
+        curve->work = curve->next;
+        curve->next = tmp;
+        g_array_set_size(curve->next, 0);
+
+        g_array_set_size(curve->xs, curve->work->len);
+        for (guint i = 0; i < curve->work->len; i++) {
+            const Interval *iv = &g_array_index(curve->work, Interval, i);
+            g_array_index(curve->xs, double, i) =
+                0.5 * (g_array_index(samples, Sample, iv->a).x + g_array_index(samples, Sample, iv->b).x);
+        }
+        evaluate(curve);
+        *evaluations += curve->xs->len;
+
+        for (guint i = 0; i < curve->work->len; i++) {
+            Interval iv = g_array_index(curve->work, Interval, i);
+            // An interval is halved once, so its ends are still neighbours in the list.
+            Sample mid = {g_array_index(curve->xs, double, i), g_array_index(curve->ys, double, i), iv.b, FALSE};
+            guint m = samples->len;
+            g_array_append_val(samples, mid);
+            g_array_index(samples, Sample, iv.a).next = m;
+
+            const Sample *sa = &g_array_index(samples, Sample, iv.a);
+            const Sample *sb = &g_array_index(samples, Sample, iv.b);
+            double rise = fabs(sb->y - sa->y);
+            gboolean bent = fabs(mid.y - 0.5 * (sa->y + sb->y)) / step > TOLERANCE;
+            int depth = iv.depth + 1;
+
+            guint ends[2][2] = {{iv.a, m}, {m, iv.b}};
+            for (int half = 0; half < 2; half++) {
+                Sample *lo = &g_array_index(samples, Sample, ends[half][0]);
+                const Sample *hi = &g_array_index(samples, Sample, ends[half][1]);
+                double part = fabs(hi->y - lo->y);
+                int streak = part > JUMP_RATIO * rise ? iv.streak + 1 : 0;
+                if (depth == MAX_DEPTH && streak >= JUMP_STREAK && part / step > 1.0) lo->jump = TRUE;
+                queue_interval(curve, ends[half][0], ends[half][1], depth, streak, bent);
+            }
+        }
+    }
+
+    Tile *tile = g_new0(Tile, 1);
+    tile->level = level;
+    tile->index = index;
+    tile->points = g_array_sized_new(FALSE, FALSE, sizeof(PlotPoint), samples->len + 8);
+    gboolean pen_up = FALSE;
+    for (guint j = 0; j != TILE_SAMPLES; j = g_array_index(samples, Sample, j).next) {
+        const Sample *sj = &g_array_index(samples, Sample, j);
+        if (isnan(sj->y)) {
+            if (!pen_up) g_array_append_val(tile->points, ((PlotPoint){sj->x, NAN}));
+            pen_up = TRUE;
+            continue;
+        }
+        g_array_append_val(tile->points, ((PlotPoint){sj->x, sj->y}));
+        pen_up = sj->jump;
+        if (pen_up) g_array_append_val(tile->points, ((PlotPoint){sj->x, NAN}));
+    }
+    return tile;
+}
+
+static gboolean tile_is_stale(gpointer key, gpointer value, gpointer frame) {
+    (void)value;
+    return ((Tile *)key)->frame != GPOINTER_TO_UINT(frame);
+}
+
+size_t plot_curve_sample(PlotCurve *curve, double x0, double x1, double unit, GArray *out) {
+    if (!(unit > 0.0) || !isfinite(x0) || !isfinite(x1) || x1 < x0) return 0;
+
+    int level = (int)floor(log2(unit));
+    double width = ldexp((double)TILE_SAMPLES, level);
+    // Sample n of the grid sits at n * 2^level. Beyond 2^53 samples from 0, n no longer fits a tile
+    // index and neighbouring samples round to the same x, so such a range stays blank.
+    double max_tiles = ldexp(1.0, 53) / TILE_SAMPLES;
+    if (fabs(x0 / width) >= max_tiles || fabs(x1 / width) >= max_tiles) return 0;
+    gint64 first = (gint64)floor(x0 / width), last = (gint64)floor(x1 / width);
+    size_t evaluations = 0;
+
+    curve->frame++;
+    for (gint64 index = first; index <= last; index++) {
+        Tile key = {.level = level, .index = index};
+        Tile *tile = g_hash_table_lookup(curve->tiles, &key);
+        if (!tile) {
+            tile = build_tile(curve, level, index, &evaluations);
+            g_hash_table_add(curve->tiles, tile);
+        }
+        tile->frame = curve->frame;
+        g_array_append_vals(out, tile->points->data, tile->points->len);
+    }
+
+    if (g_hash_table_size(curve->tiles) > MAX_TILES) {
+        g_hash_table_foreach_remove(curve->tiles, tile_is_stale, GUINT_TO_POINTER(curve->frame));
+    }
+    return evaluations;
+}
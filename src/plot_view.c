@@ -0,0 +1,302 @@
+#include "plot_view.h"
+
+#include "plot_sampler.h"
+
+#include <math.h>
+#include <string.h>
+
+// Pixels between grid lines, roughly; the spacing snaps to 1, 2 or 5 times a power of ten.
+#define GRID_SPACING 80.0
+// Zoom factor per scroll step.
+#define ZOOM_STEP 1.15
+#define MIN_UNIT 1e-12
+#define MAX_UNIT 1e12
+// Poles sample to huge values; points are clamped to this many view heights past the edges so
+// the path stays within float range. Segments that far out are clipped anyway.
+#define Y_CLAMP 4.0
+
+typedef struct {
+    char *expr;
+    PlotCurve *curve;
+} Curve;
+
+struct _PlotView {
+    GtkWidget parent_instance;
+    GPtrArray *curves;   // Curve, in the order given
+    gboolean degrees;
+    double center_x;     // world point at the middle of the widget
+    double center_y;
+    double unit;         // world units per pixel, on both axes
+    double drag_x;       // center when the drag or pinch began
+    double drag_y;
+    double drag_unit;
+    double pointer_x;    // last pointer position, which scrolling zooms about
+    double pointer_y;
+    GArray *points;      // PlotPoint, one curve's samples for the frame being drawn
+};
+
+G_DEFINE_TYPE(PlotView, plot_view, GTK_TYPE_WIDGET)
+
+static const GdkRGBA palette[] = {
+    {0.23f, 0.51f, 0.96f, 1.0f},
+    {0.94f, 0.27f, 0.27f, 1.0f},
+    {0.13f, 0.77f, 0.37f, 1.0f},
+    {0.96f, 0.62f, 0.04f, 1.0f},
+    {0.66f, 0.33f, 0.97f, 1.0f},
+};
+
+static void curve_free(gpointer data) {
+    Curve *c = data;
+    plot_curve_free(c->curve);
+    g_free(c->expr);
+    g_free(c);
+}
+
+static double screen_x(const PlotView *self, double x, int width) {
+    return (x - self->center_x) / self->unit + width / 2.0;
+}
+
+static double screen_y(const PlotView *self, double y, int height) {
+    return height / 2.0 - (y - self->center_y) / self->unit;
+}
+
+// Grid spacing in world units: 1, 2 or 5 times a power of ten, about GRID_SPACING pixels.
+static double grid_step(double unit) {
+    double target = GRID_SPACING * unit;
+    double power = pow(10.0, floor(log10(target)));
+    double m = target / power;
+    return power * (m < 1.5 ? 1.0 : m < 3.5 ? 2.0 : m < 7.5 ? 5.0 : 10.0);
+}
+
+static void draw_label(GtkWidget *widget, GtkSnapshot *snapshot, double value, double step, float x, float y,
+                       const GdkRGBA *color) {
+    char text[32];
+    if (fabs(value) < step * 1e-6) value = 0.0;
+    g_snprintf(text, sizeof(text), "%g", value);
+    PangoLayout *layout = gtk_widget_create_pango_layout(widget, text);
+    gtk_snapshot_save(snapshot);
+    gtk_snapshot_translate(snapshot, &GRAPHENE_POINT_INIT(x, y));
+    gtk_snapshot_append_layout(snapshot, layout, color);
+    gtk_snapshot_restore(snapshot);
+    g_object_unref(layout);
+}
+
+static void draw_grid(PlotView *self, GtkSnapshot *snapshot, int width, int height, const GdkRGBA *fg) {
+    GtkWidget *widget = GTK_WIDGET(self);
+    GdkRGBA line = *fg, axis = *fg, text = *fg;
+    line.alpha *= 0.08f;
+    axis.alpha *= 0.35f;
+    text.alpha *= 0.6f;
+
+    double step = grid_step(self->unit);
+    // Labels sit next to the axes, or along the edge the axis went past.
+    float axis_x = (float)CLAMP(screen_x(self, 0.0, width), 0.0, width - 1.0);
+    float axis_y = (float)CLAMP(screen_y(self, 0.0, height), 0.0, height - 1.0);
+    float label_y = axis_y + 18.0f > height ? axis_y - 16.0f : axis_y + 2.0f;
+    float label_x = axis_x + 40.0f > width ? axis_x - 40.0f : axis_x + 4.0f;
+
+    double left = self->center_x - width / 2.0 * self->unit;
+    double bottom = self->center_y - height / 2.0 * self->unit;
+    for (double k = ceil(left / step), end = floor((left + width * self->unit) / step); k <= end; k++) {
+        float sx = (float)screen_x(self, k * step, width);
+        gtk_snapshot_append_color(snapshot, k == 0 ? &axis : &line, &GRAPHENE_RECT_INIT(sx - 0.5f, 0, 1, height));
+        if (k != 0) draw_label(widget, snapshot, k * step, step, sx + 3.0f, label_y, &text);
+    }
+    for (double k = ceil(bottom / step), end = floor((bottom + height * self->unit) / step); k <= end; k++) {
+        float sy = (float)screen_y(self, k * step, height);
+        gtk_snapshot_append_color(snapshot, k == 0 ? &axis : &line, &GRAPHENE_RECT_INIT(0, sy - 0.5f, width, 1));
+        if (k != 0) draw_label(widget, snapshot, k * step, step, label_x, sy + 1.0f, &text);
+    }
+}
+
+static void draw_curve(PlotView *self, GtkSnapshot *snapshot, PlotCurve *curve, const GdkRGBA *color, int width,
+                       int height) {
+    double left = self->center_x - width / 2.0 * self->unit;
+    g_array_set_size(self->points, 0);
+    plot_curve_sample(curve, left, left + width * self->unit, self->unit, self->points);
+
+    GskPathBuilder *builder = gsk_path_builder_new();
+    double limit = Y_CLAMP * height;
+    gboolean pen_down = FALSE;
+    for (guint i = 0; i < self->points->len; i++) {
+        const PlotPoint *p = &g_array_index(self->points, PlotPoint, i);
+        if (isnan(p->y)) {
+            pen_down = FALSE;
+            continue;
+        }
+        float sx = (float)screen_x(self, p->x, width);
+        float sy = (float)CLAMP(screen_y(self, p->y, height), -limit, height + limit);
+        if (pen_down) gsk_path_builder_line_to(builder, sx, sy);
+        else gsk_path_builder_move_to(builder, sx, sy);
+        pen_down = TRUE;
+    }
+    GskPath *path = gsk_path_builder_free_to_path(builder);
+
+    GskStroke *stroke = gsk_stroke_new(2.0f);
+    gsk_stroke_set_line_join(stroke, GSK_LINE_JOIN_ROUND);
+    gtk_snapshot_append_stroke(snapshot, path, stroke, color);
+    gsk_stroke_free(stroke);
+    gsk_path_unref(path);
+}
+
+static void plot_view_snapshot(GtkWidget *widget, GtkSnapshot *snapshot) {
+    PlotView *self = PLOT_VIEW(widget);
+    int width = gtk_widget_get_width(widget);
+    int height = gtk_widget_get_height(widget);
+    if (width <= 0 || height <= 0) return;
+
+    GdkRGBA fg;
+    gtk_widget_get_color(widget, &fg);
+
+    gtk_snapshot_push_clip(snapshot, &GRAPHENE_RECT_INIT(0, 0, width, height));
+    draw_grid(self, snapshot, width, height, &fg);
+    for (guint i = 0; i < self->curves->len; i++) {
+        Curve *c = g_ptr_array_index(self->curves, i);
+        draw_curve(self, snapshot, c->curve, &palette[i % G_N_ELEMENTS(palette)], width, height);
+    }
+    gtk_snapshot_pop(snapshot);
+}
+
+// Changes the scale to unit, keeping the world point under (px, py) where it is.
+static void zoom_about(PlotView *self, double px, double py, double unit) {
+    GtkWidget *widget = GTK_WIDGET(self);
+    double ox = px - gtk_widget_get_width(widget) / 2.0;
+    double oy = py - gtk_widget_get_height(widget) / 2.0;
+    double x = self->center_x + ox * self->unit;
+    double y = self->center_y - oy * self->unit;
+    self->unit = CLAMP(unit, MIN_UNIT, MAX_UNIT);
+    self->center_x = x - ox * self->unit;
+    self->center_y = y + oy * self->unit;
+    gtk_widget_queue_draw(widget);
+}
+
+static void on_drag_begin(GtkGestureDrag *gesture, double x, double y, gpointer user_data) {
+    (void)gesture;
+    (void)x;
+    (void)y;
+    PlotView *self = PLOT_VIEW(user_data);
+    self->drag_x = self->center_x;
+    self->drag_y = self->center_y;
+}
+
+// Panning only moves the view; plot_curve_sample() then computes just the tiles that came in.
+static void on_drag_update(GtkGestureDrag *gesture, double dx, double dy, gpointer user_data) {
+    (void)gesture;
+    PlotView *self = PLOT_VIEW(user_data);
+    self->center_x = self->drag_x - dx * self->unit;
+    self->center_y = self->drag_y + dy * self->unit;
+    gtk_widget_queue_draw(GTK_WIDGET(self));
+}
+
+static void on_motion(GtkEventControllerMotion *controller, double x, double y, gpointer user_data) {
+    (void)controller;
+    PlotView *self = PLOT_VIEW(user_data);
+    self->pointer_x = x;
+    self->pointer_y = y;
+}
+
+static gboolean on_scroll(GtkEventControllerScroll *controller, double dx, double dy, gpointer user_data) {
+    (void)controller;
+    (void)dx;
+    PlotView *self = PLOT_VIEW(user_data);
+    zoom_about(self, self->pointer_x, self->pointer_y, self->unit * pow(ZOOM_STEP, dy));
+    return TRUE;
+}
+
+static void on_zoom_begin(GtkGesture *gesture, GdkEventSequence *sequence, gpointer user_data) {
+    (void)gesture;
+    (void)sequence;
+    PlotView *self = PLOT_VIEW(user_data);
+    self->drag_unit = self->unit;
+}
+
+static void on_zoom_changed(GtkGestureZoom *gesture, double scale, gpointer user_data) {
+    PlotView *self = PLOT_VIEW(user_data);
+    double x, y;
+    if (scale <= 0.0 || !gtk_gesture_get_bounding_box_center(GTK_GESTURE(gesture), &x, &y)) return;
+    zoom_about(self, x, y, self->drag_unit / scale);
+}
+
+static void plot_view_finalize(GObject *object) {
+    PlotView *self = PLOT_VIEW(object);
+    g_ptr_array_unref(self->curves);
+    g_array_unref(self->points);
+    G_OBJECT_CLASS(plot_view_parent_class)->finalize(object);
+}
+
+static void plot_view_class_init(PlotViewClass *klass) {
+    G_OBJECT_CLASS(klass)->finalize = plot_view_finalize;
+    GTK_WIDGET_CLASS(klass)->snapshot = plot_view_snapshot;
+}
+
+static void plot_view_init(PlotView *self) {
+    GtkWidget *widget = GTK_WIDGET(self);
+    self->curves = g_ptr_array_new_with_free_func(curve_free);
+    self->points = g_array_new(FALSE, FALSE, sizeof(PlotPoint));
+    self->unit = 1.0 / 40.0;
+    gtk_widget_set_overflow(widget, GTK_OVERFLOW_HIDDEN);
+
+    GtkGesture *drag = gtk_gesture_drag_new();
+    g_signal_connect(drag, "drag-begin", G_CALLBACK(on_drag_begin), self);
+    g_signal_connect(drag, "drag-update", G_CALLBACK(on_drag_update), self);
+    gtk_widget_add_controller(widget, GTK_EVENT_CONTROLLER(drag));
+
+    GtkEventController *motion = gtk_event_controller_motion_new();
+    g_signal_connect(motion, "motion", G_CALLBACK(on_motion), self);
+    gtk_widget_add_controller(widget, motion);
+
+    GtkEventController *scroll = gtk_event_controller_scroll_new(GTK_EVENT_CONTROLLER_SCROLL_VERTICAL);
+    g_signal_connect(scroll, "scroll", G_CALLBACK(on_scroll), self);
+    gtk_widget_add_controller(widget, scroll);
+
+    GtkGesture *zoom = gtk_gesture_zoom_new();
+    g_signal_connect(zoom, "begin", G_CALLBACK(on_zoom_begin), self);
+    g_signal_connect(zoom, "scale-changed", G_CALLBACK(on_zoom_changed), self);
+    gtk_widget_add_controller(widget, GTK_EVENT_CONTROLLER(zoom));
+}
+
+GtkWidget *plot_view_new(void) {
+    return g_object_new(PLOT_TYPE_VIEW, NULL);
+}
+
+// Curves for exprs, skipping those that do not parse. Curves already shown for the same
+// expression are moved over when they were sampled in the same angle mode.
+static GPtrArray *build_curves(PlotView *view, const char *const *exprs, guint n, gboolean degrees) {
+    GPtrArray *curves = g_ptr_array_new_with_free_func(curve_free);
+    for (guint i = 0; i < n; i++) {
+        Curve *c = NULL;
+        for (guint j = 0; j < view->curves->len && !c && degrees == view->degrees; j++) {
+            Curve *old = g_ptr_array_index(view->curves, j);
+            if (strcmp(old->expr, exprs[i]) == 0) c = g_ptr_array_steal_index(view->curves, j);
+        }
+        if (!c) {
+            char err[128];
+            PlotCurve *curve = plot_curve_new(exprs[i], degrees, err, sizeof(err));
+            if (!curve) continue;
+            c = g_new0(Curve, 1);
+            c->expr = g_strdup(exprs[i]);
+            c->curve = curve;
+        }
+        g_ptr_array_add(curves, c);
+    }
+    return curves;
+}
+
+guint plot_view_set_expressions(PlotView *view, const char *const *exprs, guint n, gboolean degrees) {
+    GPtrArray *curves = build_curves(view, exprs, n, degrees);
+    guint shown = curves->len;
+    if (curves->len == 0 && n > 0) { // half-typed input: keep showing the last graph
+        g_ptr_array_unref(curves);
+        if (degrees == view->degrees) return 0;
+        // ...sampled again in the new angle mode.
+        const char **last = g_new(const char *, view->curves->len);
+        for (guint i = 0; i < view->curves->len; i++) last[i] = ((Curve *)g_ptr_array_index(view->curves, i))->expr;
+        curves = build_curves(view, last, view->curves->len, degrees);
+        g_free(last);
+    }
+    g_ptr_array_unref(view->curves);
+    view->curves = curves;
+    view->degrees = degrees;
+    gtk_widget_queue_draw(GTK_WIDGET(view));
+    return shown;
+}
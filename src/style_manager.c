@@ -3,37 +3,24 @@
 #include <gio/gio.h>
 #include <string.h>
 
+#include "calc_trace.h"
+
+// Both stylesheets are parsed when the manager is created, into a provider each. A theme switch
+// removes one provider from the display and adds the other, so GTK restyles the widgets without
+// reading or parsing any CSS.
 struct StyleManager {
-    GtkCssProvider *provider;
-    GtkSettings *gtk_settings; // unowned
-    GSettings *iface_settings; // owned
-    char *dark_path;
-    char *light_path;
+    GtkCssProvider *dark_provider;
+    GtkCssProvider *light_provider;
+    GtkCssProvider *active;      // the one attached to the display, or NULL
+    GdkDisplay *display;         // unowned
+    GtkSettings *gtk_settings;   // unowned
+    GSettings *iface_settings;   // owned
+    GdkFrameClock *switch_clock; // owned while a theme switch is being timed (CALC_TRACE)
+    guint64 switch_start;
     gboolean dark;
     gboolean attached;
 };
 
-static char *exe_dir(void) {
-    GError *err = NULL;
-    char *exe = g_file_read_link("/proc/self/exe", &err);
-    if (!exe) {
-        if (err) g_error_free(err);
-        return g_strdup(".");
-    }
-    char *dir = g_path_get_dirname(exe);
-    g_free(exe);
-    return dir;
-}
-
-static char *resolve_path(const char *path) {
-    if (!path) return NULL;
-    if (g_path_is_absolute(path)) return g_strdup(path);
-    char *dir = exe_dir();
-    char *full = g_build_filename(dir, path, NULL);
-    g_free(dir);
-    return full;
-}
-
 static gboolean detect_dark(StyleManager *m) {
     // GNOME preference used by Adwaita (and GNOME apps).
     if (m->iface_settings) {
@@ -61,25 +48,54 @@ static gboolean detect_dark(StyleManager *m) {
     return TRUE;
 }
 
-static void apply_css_file(StyleManager *m, gboolean dark) {
-    const char *path = dark ? m->dark_path : m->light_path;
-    if (!path || !path[0]) return;
+static void on_theme_frame(GdkFrameClock *clock, gpointer user_data) {
+    StyleManager *m = (StyleManager *)user_data;
+    CALC_TRACE_END(CALC_TRACE_THEME, m->switch_start);
+    g_signal_handlers_disconnect_by_func(clock, on_theme_frame, m);
+    g_clear_object(&m->switch_clock);
+}
 
-    char *full = resolve_path(path);
-    if (!full) return;
+static void stop_switch_timing(StyleManager *m) {
+    if (!m->switch_clock) return;
+    g_signal_handlers_disconnect_by_func(m->switch_clock, on_theme_frame, m);
+    g_clear_object(&m->switch_clock);
+}
 
-    GFile *file = g_file_new_for_path(full);
-    gtk_css_provider_load_from_file(m->provider, file);
-    g_object_unref(file);
-    g_free(full);
+// A switch is on screen once a window has drawn the next frame with the new style.
+static void time_until_next_frame(StyleManager *m, guint64 start) {
+    stop_switch_timing(m);
+    if (!start) return;
+    GListModel *toplevels = gtk_window_get_toplevels();
+    GtkWidget *window = g_list_model_get_item(toplevels, 0);
+    if (!window) return;
+    GdkFrameClock *clock = gtk_widget_get_frame_clock(window);
+    if (clock) {
+        m->switch_clock = g_object_ref(clock);
+        m->switch_start = start;
+        g_signal_connect(clock, "after-paint", G_CALLBACK(on_theme_frame), m);
+    }
+    g_object_unref(window);
+}
 
+static void apply_theme(StyleManager *m, gboolean dark) {
+    GtkCssProvider *next = dark ? m->dark_provider : m->light_provider;
     m->dark = dark;
+    if (!m->display || next == m->active) return;
+
+    CALC_TRACE_BEGIN(start);
+    if (m->active) {
+        gtk_style_context_remove_provider_for_display(m->display, GTK_STYLE_PROVIDER(m->active));
+    }
+    gtk_style_context_add_provider_for_display(m->display, GTK_STYLE_PROVIDER(next),
+                                               GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
+    m->active = next;
+    time_until_next_frame(m, start);
 }
 
 static void sync(StyleManager *m) {
     gboolean want_dark = detect_dark(m);
     if (want_dark != m->dark) {
-        apply_css_file(m, want_dark);
+        apply_theme(m, want_dark);
     }
 }
 
@@ -99,11 +115,16 @@ static void on_iface_color_scheme_changed(GSettings *settings, gchar *key, gpoin
     sync(m);
 }
 
-StyleManager *style_manager_new(const char *dark_css_path, const char *light_css_path) {
+static GtkCssProvider *load_provider(const char *resource) {
+    GtkCssProvider *provider = gtk_css_provider_new();
+    if (resource && resource[0]) gtk_css_provider_load_from_resource(provider, resource);
+    return provider;
+}
+
+StyleManager *style_manager_new(const char *dark_resource, const char *light_resource) {
     StyleManager *m = g_new0(StyleManager, 1);
-    m->provider = gtk_css_provider_new();
-    m->dark_path = g_strdup(dark_css_path);
-    m->light_path = g_strdup(light_css_path);
+    m->dark_provider = load_provider(dark_resource);
+    m->light_provider = load_provider(light_resource);
     m->dark = TRUE;
     return m;
 }
@@ -112,12 +133,7 @@ void style_manager_attach(StyleManager *m) {
     if (!m || m->attached) return;
     m->attached = TRUE;
 
-    GdkDisplay *display = gdk_display_get_default();
-    if (display) {
-        gtk_style_context_add_provider_for_display(
-            display, GTK_STYLE_PROVIDER(m->provider),
-            GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
-    }
+    m->display = gdk_display_get_default();
 
     m->gtk_settings = gtk_settings_get_default();
     if (m->gtk_settings) {
@@ -131,9 +147,8 @@ void style_manager_attach(StyleManager *m) {
                          G_CALLBACK(on_iface_color_scheme_changed), m);
     }
 
-    // Force initial load
-    m->dark = !detect_dark(m);
-    sync(m);
+    // Attach the initial theme
+    apply_theme(m, detect_dark(m));
 }
 
 void style_manager_free(StyleManager *m) {
@@ -147,14 +162,13 @@ void style_manager_free(StyleManager *m) {
         g_object_unref(m->iface_settings);
     }
 
-    GdkDisplay *display = gdk_display_get_default();
-    if (display) {
-        gtk_style_context_remove_provider_for_display(display, GTK_STYLE_PROVIDER(m->provider));
+    stop_switch_timing(m);
+    if (m->display && m->active) {
+        gtk_style_context_remove_provider_for_display(m->display, GTK_STYLE_PROVIDER(m->active));
     }
 
-    g_object_unref(m->provider);
-    g_free(m->dark_path);
-    g_free(m->light_path);
+    g_object_unref(m->dark_provider);
+    g_object_unref(m->light_provider);
     g_free(m);
 }
 
@@ -1,6 +1,12 @@
 #include "ui.h"
 
 #include "calc_eval.h"
+#include "calc_incremental.h"
+#include "calc_trace.h"
+#include "calc_workspace.h"
+#include "expr_buffer.h"
+#include "history_model.h"
+#include "plot_view.h"
 #include "style_manager.h"
 
 #include <math.h>
@@ -10,10 +16,26 @@
 
 typedef struct {
     GtkWidget *entry;
+    GtkWidget *preview; // live result under the display while typing
+    CalcIncremental *incremental; // mirrors the entry text edit by edit
+    gboolean show_preview; // FALSE while the display shows the result of "="
+    gboolean writing_result; // "=" is replacing the display with its result
+    char *matrix_text; // expanded text of the last matrix preview, which matrix_shown holds
+    gboolean matrix_degrees;
+    gboolean matrix_ok;
+    char matrix_shown[128]; // its value, or its error if !matrix_ok
+    HistoryModel *history; // NULL if the history log cannot be opened
+    HistoryFilter *history_view; // this window's search over history
+    CalcWorkspace *workspace; // variables and functions defined with "name = ..."
+    GtkWidget *history_panel;
     GtkWidget *extra_grid;
+    GtkWidget *plot; // shown with extra_grid
+    char *plot_text; // last entry text that used x, plotted again when definitions change
+    gboolean plot_stale; // plot_text, the workspace or the angle mode changed since the last plot
     gboolean extra_visible;
     gboolean degrees;
     GtkWidget *mode_button;
+    GtkWidget *digits_spin; // 0 = double precision, otherwise calc_eval_precise() digits
     gboolean has_result;
     double last_result;
     int compact_height;
@@ -32,10 +54,11 @@ typedef struct {
 
 static StyleManager *g_style = NULL;
 static int g_style_refs = 0;
+static HistoryModel *g_history = NULL; // shared by all windows; cleared when the last one closes
 
 static void style_global_ref(void) {
     if (!g_style) {
-        g_style = style_manager_new("assets/dark.css", "assets/light.css");
+        g_style = style_manager_new("/org/project/calculator/dark.css", "/org/project/calculator/light.css");
         style_manager_attach(g_style);
         g_style_refs = 0;
     }
@@ -50,23 +73,306 @@ static void style_global_unref(void) {
     }
 }
 
+static HistoryModel *history_global_ref(void) {
+    if (g_history) return g_object_ref(g_history);
+    char *dir = g_build_filename(g_get_user_data_dir(), "calculator", NULL);
+    char err[256];
+    HistoryLog *log = history_log_open(dir, err, sizeof(err));
+    g_free(dir);
+    if (!log) {
+        g_warning("history is disabled: %s", err);
+        return NULL;
+    }
+    g_history = history_model_new(log);
+    g_object_add_weak_pointer(G_OBJECT(g_history), (gpointer *)&g_history);
+    return g_history;
+}
+
+static void remember(AppState *state, const char *expr, const char *result) {
+    if (state->history) history_model_append(state->history, expr, result);
+}
+
 static void set_entry_text(GtkEntry *entry, const char *text) {
     gtk_editable_set_text(GTK_EDITABLE(entry), text ? text : "");
+    gtk_editable_set_position(GTK_EDITABLE(entry), -1);
+}
+
+// Button input edits at the cursor like typing does: text replaces the selection, if any.
+static void insert_at_cursor(GtkEntry *entry, const char *text) {
+    GtkEditable *editable = GTK_EDITABLE(entry);
+    gtk_editable_delete_selection(editable);
+    int pos = gtk_editable_get_position(editable);
+    gtk_editable_insert_text(editable, text, -1, &pos);
+    gtk_editable_set_position(editable, pos);
 }
 
 static void handle_backspace(GtkEntry *entry) {
-    const char *text = gtk_editable_get_text(GTK_EDITABLE(entry));
-    if (!text || text[0] == '\0') return;
-    glong len = g_utf8_strlen(text, -1);
-    if (len <= 0) return;
-    const char *cut = g_utf8_offset_to_pointer(text, len - 1);
-    gchar *new_text = g_strndup(text, cut - text);
-    set_entry_text(entry, new_text);
-    g_free(new_text);
+    GtkEditable *editable = GTK_EDITABLE(entry);
+    int start = 0;
+    int end = 0;
+    if (gtk_editable_get_selection_bounds(editable, &start, &end)) {
+        gtk_editable_delete_text(editable, start, end);
+        return;
+    }
+    int pos = gtk_editable_get_position(editable);
+    if (pos > 0) gtk_editable_delete_text(editable, pos - 1, pos);
+}
+
+// Lets the preview's incremental parser read the workspace's variables as it goes.
+static CalcIncrementalName lookup_workspace_name(const char *name, size_t len, double *value, char *err,
+                                                 size_t err_cap, gpointer user_data) {
+    return calc_workspace_resolve(user_data, name, len, value, err, err_cap);
+}
+
+// Preview of expanded, which holds a matrix literal: a number, as with det([1, 2; 3, 4]), or the
+// matrix as it is, as with [1, 2; 3, 4] * 2. The last answer is kept, so asking again for the same
+// text in the same angle mode parses nothing.
+static gboolean preview_matrix(AppState *state, const char *expanded, char *out, size_t out_cap, char *err,
+                               size_t err_cap) {
+    if (g_strcmp0(expanded, state->matrix_text) != 0 || state->matrix_degrees != state->degrees) {
+        g_free(state->matrix_text);
+        state->matrix_text = g_strdup(expanded);
+        state->matrix_degrees = state->degrees;
+        char *shown = state->matrix_shown;
+        CalcComplex value = { 0.0, 0.0 };
+        CalcMatrix m;
+        state->matrix_ok = calc_eval(expanded, state->degrees, &value.re, shown, sizeof(state->matrix_shown));
+        if (state->matrix_ok) {
+            calc_format_complex(value, shown, sizeof(state->matrix_shown));
+        } else if (calc_eval_matrix(expanded, state->degrees, &m, shown, sizeof(state->matrix_shown))) {
+            calc_format_matrix(&m, shown, sizeof(state->matrix_shown));
+            g_free(m.data);
+            state->matrix_ok = TRUE;
+        }
+    }
+    g_strlcpy(state->matrix_ok ? out : err, state->matrix_shown, state->matrix_ok ? out_cap : err_cap);
+    return state->matrix_ok;
+}
+
+static void update_preview(AppState *state) {
+    GtkLabel *label = GTK_LABEL(state->preview);
+    if (!state->show_preview || calc_incremental_length(state->incremental) == 0) {
+        gtk_label_set_text(label, "");
+        return;
+    }
+    const char *text = calc_incremental_text(state->incremental);
+    if (calc_incremental_is_program(state->incremental)) { // definitions take effect on "="
+        gtk_label_set_text(label, "");
+        return;
+    }
+    char err[128] = {0};
+    char out[128] = {0};
+    CalcComplex value = { 0.0, 0.0 };
+    gboolean ok;
+    CalcIncrementalConstruct construct = calc_incremental_unsupported(state->incremental);
+    if (construct == CALC_INCREMENTAL_SUPPORTED) {
+        ok = calc_incremental_result(state->incremental, &value.re, err, sizeof(err));
+        if ((!ok || isnan(value.re)) && calc_incremental_left_reals(state->incremental)) {
+            // Only a domain error, as with sqrt(-1), is worth a complex evaluation of the whole text.
+            char *expanded = calc_workspace_expand(state->workspace, text, err, sizeof(err));
+            ok = expanded && calc_eval_complex(expanded, state->degrees, &value, err, sizeof(err));
+            g_free(expanded);
+        }
+    } else {
+        // Matrices, i, diff(), data and workspace functions go through the full parsers, which
+        // need the workspace's names replaced by their values.
+        char *expanded = calc_workspace_expand(state->workspace, text, err, sizeof(err));
+        if (!expanded) {
+            ok = FALSE;
+        } else if (construct == CALC_INCREMENTAL_MATRIX) {
+            ok = preview_matrix(state, expanded, out, sizeof(out), err, sizeof(err));
+        } else {
+            ok = construct != CALC_INCREMENTAL_COMPLEX &&
+                 calc_eval(expanded, state->degrees, &value.re, err, sizeof(err));
+            // Failing that, the value may be complex, as with sqrt(-1) or 3+4i.
+            if (!ok) ok = calc_eval_complex(expanded, state->degrees, &value, err, sizeof(err));
+        }
+        g_free(expanded);
+    }
+    if (ok) {
+        if (!out[0]) calc_format_complex(value, out, sizeof(out));
+        gtk_label_set_text(label, out);
+        gtk_widget_remove_css_class(state->preview, "hint");
+    } else {
+        gtk_label_set_text(label, err);
+        gtk_widget_add_css_class(state->preview, "hint");
+    }
+}
+
+// TRUE if x appears in text as a name of its own, not as part of one like "exp".
+static gboolean mentions_x(const char *text) {
+    for (const char *p = text; (p = strchr(p, 'x')); p++) {
+        gboolean before = p > text && (g_ascii_isalnum(p[-1]) || p[-1] == '_');
+        gboolean after = g_ascii_isalnum(p[1]) || p[1] == '_';
+        if (!before && !after) return TRUE;
+    }
+    return FALSE;
+}
+
+// Plots every ';'-separated expression in x of the entry. Text without one (a result, or the
+// start of the next expression) leaves the graph as it is.
+static void update_plot(AppState *state) {
+    const char *text = calc_incremental_text(state->incremental);
+    if (state->show_preview && mentions_x(text) && g_strcmp0(text, state->plot_text) != 0) {
+        g_free(state->plot_text);
+        state->plot_text = g_strdup(text);
+        state->plot_stale = TRUE;
+    }
+    if (!state->extra_visible || !state->plot_text || !state->plot_stale) return;
+    state->plot_stale = FALSE;
+
+    gchar **statements = g_strsplit_set(state->plot_text, ";\n", -1);
+    GPtrArray *exprs = g_ptr_array_new_with_free_func(g_free);
+    for (gchar **s = statements; *s; s++) {
+        if (strchr(*s, '=') || !mentions_x(*s)) continue; // definitions are run on "="
+        char err[128];
+        char *expr = calc_workspace_expand(state->workspace, *s, err, sizeof(err));
+        if (expr) g_ptr_array_add(exprs, expr);
+    }
+    plot_view_set_expressions(PLOT_VIEW(state->plot), (const char *const *)exprs->pdata, exprs->len, state->degrees);
+    g_ptr_array_unref(exprs);
+    g_strfreev(statements);
+}
+
+// Buffer signals are connected after the default handlers, so the buffer already holds the new
+// text while the incremental evaluator still holds the old one. The text before position is the
+// same in both, and the buffer finds its byte length from the edit point, not from the start.
+// Every edit but the result "=" writes brings the preview back, typed ones included.
+static void on_text_inserted(GtkEntryBuffer *buffer, guint position, const char *chars, guint n_chars,
+                             gpointer user_data) {
+    AppState *state = (AppState *)user_data;
+    size_t offset = expr_buffer_byte_offset(EXPR_BUFFER(buffer), position);
+    size_t len = (size_t)(g_utf8_offset_to_pointer(chars, n_chars) - chars);
+    state->show_preview = !state->writing_result;
+    calc_incremental_insert(state->incremental, offset, chars, len);
+    update_preview(state);
+    update_plot(state);
+}
+
+static void on_text_deleted(GtkEntryBuffer *buffer, guint position, guint n_chars, gpointer user_data) {
+    (void)n_chars;
+    AppState *state = (AppState *)user_data;
+    CalcIncremental *inc = state->incremental;
+    size_t offset = expr_buffer_byte_offset(EXPR_BUFFER(buffer), position);
+    size_t new_bytes = gtk_entry_buffer_get_bytes(buffer);
+    state->show_preview = !state->writing_result;
+    calc_incremental_delete(inc, offset, calc_incremental_length(inc) - new_bytes);
+    update_preview(state);
+    update_plot(state);
+}
+
+// Names in the preview and the plot may mean something else after a run or a new ans.
+static void workspace_changed(AppState *state) {
+    calc_incremental_names_changed(state->incremental);
+    state->plot_stale = TRUE;
+}
+
+static void show_error(AppState *state, const char *err) {
+    gchar *out = g_strdup_printf("Error: %s", err);
+    set_entry_text(GTK_ENTRY(state->entry), out);
+    g_free(out);
+    state->has_result = FALSE;
 }
 
-static void format_result(double value, char *out, size_t out_cap) {
-    g_snprintf(out, out_cap, "%.12g", value);
+static void set_result(AppState *state, double result) {
+    state->last_result = result;
+    state->has_result = TRUE;
+    calc_workspace_set_ans(state->workspace, result);
+    workspace_changed(state);
+}
+
+// Evaluates text, which is expr with the workspace's names replaced, and shows the result.
+static void evaluate(AppState *state, const char *expr, const char *text) {
+    GtkEntry *entry = GTK_ENTRY(state->entry);
+    char err[128] = {0};
+    double result = 0.0;
+
+    if (state->degrees) {
+        int deg = 0;
+        char display_out[128] = {0};
+        if (calc_try_special_trig(text, &deg, display_out, sizeof(display_out), &result, err, sizeof(err))) {
+            remember(state, expr, display_out);
+            set_entry_text(entry, display_out);
+            set_result(state, result);
+            return;
+        }
+        if (err[0]) {
+            show_error(state, err);
+            return;
+        }
+    }
+
+    guint digits = (guint)gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(state->digits_spin));
+    if (digits > 0) {
+        gchar *precise = calc_eval_precise(text, state->degrees, digits, err, sizeof(err));
+        if (precise) {
+            remember(state, expr, precise);
+            set_entry_text(entry, precise);
+            set_result(state, g_ascii_strtod(precise, NULL));
+            g_free(precise);
+        } else {
+            show_error(state, err);
+        }
+        return;
+    }
+
+    CalcComplex value;
+    if (calc_eval(text, state->degrees, &result, err, sizeof(err))) {
+        char out[128];
+        calc_format_result(result, out, sizeof(out));
+        remember(state, expr, out);
+        set_entry_text(entry, out);
+        set_result(state, result);
+    } else if (strchr(text, '[')) {
+        // Matrix results are shown but never become ans, which is a number.
+        CalcMatrix m;
+        if (calc_eval_matrix(text, state->degrees, &m, err, sizeof(err))) {
+            char out[128];
+            calc_format_matrix(&m, out, sizeof(out));
+            g_free(m.data);
+            remember(state, expr, out);
+            set_entry_text(entry, out);
+            state->has_result = FALSE;
+        } else {
+            show_error(state, err);
+        }
+    } else if (calc_eval_complex(text, state->degrees, &value, err, sizeof(err))) {
+        // No real value; ans keeps the last real result.
+        char out[128];
+        calc_format_complex(value, out, sizeof(out));
+        remember(state, expr, out);
+        set_entry_text(entry, out);
+        if (value.im == 0.0) set_result(state, value.re);
+        else state->has_result = FALSE;
+    } else {
+        show_error(state, err);
+    }
+}
+
+// Runs definitions and ';'-separated statements through the workspace.
+static void run_program(AppState *state, const char *expr) {
+    char err[128] = {0};
+    double result = 0.0;
+    gboolean has_value = FALSE;
+    gboolean ok = calc_workspace_run(state->workspace, expr, &result, &has_value, err, sizeof(err));
+    workspace_changed(state); // statements before a failing one still count
+    if (!ok) {
+        show_error(state, err);
+        return;
+    }
+    if (!has_value) { // ended with a function definition
+        remember(state, expr, "defined");
+        set_entry_text(GTK_ENTRY(state->entry), "");
+        gtk_label_set_text(GTK_LABEL(state->preview), "defined");
+        gtk_widget_add_css_class(state->preview, "hint");
+        state->has_result = FALSE;
+        return;
+    }
+    char out[128];
+    calc_format_result(result, out, sizeof(out));
+    remember(state, expr, out);
+    set_entry_text(GTK_ENTRY(state->entry), out);
+    set_result(state, result);
 }
 
 static void on_button_clicked(GtkButton *button, gpointer user_data) {
@@ -74,6 +380,10 @@ static void on_button_clicked(GtkButton *button, gpointer user_data) {
     const char *label = gtk_button_get_label(button);
     GtkEntry *entry = GTK_ENTRY(state->entry);
 
+    // The result of "=" replaces the display without a preview; the next edit, from a button or
+    // the keyboard, brings it back (see on_text_inserted()).
+    state->show_preview = g_strcmp0(label, "=") != 0;
+
     if (g_strcmp0(label, "C") == 0) {
         set_entry_text(entry, "");
         return;
@@ -81,6 +391,11 @@ static void on_button_clicked(GtkButton *button, gpointer user_data) {
     if (g_strcmp0(label, "deg") == 0 || g_strcmp0(label, "rad") == 0) {
         state->degrees = !state->degrees;
         gtk_button_set_label(button, state->degrees ? "deg" : "rad");
+        calc_incremental_set_degrees(state->incremental, state->degrees);
+        calc_workspace_set_degrees(state->workspace, state->degrees);
+        state->plot_stale = TRUE;
+        update_preview(state);
+        update_plot(state);
         return;
     }
     if (g_strcmp0(label, "CE") == 0) { // "⌫"
@@ -88,41 +403,20 @@ static void on_button_clicked(GtkButton *button, gpointer user_data) {
         return;
     }
     if (g_strcmp0(label, "=") == 0) {
+        CALC_TRACE_BEGIN(start);
         const char *expr = gtk_editable_get_text(GTK_EDITABLE(entry));
-        char err[128] = {0};
-        double result = 0.0;
-
-        if (state->degrees) {
-            int deg = 0;
-            char display_out[128] = {0};
-            if (calc_try_special_trig(expr, &deg, display_out, sizeof(display_out),
-                                      &result, err, sizeof(err))) {
-                set_entry_text(entry, display_out);
-                state->last_result = result;
-                state->has_result = TRUE;
-                return;
-            }
-            if (err[0]) {
-                gchar *out = g_strdup_printf("Error: %s", err);
-                set_entry_text(entry, out);
-                g_free(out);
-                state->has_result = FALSE;
-                return;
-            }
-        }
-
-        if (calc_eval(expr, state->degrees, &result, err, sizeof(err))) {
-            char out[128];
-            format_result(result, out, sizeof(out));
-            set_entry_text(entry, out);
-            state->last_result = result;
-            state->has_result = TRUE;
+        state->writing_result = TRUE;
+        if (calc_workspace_is_program(expr)) {
+            run_program(state, expr);
         } else {
-            gchar *out = g_strdup_printf("Error: %s", err);
-            set_entry_text(entry, out);
-            g_free(out);
-            state->has_result = FALSE;
+            char err[128] = {0};
+            char *text = calc_workspace_expand(state->workspace, expr, err, sizeof(err));
+            if (text) evaluate(state, expr, text);
+            else show_error(state, err);
+            g_free(text);
         }
+        state->writing_result = FALSE;
+        CALC_TRACE_END(CALC_TRACE_UI_EVALUATE, start);
         return;
     }
 
@@ -143,10 +437,7 @@ static void on_button_clicked(GtkButton *button, gpointer user_data) {
     else if (g_strcmp0(label, "π") == 0) insert = "3.141592653589793";
     else if (g_strcmp0(label, "e") == 0) insert = "2.718281828459045";
 
-    const char *current = gtk_editable_get_text(GTK_EDITABLE(entry));
-    gchar *new_text = g_strconcat(current, insert, NULL);
-    set_entry_text(entry, new_text);
-    g_free(new_text);
+    insert_at_cursor(entry, insert);
 }
 
 static void on_entry_activate(GtkEntry *entry, gpointer user_data) {
@@ -157,6 +448,60 @@ static void on_entry_activate(GtkEntry *entry, gpointer user_data) {
     g_object_unref(fake);
 }
 
+static void on_history_toggled(GtkToggleButton *button, gpointer user_data) {
+    AppState *state = (AppState *)user_data;
+    gboolean active = gtk_toggle_button_get_active(button);
+    gtk_widget_set_visible(state->history_panel, active);
+    if (active) history_model_prepare_search(state->history);
+}
+
+static void on_history_search(GtkSearchEntry *search, gpointer user_data) {
+    AppState *state = (AppState *)user_data;
+    history_filter_set_query(state->history_view, gtk_editable_get_text(GTK_EDITABLE(search)));
+}
+
+static void on_history_setup(GtkSignalListItemFactory *factory, GtkListItem *item, gpointer user_data) {
+    (void)factory;
+    (void)user_data;
+    GtkWidget *row = gtk_box_new(GTK_ORIENTATION_VERTICAL, 2);
+    GtkWidget *expression = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(expression), 1.0);
+    gtk_label_set_ellipsize(GTK_LABEL(expression), PANGO_ELLIPSIZE_START);
+    gtk_widget_add_css_class(expression, "history-expr");
+    GtkWidget *result = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(result), 1.0);
+    gtk_label_set_ellipsize(GTK_LABEL(result), PANGO_ELLIPSIZE_END);
+    gtk_widget_add_css_class(result, "history-result");
+    gtk_box_append(GTK_BOX(row), expression);
+    gtk_box_append(GTK_BOX(row), result);
+    gtk_list_item_set_child(item, row);
+}
+
+// Rows are recycled as the list scrolls; binding fills one in for the entry at its position.
+static void on_history_bind(GtkSignalListItemFactory *factory, GtkListItem *item, gpointer user_data) {
+    (void)factory;
+    AppState *state = (AppState *)user_data;
+    GtkWidget *row = gtk_list_item_get_child(item);
+    HistoryRecord rec;
+    if (!history_filter_get_record(state->history_view, gtk_list_item_get_position(item), &rec)) return;
+    char *result = g_strndup(rec.result, rec.result_len);
+    gtk_label_set_text(GTK_LABEL(gtk_widget_get_first_child(row)),
+                       gtk_string_object_get_string(GTK_STRING_OBJECT(gtk_list_item_get_item(item))));
+    gtk_label_set_text(GTK_LABEL(gtk_widget_get_last_child(row)), result);
+    g_free(result);
+}
+
+static void on_history_activate(GtkListView *list, guint position, gpointer user_data) {
+    (void)list;
+    AppState *state = (AppState *)user_data;
+    HistoryRecord rec;
+    if (!history_filter_get_record(state->history_view, position, &rec)) return;
+    char *expression = g_strndup(rec.expression, rec.expression_len);
+    state->show_preview = TRUE;
+    set_entry_text(GTK_ENTRY(state->entry), expression);
+    g_free(expression);
+}
+
 static void on_window_close(GtkButton *button, gpointer user_data) {
     (void)button;
     GtkWindow *win = GTK_WINDOW(user_data);
@@ -180,10 +525,17 @@ static void on_window_maximize(GtkButton *button, gpointer user_data) {
 }
 
 static void on_window_destroy(GtkWidget *widget, gpointer user_data) {
-    (void)widget;
     AppState *state = (AppState *)user_data;
     if (!state) return;
+    GdkSurface *surface = gtk_native_get_surface(GTK_NATIVE(widget));
+    if (surface) g_signal_handlers_disconnect_by_data(surface, state);
     style_global_unref();
+    calc_incremental_free(state->incremental);
+    calc_workspace_free(state->workspace);
+    g_free(state->plot_text);
+    g_free(state->matrix_text);
+    if (state->history_view) g_object_unref(state->history_view);
+    if (state->history) g_object_unref(state->history);
     g_free(state);
 }
 
@@ -192,6 +544,7 @@ static GtkWidget *make_button(const char *label, AppState *state) {
     gtk_widget_set_hexpand(btn, TRUE);
     gtk_widget_set_vexpand(btn, TRUE);
     gtk_widget_add_css_class(btn, "btn");
+    gtk_widget_set_focus_on_click(btn, FALSE); // the entry keeps its cursor and selection
     g_signal_connect(btn, "clicked", G_CALLBACK(on_button_clicked), state);
     return btn;
 }
@@ -202,37 +555,68 @@ static void add_btn_class(GtkWidget *btn, const char *klass) {
     }
 }
 
-static gboolean on_grid_tick(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data) {
-    (void)frame_clock;
-    AppState *state = (AppState *)user_data;
-    if (!state || !state->extra_grid) return G_SOURCE_CONTINUE;
-    int width = gtk_widget_get_width(widget);
-    if (state->window) {
-        width = gtk_widget_get_width(GTK_WIDGET(state->window));
-    }
+// Shows the extra buttons and the graph while the window is at least EXTRA_SHOW_WIDTH wide.
+// Called from the size-change signals only, so an idle window gets no wakeups.
+static void update_extra_visibility(AppState *state, int width) {
+    if (!state->extra_grid) return;
     gboolean show = width >= EXTRA_SHOW_WIDTH;
     if (show != state->extra_visible) {
         gtk_widget_set_visible(state->extra_grid, show);
+        gtk_widget_set_visible(state->plot, show);
         state->extra_visible = show;
+        update_plot(state);
     }
-    return G_SOURCE_CONTINUE;
 }
 
-static gboolean on_window_tick(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data) {
-    (void)frame_clock;
-    (void)user_data;
-    GtkWindow *win = GTK_WINDOW(widget);
-    if (gtk_window_is_maximized(win) || gtk_window_is_fullscreen(win)) {
-        return G_SOURCE_CONTINUE;
-    }
-    int w = gtk_widget_get_width(widget);
-    int h = gtk_widget_get_height(widget);
+// Keeps the window at the compact size unless it is maximized or fullscreen. GTK updates the
+// default size whenever the window is resized, so its notifications report every resize.
+static void enforce_compact_size(AppState *state) {
+    GtkWindow *win = state->window;
+    if (gtk_window_is_maximized(win) || gtk_window_is_fullscreen(win)) return;
+    int w = 0;
+    int h = 0;
+    gtk_window_get_default_size(win, &w, &h);
     if (w != COMPACT_WIDTH || h != COMPACT_HEIGHT) {
         gtk_window_set_default_size(win, COMPACT_WIDTH, COMPACT_HEIGHT);
-        gtk_widget_set_size_request(widget, COMPACT_WIDTH, COMPACT_HEIGHT);
-        gtk_widget_queue_resize(widget);
+        gtk_widget_set_size_request(GTK_WIDGET(win), COMPACT_WIDTH, COMPACT_HEIGHT);
+        gtk_widget_queue_resize(GTK_WIDGET(win));
     }
-    return G_SOURCE_CONTINUE;
+}
+
+static void on_default_size_changed(GtkWindow *win, GParamSpec *pspec, gpointer user_data) {
+    (void)win;
+    (void)pspec;
+    enforce_compact_size((AppState *)user_data);
+}
+
+// The surface reports each new size of the toplevel, maximizing and restoring included.
+static void on_surface_layout(GdkSurface *surface, int width, int height, gpointer user_data) {
+    (void)surface;
+    (void)height;
+    update_extra_visibility((AppState *)user_data, width);
+}
+
+// Time to first frame: from main() to the end of the first window's first paint (CALC_TRACE).
+static void on_first_frame(GdkFrameClock *clock, gpointer user_data) {
+    (void)user_data;
+    g_signal_handlers_disconnect_by_func(clock, on_first_frame, NULL);
+    CALC_TRACE_BEGIN_AT_ENABLE(start);
+    CALC_TRACE_END(CALC_TRACE_FIRST_FRAME, start);
+}
+
+static void on_window_realize(GtkWidget *window, gpointer user_data) {
+    static gboolean first_window = TRUE;
+    GdkSurface *surface = gtk_native_get_surface(GTK_NATIVE(window));
+    g_signal_connect(surface, "layout", G_CALLBACK(on_surface_layout), user_data);
+    if (first_window) {
+        first_window = FALSE;
+        g_signal_connect(gtk_widget_get_frame_clock(window), "after-paint", G_CALLBACK(on_first_frame), NULL);
+    }
+}
+
+static void on_window_unrealize(GtkWidget *window, gpointer user_data) {
+    GdkSurface *surface = gtk_native_get_surface(GTK_NATIVE(window));
+    if (surface) g_signal_handlers_disconnect_by_data(surface, user_data);
 }
 
 static void on_window_state_changed(GtkWindow *win, GParamSpec *pspec, gpointer user_data) {
@@ -256,6 +640,7 @@ static void on_window_state_changed(GtkWindow *win, GParamSpec *pspec, gpointer
         gtk_button_set_icon_name(GTK_BUTTON(state->btn_max),
                                  maxed ? "window-restore-symbolic" : "window-maximize-symbolic");
     }
+    if (!maxed) enforce_compact_size(state);
 }
 
 void ui_activate(GtkApplication *app, gpointer user_data) {
@@ -265,6 +650,7 @@ void ui_activate(GtkApplication *app, gpointer user_data) {
 
     AppState *state = g_new0(AppState, 1);
     state->style = g_style;
+    state->history = history_global_ref();
 
     GtkWidget *window = gtk_application_window_new(app);
     gtk_window_set_title(GTK_WINDOW(window), "Calculator");
@@ -275,7 +661,10 @@ void ui_activate(GtkApplication *app, gpointer user_data) {
     gtk_widget_add_css_class(window, "calc-window");
     state->window = GTK_WINDOW(window);
     state->root_window = window;
-    gtk_widget_add_tick_callback(window, on_window_tick, NULL, NULL);
+    g_signal_connect(window, "notify::default-width", G_CALLBACK(on_default_size_changed), state);
+    g_signal_connect(window, "notify::default-height", G_CALLBACK(on_default_size_changed), state);
+    g_signal_connect(window, "realize", G_CALLBACK(on_window_realize), state);
+    g_signal_connect(window, "unrealize", G_CALLBACK(on_window_unrealize), state);
     g_signal_connect(window, "notify::maximized", G_CALLBACK(on_window_state_changed), state);
     g_signal_connect(window, "notify::fullscreen", G_CALLBACK(on_window_state_changed), state);
     g_signal_connect(window, "destroy", G_CALLBACK(on_window_destroy), state);
@@ -326,6 +715,15 @@ void ui_activate(GtkApplication *app, gpointer user_data) {
     gtk_widget_set_size_request(btn_close, 30, 30);
     g_signal_connect(btn_close, "clicked", G_CALLBACK(on_window_close), window);
 
+    if (state->history) {
+        GtkWidget *btn_history = gtk_toggle_button_new();
+        gtk_button_set_icon_name(GTK_BUTTON(btn_history), "document-open-recent-symbolic");
+        gtk_widget_add_css_class(btn_history, "titlebar-btn");
+        gtk_widget_add_css_class(btn_history, "btn-history");
+        gtk_widget_set_size_request(btn_history, 30, 30);
+        g_signal_connect(btn_history, "toggled", G_CALLBACK(on_history_toggled), state);
+        gtk_box_append(GTK_BOX(actions), btn_history);
+    }
     gtk_box_append(GTK_BOX(actions), btn_min);
     gtk_box_append(GTK_BOX(actions), btn_max);
     gtk_box_append(GTK_BOX(actions), btn_close);
@@ -343,23 +741,68 @@ void ui_activate(GtkApplication *app, gpointer user_data) {
     gtk_widget_set_margin_end(content, 12);
     gtk_box_append(GTK_BOX(vbox), content);
 
-    GtkWidget *entry = gtk_entry_new();
+    // Typed, pasted and button input all edit the same buffer at the cursor.
+    GtkEntryBuffer *text_buffer = expr_buffer_new();
+    GtkWidget *entry = gtk_entry_new_with_buffer(text_buffer);
+    g_object_unref(text_buffer);
     gtk_entry_set_alignment(GTK_ENTRY(entry), 1.0);
     gtk_entry_set_placeholder_text(GTK_ENTRY(entry), "0");
-    gtk_entry_set_input_purpose(GTK_ENTRY(entry), GTK_INPUT_PURPOSE_NUMBER);
-    gtk_editable_set_editable(GTK_EDITABLE(entry), FALSE);
-    gtk_widget_set_can_focus(entry, FALSE);
+    gtk_entry_set_input_hints(GTK_ENTRY(entry), GTK_INPUT_HINT_NO_SPELLCHECK | GTK_INPUT_HINT_NO_EMOJI);
     gtk_widget_set_hexpand(entry, TRUE);
     gtk_widget_add_css_class(entry, "display");
     gtk_box_append(GTK_BOX(content), entry);
 
+    GtkWidget *preview = gtk_label_new("");
+    gtk_label_set_xalign(GTK_LABEL(preview), 1.0);
+    gtk_label_set_ellipsize(GTK_LABEL(preview), PANGO_ELLIPSIZE_START);
+    gtk_widget_add_css_class(preview, "preview");
+    gtk_box_append(GTK_BOX(content), preview);
+
+    state->preview = preview;
+    state->incremental = calc_incremental_new();
+    state->workspace = calc_workspace_new(FALSE);
+    calc_incremental_set_lookup(state->incremental, lookup_workspace_name, state->workspace);
+    state->show_preview = TRUE;
+
+    if (state->history) {
+        // GtkListView creates rows only for the visible part of the list and reuses them.
+        GtkWidget *panel = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
+        gtk_widget_add_css_class(panel, "history");
+        gtk_widget_set_visible(panel, FALSE);
+
+        GtkWidget *search = gtk_search_entry_new();
+        g_signal_connect(search, "search-changed", G_CALLBACK(on_history_search), state);
+        gtk_box_append(GTK_BOX(panel), search);
+
+        GtkListItemFactory *factory = gtk_signal_list_item_factory_new();
+        g_signal_connect(factory, "setup", G_CALLBACK(on_history_setup), NULL);
+        g_signal_connect(factory, "bind", G_CALLBACK(on_history_bind), state);
+        // Each window searches on its own; the history itself is shared.
+        state->history_view = history_filter_new(state->history);
+        GtkNoSelection *selection = gtk_no_selection_new(G_LIST_MODEL(g_object_ref(state->history_view)));
+        GtkWidget *list = gtk_list_view_new(GTK_SELECTION_MODEL(selection), factory);
+        gtk_list_view_set_single_click_activate(GTK_LIST_VIEW(list), TRUE);
+        g_signal_connect(list, "activate", G_CALLBACK(on_history_activate), state);
+
+        GtkWidget *scroller = gtk_scrolled_window_new();
+        gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scroller), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+        gtk_scrolled_window_set_min_content_height(GTK_SCROLLED_WINDOW(scroller), 160);
+        gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scroller), list);
+        gtk_box_append(GTK_BOX(panel), scroller);
+
+        gtk_box_append(GTK_BOX(content), panel);
+        state->history_panel = panel;
+    }
+
     g_signal_connect(entry, "activate", G_CALLBACK(on_entry_activate), state);
+    GtkEntryBuffer *buffer = gtk_entry_get_buffer(GTK_ENTRY(entry));
+    g_signal_connect_after(buffer, "inserted-text", G_CALLBACK(on_text_inserted), state);
+    g_signal_connect_after(buffer, "deleted-text", G_CALLBACK(on_text_deleted), state);
 
     GtkWidget *grid_row = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 8);
     gtk_widget_set_hexpand(grid_row, TRUE);
     gtk_widget_set_vexpand(grid_row, TRUE);
     gtk_box_append(GTK_BOX(content), grid_row);
-    gtk_widget_add_tick_callback(grid_row, on_grid_tick, state, NULL);
 
     GtkWidget *grid = gtk_grid_new();
     gtk_grid_set_row_spacing(GTK_GRID(grid), 6);
@@ -378,8 +821,17 @@ void ui_activate(GtkApplication *app, gpointer user_data) {
     gtk_widget_set_visible(extra, FALSE);
     gtk_box_append(GTK_BOX(grid_row), extra);
 
+    GtkWidget *plot = plot_view_new();
+    gtk_widget_set_hexpand(plot, TRUE);
+    gtk_widget_set_vexpand(plot, TRUE);
+    gtk_widget_set_size_request(plot, 240, 160);
+    gtk_widget_add_css_class(plot, "plot");
+    gtk_widget_set_visible(plot, FALSE);
+    gtk_box_append(GTK_BOX(grid_row), plot);
+
     state->entry = entry;
     state->extra_grid = extra;
+    state->plot = plot;
     state->extra_visible = FALSE;
     state->degrees = FALSE;
     state->mode_button = NULL;
@@ -526,11 +978,31 @@ void ui_activate(GtkApplication *app, gpointer user_data) {
     add_btn_class(btn, "btn-op");
     add_btn_class(btn, "btn-extra");
     gtk_grid_attach(GTK_GRID(extra), btn, 3, 3, 1, 1);
+    btn = make_button("ans", state);
+    add_btn_class(btn, "btn-op");
+    add_btn_class(btn, "btn-extra");
+    gtk_grid_attach(GTK_GRID(extra), btn, 0, 4, 1, 1);
+    btn = make_button("x", state);
+    add_btn_class(btn, "btn-op");
+    add_btn_class(btn, "btn-extra");
+    gtk_grid_attach(GTK_GRID(extra), btn, 1, 4, 1, 1);
     btn = make_button("deg", state);
     add_btn_class(btn, "btn-fn");
-    gtk_grid_attach(GTK_GRID(extra), btn, 0, 4, 4, 1);
+    gtk_grid_attach(GTK_GRID(extra), btn, 2, 4, 2, 1);
 
     state->mode_button = btn;
 
+    GtkWidget *digits_row = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 6);
+    GtkWidget *digits_label = gtk_label_new("digits");
+    gtk_widget_set_hexpand(digits_label, TRUE);
+    gtk_label_set_xalign(GTK_LABEL(digits_label), 0.0);
+    gtk_box_append(GTK_BOX(digits_row), digits_label);
+    GtkWidget *digits = gtk_spin_button_new_with_range(0, 1000, 1);
+    gtk_widget_set_tooltip_text(digits, "Significant digits for arbitrary precision (0 = standard)");
+    gtk_box_append(GTK_BOX(digits_row), digits);
+    gtk_grid_attach(GTK_GRID(extra), digits_row, 0, 5, 4, 1);
+
+    state->digits_spin = digits;
+
     gtk_window_present(GTK_WINDOW(window));
 }